@@ -0,0 +1,112 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.const import (
+    CONF_ID,
+    CONF_PATH,
+    CONF_BUFFER_SIZE,
+)
+from .. import sd_mmc_card
+
+DEPENDENCIES = ["sd_mmc_card"]
+
+CONF_SD_AUDIO_SOURCE_ID = "sd_audio_source_id"
+CONF_CHUNK_SIZE = "chunk_size"
+CONF_PREFETCH_SIZE = "prefetch_size"
+CONF_PREFETCH_LEAD = "prefetch_lead"
+
+sd_audio_source_ns = cg.esphome_ns.namespace("sd_audio_source")
+SdAudioSource = sd_audio_source_ns.class_("SdAudioSource", cg.PollingComponent)
+
+# Action
+SdAudioSourcePlayAction = sd_audio_source_ns.class_("SdAudioSourcePlayAction", automation.Action)
+SdAudioSourceStopAction = sd_audio_source_ns.class_("SdAudioSourceStopAction", automation.Action)
+SdAudioSourceSetNextAction = sd_audio_source_ns.class_("SdAudioSourceSetNextAction", automation.Action)
+SdAudioSourcePlayNextAction = sd_audio_source_ns.class_("SdAudioSourcePlayNextAction", automation.Action)
+
+
+def validate_chunk_size(config):
+    if config[CONF_CHUNK_SIZE] * 2 > config[CONF_BUFFER_SIZE]:
+        raise cv.Invalid("chunk_size must be at most half of buffer_size")
+    if config[CONF_PREFETCH_SIZE] > config[CONF_BUFFER_SIZE]:
+        raise cv.Invalid("prefetch_size must be at most buffer_size")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SdAudioSource),
+            cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.Optional(CONF_BUFFER_SIZE, default=128 * 1024): cv.int_range(min=8 * 1024),
+            cv.Optional(CONF_CHUNK_SIZE, default=16 * 1024): cv.int_range(min=512),
+            cv.Optional(CONF_PREFETCH_SIZE, default=64 * 1024): cv.int_range(min=0),
+            cv.Optional(CONF_PREFETCH_LEAD, default=512 * 1024): cv.int_range(min=0),
+        }
+    ).extend(cv.polling_component_schema("1s")),
+    validate_chunk_size,
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    cg.add(var.set_buffer_size(config[CONF_BUFFER_SIZE]))
+    cg.add(var.set_chunk_size(config[CONF_CHUNK_SIZE]))
+    cg.add(var.set_prefetch_size(config[CONF_PREFETCH_SIZE]))
+    cg.add(var.set_prefetch_lead(config[CONF_PREFETCH_LEAD]))
+
+
+SD_AUDIO_SOURCE_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(SdAudioSource),
+    }
+)
+
+SD_AUDIO_SOURCE_PLAY_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
+    }
+).extend(SD_AUDIO_SOURCE_ACTION_SCHEMA)
+
+
+@automation.register_action(
+    "sd_audio_source.play", SdAudioSourcePlayAction, SD_AUDIO_SOURCE_PLAY_ACTION_SCHEMA
+)
+async def sd_audio_source_play_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    cg.add(var.set_path(path_))
+    return var
+
+
+@automation.register_action(
+    "sd_audio_source.stop", SdAudioSourceStopAction, SD_AUDIO_SOURCE_ACTION_SCHEMA
+)
+async def sd_audio_source_stop_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    return var
+
+
+@automation.register_action(
+    "sd_audio_source.set_next", SdAudioSourceSetNextAction, SD_AUDIO_SOURCE_PLAY_ACTION_SCHEMA
+)
+async def sd_audio_source_set_next_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    cg.add(var.set_path(path_))
+    return var
+
+
+@automation.register_action(
+    "sd_audio_source.play_next", SdAudioSourcePlayNextAction, SD_AUDIO_SOURCE_ACTION_SCHEMA
+)
+async def sd_audio_source_play_next_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    return var
@@ -0,0 +1,280 @@
+#include "sd_audio_source.h"
+
+#include <algorithm>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_audio_source {
+
+static const char *TAG = "sd_audio_source";
+
+static const uint32_t PRODUCER_TASK_STACK_SIZE = 4096;
+static const UBaseType_t PRODUCER_TASK_PRIORITY = 5;
+
+void SdAudioSource::setup() {
+  if (!this->ring_->allocate(this->buffer_size_)) {
+    ESP_LOGE(TAG, "Failed to allocate %u bytes ring buffer", this->buffer_size_);
+    this->mark_failed();
+    return;
+  }
+  // rings are swapped when the next track starts, both have the full size
+  if (this->prefetch_size_ != 0 && !this->next_ring_->allocate(this->buffer_size_)) {
+    ESP_LOGW(TAG, "Failed to allocate the prefetch ring, next tracks are opened cold");
+    this->prefetch_size_ = 0;
+  }
+}
+
+void SdAudioSource::update() {
+#ifdef USE_SENSOR
+  if (this->buffer_fill_sensor_ != nullptr)
+    this->buffer_fill_sensor_->publish_state(this->get_buffer_fill());
+  if (this->underruns_sensor_ != nullptr)
+    this->underruns_sensor_->publish_state(this->underruns_);
+#endif
+}
+
+void SdAudioSource::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Audio Source");
+  ESP_LOGCONFIG(TAG, "  Buffer size: %s", sd_mmc_card::format_size(this->buffer_size_).c_str());
+  ESP_LOGCONFIG(TAG, "  Chunk size: %s", sd_mmc_card::format_size(this->chunk_size_).c_str());
+  if (this->prefetch_size_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Prefetch: %s, %s before the end of the track",
+                  sd_mmc_card::format_size(this->prefetch_size_).c_str(),
+                  sd_mmc_card::format_size(this->prefetch_lead_).c_str());
+  }
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Buffer fill", this->buffer_fill_sensor_);
+  LOG_SENSOR("  ", "Underruns", this->underruns_sensor_);
+#endif
+}
+
+bool SdAudioSource::play(std::string const &path) {
+  if (this->is_failed())
+    return false;
+  this->stop();
+
+  this->file_ = this->sd_mmc_card_->open_file(path.c_str(), "rb");
+  if (this->file_ == nullptr)
+    return false;
+  // chunks are far bigger than the stdio buffer, let them go straight to FatFs as multi-sector reads
+  setvbuf(this->file_, nullptr, _IONBF, 0);
+
+  this->path_ = path;
+  this->remaining_ = this->sd_mmc_card_->file_size(path);
+  this->ring_->reset();
+  this->eof_ = false;
+  this->stop_requested_ = false;
+  this->starving_ = false;
+  this->running_ = true;
+  if (xTaskCreate(SdAudioSource::producer_task, "sd_audio_src", PRODUCER_TASK_STACK_SIZE, this,
+                  PRODUCER_TASK_PRIORITY, &this->task_handle_) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start producer task");
+    fclose(this->file_);
+    this->file_ = nullptr;
+    this->running_ = false;
+    return false;
+  }
+  ESP_LOGD(TAG, "Streaming %s", path.c_str());
+  return true;
+}
+
+void SdAudioSource::stop() {
+  if (!this->running_)
+    return;
+  this->stop_requested_ = true;
+  while (this->running_)
+    vTaskDelay(pdMS_TO_TICKS(1));
+  this->task_handle_ = nullptr;
+  this->next_path_.clear();
+  ESP_LOGD(TAG, "Stopped %s", this->path_.c_str());
+}
+
+void SdAudioSource::set_next(std::string const &path) {
+  std::lock_guard<std::mutex> guard(this->stream_lock_);
+  if (path == this->next_path_)
+    return;
+  if (this->next_file_ != nullptr) {
+    fclose(this->next_file_);
+    this->next_file_ = nullptr;
+  }
+  this->next_path_ = path;
+  this->next_preloaded_ = 0;
+  this->next_ring_->reset();
+}
+
+bool SdAudioSource::play_next() {
+  std::string path;
+  {
+    std::lock_guard<std::mutex> guard(this->stream_lock_);
+    if (this->next_path_.empty())
+      return false;
+    if (this->running_ && this->next_file_ != nullptr) {
+      // the preloaded ring becomes the one consumed and its file goes on from there, no cold open
+      if (this->file_ != nullptr)
+        fclose(this->file_);
+      this->file_ = this->next_file_;
+      this->next_file_ = nullptr;
+      std::swap(this->ring_, this->next_ring_);
+      this->next_ring_->reset();
+      this->path_ = this->next_path_;
+      this->next_path_.clear();
+      this->remaining_ = this->next_remaining_;
+      this->next_preloaded_ = 0;
+      this->eof_ = false;
+      this->starving_ = false;
+      ESP_LOGD(TAG, "Streaming %s, %u bytes preloaded", this->path_.c_str(), this->ring_->available());
+      return true;
+    }
+    path = this->next_path_;
+  }
+  // not prefetched: set too late, prefetch disabled, or the stream was stopped
+  return this->play(path);
+}
+
+size_t SdAudioSource::read(uint8_t *buffer, size_t len, TickType_t ticks_to_wait) {
+  size_t total = 0;
+  TickType_t start = xTaskGetTickCount();
+  while (true) {
+    bool eof = this->eof_;
+    total += this->ring_->read(buffer + total, len - total);
+    if (total == len || eof || !this->running_)
+      break;
+    // the decoder is waiting on the card, count each dry spell once
+    if (!this->starving_) {
+      this->starving_ = true;
+      this->underruns_++;
+    }
+    if (xTaskGetTickCount() - start >= ticks_to_wait)
+      break;
+    vTaskDelay(1);
+  }
+  if (total == len)
+    this->starving_ = false;
+  return total;
+}
+
+float SdAudioSource::get_buffer_fill() const {
+  if (this->ring_->capacity() == 0)
+    return 0;
+  return this->ring_->available() * 100.0f / this->ring_->capacity();
+}
+
+void SdAudioSource::producer_task(void *params) {
+  SdAudioSource *this_source = static_cast<SdAudioSource *>(params);
+  // playback goes through the priority lane, bulk transfers wait while a chunk is being read
+  sd_mmc_card::IoScheduler *scheduler = this_source->sd_mmc_card_->get_io_scheduler();
+  this_source->transfer_ = scheduler->begin("audio", sd_mmc_card::IO_REALTIME);
+
+  // the task outlives the end of a track, the next entry may still have to be preloaded
+  while (!this_source->stop_requested_) {
+    bool busy;
+    if (!this_source->produce(&busy))
+      break;
+    if (!busy)
+      vTaskDelay(pdMS_TO_TICKS(5));
+  }
+
+  scheduler->end(this_source->transfer_);
+  this_source->transfer_ = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(this_source->stream_lock_);
+    // closing a handle of an unmounted volume only frees the FILE
+    if (this_source->file_ != nullptr)
+      fclose(this_source->file_);
+    this_source->file_ = nullptr;
+    if (this_source->next_file_ != nullptr)
+      fclose(this_source->next_file_);
+    this_source->next_file_ = nullptr;
+  }
+  this_source->running_ = false;
+  vTaskDelete(nullptr);
+}
+
+bool SdAudioSource::produce(bool *busy) {
+  std::lock_guard<std::mutex> guard(this->stream_lock_);
+  *busy = true;
+  size_t len;
+  // the playing track first, in large sequential reads only: a nearly full ring is topped up later in one go
+  if (this->file_ != nullptr && this->ring_->free() >= this->chunk_size_) {
+    if (!this->read_chunk(this->file_, this->path_, this->ring_, this->chunk_size_, &len))
+      return false;
+    if (len == 0) {
+      if (ferror(this->file_))
+        ESP_LOGE(TAG, "Read error on %s", this->path_.c_str());
+      fclose(this->file_);
+      this->file_ = nullptr;
+      this->eof_ = true;
+    }
+    this->remaining_ -= std::min(this->remaining_, len);
+    return true;
+  }
+
+  // then the head of the next entry, once the playing track is close to its end
+  if (this->next_path_.empty() || this->next_preloaded_ >= this->prefetch_size_ ||
+      (this->file_ != nullptr && this->remaining_ > this->prefetch_lead_)) {
+    *busy = false;
+    return true;
+  }
+  if (this->next_file_ == nullptr) {
+    this->next_file_ = this->sd_mmc_card_->open_file(this->next_path_.c_str(), "rb");
+    if (this->next_file_ == nullptr) {
+      // play_next() opens it again and reports the failure
+      this->next_preloaded_ = this->prefetch_size_;
+      return true;
+    }
+    setvbuf(this->next_file_, nullptr, _IONBF, 0);
+    this->next_remaining_ = this->sd_mmc_card_->file_size(this->next_path_);
+    ESP_LOGD(TAG, "Preloading %s", this->next_path_.c_str());
+  }
+  const size_t wanted = std::min(this->chunk_size_, this->prefetch_size_ - this->next_preloaded_);
+  if (this->next_ring_->free() < wanted) {
+    *busy = false;
+    return true;
+  }
+  if (!this->read_chunk(this->next_file_, this->next_path_, this->next_ring_, wanted, &len))
+    return false;
+  // a file shorter than the preload is complete, its end is found after the switch
+  this->next_preloaded_ = len == 0 ? this->prefetch_size_ : this->next_preloaded_ + len;
+  this->next_remaining_ -= std::min(this->next_remaining_, len);
+  return true;
+}
+
+bool SdAudioSource::read_chunk(FILE *file, const std::string &path, SpscRingBuffer *ring, size_t len,
+                               size_t *read) {
+  sd_mmc_card::IoScheduler *scheduler = this->sd_mmc_card_->get_io_scheduler();
+  uint8_t *ptr;
+  size_t span = ring->write_acquire(&ptr);
+  size_t wanted = scheduler->acquire(this->transfer_, std::min(span, len));
+  bool mounted;
+  *read = 0;
+  {
+    // held per chunk only: writers of the file and the unmount wait for one read, never for the whole track
+    auto lock = this->sd_mmc_card_->lock_read(path.c_str());
+    mounted = this->sd_mmc_card_->is_mounted();
+    if (mounted)
+      *read = fread(ptr, 1, wanted, file);
+  }
+  scheduler->release(this->transfer_, wanted, *read);
+  if (!mounted) {
+    // the handles died with the card, what is in the ring is still played
+    ESP_LOGW(TAG, "Card removed while streaming %s", path.c_str());
+    this->eof_ = true;
+    return false;
+  }
+  ring->write_commit(*read);
+  return true;
+}
+
+void SdAudioSource::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdAudioSource::set_buffer_size(size_t size) { this->buffer_size_ = size; }
+
+void SdAudioSource::set_chunk_size(size_t size) { this->chunk_size_ = size; }
+
+void SdAudioSource::set_prefetch_size(size_t size) { this->prefetch_size_ = size; }
+
+void SdAudioSource::set_prefetch_lead(size_t lead) { this->prefetch_lead_ = lead; }
+
+}  // namespace sd_audio_source
+}  // namespace esphome
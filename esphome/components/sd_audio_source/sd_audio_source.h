@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+
+#include "esphome/core/component.h"
+#include "esphome/core/automation.h"
+#ifdef USE_SENSOR
+#include "esphome/components/sensor/sensor.h"
+#endif
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "spsc_ring_buffer.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace esphome {
+namespace sd_audio_source {
+
+class SdAudioSource : public PollingComponent {
+#ifdef USE_SENSOR
+  SUB_SENSOR(buffer_fill)
+  SUB_SENSOR(underruns)
+#endif
+ public:
+  void setup() override;
+  void update() override;
+  void dump_config() override;
+
+  /* Start streaming a file from the card, stopping the current one if any. */
+  bool play(std::string const &path);
+  void stop();
+  /* Next entry of the playlist. Once less than prefetch_lead bytes of the current track are left to read, it
+   * is opened and its first prefetch_size bytes are preloaded into a second ring. */
+  void set_next(std::string const &path);
+  /* Switch to the entry given to set_next(), from the preloaded ring and the already open file when it was
+   * prefetched, opened cold otherwise. Called by the consumer between two reads, typically once
+   * is_finished(). */
+  bool play_next();
+  /* Pull up to len bytes, waiting at most ticks_to_wait for the producer when the ring is empty. */
+  size_t read(uint8_t *buffer, size_t len, TickType_t ticks_to_wait);
+  bool is_running() const { return this->running_; }
+  /* The whole file has been read and handed out. */
+  bool is_finished() const { return this->eof_ && this->ring_->available() == 0; }
+  float get_buffer_fill() const;
+  uint32_t get_underrun_count() const { return this->underruns_; }
+
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_buffer_size(size_t);
+  void set_chunk_size(size_t);
+  void set_prefetch_size(size_t);
+  void set_prefetch_lead(size_t);
+
+ protected:
+  /* One read for the producer, the playing track first; false once the card is gone */
+  bool produce(bool *busy);
+  /* Read up to len bytes of file into ring under the path lock, false once the card is gone */
+  bool read_chunk(FILE *file, const std::string &path, SpscRingBuffer *ring, size_t len, size_t *read);
+
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  size_t buffer_size_;
+  size_t chunk_size_;
+  size_t prefetch_size_{0};
+  size_t prefetch_lead_{0};
+  // ring_ is consumed, next_ring_ receives the head of the next entry; swapped by play_next()
+  SpscRingBuffer rings_[2];
+  SpscRingBuffer *ring_{&rings_[0]};
+  SpscRingBuffer *next_ring_{&rings_[1]};
+  // the files, paths and counters below, between the producer and set_next()/play_next()
+  std::mutex stream_lock_;
+  FILE *file_{nullptr};
+  std::string path_;
+  size_t remaining_{0};
+  FILE *next_file_{nullptr};
+  std::string next_path_;
+  size_t next_remaining_{0};
+  size_t next_preloaded_{0};
+  sd_mmc_card::IoScheduler::Transfer *transfer_{nullptr};
+  TaskHandle_t task_handle_{nullptr};
+  std::atomic<bool> running_{false};
+  std::atomic<bool> stop_requested_{false};
+  std::atomic<bool> eof_{false};
+  std::atomic<uint32_t> underruns_{0};
+  bool starving_{false};
+
+  static void producer_task(void *params);
+};
+
+template<typename... Ts> class SdAudioSourcePlayAction : public Action<Ts...> {
+ public:
+  SdAudioSourcePlayAction(SdAudioSource *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    this->parent_->play(path);
+  }
+
+ protected:
+  SdAudioSource *parent_;
+};
+
+template<typename... Ts> class SdAudioSourceSetNextAction : public Action<Ts...> {
+ public:
+  SdAudioSourceSetNextAction(SdAudioSource *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    this->parent_->set_next(path);
+  }
+
+ protected:
+  SdAudioSource *parent_;
+};
+
+template<typename... Ts> class SdAudioSourcePlayNextAction : public Action<Ts...> {
+ public:
+  SdAudioSourcePlayNextAction(SdAudioSource *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->play_next(); }
+
+ protected:
+  SdAudioSource *parent_;
+};
+
+template<typename... Ts> class SdAudioSourceStopAction : public Action<Ts...> {
+ public:
+  SdAudioSourceStopAction(SdAudioSource *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->stop(); }
+
+ protected:
+  SdAudioSource *parent_;
+};
+
+}  // namespace sd_audio_source
+}  // namespace esphome
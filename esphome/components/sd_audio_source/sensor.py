@@ -0,0 +1,43 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_PERCENT,
+)
+from . import SdAudioSource, CONF_SD_AUDIO_SOURCE_ID
+
+DEPENDENCIES = ["sd_audio_source"]
+
+CONF_BUFFER_FILL = "buffer_fill"
+CONF_UNDERRUNS = "underruns"
+
+CONFIG_SCHEMA = {
+    cv.GenerateID(CONF_SD_AUDIO_SOURCE_ID): cv.use_id(SdAudioSource),
+    cv.Optional(CONF_BUFFER_FILL): sensor.sensor_schema(
+        unit_of_measurement=UNIT_PERCENT,
+        icon="mdi:buffer",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ),
+    cv.Optional(CONF_UNDERRUNS): sensor.sensor_schema(
+        icon="mdi:alert-circle-outline",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_TOTAL_INCREASING,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ),
+}
+
+
+async def to_code(config):
+    sd_audio_source = await cg.get_variable(config[CONF_SD_AUDIO_SOURCE_ID])
+
+    if CONF_BUFFER_FILL in config:
+        sens = await sensor.new_sensor(config[CONF_BUFFER_FILL])
+        cg.add(sd_audio_source.set_buffer_fill_sensor(sens))
+    if CONF_UNDERRUNS in config:
+        sens = await sensor.new_sensor(config[CONF_UNDERRUNS])
+        cg.add(sd_audio_source.set_underruns_sensor(sens))
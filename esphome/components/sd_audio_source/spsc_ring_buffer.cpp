@@ -0,0 +1,64 @@
+#include "spsc_ring_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sd_audio_source {
+
+SpscRingBuffer::~SpscRingBuffer() {
+  if (this->storage_ != nullptr) {
+    ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+    allocator.deallocate(this->storage_, this->capacity_);
+  }
+}
+
+bool SpscRingBuffer::allocate(size_t capacity) {
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  this->storage_ = allocator.allocate(capacity);
+  if (this->storage_ == nullptr)
+    return false;
+  this->capacity_ = capacity;
+  this->reset();
+  return true;
+}
+
+void SpscRingBuffer::reset() {
+  this->head_.store(0, std::memory_order_relaxed);
+  this->tail_.store(0, std::memory_order_relaxed);
+}
+
+size_t SpscRingBuffer::available() const {
+  return this->head_.load(std::memory_order_acquire) - this->tail_.load(std::memory_order_acquire);
+}
+
+size_t SpscRingBuffer::free() const { return this->capacity_ - this->available(); }
+
+size_t SpscRingBuffer::write_acquire(uint8_t **ptr) const {
+  size_t head = this->head_.load(std::memory_order_relaxed);
+  size_t tail = this->tail_.load(std::memory_order_acquire);
+  size_t index = head % this->capacity_;
+  *ptr = this->storage_ + index;
+  return std::min(this->capacity_ - (head - tail), this->capacity_ - index);
+}
+
+void SpscRingBuffer::write_commit(size_t len) {
+  this->head_.store(this->head_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+}
+
+size_t SpscRingBuffer::read(uint8_t *dst, size_t len) {
+  size_t tail = this->tail_.load(std::memory_order_relaxed);
+  size_t head = this->head_.load(std::memory_order_acquire);
+  len = std::min(len, head - tail);
+  size_t index = tail % this->capacity_;
+  size_t first = std::min(len, this->capacity_ - index);
+  memcpy(dst, this->storage_ + index, first);
+  memcpy(dst + first, this->storage_, len - first);
+  this->tail_.store(tail + len, std::memory_order_release);
+  return len;
+}
+
+}  // namespace sd_audio_source
+}  // namespace esphome
@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace sd_audio_source {
+
+/* Lock-free single-producer/single-consumer byte ring.
+ * head_ is only written by the producer and tail_ only by the consumer; both grow monotonically. */
+class SpscRingBuffer {
+ public:
+  ~SpscRingBuffer();
+
+  bool allocate(size_t capacity);
+  void reset();
+
+  size_t capacity() const { return this->capacity_; }
+  size_t available() const;
+  size_t free() const;
+
+  /* Producer: contiguous free span starting at *ptr, to be followed by write_commit(). */
+  size_t write_acquire(uint8_t **ptr) const;
+  void write_commit(size_t len);
+
+  /* Consumer */
+  size_t read(uint8_t *dst, size_t len);
+
+ protected:
+  uint8_t *storage_{nullptr};
+  size_t capacity_{0};
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+};
+
+}  // namespace sd_audio_source
+}  // namespace esphome
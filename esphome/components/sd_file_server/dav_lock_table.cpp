@@ -0,0 +1,180 @@
+#include "dav_lock_table.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace webdavbox {
+
+static const char *const TOKEN_SCHEME = "opaquelocktoken:";
+
+DavLockTable::Result DavLockTable::lock(const std::string &path, bool exclusive, bool infinite, uint32_t timeout_s,
+                                        const std::string &owner, DavLock *granted) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->purge();
+  for (const DavLock &other : this->locks_) {
+    // a lock conflicts with the ones covering path and, at depth infinity, with the ones below it
+    bool overlaps = DavLockTable::covers(other, path) || (infinite && DavLockTable::is_below(other.path, path));
+    if (overlaps && (exclusive || other.exclusive))
+      return LOCK_CONFLICT;
+  }
+  if (this->locks_.size() >= MAX_LOCKS)
+    return LOCK_FULL;
+
+  DavLock lock{DavLockTable::new_token(), path, owner, exclusive, infinite, std::min(timeout_s, MAX_TIMEOUT_S),
+               millis()};
+  this->locks_.push_back(lock);
+  *granted = lock;
+  return LOCK_OK;
+}
+
+bool DavLockTable::refresh(const std::string &path, const std::vector<std::string> &tokens, uint32_t timeout_s,
+                           DavLock *refreshed) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->purge();
+  for (DavLock &lock : this->locks_) {
+    if (!DavLockTable::covers(lock, path) || std::find(tokens.begin(), tokens.end(), lock.token) == tokens.end())
+      continue;
+    lock.timeout_s = std::min(timeout_s, MAX_TIMEOUT_S);
+    lock.acquired_ms = millis();
+    *refreshed = lock;
+    return true;
+  }
+  return false;
+}
+
+bool DavLockTable::unlock(const std::string &path, const std::string &token) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->purge();
+  for (auto it = this->locks_.begin(); it != this->locks_.end(); ++it) {
+    if (it->token == token && DavLockTable::covers(*it, path)) {
+      this->locks_.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DavLockTable::is_allowed(const std::string &path, const std::vector<std::string> &tokens, bool subtree) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->purge();
+  bool shared_locked = false, shared_token = false;
+  for (const DavLock &lock : this->locks_) {
+    if (!DavLockTable::covers(lock, path) && !(subtree && DavLockTable::is_below(lock.path, path)))
+      continue;
+    bool submitted = std::find(tokens.begin(), tokens.end(), lock.token) != tokens.end();
+    if (lock.exclusive) {
+      if (!submitted)
+        return false;
+    } else {
+      // any holder of a shared lock may write
+      shared_locked = true;
+      shared_token = shared_token || submitted;
+    }
+  }
+  return !shared_locked || shared_token;
+}
+
+void DavLockTable::release(const std::string &path) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->locks_.erase(std::remove_if(this->locks_.begin(), this->locks_.end(),
+                                    [&path](const DavLock &lock) {
+                                      return lock.path == path || DavLockTable::is_below(lock.path, path);
+                                    }),
+                     this->locks_.end());
+}
+
+std::vector<DavLock> DavLockTable::locks_on(const std::string &path) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->purge();
+  std::vector<DavLock> locks;
+  for (const DavLock &lock : this->locks_) {
+    if (DavLockTable::covers(lock, path))
+      locks.push_back(lock);
+  }
+  return locks;
+}
+
+std::string DavLockTable::normalize(const std::string &path) {
+  if (path.empty())
+    return "/";
+  std::string normalized = path[0] == '/' ? path : "/" + path;
+  while (normalized.size() > 1 && normalized.back() == '/')
+    normalized.pop_back();
+  return normalized;
+}
+
+std::vector<std::string> DavLockTable::parse_if_header(const std::string &header) {
+  // If: <http://host/file> (<opaquelocktoken:...> ["etag"]) (Not <DAV:no-lock>)
+  std::vector<std::string> tokens;
+  size_t start = 0;
+  while ((start = header.find('<', start)) != std::string::npos) {
+    size_t end = header.find('>', start);
+    if (end == std::string::npos)
+      break;
+    std::string tag = header.substr(start + 1, end - start - 1);
+    if (tag.compare(0, strlen(TOKEN_SCHEME), TOKEN_SCHEME) == 0)
+      tokens.push_back(tag);
+    start = end + 1;
+  }
+  return tokens;
+}
+
+uint32_t DavLockTable::parse_timeout(const std::string &header) {
+  // the first value understood wins, Infinite is served as the longest timeout
+  size_t start = 0;
+  while (start < header.size()) {
+    size_t end = header.find(',', start);
+    if (end == std::string::npos)
+      end = header.size();
+    std::string value = header.substr(start, end - start);
+    value.erase(0, value.find_first_not_of(' '));
+    if (value.compare(0, 7, "Second-") == 0) {
+      unsigned long seconds = strtoul(value.c_str() + 7, nullptr, 10);
+      if (seconds != 0)
+        return std::min<unsigned long>(seconds, MAX_TIMEOUT_S);
+    } else if (value.compare(0, 8, "Infinite") == 0) {
+      return MAX_TIMEOUT_S;
+    }
+    start = end + 1;
+  }
+  return DEFAULT_TIMEOUT_S;
+}
+
+bool DavLockTable::covers(const DavLock &lock, const std::string &path) {
+  return lock.path == path || (lock.infinite && DavLockTable::is_below(path, lock.path));
+}
+
+bool DavLockTable::is_below(const std::string &path, const std::string &parent) {
+  if (parent == "/")
+    return path.size() > 1;
+  return path.size() > parent.size() && path.compare(0, parent.size(), parent) == 0 && path[parent.size()] == '/';
+}
+
+std::string DavLockTable::new_token() {
+  // random (version 4) UUID
+  uint32_t words[4] = {random_uint32(), random_uint32(), random_uint32(), random_uint32()};
+  words[1] = (words[1] & 0xFFFF0FFF) | 0x00004000;
+  words[2] = (words[2] & 0x3FFFFFFF) | 0x80000000;
+  char token[64];
+  snprintf(token, sizeof(token), "%s%08x-%04x-%04x-%04x-%04x%08x", TOKEN_SCHEME, words[0], words[1] >> 16,
+           words[1] & 0xFFFF, words[2] >> 16, words[2] & 0xFFFF, words[3]);
+  return token;
+}
+
+void DavLockTable::purge() {
+  const uint32_t now = millis();
+  this->locks_.erase(std::remove_if(this->locks_.begin(), this->locks_.end(),
+                                    [now](const DavLock &lock) {
+                                      return now - lock.acquired_ms >= lock.timeout_s * 1000;
+                                    }),
+                     this->locks_.end());
+}
+
+}  // namespace webdavbox
+}  // namespace esphome
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace webdavbox {
+
+struct DavLock {
+  std::string token;
+  std::string path;
+  std::string owner;
+  bool exclusive;
+  // depth infinity, the lock also covers everything below path
+  bool infinite;
+  uint32_t timeout_s;
+  uint32_t acquired_ms;
+};
+
+/* WebDAV (class 2) write locks, kept in memory only: a reboot releases them all, as a lock
+ * timeout would. Paths are the request paths, without trailing slash. */
+class DavLockTable {
+ public:
+  enum Result : uint8_t {
+    LOCK_OK,
+    LOCK_CONFLICT,
+    LOCK_FULL,
+  };
+
+  static constexpr size_t MAX_LOCKS = 32;
+  static constexpr uint32_t DEFAULT_TIMEOUT_S = 600;
+  static constexpr uint32_t MAX_TIMEOUT_S = 3600;
+
+  Result lock(const std::string &path, bool exclusive, bool infinite, uint32_t timeout_s, const std::string &owner,
+              DavLock *granted);
+  /* Restart the timeout of the lock on path whose token was submitted */
+  bool refresh(const std::string &path, const std::vector<std::string> &tokens, uint32_t timeout_s,
+               DavLock *refreshed);
+  bool unlock(const std::string &path, const std::string &token);
+  /* Whether path may be modified with the submitted tokens, subtree also checks the locks below path
+   * (DELETE, MOVE) */
+  bool is_allowed(const std::string &path, const std::vector<std::string> &tokens, bool subtree);
+  /* Drop the locks on path and below, once it has been deleted or moved away */
+  void release(const std::string &path);
+  /* Locks applying to path, for the lockdiscovery property */
+  std::vector<DavLock> locks_on(const std::string &path);
+
+  static std::string normalize(const std::string &path);
+  /* Lock tokens listed in an If header, resource tags and conditions are ignored */
+  static std::vector<std::string> parse_if_header(const std::string &header);
+  /* Seconds asked by a Timeout header ("Second-600, Infinite"), capped to MAX_TIMEOUT_S */
+  static uint32_t parse_timeout(const std::string &header);
+
+ protected:
+  static bool covers(const DavLock &lock, const std::string &path);
+  static bool is_below(const std::string &path, const std::string &parent);
+  static std::string new_token();
+  void purge();
+
+  std::mutex lock_;
+  std::vector<DavLock> locks_;
+};
+
+}  // namespace webdavbox
+}  // namespace esphome
@@ -0,0 +1,240 @@
+#include "directory_index.h"
+#include "dav_lock_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <strings.h>
+#include <ctime>
+#include <sys/stat.h>
+
+#include "esphome/core/hal.h"
+
+#ifdef USE_ESP_IDF
+#include "ff.h"
+#endif
+
+namespace esphome {
+namespace webdavbox {
+
+static const char *const SORT_NAMES[DirectoryIndex::SORT_KEYS] = {"name", "size", "mtime"};
+
+const DirectoryIndex::Entry &DirectoryIndex::Listing::at(SortKey sort, bool descending, size_t i) const {
+  if (this->partial_)
+    return this->entries_[i - this->first_];
+  return this->entries_[this->orders_[sort][descending ? this->total_ - 1 - i : i]];
+}
+
+bool DirectoryIndex::Listing::covers(SortKey sort, bool descending, size_t first, size_t last) const {
+  if (!this->partial_)
+    return true;
+  first = std::min(first, this->total_);
+  last = std::min(last, this->total_);
+  return sort == this->sort_ && descending == this->descending_ && first >= this->first_ &&
+         last <= this->first_ + this->entries_.size();
+}
+
+size_t DirectoryIndex::Listing::memory_usage() const {
+  // counts every order, built or not, so that the budget is known before sorting
+  return sizeof(Listing) +
+         this->entries_.size() * (sizeof(Entry) + (this->partial_ ? 0 : SORT_KEYS * sizeof(uint32_t))) +
+         this->names_.size();
+}
+
+void DirectoryIndex::Listing::sort(SortKey sort) {
+  std::vector<uint32_t> &order = this->orders_[sort];
+  order.resize(this->entries_.size());
+  for (uint32_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [this, sort](uint32_t a, uint32_t b) {
+    const Entry &left = this->entries_[a];
+    const Entry &right = this->entries_[b];
+    if (sort == SORT_SIZE && left.size != right.size)
+      return left.size < right.size;
+    if (sort == SORT_MTIME && left.mtime != right.mtime)
+      return left.mtime < right.mtime;
+    return strcasecmp(this->name(left), this->name(right)) < 0;
+  });
+}
+
+std::shared_ptr<const DirectoryIndex::Listing> DirectoryIndex::get(const std::string &path,
+                                                                   const std::string &full_path,
+                                                                   const std::string &fatfs_path, SortKey sort,
+                                                                   bool descending, size_t offset, size_t count) {
+  const uint32_t now = millis();
+  uint32_t generation;
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    for (auto it = this->cache_.begin(); it != this->cache_.end(); ++it) {
+      if (it->path != path)
+        continue;
+      if (now - it->scanned_ms >= MAX_AGE_MS) {
+        this->cache_.erase(it);
+        break;
+      }
+      // a partial listing paged out of is rescanned, store() replaces it
+      if (!it->listing->covers(sort, descending, offset, offset + count))
+        break;
+      it->used_ms = now;
+      return it->listing;
+    }
+    generation = this->generation_;
+  }
+
+  // the scan runs unlocked, invalidations from the main loop never wait for it
+  std::shared_ptr<Listing> listing = DirectoryIndex::scan(full_path, fatfs_path);
+  if (!listing)
+    return nullptr;
+  if (listing->memory_usage() > MAX_BYTES) {
+    listing = DirectoryIndex::window(*listing, sort, descending, offset);
+  } else {
+    for (uint8_t key = 0; key < SORT_KEYS; key++)
+      listing->sort(static_cast<SortKey>(key));
+  }
+  std::lock_guard<std::mutex> guard(this->lock_);
+  if (generation == this->generation_)
+    this->store(path, listing, now);
+  return listing;
+}
+
+void DirectoryIndex::invalidate(const std::string &path) {
+  const std::string changed = DavLockTable::normalize(path);
+  const size_t slash = changed.rfind('/');
+  const std::string parent = slash == 0 ? "/" : changed.substr(0, slash);
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->generation_++;
+  this->cache_.erase(std::remove_if(this->cache_.begin(), this->cache_.end(),
+                                    [&changed, &parent](const Cached &cached) {
+                                      const std::string &key = cached.path;
+                                      return key == parent || key == changed ||
+                                             (key.size() > changed.size() &&
+                                              key.compare(0, changed.size(), changed) == 0 &&
+                                              key[changed.size()] == '/');
+                                    }),
+                     this->cache_.end());
+}
+
+bool DirectoryIndex::parse_sort(const std::string &name, SortKey *sort) {
+  for (uint8_t key = 0; key < SORT_KEYS; key++) {
+    if (name == SORT_NAMES[key]) {
+      *sort = static_cast<SortKey>(key);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *DirectoryIndex::sort_to_string(SortKey sort) { return sort < SORT_KEYS ? SORT_NAMES[sort] : "unknown"; }
+
+#ifdef USE_ESP_IDF
+// FAT local date and time, converted like the VFS stat() does
+static uint32_t fat_time(WORD date, WORD time) {
+  struct tm tm = {};
+  tm.tm_year = (date >> 9) + 80;
+  tm.tm_mon = ((date >> 5) & 0xF) - 1;
+  tm.tm_mday = date & 0x1F;
+  tm.tm_hour = (time >> 11) & 0x1F;
+  tm.tm_min = (time >> 5) & 0x3F;
+  tm.tm_sec = (time & 0x1F) * 2;
+  return static_cast<uint32_t>(mktime(&tm));
+}
+#endif
+
+std::shared_ptr<DirectoryIndex::Listing> DirectoryIndex::scan(const std::string &full_path,
+                                                              const std::string &fatfs_path) {
+#ifdef USE_ESP_IDF
+  if (!fatfs_path.empty()) {
+    FF_DIR dir;
+    if (f_opendir(&dir, fatfs_path.c_str()) != FR_OK)
+      return nullptr;
+    std::shared_ptr<Listing> listing(new Listing());
+    // a FILINFO holds a full long name, too big for the stack of the web server task
+    std::unique_ptr<FILINFO> info(new FILINFO());
+    while (f_readdir(&dir, info.get()) == FR_OK && info->fname[0] != '\0') {
+      if (info->fname[0] == '.')
+        continue;
+      const bool directory = (info->fattrib & AM_DIR) != 0;
+      listing->entries_.push_back(Entry{static_cast<uint32_t>(listing->names_.size()),
+                                        directory ? 0 : static_cast<uint32_t>(info->fsize),
+                                        fat_time(info->fdate, info->ftime), directory});
+      listing->names_.append(info->fname, strlen(info->fname) + 1);
+    }
+    f_closedir(&dir);
+    listing->total_ = listing->entries_.size();
+    listing->entries_.shrink_to_fit();
+    listing->names_.shrink_to_fit();
+    return listing;
+  }
+#endif
+  DIR *dir = opendir(full_path.c_str());
+  if (dir == nullptr)
+    return nullptr;
+  std::shared_ptr<Listing> listing(new Listing());
+  const std::string prefix = full_path.back() == '/' ? full_path : full_path + "/";
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.')
+      continue;
+    struct stat info;
+    if (stat((prefix + entry->d_name).c_str(), &info) != 0)
+      continue;
+    const bool directory = S_ISDIR(info.st_mode);
+    listing->entries_.push_back(Entry{static_cast<uint32_t>(listing->names_.size()),
+                                      directory ? 0 : static_cast<uint32_t>(info.st_size),
+                                      static_cast<uint32_t>(info.st_mtime), directory});
+    listing->names_.append(entry->d_name, strlen(entry->d_name) + 1);
+  }
+  closedir(dir);
+  listing->total_ = listing->entries_.size();
+  listing->entries_.shrink_to_fit();
+  listing->names_.shrink_to_fit();
+  return listing;
+}
+
+std::shared_ptr<DirectoryIndex::Listing> DirectoryIndex::window(Listing &full, SortKey sort, bool descending,
+                                                                size_t offset) {
+  full.sort(sort);
+  std::shared_ptr<Listing> window(new Listing());
+  window->total_ = full.total_;
+  window->partial_ = true;
+  window->sort_ = sort;
+  window->descending_ = descending;
+  // a quarter of the window before the requested page, for the way back
+  window->first_ = std::min(offset - std::min(offset, WINDOW_ENTRIES / 4), full.total_);
+  const size_t last = std::min(full.total_, window->first_ + WINDOW_ENTRIES);
+  window->entries_.reserve(last - window->first_);
+  for (size_t i = window->first_; i < last; i++) {
+    const Entry &entry = full.at(sort, descending, i);
+    const char *name = full.name(entry);
+    window->entries_.push_back(
+        Entry{static_cast<uint32_t>(window->names_.size()), entry.size, entry.mtime, entry.directory});
+    window->names_.append(name, strlen(name) + 1);
+  }
+  window->names_.shrink_to_fit();
+  return window;
+}
+
+void DirectoryIndex::store(const std::string &path, std::shared_ptr<Listing> listing, uint32_t now) {
+  this->cache_.erase(std::remove_if(this->cache_.begin(), this->cache_.end(),
+                                    [&path](const Cached &cached) { return cached.path == path; }),
+                     this->cache_.end());
+  // only a window of very long names can still be over the budget
+  if (listing->memory_usage() > MAX_BYTES)
+    return;
+  this->cache_.push_back(Cached{path, std::move(listing), now, now});
+
+  size_t bytes = 0;
+  for (const Cached &cached : this->cache_)
+    bytes += cached.listing->memory_usage();
+  while (this->cache_.size() > MAX_DIRECTORIES || bytes > MAX_BYTES) {
+    // least recently used, never the listing just stored as it is the most recent
+    auto oldest = std::min_element(this->cache_.begin(), this->cache_.end(), [now](const Cached &a, const Cached &b) {
+      return now - a.used_ms > now - b.used_ms;
+    });
+    bytes -= oldest->listing->memory_usage();
+    this->cache_.erase(oldest);
+  }
+}
+
+}  // namespace webdavbox
+}  // namespace esphome
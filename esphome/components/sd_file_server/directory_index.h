@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace webdavbox {
+
+/* Sorted listings of the directories being browsed, so that paging through a folder of thousands of files
+ * scans it once instead of once per page. A directory is read a single time and every sort order, an array of
+ * indices, is built before the listing is shared. A directory too large for the budget keeps a partial
+ * listing instead: WINDOW_ENTRIES entries of the view being browsed around the requested page, rebuilt when
+ * paging leaves it. Listings are keyed by request path (without trailing slash) and are dropped when a file
+ * event touches the directory, or after MAX_AGE_MS for changes made behind the card component's back. */
+class DirectoryIndex {
+ public:
+  enum SortKey : uint8_t {
+    SORT_NAME,
+    SORT_SIZE,
+    SORT_MTIME,
+    SORT_KEYS,
+  };
+
+  struct Entry {
+    // offset of the name in the listing's name buffer
+    uint32_t name;
+    uint32_t size;
+    uint32_t mtime;
+    bool directory;
+  };
+
+  /* Immutable once handed out, a rescan builds a new one */
+  class Listing {
+   public:
+    /* Entries in the directory, including those a partial listing doesn't hold */
+    size_t size() const { return this->total_; }
+    /* i-th entry of the view sorted by sort, ties broken by name; a partial listing only holds its window */
+    const Entry &at(SortKey sort, bool descending, size_t i) const;
+    /* Whether the positions [first, last) of the view are held */
+    bool covers(SortKey sort, bool descending, size_t first, size_t last) const;
+    const char *name(const Entry &entry) const { return this->names_.data() + entry.name; }
+    size_t memory_usage() const;
+
+   protected:
+    friend class DirectoryIndex;
+    void sort(SortKey sort);
+
+    std::vector<Entry> entries_;
+    std::string names_;
+    std::vector<uint32_t> orders_[SORT_KEYS];
+    size_t total_{0};
+    // a partial listing holds entries_ in the order of its single view, from position first_ on
+    bool partial_{false};
+    SortKey sort_{SORT_NAME};
+    bool descending_{false};
+    size_t first_{0};
+  };
+
+  static constexpr size_t MAX_DIRECTORIES = 4;
+  static constexpr size_t MAX_BYTES = 256 * 1024;
+  static constexpr uint32_t MAX_AGE_MS = 60000;
+  static constexpr size_t WINDOW_ENTRIES = 2000;
+
+  /* Listing of the directory at full_path (fatfs_path for FatFs, may be empty) holding at least the count
+   * entries of the view from offset; nullptr if it can't be opened */
+  std::shared_ptr<const Listing> get(const std::string &path, const std::string &full_path,
+                                     const std::string &fatfs_path, SortKey sort, bool descending, size_t offset,
+                                     size_t count);
+  /* Forget the listings made stale by a change of path: its directory, and path itself with everything
+   * below it */
+  void invalidate(const std::string &path);
+
+  static bool parse_sort(const std::string &name, SortKey *sort);
+  static const char *sort_to_string(SortKey sort);
+
+ protected:
+  struct Cached {
+    std::string path;
+    std::shared_ptr<Listing> listing;
+    uint32_t scanned_ms;
+    uint32_t used_ms;
+  };
+
+  /* Through FatFs when fatfs_path isn't empty: a directory entry already holds the size and date, a stat() per
+   * entry would search the whole directory again */
+  static std::shared_ptr<Listing> scan(const std::string &full_path, const std::string &fatfs_path);
+  /* The part of a full listing kept for a directory over the budget */
+  static std::shared_ptr<Listing> window(Listing &full, SortKey sort, bool descending, size_t offset);
+  void store(const std::string &path, std::shared_ptr<Listing> listing, uint32_t now);
+
+  std::mutex lock_;
+  std::vector<Cached> cache_;
+  // bumped by every invalidation, a scan that overlapped one is served but not kept
+  uint32_t generation_{0};
+};
+
+}  // namespace webdavbox
+}  // namespace esphome
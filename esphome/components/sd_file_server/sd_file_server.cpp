@@ -1,15 +1,34 @@
 #include "webdav_server.h"
+#include "esphome/core/hal.h"
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <dirent.h>
 #include <cstring>
 #include <algorithm>
+#include <cinttypes>
+#include <ctime>
+#include <utility>
 
 namespace esphome {
 namespace webdavbox {
 
 static const char* TAG = "webdavbox_server";
 
+// Suivi en direct (?follow=1) : arriéré par abonné et commentaire SSE envoyé à un client inactif
+static const size_t FOLLOW_DEFAULT_BACKLOG = 4 * 1024;
+static const size_t FOLLOW_MAX_BACKLOG = 64 * 1024;
+static const size_t FOLLOW_READ_SIZE = 1024;
+static const uint32_t FOLLOW_KEEPALIVE_MS = 15000;
+
+// Index des dossiers : entrées par page
+static const size_t INDEX_DEFAULT_LIMIT = 100;
+static const size_t INDEX_MAX_LIMIT = 500;
+
+// transfers of the same address share its rate cap
+static std::string client_of(AsyncWebServerRequest* request) {
+  return request->client()->remoteIP().toString().c_str();
+}
+
 void WebDavServer::setup() {
   if (!base_) {
     ESP_LOGE(TAG, "WebServer base not set");
@@ -17,6 +36,12 @@ void WebDavServer::setup() {
   }
 
   register_webdav_handlers();
+  if (sd_mmc_card_) {
+    // Une modification de la carte périme l'index du dossier concerné
+    sd_mmc_card_->add_file_listener([this](sd_mmc_card::FileEvent event, const std::string& path) {
+      index_.invalidate(path);
+    });
+  }
   ESP_LOGI(TAG, "WebDAV handlers registered");
 }
 
@@ -64,6 +89,38 @@ void WebDavServer::register_webdav_handlers() {
     }
     return false;
   });
+
+  base_->add_handler([this](AsyncWebServerRequest* request) {
+    if (request->method() == HTTP_MOVE) {
+      handle_move(request);
+      return true;
+    }
+    return false;
+  });
+
+  base_->add_handler([this](AsyncWebServerRequest* request) {
+    if (request->method() == HTTP_OPTIONS) {
+      handle_options(request);
+      return true;
+    }
+    return false;
+  });
+
+  base_->add_handler([this](AsyncWebServerRequest* request) {
+    if (request->method() == HTTP_LOCK) {
+      handle_lock(request);
+      return true;
+    }
+    return false;
+  });
+
+  base_->add_handler([this](AsyncWebServerRequest* request) {
+    if (request->method() == HTTP_UNLOCK) {
+      handle_unlock(request);
+      return true;
+    }
+    return false;
+  });
 }
 
 bool WebDavServer::authenticate_request(AsyncWebServerRequest* request) {
@@ -88,6 +145,161 @@ bool WebDavServer::authenticate_request(AsyncWebServerRequest* request) {
   return true;
 }
 
+// Corps d'un élément XML désigné par son nom local, quel que soit son préfixe d'espace de noms
+static std::string xml_element(const std::string& xml, const std::string& name) {
+  size_t pos = 0;
+  while ((pos = xml.find('<', pos)) != std::string::npos) {
+    size_t end = xml.find_first_of(" />", pos + 1);
+    if (end == std::string::npos) {
+      break;
+    }
+    std::string tag = xml.substr(pos + 1, end - pos - 1);
+    size_t colon = tag.find(':');
+    if (!tag.empty() && tag[0] != '/' && (colon == std::string::npos ? tag : tag.substr(colon + 1)) == name) {
+      size_t open_end = xml.find('>', end);
+      if (open_end == std::string::npos || xml[open_end - 1] == '/') {
+        return "";
+      }
+      size_t close = xml.find("</" + tag, open_end);
+      if (close == std::string::npos) {
+        return "";
+      }
+      return xml.substr(open_end + 1, close - open_end - 1);
+    }
+    pos = end;
+  }
+  return "";
+}
+
+static std::string active_lock_xml(const DavLock& lock) {
+  return std::string("<D:activelock>") +
+    "<D:locktype><D:write/></D:locktype>" +
+    "<D:lockscope>" + (lock.exclusive ? "<D:exclusive/>" : "<D:shared/>") + "</D:lockscope>" +
+    "<D:depth>" + (lock.infinite ? "infinity" : "0") + "</D:depth>" +
+    (lock.owner.empty() ? "" : "<D:owner>" + lock.owner + "</D:owner>") +
+    "<D:timeout>Second-" + std::to_string(lock.timeout_s) + "</D:timeout>" +
+    "<D:locktoken><D:href>" + lock.token + "</D:href></D:locktoken>" +
+    "<D:lockroot><D:href>" + lock.path + "</D:href></D:lockroot>" +
+    "</D:activelock>";
+}
+
+// Chemin d'une URL absolue de l'en-tête Destination, décodé
+static std::string destination_path(const std::string& url) {
+  size_t start = url.find("://");
+  start = start == std::string::npos ? 0 : url.find('/', start + 3);
+  if (start == std::string::npos) {
+    return "/";
+  }
+  std::string path;
+  for (size_t i = start; i < url.size(); i++) {
+    if (url[i] == '%' && i + 2 < url.size()) {
+      path += static_cast<char>(strtol(url.substr(i + 1, 2).c_str(), nullptr, 16));
+      i += 2;
+    } else {
+      path += url[i];
+    }
+  }
+  return path;
+}
+
+static std::string json_escape(const char* text) {
+  std::string escaped;
+  for (; *text; text++) {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c < 0x20) {
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+static std::string html_escape(const char* text) {
+  std::string escaped;
+  for (; *text; text++) {
+    switch (*text) {
+      case '&': escaped += "&amp;"; break;
+      case '<': escaped += "&lt;"; break;
+      case '>': escaped += "&gt;"; break;
+      case '"': escaped += "&quot;"; break;
+      default: escaped += *text;
+    }
+  }
+  return escaped;
+}
+
+// Encodage d'un chemin pour un lien, les '/' sont conservés
+static std::string url_encode(const std::string& path) {
+  std::string encoded;
+  for (unsigned char c : path) {
+    if (isalnum(c) || strchr("/-_.~", c)) {
+      encoded += c;
+    } else {
+      char code[4];
+      snprintf(code, sizeof(code), "%%%02X", c);
+      encoded += code;
+    }
+  }
+  return encoded;
+}
+
+// En-tête Range d'un seul intervalle : "bytes=debut-fin", "bytes=debut-" ou "bytes=-longueur"
+static bool parse_range(const char* header, size_t size, size_t* start, size_t* end) {
+  if (strncmp(header, "bytes=", 6) != 0 || size == 0) {
+    return false;
+  }
+  const char* spec = header + 6;
+  char* rest;
+  if (*spec == '-') {
+    unsigned long long suffix = strtoull(spec + 1, &rest, 10);
+    if (rest == spec + 1 || suffix == 0) {
+      return false;
+    }
+    *start = suffix >= size ? 0 : size - suffix;
+    *end = size - 1;
+    return true;
+  }
+  unsigned long long first = strtoull(spec, &rest, 10);
+  if (rest == spec || *rest != '-' || first >= size) {
+    return false;
+  }
+  const char* last_spec = rest + 1;
+  unsigned long long last = size - 1;
+  if (*last_spec != '\0' && *last_spec != ',') {
+    last = strtoull(last_spec, &rest, 10);
+    if (rest == last_spec || last < first) {
+      return false;
+    }
+  }
+  *start = first;
+  *end = std::min<unsigned long long>(last, size - 1);
+  return true;
+}
+
+// Réponse 416 à une requête Range hors du fichier
+static void send_range_not_satisfiable(AsyncWebServerRequest* request, size_t size) {
+  AsyncWebServerResponse* response = request->beginResponse(416, "text/plain", "Range Not Satisfiable");
+  response->addHeader("Content-Range", ("bytes */" + std::to_string(size)).c_str());
+  request->send(response);
+}
+
+// En-têtes d'une réponse complète ou partielle (206)
+static void add_range_headers(AsyncWebServerResponse* response, bool partial, size_t start, size_t end,
+                              size_t size) {
+  response->addHeader("Accept-Ranges", "bytes");
+  if (partial) {
+    response->setCode(206);
+    response->addHeader("Content-Range",
+      ("bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" + std::to_string(size)).c_str());
+  }
+}
+
 std::string WebDavServer::resolve_sd_path(const std::string& request_path) {
   std::string full_path = sd_mount_point_;
   
@@ -119,17 +331,29 @@ void WebDavServer::handle_propfind(AsyncWebServerRequest* request) {
 
   std::string path = request->url();
   std::string full_path = resolve_sd_path(path);
-  
-  DIR* dir = opendir(full_path.c_str());
-  if (!dir) {
-    send_webdav_response(request, 404, "text/plain", "Not Found");
+
+  auto card_lock = sd_mmc_card_->lock_read(path.c_str());
+  if (!check_mounted(request)) {
     return;
   }
-
   std::string xml_response = 
     "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
     "<D:multistatus xmlns:D=\"DAV:\">\n";
 
+  DIR* dir = opendir(full_path.c_str());
+  if (!dir) {
+    // une ressource qui n'est pas un dossier se décrit elle-même, les clients la sondent avant LOCK ou GET
+    struct stat path_stat;
+    if (stat(full_path.c_str(), &path_stat) != 0 || S_ISDIR(path_stat.st_mode)) {
+      send_webdav_response(request, 404, "text/plain", "Not Found");
+      return;
+    }
+    xml_response += propfind_entry(path, path_stat);
+    xml_response += "</D:multistatus>";
+    send_webdav_response(request, 207, "application/xml", xml_response);
+    return;
+  }
+
   struct dirent* entry;
   while ((entry = readdir(dir)) != nullptr) {
     if (entry->d_name[0] == '.') continue;
@@ -137,19 +361,7 @@ void WebDavServer::handle_propfind(AsyncWebServerRequest* request) {
     std::string entry_path = full_path + "/" + entry->d_name;
     struct stat path_stat;
     if (stat(entry_path.c_str(), &path_stat) == 0) {
-      xml_response += 
-        "  <D:response>\n"
-        "    <D:href>" + path + "/" + entry->d_name + "</D:href>\n"
-        "    <D:propstat>\n"
-        "      <D:prop>\n"
-        "        <D:resourcetype>" + 
-        (S_ISDIR(path_stat.st_mode) ? "<D:collection/>" : "") + 
-        "</D:resourcetype>\n"
-        "        <D:getcontentlength>" + std::to_string(path_stat.st_size) + "</D:getcontentlength>\n"
-        "      </D:prop>\n"
-        "      <D:status>HTTP/1.1 200 OK</D:status>\n"
-        "    </D:propstat>\n"
-        "  </D:response>\n";
+      xml_response += propfind_entry(path + "/" + entry->d_name, path_stat);
     }
   }
   closedir(dir);
@@ -165,8 +377,55 @@ void WebDavServer::handle_get(AsyncWebServerRequest* request) {
 
   std::string path = request->url();
   std::string full_path = resolve_sd_path(path);
+
+  if (request->hasParam("follow") && request->getParam("follow")->value() == "1") {
+    handle_follow(request, path);
+    return;
+  }
+
+  struct stat path_stat;
+  if (stat(full_path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
+    handle_index(request, path);
+    return;
+  }
+
+  // Une écriture atomique en attente est validée avant de lire la carte ou le cache
+  sd_mmc_card_->commit_atomic_write(path.c_str());
+
+  // Petits fichiers souvent relus (icônes, polices...) : servis depuis le cache, sans passer par la carte
+  std::shared_ptr<const sd_mmc_card::FileCache::Block> cached = sd_mmc_card_->read_cached(path.c_str());
+  if (cached) {
+    size_t range_start = 0;
+    size_t range_end = cached->size() - 1;
+    bool partial = request->hasHeader("Range");
+    if (partial && !parse_range(request->header("Range").c_str(), cached->size(), &range_start, &range_end)) {
+      send_range_not_satisfiable(request, cached->size());
+      return;
+    }
+    size_t length = cached->size() == 0 ? 0 : range_end - range_start + 1;
+    AsyncWebServerResponse* response = request->beginResponse(
+      "application/octet-stream",
+      length,
+      [cached, range_start, length](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        size_t len = std::min(maxLen, length - index);
+        memcpy(buffer, cached->data() + range_start + index, len);
+        return len;
+      }
+    );
+    add_range_headers(response, partial, range_start, range_end, cached->size());
+    response->addHeader("Content-Disposition",
+      "attachment; filename=\"" + std::string(strrchr(full_path.c_str(), '/') + 1) + "\"");
+    request->send(response);
+    return;
+  }
   
-  FILE* file = fopen(full_path.c_str(), "rb");
+  // Tenu le temps de l'ouverture, puis repris à chaque bloc : jamais pendant que la main est rendue à AsyncTCP
+  sd_mmc_card::FileLock card_lock = sd_mmc_card_->lock_read(path.c_str());
+  if (!check_mounted(request)) {
+    return;
+  }
+  // Un fichier chiffré est déchiffré à la volée, la taille et les positions sont celles du contenu
+  FILE* file = sd_mmc_card_->get_file_cipher()->open(path, full_path, "rb");
   if (!file) {
     send_webdav_response(request, 404, "text/plain", "File Not Found");
     return;
@@ -174,9 +433,21 @@ void WebDavServer::handle_get(AsyncWebServerRequest* request) {
 
   // Obtenir la taille du fichier
   fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
+  long total_size = ftell(file);
   fseek(file, 0, SEEK_SET);
 
+  // Requête partielle : seul l'intervalle demandé est lu
+  size_t range_start = 0;
+  size_t range_end = total_size - 1;
+  bool partial = request->hasHeader("Range");
+  if (partial && !parse_range(request->header("Range").c_str(), total_size, &range_start, &range_end)) {
+    fclose(file);
+    send_range_not_satisfiable(request, total_size);
+    return;
+  }
+  long file_size = total_size == 0 ? 0 : range_end - range_start + 1;
+  fseek(file, range_start, SEEK_SET);
+
   // Définir la taille du buffer en fonction de la taille du fichier
   size_t buffer_size;
   if (file_size < 1024) {
@@ -196,23 +467,34 @@ void WebDavServer::handle_get(AsyncWebServerRequest* request) {
     long total_size;
     long bytes_sent;
     size_t buffer_size;
+    sd_mmc_card::IoScheduler::Transfer* transfer;
+    std::string path;
   };
 
+  sd_mmc_card::IoScheduler* scheduler = sd_mmc_card_->get_io_scheduler();
   FileStreamContext* context = new FileStreamContext{
     file, 
     file_size, 
     0, 
-    buffer_size
+    buffer_size,
+    scheduler->begin(client_of(request), sd_mmc_card::IO_BULK, sd_mmc_card::IO_REQUEST_GET),
+    path
   };
+  // Le premier bloc peut être demandé dès send(), les verrous ne sont pas récursifs
+  card_lock.release();
 
   AsyncWebServerResponse* response = request->beginResponse(
     "application/octet-stream", 
     file_size, 
-    [context](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
-      // Si tous les octets ont été envoyés, libérer les ressources
+    [this, context, scheduler](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      // Si tous les octets ont été envoyés, libérer le fichier et le transfert sans attendre la déconnexion
       if (context->bytes_sent >= context->total_size) {
-        fclose(context->file);
-        delete context;
+        scheduler->end(context->transfer);
+        context->transfer = nullptr;
+        if (context->file) {
+          fclose(context->file);
+          context->file = nullptr;
+        }
         return 0;
       }
 
@@ -225,8 +507,29 @@ void WebDavServer::handle_get(AsyncWebServerRequest* request) {
         )
       );
 
-      // Lire les données
-      size_t bytes_read = fread(buffer, 1, bytes_to_read, context->file);
+      // Attendre notre tour auprès de l'ordonnanceur de la carte
+      size_t granted = scheduler->acquire(context->transfer, bytes_to_read);
+      if (granted == 0) {
+        return RESPONSE_TRY_AGAIN;
+      }
+
+      // Lire les données, sous le verrou du fichier le temps d'un bloc seulement
+      size_t bytes_read = 0;
+      bool mounted;
+      {
+        auto card_lock = sd_mmc_card_->lock_read(context->path.c_str());
+        mounted = sd_mmc_card_->is_mounted();
+        if (mounted) {
+          bytes_read = fread(buffer, 1, granted, context->file);
+        }
+      }
+      scheduler->release(context->transfer, granted, bytes_read);
+      if (!mounted) {
+        // Carte retirée : la réponse s'arrête, le client voit un transfert incomplet
+        ESP_LOGW(TAG, "Card removed while sending %s", context->path.c_str());
+        context->bytes_sent = context->total_size;
+        return 0;
+      }
       
       // Mettre à jour le compteur d'octets envoyés
       context->bytes_sent += bytes_read;
@@ -242,10 +545,218 @@ void WebDavServer::handle_get(AsyncWebServerRequest* request) {
   );
 
   // Définir des en-têtes supplémentaires
-  response->addHeader("Accept-Ranges", "bytes");
+  add_range_headers(response, partial, range_start, range_end, total_size);
   response->addHeader("Content-Disposition", 
     "attachment; filename=\"" + std::string(strrchr(full_path.c_str(), '/') + 1) + "\"");
 
+  // Le contexte n'est libéré qu'à la déconnexion, appelée aussi quand le client part en cours de route
+  request->onDisconnect([context, scheduler]() {
+    scheduler->end(context->transfer);
+    if (context->file) {
+      fclose(context->file);
+    }
+    delete context;
+  });
+  request->send(response);
+}
+
+void WebDavServer::handle_index(AsyncWebServerRequest* request, const std::string& path) {
+  std::string dir = DavLockTable::normalize(path);
+
+  DirectoryIndex::SortKey sort = DirectoryIndex::SORT_NAME;
+  if (request->hasParam("sort") &&
+      !DirectoryIndex::parse_sort(request->getParam("sort")->value().c_str(), &sort)) {
+    send_webdav_response(request, 400, "text/plain", "Invalid Sort");
+    return;
+  }
+  // Par défaut, les plus gros et les plus récents d'abord
+  bool descending = sort != DirectoryIndex::SORT_NAME;
+  if (request->hasParam("order")) {
+    descending = request->getParam("order")->value() == "desc";
+  }
+  size_t offset = 0;
+  if (request->hasParam("offset")) {
+    offset = strtoul(request->getParam("offset")->value().c_str(), nullptr, 10);
+  }
+  size_t limit = INDEX_DEFAULT_LIMIT;
+  if (request->hasParam("limit")) {
+    limit = std::max<size_t>(1, std::min<size_t>(strtoul(request->getParam("limit")->value().c_str(), nullptr, 10),
+                                                 INDEX_MAX_LIMIT));
+  }
+  bool json = (request->hasParam("format") && request->getParam("format")->value() == "json") ||
+              (request->hasHeader("Accept") && request->header("Accept").indexOf("application/json") >= 0);
+
+  // Seule la première page parcourt le dossier, les suivantes lisent l'index en cache
+  std::shared_ptr<const DirectoryIndex::Listing> listing;
+  {
+    auto card_lock = sd_mmc_card_->lock_read(dir.c_str());
+    if (!check_mounted(request)) {
+      return;
+    }
+#ifdef USE_ESP_IDF
+    // Les tailles et dates viennent des entrées du dossier, sans un stat() par fichier
+    const std::string fatfs_path = sd_mmc_card_->get_fatfs_path(dir.c_str());
+#else
+    const std::string fatfs_path;
+#endif
+    listing = index_.get(dir, resolve_sd_path(dir), fatfs_path, sort, descending, offset, limit);
+  }
+  if (!listing) {
+    send_webdav_response(request, 404, "text/plain", "Not Found");
+    return;
+  }
+  size_t total = listing->size();
+  offset = std::min(offset, total);
+  size_t end = std::min(total, offset + limit);
+  const char* sort_name = DirectoryIndex::sort_to_string(sort);
+  const char* order_name = descending ? "desc" : "asc";
+  std::string base = dir == "/" ? "/" : url_encode(dir) + "/";
+
+  AsyncResponseStream* response = request->beginResponseStream(json ? "application/json" : "text/html");
+  response->addHeader("Cache-Control", "no-cache");
+
+  if (json) {
+    response->printf("{\"path\":\"%s\",\"sort\":\"%s\",\"order\":\"%s\",\"offset\":%zu,\"limit\":%zu,\"total\":%zu,"
+                     "\"entries\":[",
+                     json_escape(dir.c_str()).c_str(), sort_name, order_name, offset, limit, total);
+    for (size_t i = offset; i < end; i++) {
+      const DirectoryIndex::Entry& entry = listing->at(sort, descending, i);
+      response->printf("%s{\"name\":\"%s\",\"type\":\"%s\",\"size\":%" PRIu32 ",\"mtime\":%" PRIu32 "}", i == offset ? "" : ",",
+                       json_escape(listing->name(entry)).c_str(), entry.directory ? "directory" : "file",
+                       entry.size, entry.mtime);
+    }
+    response->print("]}");
+    request->send(response);
+    return;
+  }
+
+  std::string escaped_dir = html_escape(dir.c_str());
+  response->printf("<!DOCTYPE html><html><head><meta charset=\"utf-8\"><title>%s</title></head><body>"
+                   "<h1>%s</h1><p>%zu-%zu / %zu</p><table><tr>",
+                   escaped_dir.c_str(), escaped_dir.c_str(), end == offset ? offset : offset + 1, end, total);
+  for (uint8_t key = 0; key < DirectoryIndex::SORT_KEYS; key++) {
+    const char* name = DirectoryIndex::sort_to_string(static_cast<DirectoryIndex::SortKey>(key));
+    // Un second clic sur la colonne triée inverse l'ordre
+    const char* order = key == sort ? (descending ? "asc" : "desc") : (key == DirectoryIndex::SORT_NAME ? "asc" : "desc");
+    response->printf("<th><a href=\"?sort=%s&order=%s&limit=%zu\">%s</a></th>", name, order, limit, name);
+  }
+  response->print("</tr>");
+  if (dir != "/") {
+    size_t slash = dir.rfind('/');
+    std::string parent = slash == 0 ? "/" : url_encode(dir.substr(0, slash)) + "/";
+    response->printf("<tr><td><a href=\"%s\">..</a></td><td></td><td></td></tr>", parent.c_str());
+  }
+  for (size_t i = offset; i < end; i++) {
+    const DirectoryIndex::Entry& entry = listing->at(sort, descending, i);
+    const char* name = listing->name(entry);
+    char date[20] = "";
+    time_t mtime = entry.mtime;
+    struct tm tm;
+    if (localtime_r(&mtime, &tm)) {
+      strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+    }
+    response->printf("<tr><td><a href=\"%s%s%s\">%s%s</a></td>", base.c_str(), url_encode(name).c_str(),
+                     entry.directory ? "/" : "", html_escape(name).c_str(), entry.directory ? "/" : "");
+    if (entry.directory) {
+      response->printf("<td></td><td>%s</td></tr>", date);
+    } else {
+      response->printf("<td>%" PRIu32 "</td><td>%s</td></tr>", entry.size, date);
+    }
+  }
+  response->print("</table><p>");
+  if (offset > 0) {
+    response->printf("<a href=\"?sort=%s&order=%s&limit=%zu&offset=%zu\">&lt;</a> ", sort_name, order_name, limit,
+                     offset > limit ? offset - limit : 0);
+  }
+  if (end < total) {
+    response->printf("<a href=\"?sort=%s&order=%s&limit=%zu&offset=%zu\">&gt;</a>", sort_name, order_name, limit, end);
+  }
+  response->print("</p></body></html>");
+  request->send(response);
+}
+
+void WebDavServer::handle_follow(AsyncWebServerRequest* request, const std::string& path) {
+  size_t backlog = FOLLOW_DEFAULT_BACKLOG;
+  if (request->hasParam("backlog")) {
+    backlog = std::min<size_t>(strtoul(request->getParam("backlog")->value().c_str(), nullptr, 10), FOLLOW_MAX_BACKLOG);
+  }
+  size_t initial = 0;
+  if (request->hasParam("tail")) {
+    initial = strtoul(request->getParam("tail")->value().c_str(), nullptr, 10);
+  }
+  // Server-Sent Events pour un navigateur (EventSource), octets bruts sinon (curl)
+  bool sse = request->hasHeader("Accept") && request->header("Accept").indexOf("text/event-stream") >= 0;
+
+  struct stat path_stat;
+  if (stat(resolve_sd_path(path).c_str(), &path_stat) != 0) {
+    send_webdav_response(request, 404, "text/plain", "File Not Found");
+    return;
+  }
+  sd_mmc_card::TailHub* hub = sd_mmc_card_->get_tail_hub();
+  sd_mmc_card::TailHub::Subscriber* subscriber = sd_mmc_card_->follow_file(path.c_str(), backlog, initial);
+  if (!subscriber) {
+    send_webdav_response(request, 503, "text/plain", "Too Many Followers");
+    return;
+  }
+
+  struct FollowContext {
+    sd_mmc_card::TailHub* hub;
+    sd_mmc_card::TailHub::Subscriber* subscriber;
+    bool sse;
+    uint32_t last_send_ms;
+    std::string pending;
+  };
+  FollowContext* context = new FollowContext{hub, subscriber, sse, millis(), ""};
+
+  AsyncWebServerResponse* response = request->beginChunkedResponse(
+    sse ? "text/event-stream" : "application/octet-stream",
+    [context](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      if (context->pending.empty()) {
+        uint8_t data[FOLLOW_READ_SIZE];
+        uint32_t dropped = context->hub->take_dropped(context->subscriber);
+        size_t len = context->hub->read(context->subscriber, data, sizeof(data), context->sse);
+        if (!context->sse) {
+          context->pending.assign(reinterpret_cast<char*>(data), len);
+        } else {
+          if (dropped != 0) {
+            context->pending += "event: overflow\ndata: " + std::to_string(dropped) + "\n\n";
+          }
+          if (len != 0) {
+            // Une ligne data: par ligne du fichier, la dernière fin de ligne termine l'événement
+            size_t start = 0;
+            while (start < len) {
+              const uint8_t* end = static_cast<const uint8_t*>(memchr(data + start, '\n', len - start));
+              size_t line_end = end ? end - data : len;
+              context->pending += "data: ";
+              context->pending.append(reinterpret_cast<char*>(data + start), line_end - start);
+              context->pending += "\n";
+              start = line_end + 1;
+            }
+            context->pending += "\n";
+          } else if (millis() - context->last_send_ms >= FOLLOW_KEEPALIVE_MS) {
+            // Détecte un client parti même quand le fichier ne bouge pas
+            context->pending = ": keepalive\n\n";
+          }
+        }
+      }
+      if (context->pending.empty()) {
+        return RESPONSE_TRY_AGAIN;
+      }
+      size_t len = std::min(maxLen, context->pending.size());
+      memcpy(buffer, context->pending.data(), len);
+      context->pending.erase(0, len);
+      context->last_send_ms = millis();
+      return len;
+    }
+  );
+  response->addHeader("Cache-Control", "no-cache");
+
+  // L'abonné est libéré à la déconnexion, l'écrivain n'est jamais retenu
+  request->onDisconnect([context]() {
+    context->hub->unsubscribe(context->subscriber);
+    delete context;
+  });
+  ESP_LOGD(TAG, "Following %s", path.c_str());
   request->send(response);
 }
 
@@ -256,6 +767,11 @@ void WebDavServer::handle_put(AsyncWebServerRequest* request) {
 
   std::string path = request->url();
   std::string full_path = resolve_sd_path(path);
+
+  // Un verrou posé par un autre client interdit l'écriture
+  if (!check_lock(request, path, false)) {
+    return;
+  }
   
   // Vérifier l'espace disponible
   struct statvfs stat;
@@ -270,20 +786,38 @@ void WebDavServer::handle_put(AsyncWebServerRequest* request) {
     return;
   }
 
+  // Le fichier est remplacé : une écriture atomique en attente n'a plus lieu d'être
+  sd_mmc_card_->discard_atomic_write(path.c_str());
+  // Tenu le temps de la création, puis repris à chaque bloc reçu : jamais pendant que la main est rendue à AsyncTCP
+  sd_mmc_card::FileLock card_lock = sd_mmc_card_->lock_write(path.c_str());
+  if (!check_mounted(request)) {
+    return;
+  }
+
+  // Remplacer un fichier existant est une modification, pas une création
+  struct stat existing;
+  bool existed = ::stat(full_path.c_str(), &existing) == 0;
+  // Les descripteurs gardés ouverts par la carte ne verraient pas le nouveau contenu
+  sd_mmc_card_->close_handles(path.c_str());
+
   // Contexte de streaming pour l'upload
   struct FileUploadContext {
     FILE* file;
     size_t total_size;
     size_t bytes_received;
     bool upload_complete;
+    sd_mmc_card::IoScheduler::Transfer* transfer;
   };
 
+  sd_mmc_card::IoScheduler* scheduler = sd_mmc_card_->get_io_scheduler();
   FileUploadContext* context = new FileUploadContext{
-    fopen(full_path.c_str(), "wb"),
+    sd_mmc_card_->get_file_cipher()->open(path, full_path, "wb"),
     request->contentLength(),
     0,
-    false
+    false,
+    nullptr
   };
+  card_lock.release();
 
   if (!context->file) {
     delete context;
@@ -291,14 +825,41 @@ void WebDavServer::handle_put(AsyncWebServerRequest* request) {
     return;
   }
 
-  request->onBody([this, request, context, full_path](AsyncWebServerRequest* req, 
+  context->transfer = scheduler->begin(client_of(request), sd_mmc_card::IO_BULK, sd_mmc_card::IO_REQUEST_PUT);
+
+  request->onBody([this, request, context, scheduler, full_path, path, existed](AsyncWebServerRequest* req, 
                                                      uint8_t* data, 
                                                      size_t len, 
                                                      size_t index, 
                                                      size_t total) {
+    if (!context->file) {
+      return;
+    }
     // Écrire les données
-    size_t bytes_written = fwrite(data, 1, len, context->file);
+    // Le corps doit être écrit à son arrivée, il est compté après coup
+    size_t bytes_written = 0;
+    bool mounted;
+    {
+      // Un bloc à la fois : un lecteur du fichier peut voir un contenu partiel, jamais un bloc à moitié écrit
+      auto card_lock = sd_mmc_card_->lock_write(path.c_str());
+      mounted = sd_mmc_card_->is_mounted();
+      if (mounted) {
+        bytes_written = fwrite(data, 1, len, context->file);
+      }
+      if (!mounted || (context->bytes_received + bytes_written >= context->total_size)) {
+        fclose(context->file);
+        context->file = nullptr;
+      }
+    }
+    if (!mounted) {
+      scheduler->end(context->transfer);
+      context->transfer = nullptr;
+      ESP_LOGW(TAG, "Card removed while receiving %s", path.c_str());
+      send_webdav_response(request, 503, "text/plain", "Card Not Mounted");
+      return;
+    }
     context->bytes_received += bytes_written;
+    scheduler->charge(context->transfer, bytes_written);
 
     // Progression du téléchargement
     if (context->bytes_received % (1024 * 1024) == 0) {
@@ -308,22 +869,37 @@ void WebDavServer::handle_put(AsyncWebServerRequest* request) {
 
     // Vérifier si le téléchargement est terminé
     if (context->bytes_received >= context->total_size) {
-      fclose(context->file);
       context->upload_complete = true;
+      scheduler->end(context->transfer);
+      context->transfer = nullptr;
+      sd_mmc_card_->notify_file_event(existed ? sd_mmc_card::FILE_MODIFIED : sd_mmc_card::FILE_CREATED, path);
       send_webdav_response(request, 201, "text/plain", "File Created");
-      delete context;
     }
   });
 
   // Gestion des erreurs d'upload
-  request->onError([this, context, full_path](AsyncWebServerRequest* req, int error) {
+  request->onError([this, context, scheduler, full_path, path](AsyncWebServerRequest* req, int error) {
     if (context->file) {
+      auto card_lock = sd_mmc_card_->lock_write(path.c_str());
       fclose(context->file);
+      context->file = nullptr;
       remove(full_path.c_str());
     }
-    delete context;
+    scheduler->end(context->transfer);
+    context->transfer = nullptr;
     send_webdav_response(req, 500, "text/plain", "Upload Failed");
   });
+
+  // Un client parti avant la fin laisse un fichier incomplet, supprimé comme après une erreur
+  request->onDisconnect([this, context, scheduler, full_path, path]() {
+    if (context->file) {
+      auto card_lock = sd_mmc_card_->lock_write(path.c_str());
+      fclose(context->file);
+      remove(full_path.c_str());
+    }
+    scheduler->end(context->transfer);
+    delete context;
+  });
 }
 
 void WebDavServer::handle_delete(AsyncWebServerRequest* request) {
@@ -333,21 +909,35 @@ void WebDavServer::handle_delete(AsyncWebServerRequest* request) {
 
   std::string path = request->url();
   std::string full_path = resolve_sd_path(path);
-  
+
+  sd_mmc_card_->discard_atomic_write(path.c_str());
+  auto card_lock = sd_mmc_card_->lock_write(path.c_str());
+  if (!check_mounted(request)) {
+    return;
+  }
   struct stat path_stat;
   if (stat(full_path.c_str(), &path_stat) != 0) {
     send_webdav_response(request, 404, "text/plain", "Not Found");
     return;
   }
 
+  if (!check_lock(request, path, true)) {
+    return;
+  }
+
+  sd_mmc_card_->close_handles(path.c_str());
   if (S_ISDIR(path_stat.st_mode)) {
     if (rmdir(full_path.c_str()) == 0) {
+      locks_.release(DavLockTable::normalize(path));
+      sd_mmc_card_->notify_file_event(sd_mmc_card::FILE_DELETED, path);
       send_webdav_response(request, 204, "text/plain", "Deleted");
     } else {
       send_webdav_response(request, 403, "text/plain", "Forbidden");
     }
   } else {
     if (remove(full_path.c_str()) == 0) {
+      locks_.release(DavLockTable::normalize(path));
+      sd_mmc_card_->notify_file_event(sd_mmc_card::FILE_DELETED, path);
       send_webdav_response(request, 204, "text/plain", "Deleted");
     } else {
       send_webdav_response(request, 403, "text/plain", "Forbidden");
@@ -362,8 +952,17 @@ void WebDavServer::handle_mkcol(AsyncWebServerRequest* request) {
 
   std::string path = request->url();
   std::string full_path = resolve_sd_path(path);
-  
+
+  if (!check_lock(request, path, false)) {
+    return;
+  }
+
+  auto card_lock = sd_mmc_card_->lock_write(path.c_str());
+  if (!check_mounted(request)) {
+    return;
+  }
   if (mkdir(full_path.c_str(), 0755) == 0) {
+    sd_mmc_card_->notify_file_event(sd_mmc_card::FILE_CREATED, path);
     send_webdav_response(request, 201, "text/plain", "Created");
   } else {
     if (errno == EEXIST) {
@@ -374,5 +973,227 @@ void WebDavServer::handle_mkcol(AsyncWebServerRequest* request) {
   }
 }
 
+void WebDavServer::handle_move(AsyncWebServerRequest* request) {
+  if (!authenticate_request(request)) {
+    return;
+  }
+
+  std::string path = request->url();
+  std::string full_path = resolve_sd_path(path);
+  if (!request->hasHeader("Destination")) {
+    send_webdav_response(request, 400, "text/plain", "Missing Destination");
+    return;
+  }
+  std::string destination = destination_path(request->header("Destination").c_str());
+  std::string full_destination = resolve_sd_path(destination);
+
+  // La source part avec son contenu en attente, la destination est remplacée
+  sd_mmc_card_->commit_atomic_write(path.c_str());
+  sd_mmc_card_->discard_atomic_write(destination.c_str());
+  auto card_lock = sd_mmc_card_->lock_write(path.c_str(), destination.c_str());
+  if (!check_mounted(request)) {
+    return;
+  }
+  struct stat path_stat;
+  if (stat(full_path.c_str(), &path_stat) != 0) {
+    send_webdav_response(request, 404, "text/plain", "Not Found");
+    return;
+  }
+
+  // La source et la destination doivent être déverrouillées par les jetons de l'en-tête If
+  if (!check_lock(request, path, true) || !check_lock(request, destination, true)) {
+    return;
+  }
+
+  bool exists = stat(full_destination.c_str(), &path_stat) == 0;
+  if (exists) {
+    bool overwrite = !request->hasHeader("Overwrite") || request->header("Overwrite") != "F";
+    if (!overwrite) {
+      send_webdav_response(request, 412, "text/plain", "Precondition Failed");
+      return;
+    }
+    sd_mmc_card_->close_handles(destination.c_str());
+    remove(full_destination.c_str());
+  }
+
+  sd_mmc_card_->close_handles(path.c_str());
+  if (rename(full_path.c_str(), full_destination.c_str()) != 0) {
+    send_webdav_response(request, 409, "text/plain", "Conflict");
+    return;
+  }
+  // Les verrous restent attachés à l'ancien chemin, ils disparaissent avec lui
+  locks_.release(DavLockTable::normalize(path));
+  sd_mmc_card_->notify_file_event(sd_mmc_card::FILE_DELETED, path);
+  sd_mmc_card_->notify_file_event(exists ? sd_mmc_card::FILE_MODIFIED : sd_mmc_card::FILE_CREATED, destination);
+  send_webdav_response(request, exists ? 204 : 201, "text/plain", exists ? "Moved" : "Created");
+}
+
+void WebDavServer::handle_options(AsyncWebServerRequest* request) {
+  AsyncWebServerResponse* response = request->beginResponse(200, "text/plain", "");
+  // Classe 2 : les clients natifs verrouillent avant d'écrire
+  response->addHeader("DAV", "1, 2");
+  response->addHeader("MS-Author-Via", "DAV");
+  response->addHeader("Allow", "OPTIONS, GET, PUT, DELETE, PROPFIND, MKCOL, MOVE, LOCK, UNLOCK");
+  request->send(response);
+}
+
+void WebDavServer::handle_lock(AsyncWebServerRequest* request) {
+  if (!authenticate_request(request)) {
+    return;
+  }
+
+  std::string path = DavLockTable::normalize(request->url());
+  uint32_t timeout = DavLockTable::DEFAULT_TIMEOUT_S;
+  if (request->hasHeader("Timeout")) {
+    timeout = DavLockTable::parse_timeout(request->header("Timeout").c_str());
+  }
+
+  // Sans corps, c'est un rafraîchissement du verrou désigné par l'en-tête If
+  if (request->contentLength() == 0) {
+    std::vector<std::string> tokens;
+    if (request->hasHeader("If")) {
+      tokens = DavLockTable::parse_if_header(request->header("If").c_str());
+    }
+    DavLock lock;
+    if (!locks_.refresh(path, tokens, timeout, &lock)) {
+      send_webdav_response(request, 412, "text/plain", "Precondition Failed");
+      return;
+    }
+    send_lock_response(request, 200, lock);
+    return;
+  }
+
+  bool infinite = !request->hasHeader("Depth") || request->header("Depth") != "0";
+  std::string* body = new std::string();
+  request->onBody([this, request, body, path, timeout, infinite](AsyncWebServerRequest* req,
+                                                                  uint8_t* data,
+                                                                  size_t len,
+                                                                  size_t index,
+                                                                  size_t total) {
+    body->append(reinterpret_cast<char*>(data), len);
+    if (index + len < total) {
+      return;
+    }
+
+    bool exclusive = xml_element(*body, "lockscope").find("shared") == std::string::npos;
+    std::string owner = xml_element(*body, "owner");
+    delete body;
+
+    DavLock lock;
+    DavLockTable::Result result = locks_.lock(path, exclusive, infinite, timeout, owner, &lock);
+    if (result == DavLockTable::LOCK_CONFLICT) {
+      send_webdav_response(request, 423, "text/plain", "Locked");
+      return;
+    }
+    if (result == DavLockTable::LOCK_FULL) {
+      send_webdav_response(request, 503, "text/plain", "Too Many Locks");
+      return;
+    }
+
+    // Verrouiller un chemin inexistant crée une ressource vide (RFC 4918, 9.10.4)
+    std::string full_path = resolve_sd_path(path);
+    struct stat path_stat;
+    bool created = false;
+    auto card_lock = sd_mmc_card_->lock_write(path.c_str());
+    if (sd_mmc_card_->is_mounted() && stat(full_path.c_str(), &path_stat) != 0) {
+      FILE* file = sd_mmc_card_->get_file_cipher()->open(path, full_path, "wb");
+      if (file) {
+        fclose(file);
+        created = true;
+        sd_mmc_card_->notify_file_event(sd_mmc_card::FILE_CREATED, path);
+      }
+    }
+    ESP_LOGD(TAG, "Locked %s (%s, %us)", path.c_str(), exclusive ? "exclusive" : "shared", lock.timeout_s);
+    send_lock_response(request, created ? 201 : 200, lock);
+  });
+}
+
+void WebDavServer::handle_unlock(AsyncWebServerRequest* request) {
+  if (!authenticate_request(request)) {
+    return;
+  }
+
+  std::string path = DavLockTable::normalize(request->url());
+  if (!request->hasHeader("Lock-Token")) {
+    send_webdav_response(request, 400, "text/plain", "Missing Lock-Token");
+    return;
+  }
+  std::string token = request->header("Lock-Token").c_str();
+  if (!token.empty() && token.front() == '<') {
+    token = token.substr(1, token.find('>') - 1);
+  }
+
+  if (!locks_.unlock(path, token)) {
+    send_webdav_response(request, 409, "text/plain", "Lock Token Does Not Match");
+    return;
+  }
+  ESP_LOGD(TAG, "Unlocked %s", path.c_str());
+  send_webdav_response(request, 204, "text/plain", "");
+}
+
+void WebDavServer::send_lock_response(AsyncWebServerRequest* request, int status_code, const DavLock& lock) {
+  std::string xml_response =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<D:prop xmlns:D=\"DAV:\">\n"
+    "  <D:lockdiscovery>" + active_lock_xml(lock) + "</D:lockdiscovery>\n"
+    "</D:prop>";
+  AsyncWebServerResponse* response = request->beginResponse(status_code, "application/xml", xml_response.c_str());
+  response->addHeader("Lock-Token", ("<" + lock.token + ">").c_str());
+  request->send(response);
+}
+
+bool WebDavServer::check_lock(AsyncWebServerRequest* request, const std::string& path, bool subtree) {
+  std::vector<std::string> tokens;
+  if (request->hasHeader("If")) {
+    tokens = DavLockTable::parse_if_header(request->header("If").c_str());
+  }
+  if (locks_.is_allowed(DavLockTable::normalize(path), tokens, subtree)) {
+    return true;
+  }
+  send_webdav_response(request, 423, "text/plain", "Locked");
+  return false;
+}
+
+bool WebDavServer::check_mounted(AsyncWebServerRequest* request) {
+  if (sd_mmc_card_->is_mounted()) {
+    return true;
+  }
+  send_webdav_response(request, 503, "text/plain", "Card Not Ready");
+  return false;
+}
+
+std::string WebDavServer::propfind_entry(const std::string& href, const struct stat& path_stat) {
+  return
+    "  <D:response>\n"
+    "    <D:href>" + href + "</D:href>\n"
+    "    <D:propstat>\n"
+    "      <D:prop>\n"
+    "        <D:resourcetype>" + 
+    (S_ISDIR(path_stat.st_mode) ? "<D:collection/>" : "") + 
+    "</D:resourcetype>\n"
+    "        <D:getcontentlength>" +
+    std::to_string(sd_mmc_card_->get_file_cipher()->plain_size(href.c_str(), path_stat.st_size)) +
+    "</D:getcontentlength>\n" +
+    lock_properties(href) +
+    "      </D:prop>\n"
+    "      <D:status>HTTP/1.1 200 OK</D:status>\n"
+    "    </D:propstat>\n"
+    "  </D:response>\n";
+}
+
+std::string WebDavServer::lock_properties(const std::string& path) {
+  std::string xml =
+    "        <D:supportedlock>\n"
+    "          <D:lockentry><D:lockscope><D:exclusive/></D:lockscope><D:locktype><D:write/></D:locktype></D:lockentry>\n"
+    "          <D:lockentry><D:lockscope><D:shared/></D:lockscope><D:locktype><D:write/></D:locktype></D:lockentry>\n"
+    "        </D:supportedlock>\n"
+    "        <D:lockdiscovery>";
+  for (const DavLock& lock : locks_.locks_on(DavLockTable::normalize(path))) {
+    xml += active_lock_xml(lock);
+  }
+  xml += "</D:lockdiscovery>\n";
+  return xml;
+}
+
 } // namespace webdavbox
 } // namespace esphome
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <sys/stat.h>
+
+#include "esphome/core/component.h"
+#include "esphome/core/log.h"
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+#include "dav_lock_table.h"
+#include "directory_index.h"
+
+namespace esphome {
+namespace webdavbox {
+
+/* WebDAV access to the card (PROPFIND, GET, PUT, DELETE, MKCOL, MOVE), with class 2 locking (LOCK, UNLOCK) so
+ * that Finder and Explorer write in place.
+ * Downloads and uploads are bulk transfers of the card I/O scheduler, keyed by the client address. Every handler
+ * holds the card lock of its path (shared for reads, exclusive for writes) until its transfer ends, like the
+ * file operations of SdMmc, so they are serialized with them and the card isn't unmounted under a transfer.
+ * GET on a directory answers a page of its sorted listing, in HTML or JSON. */
+class WebDavServer : public Component {
+ public:
+  void setup() override;
+  void loop() override;
+  float get_setup_priority() const override { return setup_priority::WIFI - 1.0f; }
+
+  void set_web_server_base(web_server_base::WebServerBase *base) { this->base_ = base; }
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+  void set_mount_point(std::string const &mount_point) { this->sd_mount_point_ = mount_point; }
+  void set_username(std::string const &username) { this->username_ = username; }
+  void set_password(std::string const &password) { this->password_ = password; }
+
+ protected:
+  void register_webdav_handlers();
+  bool authenticate_request(AsyncWebServerRequest *request);
+  std::string resolve_sd_path(const std::string &request_path);
+  void send_webdav_response(AsyncWebServerRequest *request, int status_code, const std::string &content_type,
+                            const std::string &body);
+
+  void handle_propfind(AsyncWebServerRequest *request);
+  void handle_get(AsyncWebServerRequest *request);
+  /* GET on a directory: ?offset=&limit=&sort=name|size|mtime&order=asc|desc, JSON with ?format=json */
+  void handle_index(AsyncWebServerRequest *request, const std::string &path);
+  /* GET ?follow=1: stream the bytes appended to path from now on */
+  void handle_follow(AsyncWebServerRequest *request, const std::string &path);
+  void handle_put(AsyncWebServerRequest *request);
+  void handle_delete(AsyncWebServerRequest *request);
+  void handle_mkcol(AsyncWebServerRequest *request);
+  void handle_move(AsyncWebServerRequest *request);
+  void handle_options(AsyncWebServerRequest *request);
+  void handle_lock(AsyncWebServerRequest *request);
+  void handle_unlock(AsyncWebServerRequest *request);
+  void send_lock_response(AsyncWebServerRequest *request, int status_code, const DavLock &lock);
+  /* Answer 423 unless the If header holds the tokens of the locks on path (and below it with subtree) */
+  bool check_lock(AsyncWebServerRequest *request, const std::string &path, bool subtree);
+  /* Answer 503 unless the card is mounted, checked with a card lock held so that it stays mounted */
+  bool check_mounted(AsyncWebServerRequest *request);
+  std::string lock_properties(const std::string &path);
+  std::string propfind_entry(const std::string &href, const struct stat &path_stat);
+
+  web_server_base::WebServerBase *base_{nullptr};
+  sd_mmc_card::SdMmc *sd_mmc_card_{nullptr};
+  std::string sd_mount_point_{"/sdcard"};
+  std::string username_;
+  std::string password_;
+  DavLockTable locks_;
+  DirectoryIndex index_;
+};
+
+}  // namespace webdavbox
+}  // namespace esphome
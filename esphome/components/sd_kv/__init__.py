@@ -0,0 +1,93 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.const import (
+    CONF_ID,
+    CONF_KEY,
+    CONF_PATH,
+    CONF_VALUE,
+)
+from .. import sd_mmc_card
+
+DEPENDENCIES = ["sd_mmc_card"]
+
+CONF_SEGMENT_SIZE = "segment_size"
+
+sd_kv_ns = cg.esphome_ns.namespace("sd_kv")
+SdKv = sd_kv_ns.class_("SdKv", cg.PollingComponent)
+
+# Action
+SdKvPutAction = sd_kv_ns.class_("SdKvPutAction", automation.Action)
+SdKvDeleteAction = sd_kv_ns.class_("SdKvDeleteAction", automation.Action)
+
+# Condition
+SdKvContainsCondition = sd_kv_ns.class_("SdKvContainsCondition", automation.Condition)
+
+
+def validate_path(value):
+    value = cv.string_strict(value)
+    if not value.startswith("/") or value.endswith("/"):
+        raise cv.Invalid("path must be absolute, without trailing slash")
+    return value
+
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(SdKv),
+        cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+        cv.Optional(CONF_PATH, default="/kv"): validate_path,
+        cv.Optional(CONF_SEGMENT_SIZE, default=256 * 1024): cv.int_range(min=4 * 1024),
+    }
+).extend(cv.polling_component_schema("10s"))
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    cg.add(var.set_path(config[CONF_PATH]))
+    cg.add(var.set_segment_size(config[CONF_SEGMENT_SIZE]))
+
+
+SD_KV_KEY_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(SdKv),
+        cv.Required(CONF_KEY): cv.templatable(cv.string_strict),
+    }
+)
+
+SD_KV_PUT_ACTION_SCHEMA = SD_KV_KEY_SCHEMA.extend(
+    {
+        cv.Required(CONF_VALUE): cv.templatable(cv.string),
+    }
+)
+
+
+@automation.register_action("sd_kv.put", SdKvPutAction, SD_KV_PUT_ACTION_SCHEMA)
+async def sd_kv_put_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    key_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    value_ = await cg.templatable(config[CONF_VALUE], args, cg.std_string)
+    cg.add(var.set_key(key_))
+    cg.add(var.set_value(value_))
+    return var
+
+
+@automation.register_action("sd_kv.delete", SdKvDeleteAction, SD_KV_KEY_SCHEMA)
+async def sd_kv_delete_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    key_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    cg.add(var.set_key(key_))
+    return var
+
+
+@automation.register_condition("sd_kv.contains", SdKvContainsCondition, SD_KV_KEY_SCHEMA)
+async def sd_kv_contains_to_code(config, condition_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(condition_id, template_arg, parent)
+    key_ = await cg.templatable(config[CONF_KEY], args, cg.std_string)
+    cg.add(var.set_key(key_))
+    return var
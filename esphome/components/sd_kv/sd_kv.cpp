@@ -0,0 +1,495 @@
+#include "sd_kv.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_kv {
+
+static const char *TAG = "sd_kv";
+
+static const uint8_t RECORD_MAGIC = 0xA5;
+static const uint8_t FLAG_TOMBSTONE = 0x01;
+static const size_t MAX_KEY_LENGTH = 255;
+static const size_t INITIAL_CAPACITY = 1024;
+// compaction runs from loop() in slices this long, puts and gets are served in between
+static const uint32_t COMPACT_SLICE_MS = 4;
+// hash values 0 and 1 mark empty and deleted slots
+static const uint64_t SLOT_EMPTY = 0;
+static const uint64_t SLOT_DELETED = 1;
+
+struct RecordHeader {
+  uint32_t crc;
+  uint8_t magic;
+  uint8_t flags;
+  uint8_t key_length;
+  uint8_t reserved;
+  uint32_t value_length;
+};
+
+static uint64_t hash_key(const std::string &key) {
+  // 64 bits FNV-1a, wide enough to tell keys apart without reading them back from the card
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash > SLOT_DELETED ? hash : hash + 2;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+void SdKv::setup() {
+  ExternalRAMAllocator<IndexEntry> allocator(ExternalRAMAllocator<IndexEntry>::ALLOW_FAILURE);
+  this->table_ = allocator.allocate(INITIAL_CAPACITY);
+  if (this->table_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate the index");
+    this->mark_failed();
+    return;
+  }
+  this->capacity_ = INITIAL_CAPACITY;
+  memset(this->table_, 0, this->capacity_ * sizeof(IndexEntry));
+}
+
+void SdKv::loop() {
+  // the store follows the card, it is loaded once mounted and dropped when the card goes away
+  if (!this->sd_mmc_card_->is_mounted()) {
+    if (this->loaded_)
+      this->unload();
+    this->load_failed_ = false;
+    return;
+  }
+  if (!this->loaded_ && !this->load_failed_) {
+    this->loaded_ = this->load();
+    if (!this->loaded_) {
+      ESP_LOGE(TAG, "Failed to load the store from %s", this->path_.c_str());
+      this->unload();
+      this->load_failed_ = true;
+    }
+  }
+  if (this->compacting_ != 0)
+    this->compact_step();
+}
+
+void SdKv::update() {
+  if (!this->loaded_)
+    return;
+  this->sync();
+  if (this->compacting_ == 0)
+    this->start_compaction();
+}
+
+void SdKv::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Key-Value store");
+  ESP_LOGCONFIG(TAG, "  Path: %s", this->path_.c_str());
+  ESP_LOGCONFIG(TAG, "  Segment size: %s", sd_mmc_card::format_size(this->segment_size_).c_str());
+  if (this->loaded_) {
+    ESP_LOGCONFIG(TAG, "  Keys: %u", this->count_);
+    ESP_LOGCONFIG(TAG, "  Segments: %u", this->segments_.size());
+  }
+}
+
+bool SdKv::put(const std::string &key, const uint8_t *data, size_t len) {
+  if (!this->loaded_ || key.empty() || key.size() > MAX_KEY_LENGTH || len > this->segment_size_)
+    return false;
+  // checked before the append, a record the index can't hold would still come back at the next load
+  if (!this->has_room(hash_key(key))) {
+    ESP_LOGE(TAG, "Index full (%u keys), %s not stored", this->count_, key.c_str());
+    return false;
+  }
+  IndexEntry entry;
+  if (!this->append_record(key, data, len, false, &entry))
+    return false;
+  this->insert(entry);
+  return true;
+}
+
+bool SdKv::put(const std::string &key, const std::string &value) {
+  return this->put(key, reinterpret_cast<const uint8_t *>(value.data()), value.size());
+}
+
+bool SdKv::get(const std::string &key, std::vector<uint8_t> &value) {
+  if (!this->loaded_)
+    return false;
+  int32_t slot = this->find(hash_key(key));
+  if (slot < 0)
+    return false;
+  std::vector<uint8_t> record;
+  if (!this->read_record(this->table_[slot], record))
+    return false;
+  RecordHeader header;
+  memcpy(&header, record.data(), sizeof(header));
+  if (key.compare(0, std::string::npos, reinterpret_cast<const char *>(record.data() + sizeof(header)),
+                  header.key_length) != 0) {
+    ESP_LOGW(TAG, "Hash collision on %s", key.c_str());
+    return false;
+  }
+  const uint8_t *start = record.data() + sizeof(header) + header.key_length;
+  value.assign(start, start + header.value_length);
+  return true;
+}
+
+std::string SdKv::get(const std::string &key, const std::string &fallback) {
+  std::vector<uint8_t> value;
+  if (!this->get(key, value))
+    return fallback;
+  return std::string(value.begin(), value.end());
+}
+
+bool SdKv::remove(const std::string &key) {
+  if (!this->loaded_)
+    return false;
+  int32_t slot = this->find(hash_key(key));
+  if (slot < 0)
+    return false;
+  if (!this->append_record(key, nullptr, 0, true, nullptr))
+    return false;
+  this->erase_slot(slot);
+  return true;
+}
+
+bool SdKv::contains(const std::string &key) const { return this->loaded_ && this->find(hash_key(key)) >= 0; }
+
+bool SdKv::load() {
+  if (!this->sd_mmc_card_->is_directory(this->path_) && !this->sd_mmc_card_->create_directory(this->path_.c_str()))
+    return false;
+
+  for (auto &info : this->sd_mmc_card_->list_directory_file_info(this->path_, 0)) {
+    if (info.is_directory)
+      continue;
+    std::string name = info.path.substr(info.path.rfind('/') + 1);
+    uint32_t id;
+    char suffix[8];
+    if (sscanf(name.c_str(), "%8x.%7s", &id, suffix) == 2 && strcmp(suffix, "seg") == 0)
+      this->segments_.push_back(Segment{id, 0, 0});
+  }
+  std::sort(this->segments_.begin(), this->segments_.end(),
+            [](const Segment &a, const Segment &b) { return a.id < b.id; });
+
+  bool torn = false;
+  for (auto &segment : this->segments_)
+    torn = !this->scan_segment(segment);
+  // appending after a torn record would hide everything written later, start a new segment instead
+  bool ok = this->open_active(this->segments_.empty() || torn);
+  ESP_LOGI(TAG, "Loaded %u keys from %u segments", this->count_, this->segments_.size());
+  return ok;
+}
+
+void SdKv::unload() {
+  if (this->compact_file_ != nullptr)
+    fclose(this->compact_file_);
+  this->compact_file_ = nullptr;
+  this->compacting_ = 0;
+  if (this->active_ != nullptr)
+    fclose(this->active_);
+  this->active_ = nullptr;
+  this->unsynced_ = false;
+  this->segments_.clear();
+  if (this->table_ != nullptr)
+    memset(this->table_, 0, this->capacity_ * sizeof(IndexEntry));
+  this->count_ = 0;
+  this->used_slots_ = 0;
+  this->loaded_ = false;
+}
+
+bool SdKv::scan_segment(Segment &segment) {
+  FILE *file = this->sd_mmc_card_->open_file(this->segment_path(segment.id).c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  std::vector<uint8_t> buffer;
+  RecordHeader header;
+  uint32_t offset = 0;
+  bool complete = true;
+  size_t got;
+  while ((got = fread(&header, 1, sizeof(header), file)) == sizeof(header)) {
+    size_t body = header.key_length + header.value_length;
+    if (header.magic != RECORD_MAGIC || header.key_length == 0 || body > this->segment_size_) {
+      complete = false;
+      break;
+    }
+    buffer.resize(sizeof(header) + body);
+    memcpy(buffer.data(), &header, sizeof(header));
+    if (fread(buffer.data() + sizeof(header), 1, body, file) != body ||
+        crc32(0, buffer.data() + sizeof(uint32_t), buffer.size() - sizeof(uint32_t)) != header.crc) {
+      complete = false;
+      break;
+    }
+
+    std::string key(reinterpret_cast<const char *>(buffer.data() + sizeof(header)), header.key_length);
+    int32_t slot = this->find(hash_key(key));
+    if (header.flags & FLAG_TOMBSTONE) {
+      if (slot >= 0)
+        this->erase_slot(slot);
+    } else if (!this->insert(IndexEntry{hash_key(key), segment.id, offset, static_cast<uint32_t>(buffer.size())})) {
+      ESP_LOGE(TAG, "Index full (%u keys), %s dropped", this->count_, key.c_str());
+    }
+    offset += buffer.size();
+  }
+  if (got != 0 && got != sizeof(header))
+    complete = false;
+  if (!complete)
+    ESP_LOGW(TAG, "Segment %08x is truncated at %u", segment.id, offset);
+  segment.size = offset;
+  fclose(file);
+  return complete;
+}
+
+bool SdKv::open_active(bool create) {
+  if (this->active_ != nullptr)
+    fclose(this->active_);
+  if (create) {
+    uint32_t id = this->segments_.empty() ? 1 : this->segments_.back().id + 1;
+    this->segments_.push_back(Segment{id, 0, 0});
+  }
+  this->active_ = this->sd_mmc_card_->open_file(this->segment_path(this->segments_.back().id).c_str(), "ab");
+  return this->active_ != nullptr;
+}
+
+bool SdKv::append_record(const std::string &key, const uint8_t *data, size_t len, bool tombstone,
+                         IndexEntry *entry) {
+  if (this->active_ == nullptr)
+    return false;
+  if (this->segments_.back().size >= this->segment_size_) {
+    this->sync();
+    if (!this->open_active(true))
+      return false;
+  }
+
+  RecordHeader header{0, RECORD_MAGIC, static_cast<uint8_t>(tombstone ? FLAG_TOMBSTONE : 0),
+                      static_cast<uint8_t>(key.size()), 0, static_cast<uint32_t>(len)};
+  uint32_t crc = crc32(0, reinterpret_cast<const uint8_t *>(&header) + sizeof(uint32_t),
+                       sizeof(header) - sizeof(uint32_t));
+  crc = crc32(crc, reinterpret_cast<const uint8_t *>(key.data()), key.size());
+  header.crc = crc32(crc, data, len);
+
+  Segment &segment = this->segments_.back();
+  bool ok = fwrite(&header, 1, sizeof(header), this->active_) == sizeof(header) &&
+            fwrite(key.data(), 1, key.size(), this->active_) == key.size() &&
+            (len == 0 || fwrite(data, 1, len, this->active_) == len) && fflush(this->active_) == 0;
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to append to segment %08x", segment.id);
+    return false;
+  }
+  // a handle the card keeps for a reader of the segment would report the old size
+  this->sd_mmc_card_->close_handles(this->segment_path(segment.id).c_str());
+  uint32_t length = sizeof(header) + key.size() + len;
+  if (entry != nullptr)
+    *entry = IndexEntry{hash_key(key), segment.id, segment.size, length};
+  segment.size += length;
+  this->unsynced_ = true;
+  return true;
+}
+
+bool SdKv::read_record(const IndexEntry &entry, std::vector<uint8_t> &record) {
+  // the active segment may still hold the record in its stdio buffer
+  if (this->active_ != nullptr && entry.segment == this->segments_.back().id)
+    fflush(this->active_);
+  FILE *file = this->sd_mmc_card_->open_file(this->segment_path(entry.segment).c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  record.resize(entry.length);
+  bool ok = fseek(file, entry.offset, SEEK_SET) == 0 && fread(record.data(), 1, entry.length, file) == entry.length;
+  fclose(file);
+  if (!ok)
+    ESP_LOGE(TAG, "Failed to read record at %08x:%u", entry.segment, entry.offset);
+  return ok;
+}
+
+bool SdKv::start_compaction() {
+  // the segment with the most outdated bytes, once at least half of it is; never the active one, still growing
+  const Segment *victim = nullptr;
+  for (size_t i = 0; i + 1 < this->segments_.size(); i++) {
+    const Segment &segment = this->segments_[i];
+    if (segment.live * 2 > segment.size)
+      continue;
+    if (victim == nullptr || segment.size - segment.live > victim->size - victim->live)
+      victim = &segment;
+  }
+  if (victim == nullptr)
+    return false;
+  this->compact_file_ = this->sd_mmc_card_->open_file(this->segment_path(victim->id).c_str(), "rb");
+  if (this->compact_file_ == nullptr)
+    return false;
+  ESP_LOGV(TAG, "Compacting segment %08x, %u of %u bytes outdated", victim->id, victim->size - victim->live,
+           victim->size);
+  this->compacting_ = victim->id;
+  this->compact_offset_ = 0;
+  this->compact_moved_ = 0;
+  return true;
+}
+
+void SdKv::compact_step() {
+  // tombstones only matter while an older segment may still hold the value they delete
+  const bool oldest = this->segments_.front().id == this->compacting_;
+  const uint32_t start = millis();
+  std::vector<uint8_t> record;
+  RecordHeader header;
+  while (millis() - start < COMPACT_SLICE_MS) {
+    size_t got = fread(&header, 1, sizeof(header), this->compact_file_);
+    size_t body = header.key_length + header.value_length;
+    // the end, or a torn record that load() stopped at too: nothing after it is indexed
+    if (got != sizeof(header) || header.magic != RECORD_MAGIC || header.key_length == 0 || body > this->segment_size_) {
+      this->finish_compaction(!ferror(this->compact_file_));
+      return;
+    }
+    record.resize(sizeof(header) + body);
+    memcpy(record.data(), &header, sizeof(header));
+    if (fread(record.data() + sizeof(header), 1, body, this->compact_file_) != body) {
+      this->finish_compaction(!ferror(this->compact_file_));
+      return;
+    }
+    const uint32_t offset = this->compact_offset_;
+    this->compact_offset_ += record.size();
+
+    std::string key(reinterpret_cast<const char *>(record.data() + sizeof(header)), header.key_length);
+    int32_t slot = this->find(hash_key(key));
+    const bool tombstone = header.flags & FLAG_TOMBSTONE;
+    // a value is moved if it is still the newest one, a tombstone if its key wasn't written again since
+    const bool keep = tombstone ? !oldest && slot < 0
+                                : slot >= 0 && this->table_[slot].segment == this->compacting_ &&
+                                      this->table_[slot].offset == offset;
+    if (!keep)
+      continue;
+    IndexEntry moved;
+    if (!this->append_record(key, record.data() + sizeof(header) + header.key_length, header.value_length, tombstone,
+                             tombstone ? nullptr : &moved)) {
+      this->finish_compaction(false);
+      return;
+    }
+    if (!tombstone)
+      this->insert(moved);
+    this->compact_moved_++;
+  }
+}
+
+void SdKv::finish_compaction(bool done) {
+  fclose(this->compact_file_);
+  this->compact_file_ = nullptr;
+  const uint32_t id = this->compacting_;
+  this->compacting_ = 0;
+  if (!done) {
+    ESP_LOGE(TAG, "Failed to compact segment %08x, retried later", id);
+    return;
+  }
+  // the copies must be on the card before the only other version goes away
+  this->sync();
+  auto it = std::find_if(this->segments_.begin(), this->segments_.end(),
+                         [id](const Segment &segment) { return segment.id == id; });
+  const uint32_t size = it->size;
+  this->sd_mmc_card_->delete_file(this->segment_path(id));
+  this->segments_.erase(it);
+  ESP_LOGD(TAG, "Compacted segment %08x, %u records moved, %u bytes reclaimed", id, this->compact_moved_, size);
+}
+
+void SdKv::sync() {
+  if (!this->unsynced_ || this->active_ == nullptr)
+    return;
+  fflush(this->active_);
+  fsync(fileno(this->active_));
+  this->unsynced_ = false;
+}
+
+int32_t SdKv::find(uint64_t hash) const {
+  size_t mask = this->capacity_ - 1;
+  for (size_t i = hash & mask, probes = 0; probes < this->capacity_; i = (i + 1) & mask, probes++) {
+    if (this->table_[i].hash == SLOT_EMPTY)
+      return -1;
+    if (this->table_[i].hash == hash)
+      return i;
+  }
+  return -1;
+}
+
+bool SdKv::has_room(uint64_t hash) {
+  return this->find(hash) >= 0 || this->count_ < this->capacity_ || this->grow();
+}
+
+bool SdKv::insert(const IndexEntry &entry) {
+  int32_t slot = this->find(entry.hash);
+  if (slot >= 0) {
+    // the previous version of the value becomes garbage in its segment
+    Segment *previous = this->find_segment(this->table_[slot].segment);
+    if (previous != nullptr)
+      previous->live -= this->table_[slot].length;
+  } else {
+    if ((this->used_slots_ + 1) * 4 > this->capacity_ * 3 && !this->grow())
+      ESP_LOGW(TAG, "Index is getting full (%u keys)", this->count_);
+    // without a free slot the probe below would never end
+    if (this->count_ >= this->capacity_)
+      return false;
+    size_t mask = this->capacity_ - 1;
+    slot = entry.hash & mask;
+    while (this->table_[slot].hash > SLOT_DELETED)
+      slot = (slot + 1) & mask;
+    if (this->table_[slot].hash == SLOT_EMPTY)
+      this->used_slots_++;
+    this->count_++;
+  }
+  this->table_[slot] = entry;
+  Segment *segment = this->find_segment(entry.segment);
+  if (segment != nullptr)
+    segment->live += entry.length;
+  return true;
+}
+
+void SdKv::erase_slot(int32_t slot) {
+  Segment *segment = this->find_segment(this->table_[slot].segment);
+  if (segment != nullptr)
+    segment->live -= this->table_[slot].length;
+  this->table_[slot].hash = SLOT_DELETED;
+  this->count_--;
+}
+
+bool SdKv::grow() {
+  ExternalRAMAllocator<IndexEntry> allocator(ExternalRAMAllocator<IndexEntry>::ALLOW_FAILURE);
+  size_t capacity = this->capacity_ * 2;
+  IndexEntry *table = allocator.allocate(capacity);
+  if (table == nullptr)
+    return false;
+  memset(table, 0, capacity * sizeof(IndexEntry));
+  for (size_t i = 0; i < this->capacity_; i++) {
+    if (this->table_[i].hash <= SLOT_DELETED)
+      continue;
+    size_t slot = this->table_[i].hash & (capacity - 1);
+    while (table[slot].hash != SLOT_EMPTY)
+      slot = (slot + 1) & (capacity - 1);
+    table[slot] = this->table_[i];
+  }
+  allocator.deallocate(this->table_, this->capacity_);
+  this->table_ = table;
+  this->capacity_ = capacity;
+  this->used_slots_ = this->count_;
+  return true;
+}
+
+SdKv::Segment *SdKv::find_segment(uint32_t id) {
+  for (auto &segment : this->segments_) {
+    if (segment.id == id)
+      return &segment;
+  }
+  return nullptr;
+}
+
+std::string SdKv::segment_path(uint32_t id) const { return this->path_ + str_sprintf("/%08x.seg", id); }
+
+void SdKv::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdKv::set_path(std::string const &path) { this->path_ = path; }
+
+void SdKv::set_segment_size(size_t size) { this->segment_size_ = size; }
+
+}  // namespace sd_kv
+}  // namespace esphome
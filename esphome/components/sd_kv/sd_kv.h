@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "esphome/core/automation.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_kv {
+
+/* Key-value store kept as append-only segment files on the card.
+ * Every put or delete appends a CRC protected record to the active segment; an open addressing hash table in
+ * PSRAM maps each key hash to its newest record. The segment with the most outdated bytes is compacted from
+ * loop(), a slice at a time, by copying its live records to the active segment. Its tombstones are copied too
+ * while an older segment may still hold the value they delete. */
+class SdKv : public PollingComponent {
+ public:
+  void setup() override;
+  void loop() override;
+  void update() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  bool put(const std::string &key, const uint8_t *data, size_t len);
+  bool put(const std::string &key, const std::string &value);
+  bool get(const std::string &key, std::vector<uint8_t> &value);
+  std::string get(const std::string &key, const std::string &fallback = "");
+  bool remove(const std::string &key);
+  bool contains(const std::string &key) const;
+  /* Store loaded from the card and usable */
+  bool is_ready() const { return this->loaded_; }
+  size_t size() const { return this->count_; }
+
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_path(std::string const &);
+  void set_segment_size(size_t);
+
+ protected:
+  struct IndexEntry {
+    uint64_t hash;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t length;
+  };
+  struct Segment {
+    uint32_t id;
+    uint32_t size;
+    uint32_t live;
+  };
+
+  bool load();
+  void unload();
+  bool scan_segment(Segment &segment);
+  bool open_active(bool create);
+  bool append_record(const std::string &key, const uint8_t *data, size_t len, bool tombstone, IndexEntry *entry);
+  bool read_record(const IndexEntry &entry, std::vector<uint8_t> &record);
+  /* Pick the segment to compact, false if none is worth it */
+  bool start_compaction();
+  /* Move the records of the segment being compacted for one slice */
+  void compact_step();
+  /* Delete the compacted segment once done, keep it when the compaction failed */
+  void finish_compaction(bool done);
+  void sync();
+
+  int32_t find(uint64_t hash) const;
+  /* True if hash is already indexed or a slot is free for it, growing the table if needed */
+  bool has_room(uint64_t hash);
+  /* False when the table is full and can't grow */
+  bool insert(const IndexEntry &entry);
+  void erase_slot(int32_t slot);
+  bool grow();
+  Segment *find_segment(uint32_t id);
+  std::string segment_path(uint32_t id) const;
+
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  std::string path_;
+  size_t segment_size_;
+  bool loaded_{false};
+  bool load_failed_{false};
+
+  // hash index, allocated in PSRAM when available
+  IndexEntry *table_{nullptr};
+  size_t capacity_{0};
+  size_t count_{0};
+  size_t used_slots_{0};
+
+  std::vector<Segment> segments_;
+  FILE *active_{nullptr};
+  bool unsynced_{false};
+
+  // segment being compacted, 0 when none, read sequentially
+  uint32_t compacting_{0};
+  FILE *compact_file_{nullptr};
+  uint32_t compact_offset_{0};
+  uint32_t compact_moved_{0};
+};
+
+template<typename... Ts> class SdKvPutAction : public Action<Ts...> {
+ public:
+  SdKvPutAction(SdKv *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, key)
+  TEMPLATABLE_VALUE(std::string, value)
+
+  void play(Ts... x) {
+    auto key = this->key_.value(x...);
+    auto value = this->value_.value(x...);
+    this->parent_->put(key, value);
+  }
+
+ protected:
+  SdKv *parent_;
+};
+
+template<typename... Ts> class SdKvDeleteAction : public Action<Ts...> {
+ public:
+  SdKvDeleteAction(SdKv *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, key)
+
+  void play(Ts... x) {
+    auto key = this->key_.value(x...);
+    this->parent_->remove(key);
+  }
+
+ protected:
+  SdKv *parent_;
+};
+
+template<typename... Ts> class SdKvContainsCondition : public Condition<Ts...> {
+ public:
+  SdKvContainsCondition(SdKv *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, key)
+
+  bool check(Ts... x) override { return this->parent_->contains(this->key_.value(x...)); }
+
+ protected:
+  SdKv *parent_;
+};
+
+}  // namespace sd_kv
+}  // namespace esphome
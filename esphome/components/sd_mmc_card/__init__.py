@@ -6,10 +6,18 @@ from esphome.const import (
     CONF_DATA,
     CONF_PATH,
     CONF_CLK_PIN,
+    CONF_CS_PIN,
+    CONF_MISO_PIN,
+    CONF_MOSI_PIN,
     CONF_INPUT,
     CONF_OUTPUT,
     CONF_PULLUP,
     CONF_PULLDOWN,
+    CONF_MODE,
+    CONF_NAME,
+    CONF_TRIGGER_ID,
+    CONF_SIZE,
+    CONF_KEY,
 )
 from esphome.core import CORE
 
@@ -21,16 +29,121 @@ CONF_DATA2_PIN = "data2_pin"
 CONF_DATA3_PIN = "data3_pin"
 CONF_MODE_1BIT = "mode_1bit"
 CONF_POWER_CTRL_PIN = "power_ctrl_pin"
+CONF_MAX_FREQUENCY = "max_frequency"
+CONF_CARD_DETECT_PIN = "card_detect_pin"
+CONF_MOUNT_RETRY_INTERVAL = "mount_retry_interval"
+CONF_AUTO_TUNE = "auto_tune"
+CONF_TRIM_MODE = "trim_mode"
+CONF_RAW_LOG = "raw_log"
+CONF_SIZE_MB = "size_mb"
+CONF_BATCH_SIZE = "batch_size"
+CONF_ROTATING_LOGS = "rotating_logs"
+CONF_MAX_SIZE = "max_size"
+CONF_MAX_AGE = "max_age"
+CONF_KEEP = "keep"
+CONF_MAX_TOTAL_SIZE = "max_total_size"
+CONF_SHARDED_DIRECTORIES = "sharded_directories"
+CONF_LEVELS = "levels"
+CONF_FAN_OUT = "fan_out"
+CONF_TIMESTAMP = "timestamp"
+CONF_IO_SCHEDULER = "io_scheduler"
+CONF_QUANTUM = "quantum"
+CONF_CLIENT_RATE_LIMIT = "client_rate_limit"
+CONF_CLIENTS = "clients"
+CONF_CLIENT = "client"
+CONF_RATE_LIMIT = "rate_limit"
+CONF_WEIGHTS = "weights"
+CONF_GET = "get"
+CONF_PUT = "put"
+CONF_INTERNAL = "internal"
+CONF_PATTERN = "pattern"
+CONF_FILE_CACHE = "file_cache"
+CONF_MAX_FILE_SIZE = "max_file_size"
+CONF_MAX_OPEN_FILES = "max_open_files"
+CONF_HANDLE_CACHE = "handle_cache"
+CONF_ATOMIC_WRITE = "atomic_write"
+CONF_COMMIT_INTERVAL = "commit_interval"
+CONF_COMMIT_BYTES = "commit_bytes"
+CONF_ON_FILE_CREATED = "on_file_created"
+CONF_ON_FILE_MODIFIED = "on_file_modified"
+CONF_ON_FILE_DELETED = "on_file_deleted"
+CONF_ON_BATCH_PROGRESS = "on_batch_progress"
+CONF_ON_BATCH_FINISHED = "on_batch_finished"
+CONF_ON_BATCH_CANCELLED = "on_batch_cancelled"
+CONF_PATHS = "paths"
+CONF_DESTINATION = "destination"
+CONF_ENCRYPTION = "encryption"
+CONF_SHA256 = "sha256"
+CONF_REBOOT = "reboot"
+CONF_ON_OTA_PROGRESS = "on_ota_progress"
+CONF_ON_OTA_FINISHED = "on_ota_finished"
+CONF_ON_OTA_FAILED = "on_ota_failed"
 
 sd_mmc_card_component_ns = cg.esphome_ns.namespace("sd_mmc_card")
 SdMmc = sd_mmc_card_component_ns.class_("SdMmc", cg.Component)
+TrimMode = sd_mmc_card_component_ns.enum("TrimMode")
+RotatingLog = sd_mmc_card_component_ns.class_("RotatingLog")
+ShardedDirectory = sd_mmc_card_component_ns.class_("ShardedDirectory")
+ShardMode = sd_mmc_card_component_ns.enum("ShardMode")
+FileEvent = sd_mmc_card_component_ns.enum("FileEvent")
+IoRequest = sd_mmc_card_component_ns.enum("IoRequest")
+FileEventTrigger = sd_mmc_card_component_ns.class_(
+    "FileEventTrigger", automation.Trigger.template(cg.std_string)
+)
+BatchEvent = sd_mmc_card_component_ns.enum("BatchEvent")
+BatchTrigger = sd_mmc_card_component_ns.class_(
+    "BatchTrigger", automation.Trigger.template(cg.std_string, cg.uint32, cg.uint32)
+)
+OtaProgressTrigger = sd_mmc_card_component_ns.class_(
+    "OtaProgressTrigger", automation.Trigger.template(cg.float_)
+)
+OtaFinishedTrigger = sd_mmc_card_component_ns.class_("OtaFinishedTrigger", automation.Trigger.template())
+OtaFailedTrigger = sd_mmc_card_component_ns.class_(
+    "OtaFailedTrigger", automation.Trigger.template(cg.std_string)
+)
+
+FILE_EVENTS = {
+    CONF_ON_FILE_CREATED: FileEvent.FILE_CREATED,
+    CONF_ON_FILE_MODIFIED: FileEvent.FILE_MODIFIED,
+    CONF_ON_FILE_DELETED: FileEvent.FILE_DELETED,
+}
+
+BATCH_EVENTS = {
+    CONF_ON_BATCH_PROGRESS: BatchEvent.BATCH_PROGRESS,
+    CONF_ON_BATCH_FINISHED: BatchEvent.BATCH_FINISHED,
+    CONF_ON_BATCH_CANCELLED: BatchEvent.BATCH_CANCELLED,
+}
+
+SHARD_MODES = {
+    "HASH": ShardMode.SHARD_HASH,
+    "HOUR": ShardMode.SHARD_HOUR,
+    "DAY": ShardMode.SHARD_DAY,
+}
+
+TRIM_MODES = {
+    "NONE": TrimMode.TRIM_NONE,
+    "INLINE": TrimMode.TRIM_INLINE,
+    "IDLE": TrimMode.TRIM_IDLE,
+}
 
 # Action
 SdMmcWriteFileAction = sd_mmc_card_component_ns.class_("SdMmcWriteFileAction", automation.Action)
 SdMmcAppendFileAction = sd_mmc_card_component_ns.class_("SdMmcAppendFileAction", automation.Action)
+SdMmcWriteFileAtomicAction = sd_mmc_card_component_ns.class_("SdMmcWriteFileAtomicAction", automation.Action)
 SdMmcCreateDirectoryAction = sd_mmc_card_component_ns.class_("SdMmcCreateDirectoryAction", automation.Action)
 SdMmcRemoveDirectoryAction = sd_mmc_card_component_ns.class_("SdMmcRemoveDirectoryAction", automation.Action)
 SdMmcDeleteFileAction = sd_mmc_card_component_ns.class_("SdMmcDeleteFileAction", automation.Action)
+SdMmcDeleteRecursiveAction = sd_mmc_card_component_ns.class_("SdMmcDeleteRecursiveAction", automation.Action)
+SdMmcCreateDirectoriesAction = sd_mmc_card_component_ns.class_("SdMmcCreateDirectoriesAction", automation.Action)
+SdMmcDeletePathsAction = sd_mmc_card_component_ns.class_("SdMmcDeletePathsAction", automation.Action)
+SdMmcMovePathsAction = sd_mmc_card_component_ns.class_("SdMmcMovePathsAction", automation.Action)
+SdMmcCancelBatchAction = sd_mmc_card_component_ns.class_("SdMmcCancelBatchAction", automation.Action)
+SdMmcOtaUpdateAction = sd_mmc_card_component_ns.class_("SdMmcOtaUpdateAction", automation.Action)
+SdMmcAppendRawLogAction = sd_mmc_card_component_ns.class_("SdMmcAppendRawLogAction", automation.Action)
+SdMmcAppendRotatingLogAction = sd_mmc_card_component_ns.class_("SdMmcAppendRotatingLogAction", automation.Action)
+SdMmcRotateLogAction = sd_mmc_card_component_ns.class_("SdMmcRotateLogAction", automation.Action)
+SdMmcWriteShardedFileAction = sd_mmc_card_component_ns.class_("SdMmcWriteShardedFileAction", automation.Action)
+SdMmcDeleteShardedFileAction = sd_mmc_card_component_ns.class_("SdMmcDeleteShardedFileAction", automation.Action)
 
 def validate_raw_data(value):
     if isinstance(value, str):
@@ -41,23 +154,197 @@ def validate_raw_data(value):
         "data must either be a string wrapped in quotes or a list of bytes"
     )
 
-CONFIG_SCHEMA = cv.Schema(
+def validate_batch_size(value):
+    value = cv.int_range(min=4096, max=256 * 1024)(value)
+    if value % 512:
+        raise cv.Invalid("batch_size must be a multiple of 512")
+    return value
+
+def validate_rotating_log(config):
+    if CONF_MAX_SIZE not in config and CONF_MAX_AGE not in config:
+        raise cv.Invalid("at least one of max_size or max_age is required")
+    return config
+
+ROTATING_LOG_SCHEMA = cv.All(cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(RotatingLog),
+        cv.Required(CONF_PATH): cv.string_strict,
+        cv.Optional(CONF_MAX_SIZE): cv.int_range(min=512),
+        cv.Optional(CONF_MAX_AGE): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_KEEP, default=0): cv.int_range(min=0),
+        cv.Optional(CONF_MAX_TOTAL_SIZE, default=0): cv.int_range(min=0),
+    }
+), validate_rotating_log)
+
+SHARDED_DIRECTORY_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(ShardedDirectory),
+        cv.Required(CONF_PATH): cv.string_strict,
+        cv.Optional(CONF_MODE, default="HASH"): cv.enum(SHARD_MODES, upper=True),
+        cv.Optional(CONF_LEVELS, default=2): cv.int_range(min=1, max=3),
+        cv.Optional(CONF_FAN_OUT, default=64): cv.int_range(min=2, max=256),
+    }
+)
+
+IO_SCHEDULER_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_QUANTUM, default=16 * 1024): cv.int_range(min=512, max=256 * 1024),
+        cv.Optional(CONF_CLIENT_RATE_LIMIT, default=0): cv.int_range(min=0),
+        cv.Optional(CONF_WEIGHTS, default={}): cv.Schema(
+            {
+                cv.Optional(CONF_GET, default=1): cv.int_range(min=1, max=16),
+                cv.Optional(CONF_PUT, default=1): cv.int_range(min=1, max=16),
+                cv.Optional(CONF_INTERNAL, default=1): cv.int_range(min=1, max=16),
+            }
+        ),
+        cv.Optional(CONF_CLIENTS): cv.ensure_list(cv.Schema(
+            {
+                cv.Required(CONF_CLIENT): cv.string_strict,
+                cv.Required(CONF_RATE_LIMIT): cv.int_range(min=0),
+            }
+        )),
+    }
+)
+
+def validate_file_cache(config):
+    if config[CONF_MAX_FILE_SIZE] > config[CONF_SIZE]:
+        raise cv.Invalid("max_file_size can't exceed the cache size")
+    return config
+
+FILE_CACHE_SCHEMA = cv.All(cv.Schema(
+    {
+        cv.Required(CONF_SIZE): cv.int_range(min=4096),
+        cv.Optional(CONF_MAX_FILE_SIZE, default=64 * 1024): cv.int_range(min=512),
+    }
+), validate_file_cache)
+
+def validate_encryption_key(value):
+    value = cv.string_strict(value).replace(":", "").replace(" ", "")
+    try:
+        key = bytes.fromhex(value)
+    except ValueError as err:
+        raise cv.Invalid("key must be hexadecimal") from err
+    if len(key) != 32:
+        raise cv.Invalid("key must be 32 bytes (64 hexadecimal digits) for AES-256")
+    return list(key)
+
+ENCRYPTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_KEY): validate_encryption_key,
+        cv.Required(CONF_PATHS): cv.All(cv.ensure_list(cv.string_strict), cv.Length(min=1)),
+    }
+)
+
+ATOMIC_WRITE_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_COMMIT_INTERVAL, default="0ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_COMMIT_BYTES, default=0): cv.int_range(min=0),
+    }
+)
+
+def validate_bus(config):
+    if CONF_CS_PIN in config:
+        if not CORE.using_esp_idf:
+            raise cv.Invalid("SPI bus is only supported with the esp-idf framework")
+        for pin in (CONF_MOSI_PIN, CONF_MISO_PIN):
+            if pin not in config:
+                raise cv.Invalid(f"{pin} is required for the SPI bus")
+        for pin in (CONF_CMD_PIN, CONF_DATA0_PIN, CONF_DATA1_PIN, CONF_DATA2_PIN, CONF_DATA3_PIN):
+            if pin in config:
+                raise cv.Invalid(f"{pin} can't be used with the SPI bus")
+    else:
+        for pin in (CONF_CMD_PIN, CONF_DATA0_PIN):
+            if pin not in config:
+                raise cv.Invalid(f"{pin} is required for the SDMMC bus")
+        if not config[CONF_MODE_1BIT]:
+            for pin in (CONF_DATA1_PIN, CONF_DATA2_PIN, CONF_DATA3_PIN):
+                if pin not in config:
+                    raise cv.Invalid(f"{pin} is required in 4 bit mode")
+    if config[CONF_AUTO_TUNE] and not CORE.using_esp_idf:
+        raise cv.Invalid("auto_tune is only supported with the esp-idf framework")
+    if config[CONF_TRIM_MODE] != "NONE" and not CORE.using_esp_idf:
+        raise cv.Invalid("trim_mode is only supported with the esp-idf framework")
+    if CONF_RAW_LOG in config and not CORE.using_esp_idf:
+        raise cv.Invalid("raw_log is only supported with the esp-idf framework")
+    if (CONF_MAX_OPEN_FILES in config or config[CONF_HANDLE_CACHE] != 0) and not CORE.using_esp_idf:
+        raise cv.Invalid("max_open_files and handle_cache are only supported with the esp-idf framework")
+    if CONF_ENCRYPTION in config and not CORE.using_esp_idf:
+        raise cv.Invalid("encryption is only supported with the esp-idf framework")
+    if config[CONF_HANDLE_CACHE] >= config.get(CONF_MAX_OPEN_FILES, 5):
+        raise cv.Invalid("handle_cache must leave at least one of max_open_files for other files")
+    return config
+
+CONFIG_SCHEMA = cv.All(cv.Schema(
     {
         cv.GenerateID(): cv.declare_id(SdMmc),
         cv.Required(CONF_CLK_PIN): pins.internal_gpio_output_pin_number,
-        cv.Required(CONF_CMD_PIN): pins.internal_gpio_output_pin_number,
-        cv.Required(CONF_DATA0_PIN): pins.internal_gpio_pin_number({CONF_OUTPUT: True, CONF_INPUT: True}),
+        cv.Optional(CONF_CMD_PIN): pins.internal_gpio_output_pin_number,
+        cv.Optional(CONF_DATA0_PIN): pins.internal_gpio_pin_number({CONF_OUTPUT: True, CONF_INPUT: True}),
         cv.Optional(CONF_DATA1_PIN): pins.internal_gpio_pin_number({CONF_OUTPUT: True, CONF_INPUT: True}),
         cv.Optional(CONF_DATA2_PIN): pins.internal_gpio_pin_number({CONF_OUTPUT: True, CONF_INPUT: True}),
         cv.Optional(CONF_DATA3_PIN): pins.internal_gpio_pin_number({CONF_OUTPUT: True, CONF_INPUT: True}),
         cv.Optional(CONF_MODE_1BIT, default=False): cv.boolean,
+        cv.Optional(CONF_MOSI_PIN): pins.internal_gpio_output_pin_number,
+        cv.Optional(CONF_MISO_PIN): pins.internal_gpio_input_pin_number,
+        cv.Optional(CONF_CS_PIN): pins.internal_gpio_output_pin_number,
+        cv.Optional(CONF_MAX_FREQUENCY, default="40MHz"): cv.All(
+            cv.frequency, cv.float_range(min=400e3, max=40e6)
+        ),
         cv.Optional(CONF_POWER_CTRL_PIN) : pins.gpio_pin_schema({
             CONF_OUTPUT: True,
             CONF_PULLUP: False,
             CONF_PULLDOWN: False,
         }),
+        cv.Optional(CONF_CARD_DETECT_PIN): pins.gpio_input_pin_schema,
+        cv.Optional(CONF_MOUNT_RETRY_INTERVAL, default="5s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_AUTO_TUNE, default=False): cv.boolean,
+        cv.Optional(CONF_TRIM_MODE, default="NONE"): cv.enum(TRIM_MODES, upper=True),
+        cv.Optional(CONF_RAW_LOG): cv.Schema({
+            cv.Required(CONF_SIZE_MB): cv.int_range(min=1),
+            cv.Optional(CONF_BATCH_SIZE, default=32 * 1024): validate_batch_size,
+        }),
+        cv.Optional(CONF_ROTATING_LOGS): cv.ensure_list(ROTATING_LOG_SCHEMA),
+        cv.Optional(CONF_SHARDED_DIRECTORIES): cv.ensure_list(SHARDED_DIRECTORY_SCHEMA),
+        cv.Optional(CONF_IO_SCHEDULER): IO_SCHEDULER_SCHEMA,
+        cv.Optional(CONF_FILE_CACHE): FILE_CACHE_SCHEMA,
+        cv.Optional(CONF_MAX_OPEN_FILES): cv.int_range(min=1, max=64),
+        cv.Optional(CONF_ATOMIC_WRITE): ATOMIC_WRITE_SCHEMA,
+        cv.Optional(CONF_ENCRYPTION): ENCRYPTION_SCHEMA,
+        cv.Optional(CONF_HANDLE_CACHE, default=0): cv.int_range(min=0, max=32),
+        **{
+            cv.Optional(event): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(FileEventTrigger),
+                    cv.Optional(CONF_PATTERN, default="**"): cv.string_strict,
+                }
+            )
+            for event in FILE_EVENTS
+        },
+        **{
+            cv.Optional(event): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(BatchTrigger),
+                }
+            )
+            for event in BATCH_EVENTS
+        },
+        cv.Optional(CONF_ON_OTA_PROGRESS): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OtaProgressTrigger),
+            }
+        ),
+        cv.Optional(CONF_ON_OTA_FINISHED): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OtaFinishedTrigger),
+            }
+        ),
+        cv.Optional(CONF_ON_OTA_FAILED): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OtaFailedTrigger),
+            }
+        ),
     }
-).extend(cv.COMPONENT_SCHEMA)
+).extend(cv.COMPONENT_SCHEMA), validate_bus)
 
 
 async def to_code(config):
@@ -65,20 +352,105 @@ async def to_code(config):
     await cg.register_component(var, config)
 
     cg.add(var.set_mode_1bit(config[CONF_MODE_1BIT]))
+    cg.add(var.set_max_frequency(int(config[CONF_MAX_FREQUENCY] / 1000)))
 
     cg.add(var.set_clk_pin(config[CONF_CLK_PIN]))
-    cg.add(var.set_cmd_pin(config[CONF_CMD_PIN]))
-    cg.add(var.set_data0_pin(config[CONF_DATA0_PIN]))
+    if (CONF_CS_PIN in config):
+        cg.add(var.set_mosi_pin(config[CONF_MOSI_PIN]))
+        cg.add(var.set_miso_pin(config[CONF_MISO_PIN]))
+        cg.add(var.set_cs_pin(config[CONF_CS_PIN]))
+    else:
+        cg.add(var.set_cmd_pin(config[CONF_CMD_PIN]))
+        cg.add(var.set_data0_pin(config[CONF_DATA0_PIN]))
 
-    if (config[CONF_MODE_1BIT] == False):
-        cg.add(var.set_data1_pin(config[CONF_DATA1_PIN]))
-        cg.add(var.set_data2_pin(config[CONF_DATA2_PIN]))
-        cg.add(var.set_data3_pin(config[CONF_DATA3_PIN]))
+        if (config[CONF_MODE_1BIT] == False):
+            cg.add(var.set_data1_pin(config[CONF_DATA1_PIN]))
+            cg.add(var.set_data2_pin(config[CONF_DATA2_PIN]))
+            cg.add(var.set_data3_pin(config[CONF_DATA3_PIN]))
 
     if (CONF_POWER_CTRL_PIN in config):
         power_ctrl = await cg.gpio_pin_expression(config[CONF_POWER_CTRL_PIN])
         cg.add(var.set_power_ctrl_pin(power_ctrl));
 
+    if (CONF_CARD_DETECT_PIN in config):
+        card_detect = await cg.gpio_pin_expression(config[CONF_CARD_DETECT_PIN])
+        cg.add(var.set_card_detect_pin(card_detect))
+
+    cg.add(var.set_mount_retry_interval(config[CONF_MOUNT_RETRY_INTERVAL]))
+    cg.add(var.set_auto_tune(config[CONF_AUTO_TUNE]))
+    cg.add(var.set_trim_mode(config[CONF_TRIM_MODE]))
+    if CONF_RAW_LOG in config:
+        raw_log = config[CONF_RAW_LOG]
+        cg.add(var.set_raw_log(raw_log[CONF_SIZE_MB], raw_log[CONF_BATCH_SIZE]))
+    for conf in config.get(CONF_ROTATING_LOGS, []):
+        log = cg.new_Pvariable(conf[CONF_ID], var)
+        cg.add(log.set_path(conf[CONF_PATH]))
+        if CONF_MAX_SIZE in conf:
+            cg.add(log.set_max_size(conf[CONF_MAX_SIZE]))
+        if CONF_MAX_AGE in conf:
+            cg.add(log.set_max_age(conf[CONF_MAX_AGE]))
+        cg.add(log.set_keep(conf[CONF_KEEP]))
+        cg.add(log.set_max_total_size(conf[CONF_MAX_TOTAL_SIZE]))
+        cg.add(var.add_rotating_log(log))
+    for conf in config.get(CONF_SHARDED_DIRECTORIES, []):
+        directory = cg.new_Pvariable(conf[CONF_ID], var)
+        cg.add(directory.set_path(conf[CONF_PATH]))
+        cg.add(directory.set_mode(conf[CONF_MODE]))
+        cg.add(directory.set_levels(conf[CONF_LEVELS]))
+        cg.add(directory.set_fan_out(conf[CONF_FAN_OUT]))
+
+    if CONF_IO_SCHEDULER in config:
+        scheduler = config[CONF_IO_SCHEDULER]
+        cg.add(var.set_io_quantum(scheduler[CONF_QUANTUM]))
+        cg.add(var.set_client_rate_limit(scheduler[CONF_CLIENT_RATE_LIMIT]))
+        weights = scheduler[CONF_WEIGHTS]
+        cg.add(var.set_io_weight(IoRequest.IO_REQUEST_GET, weights[CONF_GET]))
+        cg.add(var.set_io_weight(IoRequest.IO_REQUEST_PUT, weights[CONF_PUT]))
+        cg.add(var.set_io_weight(IoRequest.IO_REQUEST_INTERNAL, weights[CONF_INTERNAL]))
+        for conf in scheduler.get(CONF_CLIENTS, []):
+            cg.add(var.add_client_rate_limit(conf[CONF_CLIENT], conf[CONF_RATE_LIMIT]))
+
+    if CONF_MAX_OPEN_FILES in config:
+        cg.add(var.set_max_open_files(config[CONF_MAX_OPEN_FILES]))
+    cg.add(var.set_handle_cache(config[CONF_HANDLE_CACHE]))
+
+    if CONF_ATOMIC_WRITE in config:
+        atomic_write = config[CONF_ATOMIC_WRITE]
+        cg.add(var.set_atomic_commit_interval(atomic_write[CONF_COMMIT_INTERVAL]))
+        cg.add(var.set_atomic_commit_bytes(atomic_write[CONF_COMMIT_BYTES]))
+
+    if CONF_ENCRYPTION in config:
+        encryption = config[CONF_ENCRYPTION]
+        cg.add(var.set_encryption_key([cg.RawExpression(f"0x{byte:02X}") for byte in encryption[CONF_KEY]]))
+        for pattern in encryption[CONF_PATHS]:
+            cg.add(var.add_encrypted_path(pattern))
+
+    if CONF_FILE_CACHE in config:
+        cache = config[CONF_FILE_CACHE]
+        cg.add(var.set_file_cache(cache[CONF_SIZE], cache[CONF_MAX_FILE_SIZE]))
+
+    for event, file_event in FILE_EVENTS.items():
+        for conf in config.get(event, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var, file_event, conf[CONF_PATTERN])
+            await automation.build_automation(trigger, [(cg.std_string, "path")], conf)
+
+    for event, batch_event in BATCH_EVENTS.items():
+        for conf in config.get(event, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var, batch_event)
+            await automation.build_automation(
+                trigger, [(cg.std_string, "path"), (cg.uint32, "done"), (cg.uint32, "failed")], conf
+            )
+
+    for conf in config.get(CONF_ON_OTA_PROGRESS, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.float_, "x")], conf)
+    for conf in config.get(CONF_ON_OTA_FINISHED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [], conf)
+    for conf in config.get(CONF_ON_OTA_FAILED, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(trigger, [(cg.std_string, "error")], conf)
+
     if CORE.using_arduino:
         if CORE.is_esp32:
             cg.add_library("FS", None)
@@ -113,6 +485,19 @@ async def sd_mmc_write_file_to_code(config, action_id, template_arg, args):
     return var
 
 
+@automation.register_action(
+    "sd_mmc_card.write_file_atomic", SdMmcWriteFileAtomicAction, SD_MMC_WRITE_FILE_ACTION_SCHEMA
+)
+async def sd_mmc_write_file_atomic_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    data_ = await cg.templatable(config[CONF_DATA], args, cg.std_vector.template(cg.uint8))
+    cg.add(var.set_path(path_))
+    cg.add(var.set_data(data_))
+    return var
+
+
 @automation.register_action(
     "sd_mmc_card.append_file", SdMmcAppendFileAction, SD_MMC_WRITE_FILE_ACTION_SCHEMA
 )
@@ -157,3 +542,218 @@ async def sd_mmc_delete_file_to_code(config, action_id, template_arg, args):
     path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
     cg.add(var.set_path(path_))
     return var
+
+
+@automation.register_action(
+    "sd_mmc_card.delete_recursive", SdMmcDeleteRecursiveAction, SD_MMC_PATH_ACTION_SCHEMA
+)
+async def sd_mmc_delete_recursive_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    cg.add(var.set_path(path_))
+    return var
+
+
+@automation.register_action(
+    "sd_mmc_card.create_directories", SdMmcCreateDirectoriesAction, SD_MMC_PATH_ACTION_SCHEMA
+)
+async def sd_mmc_create_directories_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    cg.add(var.set_path(path_))
+    return var
+
+
+def paths_expression(paths):
+    return cg.std_vector.template(cg.std_string)(paths)
+
+
+SD_MMC_DELETE_PATHS_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(SdMmc),
+        cv.Required(CONF_PATHS): cv.templatable(cv.ensure_list(cv.string_strict)),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.delete_paths", SdMmcDeletePathsAction, SD_MMC_DELETE_PATHS_ACTION_SCHEMA
+)
+async def sd_mmc_delete_paths_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    paths_ = await cg.templatable(
+        config[CONF_PATHS], args, cg.std_vector.template(cg.std_string), to_exp=paths_expression
+    )
+    cg.add(var.set_paths(paths_))
+    return var
+
+
+SD_MMC_MOVE_PATHS_ACTION_SCHEMA = SD_MMC_DELETE_PATHS_ACTION_SCHEMA.extend(
+    {
+        cv.Required(CONF_DESTINATION): cv.templatable(cv.string_strict),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.move_paths", SdMmcMovePathsAction, SD_MMC_MOVE_PATHS_ACTION_SCHEMA
+)
+async def sd_mmc_move_paths_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    paths_ = await cg.templatable(
+        config[CONF_PATHS], args, cg.std_vector.template(cg.std_string), to_exp=paths_expression
+    )
+    destination_ = await cg.templatable(config[CONF_DESTINATION], args, cg.std_string)
+    cg.add(var.set_paths(paths_))
+    cg.add(var.set_destination(destination_))
+    return var
+
+
+@automation.register_action(
+    "sd_mmc_card.cancel_batch",
+    SdMmcCancelBatchAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(SdMmc)}),
+)
+async def sd_mmc_cancel_batch_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, parent)
+
+
+def validate_sha256(value):
+    value = cv.string_strict(value).strip().lower()
+    if len(value) != 64 or any(c not in "0123456789abcdef" for c in value):
+        raise cv.Invalid("sha256 must be 64 hexadecimal characters")
+    return value
+
+
+SD_MMC_OTA_UPDATE_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(SdMmc),
+        cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
+        cv.Optional(CONF_SHA256, default=""): cv.templatable(cv.Any(cv.one_of(""), validate_sha256)),
+        cv.Optional(CONF_REBOOT, default=True): cv.templatable(cv.boolean),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.ota_update", SdMmcOtaUpdateAction, SD_MMC_OTA_UPDATE_ACTION_SCHEMA
+)
+async def sd_mmc_ota_update_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    path_ = await cg.templatable(config[CONF_PATH], args, cg.std_string)
+    sha256_ = await cg.templatable(config[CONF_SHA256], args, cg.std_string)
+    reboot_ = await cg.templatable(config[CONF_REBOOT], args, cg.bool_)
+    cg.add(var.set_path(path_))
+    cg.add(var.set_sha256(sha256_))
+    cg.add(var.set_reboot(reboot_))
+    return var
+
+
+def validate_raw_log_action(config):
+    if not CORE.using_esp_idf:
+        raise cv.Invalid("append_raw_log is only supported with the esp-idf framework")
+    return config
+
+
+SD_MMC_APPEND_RAW_LOG_ACTION_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(SdMmc),
+            cv.Required(CONF_DATA): cv.templatable(validate_raw_data),
+        }
+    ),
+    validate_raw_log_action,
+)
+
+@automation.register_action(
+    "sd_mmc_card.append_raw_log", SdMmcAppendRawLogAction, SD_MMC_APPEND_RAW_LOG_ACTION_SCHEMA
+)
+async def sd_mmc_append_raw_log_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    data_ = await cg.templatable(config[CONF_DATA], args, cg.std_vector.template(cg.uint8))
+    cg.add(var.set_data(data_))
+    return var
+
+
+SD_MMC_APPEND_ROTATING_LOG_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.use_id(RotatingLog),
+        cv.Required(CONF_DATA): cv.templatable(validate_raw_data),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.append_rotating_log", SdMmcAppendRotatingLogAction, SD_MMC_APPEND_ROTATING_LOG_ACTION_SCHEMA
+)
+async def sd_mmc_append_rotating_log_to_code(config, action_id, template_arg, args):
+    log = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, log)
+    data_ = await cg.templatable(config[CONF_DATA], args, cg.std_vector.template(cg.uint8))
+    cg.add(var.set_data(data_))
+    return var
+
+
+SD_MMC_ROTATE_LOG_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.use_id(RotatingLog),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.rotate_log", SdMmcRotateLogAction, SD_MMC_ROTATE_LOG_ACTION_SCHEMA
+)
+async def sd_mmc_rotate_log_to_code(config, action_id, template_arg, args):
+    log = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, log)
+    return var
+
+
+SD_MMC_WRITE_SHARDED_FILE_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.use_id(ShardedDirectory),
+        cv.Required(CONF_NAME): cv.templatable(cv.string_strict),
+        cv.Required(CONF_DATA): cv.templatable(validate_raw_data),
+        cv.Optional(CONF_TIMESTAMP): cv.templatable(cv.positive_int),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.write_sharded_file", SdMmcWriteShardedFileAction, SD_MMC_WRITE_SHARDED_FILE_ACTION_SCHEMA
+)
+async def sd_mmc_write_sharded_file_to_code(config, action_id, template_arg, args):
+    directory = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, directory)
+    name_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    data_ = await cg.templatable(config[CONF_DATA], args, cg.std_vector.template(cg.uint8))
+    cg.add(var.set_name(name_))
+    cg.add(var.set_data(data_))
+    if CONF_TIMESTAMP in config:
+        timestamp_ = await cg.templatable(config[CONF_TIMESTAMP], args, cg.uint32)
+        cg.add(var.set_timestamp(timestamp_))
+    return var
+
+
+SD_MMC_DELETE_SHARDED_FILE_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.use_id(ShardedDirectory),
+        cv.Required(CONF_NAME): cv.templatable(cv.string_strict),
+        cv.Optional(CONF_TIMESTAMP): cv.templatable(cv.positive_int),
+    }
+)
+
+@automation.register_action(
+    "sd_mmc_card.delete_sharded_file", SdMmcDeleteShardedFileAction, SD_MMC_DELETE_SHARDED_FILE_ACTION_SCHEMA
+)
+async def sd_mmc_delete_sharded_file_to_code(config, action_id, template_arg, args):
+    directory = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, directory)
+    name_ = await cg.templatable(config[CONF_NAME], args, cg.std_string)
+    cg.add(var.set_name(name_))
+    if CONF_TIMESTAMP in config:
+        timestamp_ = await cg.templatable(config[CONF_TIMESTAMP], args, cg.uint32)
+        cg.add(var.set_timestamp(timestamp_))
+    return var
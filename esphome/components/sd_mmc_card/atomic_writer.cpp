@@ -0,0 +1,264 @@
+#include "atomic_writer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.atomic";
+
+static const char *const TEMPORARY_SUFFIX = ".tmp";
+// paths being replaced by the commit in progress, one per line
+static const char *const JOURNAL_PATH = "/.atomic_commit";
+
+AtomicWriter::AtomicWriter(SdMmc *parent) : parent_(parent) {}
+
+bool AtomicWriter::write(const std::string &path, const uint8_t *data, size_t len) {
+  bool commit_now;
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    auto it = std::find_if(this->pending_.begin(), this->pending_.end(),
+                           [&path](const Pending &pending) { return pending.path == path; });
+    auto contents = std::make_shared<const std::vector<uint8_t>>(data, data + len);
+    if (it != this->pending_.end()) {
+      if (it->data)
+        this->pending_bytes_ -= it->data->size();
+      if (it->committing && !this->has_waiting())
+        this->oldest_ms_ = millis();
+      // a commit still writing the previous contents keeps its own copy
+      it->data = std::move(contents);
+    } else {
+      if (!this->has_waiting())
+        this->oldest_ms_ = millis();
+      this->pending_.push_back(Pending{path, std::move(contents)});
+    }
+    this->pending_bytes_ += len;
+    commit_now = (this->commit_interval_ == 0 && this->commit_bytes_ == 0) ||
+                 (this->commit_bytes_ != 0 && this->pending_bytes_ >= this->commit_bytes_);
+  }
+  return !commit_now || this->commit();
+}
+
+bool AtomicWriter::read_pending(const std::string &path, std::vector<uint8_t> *data) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (const Pending &pending : this->pending_) {
+    if (pending.path == path && pending.data) {
+      *data = *pending.data;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AtomicWriter::pending_size(const std::string &path, size_t *size) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (const Pending &pending : this->pending_) {
+    if (pending.path == path && pending.data) {
+      *size = pending.data->size();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AtomicWriter::commit(const std::string &path) {
+  size_t size;
+  // the whole batch goes, one journal pass like any other commit
+  return !this->pending_size(path, &size) || this->commit();
+}
+
+void AtomicWriter::discard(const std::string &path) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  auto it = std::find_if(this->pending_.begin(), this->pending_.end(),
+                         [&path](const Pending &pending) { return pending.path == path; });
+  if (it == this->pending_.end())
+    return;
+  if (it->data)
+    this->pending_bytes_ -= it->data->size();
+  if (it->committing) {
+    // removed by the commit once it knows not to replace the file
+    it->data.reset();
+    it->cancelled = true;
+  } else {
+    this->pending_.erase(it);
+  }
+}
+
+void AtomicWriter::loop(uint32_t now) {
+  if (this->commit_interval_ == 0)
+    return;
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    if (!this->has_waiting() || now - this->oldest_ms_ < this->commit_interval_)
+      return;
+  }
+  this->commit();
+}
+
+bool AtomicWriter::commit() {
+  std::lock_guard<std::mutex> commit_guard(this->commit_lock_);
+  struct Entry {
+    std::string path;
+    std::shared_ptr<const std::vector<uint8_t>> data;
+  };
+  std::vector<Entry> batch;
+  {
+    // the entries stay in pending_, reads keep finding the new contents until the file is replaced
+    std::lock_guard<std::mutex> guard(this->lock_);
+    for (Pending &pending : this->pending_) {
+      pending.committing = true;
+      batch.push_back(Entry{pending.path, pending.data});
+    }
+  }
+  if (batch.empty())
+    return true;
+  if (!this->parent_->is_mounted()) {
+    ESP_LOGE(TAG, "Card not mounted, %zu atomic writes lost", batch.size());
+    for (const Entry &entry : batch)
+      this->settle(entry.path, entry.data);
+    return false;
+  }
+
+  // every new content is on the card before any target is touched
+  bool ok = true;
+  std::string journal;
+  for (auto it = batch.begin(); it != batch.end();) {
+    const std::string temporary = AtomicWriter::temporary_path(build_path(it->path.c_str()));
+    // encrypted like the file it replaces
+    FILE *file = this->parent_->get_file_cipher()->open(it->path, temporary, "wb");
+    if (!AtomicWriter::write_synced(file, it->data->data(), it->data->size())) {
+      ESP_LOGE(TAG, "Failed to write %s", temporary.c_str());
+      remove(temporary.c_str());
+      this->settle(it->path, it->data);
+      it = batch.erase(it);
+      ok = false;
+      continue;
+    }
+    journal += it->path + "\n";
+    ++it;
+  }
+  if (batch.empty())
+    return false;
+  const std::string journal_path = build_path(JOURNAL_PATH);
+  FILE *journal_file = fopen(journal_path.c_str(), "wb");
+  if (!AtomicWriter::write_synced(journal_file, reinterpret_cast<const uint8_t *>(journal.data()), journal.size())) {
+    ESP_LOGE(TAG, "Failed to write the commit journal");
+    for (const Entry &entry : batch) {
+      remove(AtomicWriter::temporary_path(build_path(entry.path.c_str())).c_str());
+      this->settle(entry.path, entry.data);
+    }
+    return false;
+  }
+
+  // from here on a reset is finished by recover()
+  for (const Entry &entry : batch) {
+    auto lock = this->parent_->lock_write(entry.path.c_str());
+    if (this->is_cancelled(entry.path)) {
+      // replaced or deleted since, by an access that went through the path lock after the discard
+      remove(AtomicWriter::temporary_path(build_path(entry.path.c_str())).c_str());
+      this->settle(entry.path, entry.data);
+      continue;
+    }
+    this->parent_->close_handles(entry.path.c_str());
+    bool existed;
+    const bool replaced = AtomicWriter::replace(build_path(entry.path.c_str()), &existed);
+    // still under the path lock: no read falls between the rename and the end of the pending entry
+    this->settle(entry.path, entry.data);
+    if (!replaced) {
+      ESP_LOGE(TAG, "Failed to replace %s", entry.path.c_str());
+      ok = false;
+      continue;
+    }
+    this->parent_->notify_file_event(existed ? FILE_MODIFIED : FILE_CREATED, entry.path);
+  }
+  remove(journal_path.c_str());
+  ESP_LOGV(TAG, "Committed %zu files", batch.size());
+  return ok;
+}
+
+bool AtomicWriter::is_cancelled(const std::string &path) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (const Pending &pending : this->pending_) {
+    if (pending.path == path)
+      return pending.cancelled;
+  }
+  return false;
+}
+
+bool AtomicWriter::has_waiting() const {
+  // entries of the running commit don't count, nor do later writes of their paths until it settles them
+  return std::any_of(this->pending_.begin(), this->pending_.end(),
+                     [](const Pending &pending) { return !pending.committing; });
+}
+
+void AtomicWriter::settle(const std::string &path, const std::shared_ptr<const std::vector<uint8_t>> &data) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  auto it = std::find_if(this->pending_.begin(), this->pending_.end(),
+                         [&path](const Pending &pending) { return pending.path == path; });
+  if (it == this->pending_.end())
+    return;
+  if (it->data == data || !it->data) {
+    if (it->data)
+      this->pending_bytes_ -= it->data->size();
+    this->pending_.erase(it);
+  } else {
+    // written again during the commit, left for the next one
+    it->committing = false;
+    it->cancelled = false;
+  }
+}
+
+void AtomicWriter::recover() {
+  const std::string journal_path = build_path(JOURNAL_PATH);
+  FILE *journal = fopen(journal_path.c_str(), "r");
+  if (journal == nullptr)
+    return;
+  char line[256];
+  uint32_t replaced = 0;
+  while (fgets(line, sizeof(line), journal) != nullptr) {
+    line[strcspn(line, "\n")] = '\0';
+    bool existed;
+    // no temporary file left: that replacement was done before the reset
+    if (line[0] != '\0' && AtomicWriter::replace(build_path(line), &existed))
+      replaced++;
+  }
+  fclose(journal);
+  remove(journal_path.c_str());
+  ESP_LOGW(TAG, "Finished an interrupted commit, %u files replaced", replaced);
+}
+
+size_t AtomicWriter::get_pending_bytes() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->pending_bytes_;
+}
+
+std::string AtomicWriter::temporary_path(const std::string &absolut_path) { return absolut_path + TEMPORARY_SUFFIX; }
+
+bool AtomicWriter::write_synced(FILE *file, const uint8_t *data, size_t len) {
+  if (file == nullptr)
+    return false;
+  // an encrypted stream has no descriptor, its fclose() syncs the file on the card like any FAT close
+  const int fd = fileno(file);
+  bool ok = fwrite(data, 1, len, file) == len && fflush(file) == 0 && (fd < 0 || fsync(fd) == 0);
+  return fclose(file) == 0 && ok;
+}
+
+bool AtomicWriter::replace(const std::string &absolut_path, bool *existed) {
+  const std::string temporary = AtomicWriter::temporary_path(absolut_path);
+  struct stat info;
+  if (stat(temporary.c_str(), &info) != 0)
+    return false;
+  *existed = remove(absolut_path.c_str()) == 0;
+  return rename(temporary.c_str(), absolut_path.c_str()) == 0;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+/* Whole file replacements that a reset can't leave half written: the new contents go to a temporary file next
+ * to the target, synced, and only then replace it. FAT can't rename over an existing file, so the replacement
+ * is a delete followed by a rename; the paths being replaced are listed in a journal first and recover()
+ * finishes the renames cut short by a reset.
+ * Writes are grouped: they wait in memory (a later write of the same path replaces the earlier one) and are
+ * committed together, one journal and one sync pass for all of them, immediately, once commit_interval has
+ * passed since the oldest one or once commit_bytes are waiting. A write acknowledged but not yet committed is
+ * lost on reset, the file then keeps its previous contents. A write stays pending, and read from memory, until
+ * its file has been replaced under the path lock. */
+class AtomicWriter {
+ public:
+  AtomicWriter(SdMmc *parent);
+
+  /* Queue the new contents of path, committed now when the policy says so. False if that commit failed */
+  bool write(const std::string &path, const uint8_t *data, size_t len);
+  /* Contents of path waiting to be committed, false if there are none */
+  bool read_pending(const std::string &path, std::vector<uint8_t> *data);
+  /* Size of the contents of path waiting to be committed, false if there are none */
+  bool pending_size(const std::string &path, size_t *size);
+  /* Commit now if path has a write waiting, for an access that reads the card directly. Takes the path lock,
+   * the caller must not hold it */
+  bool commit(const std::string &path);
+  /* Drop the write waiting on path, for an access replacing or deleting the file anyway. A commit already
+   * writing it skips its replacement */
+  void discard(const std::string &path);
+  /* Commit once the oldest waiting write is commit_interval old */
+  void loop(uint32_t now);
+  /* Commit every waiting write, false if one of them failed */
+  bool commit();
+  /* Finish the commit interrupted by a reset, before the card is used */
+  void recover();
+
+  size_t get_pending_bytes();
+  void set_commit_interval(uint32_t commit_interval) { this->commit_interval_ = commit_interval; }
+  void set_commit_bytes(size_t commit_bytes) { this->commit_bytes_ = commit_bytes; }
+  uint32_t get_commit_interval() const { return this->commit_interval_; }
+  size_t get_commit_bytes() const { return this->commit_bytes_; }
+
+ protected:
+  struct Pending {
+    std::string path;
+    // shared with the commit writing it, nullptr once discarded
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    // part of the running commit
+    bool committing{false};
+    // discarded while committing, the running commit must not replace the file
+    bool cancelled{false};
+  };
+
+  static std::string temporary_path(const std::string &absolut_path);
+  /* Write data to file and close it, synced. file may be nullptr when opening failed */
+  static bool write_synced(FILE *file, const uint8_t *data, size_t len);
+  /* Replace the target of a journaled path by its temporary file, when that one exists */
+  static bool replace(const std::string &absolut_path, bool *existed);
+  /* Some write is waiting for the next commit, under lock_ */
+  bool has_waiting() const;
+  /* Cancelled since the commit took it, under the path lock */
+  bool is_cancelled(const std::string &path);
+  /* The commit is done with path: its entry goes unless a later write replaced the data */
+  void settle(const std::string &path, const std::shared_ptr<const std::vector<uint8_t>> &data);
+
+  SdMmc *parent_;
+  // pending_ and the policy counters
+  std::mutex lock_;
+  // one commit at a time, the journal is shared
+  std::mutex commit_lock_;
+  std::vector<Pending> pending_;
+  size_t pending_bytes_{0};
+  uint32_t oldest_ms_{0};
+  uint32_t commit_interval_{0};
+  size_t commit_bytes_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
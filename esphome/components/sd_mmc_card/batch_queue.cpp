@@ -0,0 +1,319 @@
+#include "batch_queue.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.batch";
+
+// files deleted for one read of their directory, also bounds the names held in memory
+static const size_t DELETE_CHUNK = 16;
+static const uint32_t PROGRESS_INTERVAL_MS = 1000;
+
+static bool normalize_path(std::string &path, bool allow_root) {
+  while (path.size() > 1 && path.back() == '/')
+    path.pop_back();
+  if (path.empty() || path[0] != '/' || (!allow_root && path == "/")) {
+    ESP_LOGE(TAG, "Invalid path '%s'", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+BatchQueue::BatchQueue(SdMmc *parent) : parent_(parent) {}
+
+bool BatchQueue::delete_paths(std::vector<std::string> paths) {
+  for (std::string &path : paths) {
+    if (!normalize_path(path, false))
+      return false;
+  }
+  return this->enqueue(Batch{OP_DELETE, std::move(paths), ""});
+}
+
+bool BatchQueue::create_directories(std::string const &path) {
+  std::string directory = path;
+  if (!normalize_path(directory, true))
+    return false;
+  return this->enqueue(Batch{OP_CREATE_DIRECTORIES, {directory}, ""});
+}
+
+bool BatchQueue::move_paths(std::vector<std::string> paths, std::string const &destination) {
+  std::string directory = destination;
+  if (!normalize_path(directory, true))
+    return false;
+  for (std::string &path : paths) {
+    if (!normalize_path(path, false))
+      return false;
+  }
+  return this->enqueue(Batch{OP_MOVE, std::move(paths), directory});
+}
+
+void BatchQueue::cancel() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->queued_.clear();
+  this->cancel_requested_ = true;
+}
+
+bool BatchQueue::step(uint32_t start_ms, uint32_t slice_ms) {
+  bool cancel;
+  {
+    std::lock_guard<std::mutex> guard(this->lock_);
+    cancel = this->cancel_requested_;
+    this->cancel_requested_ = false;
+    if (!this->running_ && !cancel && !this->queued_.empty() && this->parent_->is_mounted()) {
+      this->batch_ = std::move(this->queued_.front());
+      this->queued_.erase(this->queued_.begin());
+      this->next_ = 0;
+      this->stack_.clear();
+      this->status_ = BatchStatus{this->batch_.paths.empty() ? "" : this->batch_.paths.front(), 0, 0};
+      this->published_ms_ = start_ms;
+      this->running_ = true;
+    }
+  }
+  if (!this->running_)
+    return false;
+  if (cancel) {
+    this->end(BATCH_CANCELLED);
+    return true;
+  }
+  if (!this->parent_->is_mounted()) {
+    ESP_LOGW(TAG, "Card removed, batch on %s stopped", this->status_.path.c_str());
+    this->end(BATCH_CANCELLED);
+    return true;
+  }
+
+  bool more;
+  do {
+    switch (this->batch_.operation) {
+      case OP_DELETE:
+        more = this->step_delete();
+        break;
+      case OP_CREATE_DIRECTORIES:
+        more = this->step_create_directories();
+        break;
+      case OP_MOVE:
+        more = this->step_move();
+        break;
+      default:
+        more = false;
+        break;
+    }
+  } while (more && millis() - start_ms < slice_ms);
+  if (!more) {
+    this->end(BATCH_FINISHED);
+    return true;
+  }
+  if (millis() - this->published_ms_ >= PROGRESS_INTERVAL_MS)
+    this->publish(BATCH_PROGRESS);
+  return false;
+}
+
+bool BatchQueue::is_busy() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->running_ || !this->queued_.empty();
+}
+
+void BatchQueue::add_listener(std::function<void(BatchEvent, const BatchStatus &)> &&listener) {
+  this->listeners_.push_back(std::move(listener));
+}
+
+bool BatchQueue::enqueue(Batch &&batch) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  if (this->queued_.size() >= MAX_BATCHES) {
+    ESP_LOGW(TAG, "Too many batches queued, dropped the one on %s",
+             batch.paths.empty() ? "" : batch.paths.front().c_str());
+    return false;
+  }
+  this->queued_.push_back(std::move(batch));
+  return true;
+}
+
+bool BatchQueue::step_delete() {
+  if (this->stack_.empty()) {
+    if (this->next_ >= this->batch_.paths.size())
+      return false;
+    const std::string &path = this->batch_.paths[this->next_++];
+    this->parent_->close_handles(path.c_str());
+    struct stat info;
+    if (stat(build_path(path.c_str()).c_str(), &info) != 0) {
+      ESP_LOGW(TAG, "Failed to delete %s: %s", path.c_str(), strerror(errno));
+      this->status_.failed++;
+    } else if (S_ISDIR(info.st_mode)) {
+      this->stack_.push_back(Frame{path, 0});
+    } else if (this->remove_entry(path)) {
+      this->status_.done++;
+      this->parent_->notify_file_event(FILE_DELETED, path);
+    } else {
+      this->status_.failed++;
+    }
+    return true;
+  }
+
+  const std::string base = this->stack_.back().path + "/";
+  DIR *dir = opendir(build_path(this->stack_.back().path.c_str()).c_str());
+  if (dir == nullptr) {
+    ESP_LOGW(TAG, "Failed to open %s: %s", this->stack_.back().path.c_str(), strerror(errno));
+    this->pop_frame(false);
+    return true;
+  }
+  // deleting entries doesn't move the others, the ones left behind come first on every read
+  uint32_t skip = this->stack_.back().skipped;
+  std::vector<std::string> files;
+  std::string directory;
+  struct dirent *entry;
+  while (files.size() < DELETE_CHUNK && (entry = readdir(dir)) != nullptr) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    if (skip > 0) {
+      skip--;
+      continue;
+    }
+    if (entry->d_type == DT_DIR) {
+      directory = entry->d_name;
+      break;
+    }
+    files.push_back(entry->d_name);
+  }
+  closedir(dir);
+
+  for (const std::string &name : files) {
+    if (this->remove_entry(base + name)) {
+      this->status_.done++;
+    } else {
+      this->status_.failed++;
+      this->stack_.back().skipped++;
+    }
+  }
+  if (!directory.empty()) {
+    this->stack_.push_back(Frame{base + directory, 0});
+  } else if (files.empty()) {
+    this->pop_frame(true);
+  }
+  return true;
+}
+
+bool BatchQueue::step_create_directories() {
+  const std::string &path = this->batch_.paths.front();
+  if (this->next_ >= path.size())
+    return false;
+  size_t end = path.find('/', this->next_ + 1);
+  if (end == std::string::npos)
+    end = path.size();
+  const std::string directory = path.substr(0, end);
+  this->next_ = end;
+
+  auto lock = this->parent_->lock_write(directory.c_str());
+  const std::string absolut_path = build_path(directory.c_str());
+  struct stat info;
+  if (stat(absolut_path.c_str(), &info) == 0) {
+    if (S_ISDIR(info.st_mode))
+      return true;
+    ESP_LOGW(TAG, "Failed to create %s: not a directory", directory.c_str());
+    this->status_.failed++;
+    return false;
+  }
+  if (mkdir(absolut_path.c_str(), 0777) != 0) {
+    ESP_LOGW(TAG, "Failed to create %s: %s", directory.c_str(), strerror(errno));
+    this->status_.failed++;
+    return false;
+  }
+  this->status_.done++;
+  this->parent_->notify_file_event(FILE_CREATED, directory);
+  return true;
+}
+
+bool BatchQueue::step_move() {
+  if (this->next_ >= this->batch_.paths.size())
+    return false;
+  const std::string &destination = this->batch_.destination;
+  struct stat info;
+  if (this->next_ == 0 &&
+      (stat(build_path(destination.c_str()).c_str(), &info) != 0 || !S_ISDIR(info.st_mode))) {
+    ESP_LOGW(TAG, "Failed to move into %s: not a directory", destination.c_str());
+    this->status_.failed += this->batch_.paths.size();
+    return false;
+  }
+  const std::string &source = this->batch_.paths[this->next_++];
+  const std::string target = (destination == "/" ? "" : destination) + source.substr(source.rfind('/'));
+  if (target == source)
+    return true;
+  if (target.compare(0, source.size() + 1, source + "/") == 0) {
+    ESP_LOGW(TAG, "Failed to move %s into itself", source.c_str());
+    this->status_.failed++;
+    return true;
+  }
+
+  {
+    auto lock = this->parent_->lock_write(source.c_str());
+    this->parent_->close_handles(source.c_str());
+    // FAT can't rename over an existing entry
+    if (stat(build_path(target.c_str()).c_str(), &info) == 0) {
+      ESP_LOGW(TAG, "Failed to move %s: %s exists", source.c_str(), target.c_str());
+      this->status_.failed++;
+      return true;
+    }
+    if (rename(build_path(source.c_str()).c_str(), build_path(target.c_str()).c_str()) != 0) {
+      ESP_LOGW(TAG, "Failed to move %s: %s", source.c_str(), strerror(errno));
+      this->status_.failed++;
+      return true;
+    }
+  }
+  this->status_.done++;
+  this->parent_->notify_file_event(FILE_DELETED, source);
+  this->parent_->notify_file_event(FILE_CREATED, target);
+  return true;
+}
+
+bool BatchQueue::remove_entry(std::string const &path) {
+  auto lock = this->parent_->lock_write(path.c_str());
+  if (remove(build_path(path.c_str()).c_str()) != 0) {
+    ESP_LOGW(TAG, "Failed to delete %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void BatchQueue::pop_frame(bool readable) {
+  const std::string path = std::move(this->stack_.back().path);
+  const bool emptied = readable && this->stack_.back().skipped == 0;
+  this->stack_.pop_back();
+  const bool removed = emptied && this->remove_entry(path);
+  if (removed) {
+    this->status_.done++;
+  } else {
+    this->status_.failed++;
+    if (!this->stack_.empty())
+      this->stack_.back().skipped++;
+  }
+  // the top level directory stands for everything deleted below it
+  if (this->stack_.empty())
+    this->parent_->notify_file_event(removed ? FILE_DELETED : FILE_MODIFIED, path);
+}
+
+void BatchQueue::end(BatchEvent event) {
+  this->running_ = false;
+  if (!this->stack_.empty())
+    this->parent_->notify_file_event(FILE_MODIFIED, this->stack_.front().path);
+  this->stack_.clear();
+  this->batch_.paths.clear();
+  ESP_LOGD(TAG, "Batch on %s %s: %u done, %u failed", this->status_.path.c_str(),
+           event == BATCH_CANCELLED ? "cancelled" : "finished", this->status_.done, this->status_.failed);
+  this->publish(event);
+}
+
+void BatchQueue::publish(BatchEvent event) {
+  this->published_ms_ = millis();
+  for (auto &listener : this->listeners_)
+    listener(event, this->status_);
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
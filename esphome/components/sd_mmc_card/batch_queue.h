@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+enum BatchEvent : uint8_t {
+  BATCH_PROGRESS,
+  BATCH_FINISHED,
+  BATCH_CANCELLED,
+};
+
+struct BatchStatus {
+  // first path of the batch, telling batches apart
+  std::string path;
+  // entries deleted, moved or created so far, and the ones that couldn't be
+  uint32_t done;
+  uint32_t failed;
+};
+
+/* Filesystem operations over many entries: recursive delete of several paths, mkdir -p and moving several paths
+ * into a directory. Batches are queued from any task and run one after the other by step(), called from the card
+ * loop with a time budget, so a tree of thousands of files neither holds the main loop nor needs its listing in
+ * memory: a directory being deleted is read a few entries at a time and only the directories being descended
+ * into are remembered. Each deleted or moved top level path is reported once as a file event, a directory
+ * standing for everything below it. */
+class BatchQueue {
+ public:
+  static constexpr size_t MAX_BATCHES = 8;
+
+  BatchQueue(SdMmc *parent);
+
+  /* Queue a batch, false when too many are waiting or a path is invalid */
+  bool delete_paths(std::vector<std::string> paths);
+  bool create_directories(std::string const &path);
+  /* Move every path into destination, an existing directory, keeping their names */
+  bool move_paths(std::vector<std::string> paths, std::string const &destination);
+  /* Drop the queued batches and stop the running one after the entry in progress */
+  void cancel();
+
+  /* Work on the running batch until slice_ms have passed since start_ms, true when a batch ended */
+  bool step(uint32_t start_ms, uint32_t slice_ms);
+  bool is_busy();
+
+  /* Called from the main loop: progress at most once a second while a batch runs, then finished or cancelled */
+  void add_listener(std::function<void(BatchEvent, const BatchStatus &)> &&listener);
+
+ protected:
+  enum Operation : uint8_t {
+    OP_DELETE,
+    OP_CREATE_DIRECTORIES,
+    OP_MOVE,
+  };
+  struct Batch {
+    Operation operation;
+    std::vector<std::string> paths;
+    std::string destination;
+  };
+  // directory being emptied, its first skipped entries are the ones that couldn't be deleted
+  struct Frame {
+    std::string path;
+    uint32_t skipped;
+  };
+
+  bool enqueue(Batch &&batch);
+  /* One unit of work on the running batch, false once it is done */
+  bool step_delete();
+  bool step_create_directories();
+  bool step_move();
+  /* Remove a file or an empty directory */
+  bool remove_entry(std::string const &path);
+  /* Remove the directory on top of the stack once emptied, readable false when it couldn't be listed */
+  void pop_frame(bool readable);
+  void end(BatchEvent event);
+  void publish(BatchEvent event);
+
+  SdMmc *parent_;
+  // queued_ and cancel_requested_, the running batch only belongs to the main loop
+  std::mutex lock_;
+  std::vector<Batch> queued_;
+  bool cancel_requested_{false};
+
+  bool running_{false};
+  Batch batch_;
+  size_t next_{0};
+  std::vector<Frame> stack_;
+  BatchStatus status_{};
+  uint32_t published_ms_{0};
+  std::vector<std::function<void(BatchEvent, const BatchStatus &)>> listeners_;
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
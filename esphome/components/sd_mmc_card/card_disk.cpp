@@ -0,0 +1,169 @@
+#include "card_disk.h"
+
+#ifdef USE_ESP_IDF
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "diskio_sdmmc.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.disk";
+
+// tries of a transfer failing on a CRC error or a timeout, a marginal bus or a worn card usually passes the second
+static const uint8_t MAX_TRANSFER_ATTEMPTS = 3;
+
+CardDisk *CardDisk::instances_[FF_VOLUMES] = {};
+
+bool CardDisk::attach(sdmmc_card_t *card, TrimMode mode) {
+  BYTE pdrv = ff_diskio_get_pdrv_card(card);
+  if (pdrv >= FF_VOLUMES)
+    return false;
+  char drive[3] = {static_cast<char>('0' + pdrv), ':', '\0'};
+  FATFS *fs;
+  DWORD free_clusters;
+  if (f_getfree(drive, &free_clusters, &fs) != FR_OK)
+    return false;
+
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (!this->trim_.attach(card, fs, mode))
+    return false;
+  this->card_ = card;
+  this->pdrv_ = pdrv;
+  this->volume_end_ = fs->database + (fs->n_fatent - 2) * fs->csize;
+
+  // replace the stock sdmmc driver of the drive, the card stays registered for the unmount
+  static const ff_diskio_impl_t DISKIO_IMPL = {
+      .init = &CardDisk::disk_initialize,
+      .status = &CardDisk::disk_status,
+      .read = &CardDisk::disk_read,
+      .write = &CardDisk::disk_write,
+      .ioctl = &CardDisk::disk_ioctl,
+  };
+  CardDisk::instances_[pdrv] = this;
+  ff_diskio_register(pdrv, &DISKIO_IMPL);
+  return true;
+}
+
+void CardDisk::detach() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (this->pdrv_ < FF_VOLUMES)
+    CardDisk::instances_[this->pdrv_] = nullptr;
+  this->pdrv_ = 0xFF;
+  this->card_ = nullptr;
+  this->trim_.detach();
+}
+
+bool CardDisk::read_sectors(uint8_t *data, uint32_t sector, uint32_t count) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  return this->card_ != nullptr && this->read_card(data, sector, count) == ESP_OK;
+}
+
+bool CardDisk::is_idle(uint32_t idle_ms) const { return millis() - this->last_io_ms_ >= idle_ms; }
+
+uint32_t CardDisk::sweep(uint32_t max_sectors) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  return this->card_ != nullptr ? this->trim_.sweep(max_sectors) : 0;
+}
+
+DRESULT CardDisk::read(BYTE *buff, uint32_t sector, UINT count) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->last_io_ms_ = millis();
+  return this->read_card(buff, sector, count) == ESP_OK ? RES_OK : RES_ERROR;
+}
+
+DRESULT CardDisk::write(const BYTE *buff, uint32_t sector, UINT count) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->last_io_ms_ = millis();
+  this->trim_.before_write(buff, sector, count);
+  if (this->write_card(buff, sector, count) != ESP_OK)
+    return RES_ERROR;
+  this->trim_.after_write();
+  return RES_OK;
+}
+
+DRESULT CardDisk::ioctl(BYTE cmd, void *buff) {
+  switch (cmd) {
+    case CTRL_SYNC:
+      return RES_OK;
+    case GET_SECTOR_COUNT:
+      *static_cast<DWORD *>(buff) = this->card_->csd.capacity;
+      return RES_OK;
+    case GET_SECTOR_SIZE:
+      *static_cast<WORD *>(buff) = this->card_->csd.sector_size;
+      return RES_OK;
+#if FF_USE_TRIM
+    case CTRL_TRIM: {
+      std::lock_guard<std::mutex> lock(this->lock_);
+      const LBA_t *range = static_cast<const LBA_t *>(buff);
+      this->trim_.freed(range[0], range[1] - range[0] + 1);
+      return RES_OK;
+    }
+#endif
+    default:
+      return RES_ERROR;
+  }
+}
+
+esp_err_t CardDisk::read_card(void *data, uint32_t sector, uint32_t count) {
+  esp_err_t err;
+  for (uint8_t attempt = 1;; attempt++) {
+    err = sdmmc_read_sectors(this->card_, data, sector, count);
+    if (err == ESP_OK || !this->count_error(err) || attempt == MAX_TRANSFER_ATTEMPTS)
+      break;
+    this->retries_++;
+  }
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Failed to read %u sectors at %u: %s", count, sector, esp_err_to_name(err));
+  return err;
+}
+
+esp_err_t CardDisk::write_card(const void *data, uint32_t sector, uint32_t count) {
+  esp_err_t err;
+  for (uint8_t attempt = 1;; attempt++) {
+    err = sdmmc_write_sectors(this->card_, data, sector, count);
+    if (err == ESP_OK || !this->count_error(err) || attempt == MAX_TRANSFER_ATTEMPTS)
+      break;
+    this->retries_++;
+  }
+  if (err != ESP_OK)
+    ESP_LOGW(TAG, "Failed to write %u sectors at %u: %s", count, sector, esp_err_to_name(err));
+  return err;
+}
+
+bool CardDisk::count_error(esp_err_t err) {
+  switch (err) {
+    case ESP_ERR_INVALID_CRC:
+      this->crc_errors_++;
+      return true;
+    case ESP_ERR_TIMEOUT:
+      this->timeouts_++;
+      return true;
+    default:
+      return false;
+  }
+}
+
+DSTATUS CardDisk::disk_initialize(BYTE pdrv) { return CardDisk::disk_status(pdrv); }
+
+DSTATUS CardDisk::disk_status(BYTE pdrv) { return CardDisk::instances_[pdrv] != nullptr ? 0 : STA_NOINIT; }
+
+DRESULT CardDisk::disk_read(BYTE pdrv, BYTE *buff, uint32_t sector, UINT count) {
+  CardDisk *disk = CardDisk::instances_[pdrv];
+  return disk != nullptr ? disk->read(buff, sector, count) : RES_NOTRDY;
+}
+
+DRESULT CardDisk::disk_write(BYTE pdrv, const BYTE *buff, uint32_t sector, UINT count) {
+  CardDisk *disk = CardDisk::instances_[pdrv];
+  return disk != nullptr ? disk->write(buff, sector, count) : RES_NOTRDY;
+}
+
+DRESULT CardDisk::disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+  CardDisk *disk = CardDisk::instances_[pdrv];
+  return disk != nullptr ? disk->ioctl(cmd, buff) : RES_NOTRDY;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
+
+#endif  // USE_ESP_IDF
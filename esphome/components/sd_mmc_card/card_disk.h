@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "esphome/core/defines.h"
+#include "sd_trim.h"
+
+#ifdef USE_ESP_IDF
+#include "diskio_impl.h"
+#include "sdmmc_cmd.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+#ifdef USE_ESP_IDF
+/* FatFs disk driver for the mounted card, in place of the stock sdmmc one. It owns the lock shared with the raw
+ * sector accesses made next to the filesystem, and counts the transfer errors: a transfer failing on a CRC error
+ * or a timeout is retried before FatFs sees the error. Erasing the freed clusters (SdTrim) is one feature of it. */
+class CardDisk {
+ public:
+  /* With TRIM_NONE the driver only serializes and retries the card accesses. */
+  bool attach(sdmmc_card_t *card, TrimMode mode);
+  void detach();
+  bool is_attached() const { return this->card_ != nullptr; }
+  std::mutex &get_lock() { return this->lock_; }
+  /* First sector past the FAT volume */
+  uint32_t get_volume_end() const { return this->volume_end_; }
+  /* Read sectors outside of FatFs, serialized with it and retried like its transfers */
+  bool read_sectors(uint8_t *data, uint32_t sector, uint32_t count);
+  /* No transfer for idle_ms */
+  bool is_idle(uint32_t idle_ms) const;
+  /* Erase up to max_sectors of the freed ranges, returns the number of sectors erased. */
+  uint32_t sweep(uint32_t max_sectors);
+  const SdTrim &get_trim() const { return this->trim_; }
+  /* Transfer errors since boot, retries included, and the retries made */
+  uint32_t get_crc_errors() const { return this->crc_errors_; }
+  uint32_t get_timeouts() const { return this->timeouts_; }
+  uint32_t get_retries() const { return this->retries_; }
+
+ protected:
+  DRESULT read(BYTE *buff, uint32_t sector, UINT count);
+  DRESULT write(const BYTE *buff, uint32_t sector, UINT count);
+  DRESULT ioctl(BYTE cmd, void *buff);
+  /* Card transfer with the retries, under lock_ */
+  esp_err_t read_card(void *data, uint32_t sector, uint32_t count);
+  esp_err_t write_card(const void *data, uint32_t sector, uint32_t count);
+  /* Count a failed transfer, true when it is worth retrying */
+  bool count_error(esp_err_t err);
+
+  static DSTATUS disk_initialize(BYTE pdrv);
+  static DSTATUS disk_status(BYTE pdrv);
+  static DRESULT disk_read(BYTE pdrv, BYTE *buff, uint32_t sector, UINT count);
+  static DRESULT disk_write(BYTE pdrv, const BYTE *buff, uint32_t sector, UINT count);
+  static DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff);
+  static CardDisk *instances_[FF_VOLUMES];
+
+  sdmmc_card_t *card_{nullptr};
+  BYTE pdrv_{0xFF};
+  uint32_t volume_end_{0};
+  // serializes the card accesses, an erase must not interleave with the FatFs transfers
+  std::mutex lock_;
+  SdTrim trim_;
+  std::atomic<uint32_t> last_io_ms_{0};
+  std::atomic<uint32_t> crc_errors_{0};
+  std::atomic<uint32_t> timeouts_{0};
+  std::atomic<uint32_t> retries_{0};
+};
+#endif
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,143 @@
+#include "card_info.h"
+
+#ifdef USE_ESP_IDF
+#include <cctype>
+#include <cstring>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esp_heap_caps.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.info";
+
+// values defined in esp-idf/components/sdmmc/include/sd_protocol_defs.h
+static const uint32_t MMC_APP_CMD = 55;
+static const uint32_t SD_APP_SD_STATUS = 13;
+static const size_t SD_STATUS_SIZE = 64;
+
+// SPEED_CLASS codes of the SD status
+static const uint8_t SPEED_CLASSES[] = {0, 2, 4, 6, 10};
+// AU_SIZE codes of the SD status, in KB
+static const uint32_t AU_SIZES_KB[] = {0,    16,   32,   64,    128,   256,   512,   1024,
+                                       2048, 4096, 8192, 12288, 16384, 24576, 32768, 65536};
+
+struct Manufacturer {
+  uint8_t id;
+  const char *name;
+};
+// manufacturer ids are assigned privately by the SD association, these are the commonly seen ones
+static const Manufacturer MANUFACTURERS[] = {
+    {0x01, "Panasonic"}, {0x02, "Toshiba"},       {0x03, "SanDisk"}, {0x1B, "Samsung"},
+    {0x1D, "ADATA"},     {0x27, "Phison"},        {0x28, "Lexar"},   {0x31, "Silicon Power"},
+    {0x41, "Kingston"},  {0x74, "Transcend"},     {0x76, "Patriot"}, {0x82, "Sony"},
+    {0x9C, "Angelbird"},
+};
+
+// ACMD13, the 512 bits SD status, sent like the driver does at init on recent versions
+static bool read_sd_status(sdmmc_card_t *card, uint8_t *status) {
+  sdmmc_command_t app_cmd = {};
+  app_cmd.opcode = MMC_APP_CMD;
+  app_cmd.arg = static_cast<uint32_t>(card->rca) << 16;
+  app_cmd.flags = SCF_CMD_AC | SCF_RSP_R1;
+  esp_err_t err = card->host.do_transaction(card->host.slot, &app_cmd);
+  if (err != ESP_OK)
+    return false;
+  sdmmc_command_t cmd = {};
+  cmd.opcode = SD_APP_SD_STATUS;
+  cmd.flags = SCF_CMD_ADTC | SCF_CMD_READ | SCF_RSP_R1;
+  cmd.data = status;
+  cmd.datalen = SD_STATUS_SIZE;
+  cmd.buflen = SD_STATUS_SIZE;
+  cmd.blklen = SD_STATUS_SIZE;
+  err = card->host.do_transaction(card->host.slot, &cmd);
+  if (err != ESP_OK) {
+    ESP_LOGD(TAG, "Failed to read the SD status: %s", esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+CardInfo CardInfo::read(sdmmc_card_t *card, bool read_status) {
+  CardInfo info;
+  info.valid = true;
+  info.manufacturer_id = static_cast<uint8_t>(card->cid.mfg_id);
+  info.oem_id[0] = static_cast<char>((card->cid.oem_id >> 8) & 0xFF);
+  info.oem_id[1] = static_cast<char>(card->cid.oem_id & 0xFF);
+  strncpy(info.product, card->cid.name, sizeof(info.product) - 1);
+  info.revision = static_cast<uint8_t>(card->cid.revision);
+  info.serial = static_cast<uint32_t>(card->cid.serial);
+  if (!card->is_mmc) {
+    // MDT: years since 2000 then the month
+    info.year = 2000 + ((card->cid.date >> 4) & 0xFF);
+    info.month = card->cid.date & 0x0F;
+  }
+  info.capacity = static_cast<uint64_t>(card->csd.capacity) * card->csd.sector_size;
+
+  if (!read_status || card->is_mmc || card->is_sdio)
+    return info;
+  uint8_t *status = static_cast<uint8_t *>(heap_caps_malloc(SD_STATUS_SIZE, MALLOC_CAP_DMA));
+  if (status == nullptr)
+    return info;
+  if (read_sd_status(card, status)) {
+    // the register arrives most significant byte first, byte n holds bits 511 - 8n down to 504 - 8n
+    info.has_status = true;
+    info.speed_class = status[8] < sizeof(SPEED_CLASSES) ? SPEED_CLASSES[status[8]] : 0;
+    info.au_size = AU_SIZES_KB[status[10] >> 4] * 1024;
+    info.uhs_grade = status[14] >> 4;
+    info.video_class = status[15];
+    info.app_class = status[21] & 0x0F;
+  }
+  heap_caps_free(status);
+  return info;
+}
+
+std::string CardInfo::get_manufacturer() const {
+  for (const Manufacturer &manufacturer : MANUFACTURERS) {
+    if (manufacturer.id == this->manufacturer_id)
+      return manufacturer.name;
+  }
+  return str_sprintf("MID 0x%02X", this->manufacturer_id);
+}
+
+std::string CardInfo::get_identity() const {
+  if (!this->valid)
+    return "";
+  std::string identity = str_sprintf("%s %s rev %u.%u, %.1f GB", this->get_manufacturer().c_str(), this->product,
+                                     this->revision >> 4, this->revision & 0x0F,
+                                     static_cast<float>(convertBytes(this->capacity, GigaByte)));
+  if (this->month != 0)
+    identity += str_sprintf(", %u-%02u", this->year, this->month);
+  return identity + str_sprintf(", SN %08x", this->serial);
+}
+
+std::string CardInfo::get_speed_class() const {
+  if (!this->has_status)
+    return "unknown";
+  std::string speed = str_sprintf("C%u", this->speed_class);
+  if (this->uhs_grade != 0)
+    speed += str_sprintf(" U%u", this->uhs_grade);
+  if (this->video_class != 0)
+    speed += str_sprintf(" V%u", this->video_class);
+  if (this->app_class != 0)
+    speed += str_sprintf(" A%u", this->app_class);
+  if (this->au_size != 0)
+    speed += ", AU " + format_size(this->au_size);
+  return speed;
+}
+
+bool CardInfo::is_suspicious() const {
+  if (!this->valid)
+    return false;
+  if (this->manufacturer_id == 0 || !isprint(this->oem_id[0]) || !isprint(this->oem_id[1]))
+    return true;
+  return this->year != 0 && (this->month == 0 || this->month > 12);
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
+
+#endif  // USE_ESP_IDF
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_ESP_IDF
+#include "sdmmc_cmd.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+#ifdef USE_ESP_IDF
+/* What the card tells about itself: identification (CID), capacity (CSD), spec version (SCR) and the
+ * performance grades of the SD status (SSR). Read once at mount. The driver only decodes part of the SSR, the
+ * speed classes are taken from the raw register. */
+struct CardInfo {
+  bool valid{false};
+  uint8_t manufacturer_id{0};
+  char oem_id[3]{};
+  char product[8]{};
+  uint8_t revision{0};
+  uint32_t serial{0};
+  // 0 when unknown
+  uint16_t year{0};
+  uint8_t month{0};
+  uint64_t capacity{0};
+  // from the SD status, all 0 when it couldn't be read (SPI bus, MMC)
+  bool has_status{false};
+  uint8_t speed_class{0};
+  uint8_t uhs_grade{0};
+  uint8_t video_class{0};
+  uint8_t app_class{0};
+  uint32_t au_size{0};
+
+  /* Decode the registers of a card just initialized, read_status false skips the SD status command */
+  static CardInfo read(sdmmc_card_t *card, bool read_status);
+
+  std::string get_manufacturer() const;
+  /* e.g. "SanDisk SN64G rev 8.0, 59.5 GB, 2022-03, SN 1a2b3c4d" */
+  std::string get_identity() const;
+  /* e.g. "C10 U3 V30 A2, AU 4.00 MB" */
+  std::string get_speed_class() const;
+  /* Identification fields a genuine card fills: known manufacturer, printable OEM id, plausible date */
+  bool is_suspicious() const;
+};
+#endif
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
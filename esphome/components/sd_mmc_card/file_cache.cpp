@@ -0,0 +1,111 @@
+#include "file_cache.h"
+
+#include <algorithm>
+
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+FileCache::Block::Block(size_t size) : data_(nullptr), size_(size) {
+  if (size == 0)
+    return;
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  this->data_ = allocator.allocate(size);
+}
+
+FileCache::Block::~Block() {
+  if (this->data_ == nullptr)
+    return;
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  allocator.deallocate(this->data_, this->size_);
+}
+
+std::shared_ptr<const FileCache::Block> FileCache::lookup(const std::string &path, size_t size, uint32_t mtime) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  auto it = this->entries_.find(path);
+  if (it == this->entries_.end()) {
+    this->misses_++;
+    return nullptr;
+  }
+  if (it->second.block->size() != size || it->second.mtime != mtime) {
+    // changed behind the component's back
+    this->erase(it);
+    this->misses_++;
+    return nullptr;
+  }
+  it->second.used = ++this->clock_;
+  this->hits_++;
+  this->hit_bytes_ += size;
+  return it->second.block;
+}
+
+void FileCache::insert(const std::string &path, std::shared_ptr<const Block> block, uint32_t mtime) {
+  if (!this->is_cacheable(block->size()))
+    return;
+  std::lock_guard<std::mutex> guard(this->lock_);
+  auto it = this->entries_.find(path);
+  if (it != this->entries_.end())
+    this->erase(it);
+  while (this->used_ + block->size() > this->capacity_ && !this->entries_.empty()) {
+    auto oldest = std::min_element(this->entries_.begin(), this->entries_.end(),
+                                   [this](const std::pair<const std::string, Entry> &a,
+                                          const std::pair<const std::string, Entry> &b) {
+                                     return this->clock_ - a.second.used > this->clock_ - b.second.used;
+                                   });
+    this->erase(oldest);
+  }
+  this->used_ += block->size();
+  this->entries_[path] = Entry{std::move(block), mtime, ++this->clock_};
+}
+
+void FileCache::invalidate(const std::string &path) {
+  if (path.empty())
+    return;
+  std::lock_guard<std::mutex> guard(this->lock_);
+  auto it = this->entries_.lower_bound(path);
+  while (it != this->entries_.end() && it->first.compare(0, path.size(), path) == 0) {
+    const std::string &key = it->first;
+    if (key.size() == path.size() || key[path.size()] == '/' || path.back() == '/') {
+      auto next = std::next(it);
+      this->erase(it);
+      it = next;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void FileCache::clear() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->entries_.clear();
+  this->used_ = 0;
+}
+
+uint32_t FileCache::get_hits() const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->hits_;
+}
+
+uint32_t FileCache::get_misses() const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->misses_;
+}
+
+uint64_t FileCache::get_hit_bytes() const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->hit_bytes_;
+}
+
+size_t FileCache::get_used() const {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  return this->used_;
+}
+
+void FileCache::erase(std::map<std::string, Entry>::iterator it) {
+  this->used_ -= it->second.block->size();
+  this->entries_.erase(it);
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
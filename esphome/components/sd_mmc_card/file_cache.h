@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Contents of small, often read files (icons, fonts, configuration) kept in PSRAM, the least recently used
+ * evicted first. An entry is only served while the file still has the size and mtime it was read with, and the
+ * component's own writes drop it. Blocks are shared: one evicted while a response still streams it is freed
+ * once that response is done. */
+class FileCache {
+ public:
+  class Block {
+   public:
+    explicit Block(size_t size);
+    ~Block();
+    Block(const Block &) = delete;
+    Block &operator=(const Block &) = delete;
+
+    /* false when PSRAM had no room for it */
+    bool is_valid() const { return this->size_ == 0 || this->data_ != nullptr; }
+    uint8_t *data() { return this->data_; }
+    const uint8_t *data() const { return this->data_; }
+    size_t size() const { return this->size_; }
+
+   protected:
+    uint8_t *data_;
+    size_t size_;
+  };
+
+  void set_capacity(size_t capacity) { this->capacity_ = capacity; }
+  void set_max_file_size(size_t max_file_size) { this->max_file_size_ = max_file_size; }
+  size_t get_capacity() const { return this->capacity_; }
+  size_t get_max_file_size() const { return this->max_file_size_; }
+  bool is_enabled() const { return this->capacity_ != 0; }
+  bool is_cacheable(size_t size) const {
+    return this->capacity_ != 0 && size <= this->max_file_size_ && size <= this->capacity_;
+  }
+
+  /* Cached contents of path if they were read at this size and mtime, counted as a hit or a miss */
+  std::shared_ptr<const Block> lookup(const std::string &path, size_t size, uint32_t mtime);
+  void insert(const std::string &path, std::shared_ptr<const Block> block, uint32_t mtime);
+  /* Drop path and, for a directory, everything below it */
+  void invalidate(const std::string &path);
+  void clear();
+
+  uint32_t get_hits() const;
+  uint32_t get_misses() const;
+  uint64_t get_hit_bytes() const;
+  size_t get_used() const;
+
+ protected:
+  struct Entry {
+    std::shared_ptr<const Block> block;
+    uint32_t mtime;
+    uint32_t used;
+  };
+
+  void erase(std::map<std::string, Entry>::iterator it);
+
+  mutable std::mutex lock_;
+  std::map<std::string, Entry> entries_;
+  size_t capacity_{0};
+  size_t max_file_size_{64 * 1024};
+  size_t used_{0};
+  // bumped by every access, orders the entries for eviction
+  uint32_t clock_{0};
+  uint32_t hits_{0};
+  uint32_t misses_{0};
+  uint64_t hit_bytes_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,276 @@
+#include "file_cipher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "mbedtls/aes.h"
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.cipher";
+
+// header: magic, version, 7 reserved bytes, nonce, key check
+static const uint8_t MAGIC[8] = {'S', 'D', 'M', 'M', 'C', 'E', 'N', 'C'};
+static const uint8_t VERSION = 1;
+static const size_t NONCE_OFFSET = 16;
+static const size_t NONCE_SIZE = 8;
+static const size_t CHECK_OFFSET = 24;
+static const size_t CHECK_SIZE = 8;
+// bytes encrypted at once on writes, also the stdio buffer of the stream
+static const size_t CHUNK_SIZE = 4096;
+
+struct FileCipher::Stream {
+  FileCipher *cipher;
+  FILE *raw;
+  mbedtls_aes_context aes;
+  uint8_t nonce[NONCE_SIZE];
+  // of the contents, the raw file is HEADER_SIZE longer
+  uint64_t size;
+  uint64_t position;
+  // where the raw file stands, a switch between reading and writing needs a seek
+  uint64_t raw_position;
+  bool raw_writing;
+  bool readable;
+  bool writable;
+  bool append;
+  uint8_t chunk[CHUNK_SIZE];
+};
+
+// counter block of the 16 bytes block at index, the nonce followed by the big endian index
+static void counter_block(const uint8_t *nonce, uint64_t index, uint8_t *block) {
+  memcpy(block, nonce, NONCE_SIZE);
+  for (size_t i = 0; i < 8; i++)
+    block[15 - i] = static_cast<uint8_t>(index >> (8 * i));
+}
+
+// first bytes of the last counter block of the file encrypted, never used for the contents
+static void key_check(mbedtls_aes_context *aes, const uint8_t *nonce, uint8_t *check) {
+  uint8_t block[16], encrypted[16];
+  counter_block(nonce, UINT64_MAX, block);
+  mbedtls_aes_crypt_ecb(aes, MBEDTLS_AES_ENCRYPT, block, encrypted);
+  memcpy(check, encrypted, CHECK_SIZE);
+}
+
+void FileCipher::set_key(const std::array<uint8_t, KEY_SIZE> &key) {
+  this->key_ = key;
+  this->enabled_ = true;
+}
+
+bool FileCipher::is_encrypted(const char *path) const {
+  if (!this->enabled_)
+    return false;
+  for (const std::string &pattern : this->patterns_) {
+    if (glob_match(pattern.c_str(), path))
+      return true;
+  }
+  return false;
+}
+
+FILE *FileCipher::open(std::string const &path, std::string const &absolut_path, const char *mode) {
+  if (!this->is_encrypted(path))
+    return fopen(absolut_path.c_str(), mode);
+
+  const bool update = strchr(mode, '+') != nullptr;
+  // overwriting bytes in place would encrypt them with the keystream of the old ones and leak the XOR of both
+  // contents. Encrypted files are only written at their end ("a") or rewritten whole with a new nonce ("w").
+  if (mode[0] == 'r' && update) {
+    ESP_LOGE(TAG, "%s is encrypted and can't be opened for in place writes", path.c_str());
+    errno = EPERM;
+    return nullptr;
+  }
+  const char *raw_mode = mode[0] == 'r' ? "rb" : (mode[0] == 'w' ? "w+b" : "a+b");
+  FILE *raw = fopen(absolut_path.c_str(), raw_mode);
+  if (raw == nullptr)
+    return nullptr;
+  struct stat info;
+  if (fstat(fileno(raw), &info) != 0) {
+    fclose(raw);
+    return nullptr;
+  }
+
+  Stream *stream = new Stream();
+  stream->cipher = this;
+  stream->raw = raw;
+  mbedtls_aes_init(&stream->aes);
+  mbedtls_aes_setkey_enc(&stream->aes, this->key_.data(), KEY_SIZE * 8);
+  uint8_t header[HEADER_SIZE] = {};
+  uint8_t check[CHECK_SIZE];
+  bool ok;
+  if (info.st_size == 0 && mode[0] != 'r') {
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    header[sizeof(MAGIC)] = VERSION;
+    random_bytes(stream->nonce, NONCE_SIZE);
+    memcpy(header + NONCE_OFFSET, stream->nonce, NONCE_SIZE);
+    key_check(&stream->aes, stream->nonce, header + CHECK_OFFSET);
+    ok = fwrite(header, 1, HEADER_SIZE, raw) == HEADER_SIZE;
+    stream->size = 0;
+  } else {
+    ok = fread(header, 1, HEADER_SIZE, raw) == HEADER_SIZE && memcmp(header, MAGIC, sizeof(MAGIC)) == 0 &&
+         header[sizeof(MAGIC)] == VERSION;
+    if (!ok) {
+      ESP_LOGE(TAG, "%s is not an encrypted file", path.c_str());
+      errno = EILSEQ;
+    } else {
+      memcpy(stream->nonce, header + NONCE_OFFSET, NONCE_SIZE);
+      key_check(&stream->aes, stream->nonce, check);
+      ok = memcmp(check, header + CHECK_OFFSET, CHECK_SIZE) == 0;
+      if (!ok) {
+        ESP_LOGE(TAG, "%s was encrypted with another key", path.c_str());
+        errno = EACCES;
+      }
+    }
+    stream->size = info.st_size > static_cast<off_t>(HEADER_SIZE) ? info.st_size - HEADER_SIZE : 0;
+  }
+  stream->raw_position = HEADER_SIZE;
+  stream->raw_writing = mode[0] != 'r' && info.st_size == 0;
+  stream->readable = mode[0] == 'r' || update;
+  stream->writable = mode[0] != 'r';
+  stream->append = mode[0] == 'a';
+  stream->position = stream->append ? stream->size : 0;
+
+  FILE *file = nullptr;
+  if (ok) {
+    cookie_io_functions_t functions = {};
+    functions.read = FileCipher::read_stream;
+    functions.write = FileCipher::write_stream;
+    functions.seek = FileCipher::seek_stream;
+    functions.close = FileCipher::close_stream;
+    file = fopencookie(stream, mode, functions);
+  }
+  if (file == nullptr) {
+    const int error = errno;
+    FileCipher::close_stream(stream);
+    errno = error;
+    return nullptr;
+  }
+  setvbuf(file, nullptr, _IOFBF, CHUNK_SIZE);
+  return file;
+}
+
+size_t FileCipher::plain_size(const char *path, size_t size) const {
+  if (!this->is_encrypted(path))
+    return size;
+  return size > HEADER_SIZE ? size - HEADER_SIZE : 0;
+}
+
+ssize_t FileCipher::read_stream(void *cookie, char *data, size_t len) {
+  Stream *stream = static_cast<Stream *>(cookie);
+  if (!stream->readable) {
+    errno = EBADF;
+    return -1;
+  }
+  if (stream->position >= stream->size)
+    return 0;
+  len = std::min<uint64_t>(len, stream->size - stream->position);
+  if (!FileCipher::seek_raw(stream, stream->position, false))
+    return -1;
+  uint8_t *buffer = reinterpret_cast<uint8_t *>(data);
+  const size_t read = fread(buffer, 1, len, stream->raw);
+  stream->raw_position += read;
+  if (read == 0 && ferror(stream->raw))
+    return -1;
+  stream->cipher->crypt(stream, stream->position, buffer, buffer, read);
+  stream->position += read;
+  return read;
+}
+
+ssize_t FileCipher::write_stream(void *cookie, const char *data, size_t len) {
+  Stream *stream = static_cast<Stream *>(cookie);
+  if (!stream->writable) {
+    errno = EBADF;
+    return -1;
+  }
+  if (stream->append)
+    stream->position = stream->size;
+  const uint8_t *source = reinterpret_cast<const uint8_t *>(data);
+  size_t done = 0;
+  while (done < len) {
+    if (!FileCipher::seek_raw(stream, stream->position, true))
+      break;
+    const size_t chunk = std::min(len - done, CHUNK_SIZE);
+    stream->cipher->crypt(stream, stream->position, source + done, stream->chunk, chunk);
+    const size_t written = fwrite(stream->chunk, 1, chunk, stream->raw);
+    stream->raw_position += written;
+    stream->position += written;
+    stream->size = std::max(stream->size, stream->position);
+    done += written;
+    if (written != chunk)
+      break;
+  }
+  return done != 0 || len == 0 ? static_cast<ssize_t>(done) : -1;
+}
+
+template<typename Offset> int FileCipher::seek_stream(void *cookie, Offset *offset, int whence) {
+  Stream *stream = static_cast<Stream *>(cookie);
+  int64_t base;
+  switch (whence) {
+    case SEEK_SET:
+      base = 0;
+      break;
+    case SEEK_CUR:
+      base = stream->position;
+      break;
+    case SEEK_END:
+      base = stream->size;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+  if (base + *offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  stream->position = base + *offset;
+  *offset = stream->position;
+  return 0;
+}
+
+int FileCipher::close_stream(void *cookie) {
+  Stream *stream = static_cast<Stream *>(cookie);
+  const int result = fclose(stream->raw);
+  mbedtls_aes_free(&stream->aes);
+  delete stream;
+  return result;
+}
+
+void FileCipher::crypt(Stream *stream, uint64_t position, const uint8_t *in, uint8_t *out, size_t len) {
+  if (len == 0)
+    return;
+  const uint32_t start = micros();
+  uint8_t counter[16], keystream[16];
+  counter_block(stream->nonce, position / 16, counter);
+  // mbedtls continues from the keystream of a block already started
+  size_t offset = position % 16;
+  if (offset != 0) {
+    mbedtls_aes_crypt_ecb(&stream->aes, MBEDTLS_AES_ENCRYPT, counter, keystream);
+    counter_block(stream->nonce, position / 16 + 1, counter);
+  }
+  mbedtls_aes_crypt_ctr(&stream->aes, len, &offset, counter, keystream, in, out);
+  this->busy_us_ += micros() - start;
+  this->bytes_ += len;
+}
+
+bool FileCipher::seek_raw(Stream *stream, uint64_t position, bool writing) {
+  const uint64_t raw_position = position + HEADER_SIZE;
+  if (raw_position == stream->raw_position && writing == stream->raw_writing)
+    return true;
+  stream->raw_writing = writing;
+  if (fseek(stream->raw, raw_position, SEEK_SET) != 0) {
+    stream->raw_position = UINT64_MAX;
+    return false;
+  }
+  stream->raw_position = raw_position;
+  return true;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Files encrypted at rest with AES-256 in CTR mode, on the AES peripheral through mbedtls. Each file starts with
+ * a header holding a random nonce, the keystream of any byte depends on its offset only: reads can start
+ * anywhere and appends continue the file, the way a plain FILE* does. open() hands out a regular FILE* whose
+ * stdio callbacks encrypt and decrypt, so streaming readers, fseek() and HTTP range requests work unchanged.
+ * CTR hides the contents but doesn't authenticate them, a modified file decrypts to garbage without error. */
+class FileCipher {
+ public:
+  static constexpr size_t KEY_SIZE = 32;
+  static constexpr size_t HEADER_SIZE = 32;
+
+  void set_key(const std::array<uint8_t, KEY_SIZE> &key);
+  void add_pattern(std::string const &pattern) { this->patterns_.push_back(pattern); }
+  bool is_enabled() const { return this->enabled_; }
+  size_t get_pattern_count() const { return this->patterns_.size(); }
+
+  /* Whether path, relative to the mount point, is stored encrypted */
+  bool is_encrypted(const char *path) const;
+  bool is_encrypted(std::string const &path) const { return this->is_encrypted(path.c_str()); }
+  /* fopen() of absolut_path, through the cipher when path is stored encrypted. A file to read that has no
+   * valid header fails with EILSEQ, "r+" on an encrypted path fails with EPERM. */
+  FILE *open(std::string const &path, std::string const &absolut_path, const char *mode);
+  /* Size of the contents of path, from the size of the file on the card */
+  size_t plain_size(const char *path, size_t size) const;
+
+  /* Bytes gone through the AES peripheral and the time spent on them, since boot */
+  uint64_t get_bytes() const { return this->bytes_; }
+  uint64_t get_busy_us() const { return this->busy_us_; }
+
+ protected:
+  struct Stream;
+
+  static ssize_t read_stream(void *cookie, char *data, size_t len);
+  static ssize_t write_stream(void *cookie, const char *data, size_t len);
+  template<typename Offset> static int seek_stream(void *cookie, Offset *offset, int whence);
+  static int close_stream(void *cookie);
+  /* Encrypt or decrypt len bytes found at position in the file, in and out may be the same buffer */
+  void crypt(Stream *stream, uint64_t position, const uint8_t *in, uint8_t *out, size_t len);
+  /* Put the raw file at the byte of the contents at position */
+  static bool seek_raw(Stream *stream, uint64_t position, bool writing);
+
+  std::array<uint8_t, KEY_SIZE> key_{};
+  bool enabled_{false};
+  std::vector<std::string> patterns_;
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<uint64_t> busy_us_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,135 @@
+#include "file_handles.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.handles";
+
+FILE *HandlePool::acquire(const std::string &path, char mode) {
+  if (this->capacity_ != 0) {
+    FILE *file = nullptr;
+    {
+      std::lock_guard<std::mutex> guard(this->lock_);
+      for (auto it = this->idle_.begin(); it != this->idle_.end(); ++it) {
+        if (it->path == path && it->mode == mode) {
+          file = it->file;
+          this->idle_.erase(it);
+          break;
+        }
+      }
+    }
+    if (file != nullptr) {
+      if (mode == 'r')
+        rewind(file);
+      return file;
+    }
+  }
+  FILE *file = HandlePool::open(path, mode);
+  if (file == nullptr && errno == ENFILE) {
+    // every file slot of the mount is taken, some by idle handles of ours
+    bool evicted;
+    {
+      std::lock_guard<std::mutex> guard(this->lock_);
+      evicted = this->evict();
+    }
+    if (evicted)
+      file = HandlePool::open(path, mode);
+  }
+  return file;
+}
+
+void HandlePool::release(const std::string &path, char mode, FILE *file) {
+  if (file == nullptr)
+    return;
+  if (this->capacity_ == 0) {
+    fclose(file);
+    return;
+  }
+  if (mode == 'a' && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+    ESP_LOGW(TAG, "Failed to sync %s, closing it", path.c_str());
+    fclose(file);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (const Handle &handle : this->idle_) {
+    if (handle.path == path && handle.mode == mode) {
+      // a concurrent caller opened its own, one is enough
+      fclose(file);
+      return;
+    }
+  }
+  while (this->idle_.size() >= this->capacity_ && this->evict()) {
+  }
+  this->idle_.push_back(Handle{path, mode, file, millis()});
+}
+
+bool HandlePool::pooled_size(const std::string &path, size_t *size) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (const Handle &handle : this->idle_) {
+    struct stat info;
+    if (handle.path == path && fstat(fileno(handle.file), &info) == 0) {
+      *size = info.st_size;
+      return true;
+    }
+  }
+  return false;
+}
+
+void HandlePool::close(const std::string &path, char keep) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->idle_.erase(std::remove_if(this->idle_.begin(), this->idle_.end(),
+                                   [&path, keep](const Handle &handle) {
+                                     const bool below = handle.path.size() > path.size() &&
+                                                        handle.path.compare(0, path.size(), path) == 0 &&
+                                                        handle.path[path.size()] == '/';
+                                     if ((handle.path != path && !below) || handle.mode == keep)
+                                       return false;
+                                     fclose(handle.file);
+                                     return true;
+                                   }),
+                    this->idle_.end());
+}
+
+void HandlePool::close_idle(uint32_t now, uint32_t max_idle_ms) {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  this->idle_.erase(std::remove_if(this->idle_.begin(), this->idle_.end(),
+                                   [now, max_idle_ms](const Handle &handle) {
+                                     if (now - handle.used_ms < max_idle_ms)
+                                       return false;
+                                     fclose(handle.file);
+                                     return true;
+                                   }),
+                    this->idle_.end());
+}
+
+void HandlePool::close_all() {
+  std::lock_guard<std::mutex> guard(this->lock_);
+  for (const Handle &handle : this->idle_)
+    fclose(handle.file);
+  this->idle_.clear();
+}
+
+FILE *HandlePool::open(const std::string &path, char mode) { return fopen(path.c_str(), mode == 'a' ? "ab" : "rb"); }
+
+bool HandlePool::evict() {
+  if (this->idle_.empty())
+    return false;
+  const uint32_t now = millis();
+  auto oldest = std::min_element(this->idle_.begin(), this->idle_.end(), [now](const Handle &a, const Handle &b) {
+    return now - a.used_ms > now - b.used_ms;
+  });
+  fclose(oldest->file);
+  this->idle_.erase(oldest);
+  return true;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Open files kept between calls, so that reading or appending to the same few files again skips the FAT
+ * directory lookup of fopen. Handles are keyed by absolute path and mode ('r' read, 'a' append) and lent out
+ * one caller at a time: a caller finding none idle opens its own. Past the capacity, and when the mount runs out
+ * of file slots, the least recently used idle handle is closed.
+ * A kept append handle is synced when handed back, so other readers and stat() see what was written as after
+ * fclose(). Whoever rewrites, deletes or moves a file closes its handles first. */
+class HandlePool {
+ public:
+  void set_capacity(size_t capacity) { this->capacity_ = capacity; }
+  size_t get_capacity() const { return this->capacity_; }
+  bool is_enabled() const { return this->capacity_ != 0; }
+
+  /* Handle on path, idle one or freshly opened; a reused read handle is rewound. nullptr if it can't be opened */
+  FILE *acquire(const std::string &path, char mode);
+  /* Hand back a handle from acquire(), kept for the next caller or closed */
+  void release(const std::string &path, char mode, FILE *file);
+  /* Size of path read from one of its idle handles, false when none is kept */
+  bool pooled_size(const std::string &path, size_t *size);
+  /* Close the idle handles on path and below it, but the ones opened with keep */
+  void close(const std::string &path, char keep = '\0');
+  void close_idle(uint32_t now, uint32_t max_idle_ms);
+  void close_all();
+
+ protected:
+  struct Handle {
+    std::string path;
+    char mode;
+    FILE *file;
+    uint32_t used_ms;
+  };
+
+  static FILE *open(const std::string &path, char mode);
+  /* Close the least recently used idle handle, false if there is none */
+  bool evict();
+
+  std::mutex lock_;
+  std::vector<Handle> idle_;
+  size_t capacity_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
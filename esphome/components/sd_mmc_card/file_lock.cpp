@@ -0,0 +1,116 @@
+#include "file_lock.h"
+
+#include <utility>
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+FileLock::FileLock(FileLock &&other)
+    : mount_(other.mount_), path_(other.path_), second_(other.second_), exclusive_(other.exclusive_) {
+  other.mount_ = nullptr;
+  other.path_ = nullptr;
+  other.second_ = nullptr;
+}
+
+FileLock &FileLock::operator=(FileLock &&other) {
+  if (this != &other) {
+    this->release();
+    this->mount_ = other.mount_;
+    this->path_ = other.path_;
+    this->second_ = other.second_;
+    this->exclusive_ = other.exclusive_;
+    other.mount_ = nullptr;
+    other.path_ = nullptr;
+    other.second_ = nullptr;
+  }
+  return *this;
+}
+
+void FileLock::release() {
+  if (this->second_ != nullptr) {
+    if (this->exclusive_) {
+      this->second_->unlock();
+    } else {
+      this->second_->unlock_shared();
+    }
+    this->second_ = nullptr;
+  }
+  if (this->path_ != nullptr) {
+    if (this->exclusive_) {
+      this->path_->unlock();
+    } else {
+      this->path_->unlock_shared();
+    }
+    this->path_ = nullptr;
+  }
+  if (this->mount_ != nullptr) {
+    this->mount_->unlock_shared();
+    this->mount_ = nullptr;
+  }
+}
+
+FileLock LockTable::lock_path(const char *path, bool exclusive) {
+  // always the mount lock first, then the path one, so two holders never wait on each other
+  this->acquire(this->mount_, false);
+  std::shared_mutex &stripe = this->stripes_[LockTable::stripe_of(path)];
+  this->acquire(stripe, exclusive);
+  return FileLock(&this->mount_, &stripe, nullptr, exclusive);
+}
+
+FileLock LockTable::lock_paths(const char *first, const char *second, bool exclusive) {
+  this->acquire(this->mount_, false);
+  size_t low = LockTable::stripe_of(first);
+  size_t high = LockTable::stripe_of(second);
+  // lowest stripe first, two holders of crossed paths would otherwise wait on each other; a stripe is never
+  // taken twice, the locks aren't recursive
+  if (low > high)
+    std::swap(low, high);
+  this->acquire(this->stripes_[low], exclusive);
+  std::shared_mutex *other = nullptr;
+  if (high != low) {
+    other = &this->stripes_[high];
+    this->acquire(*other, exclusive);
+  }
+  return FileLock(&this->mount_, &this->stripes_[low], other, exclusive);
+}
+
+FileLock LockTable::lock_card() {
+  this->acquire(this->mount_, false);
+  return FileLock(&this->mount_, nullptr, nullptr, false);
+}
+
+std::unique_lock<std::shared_mutex> LockTable::lock_mount() {
+  this->acquire(this->mount_, true);
+  return std::unique_lock<std::shared_mutex>(this->mount_, std::adopt_lock);
+}
+
+size_t LockTable::stripe_of(const char *path) {
+  // FNV-1a, ignoring a trailing separator so that "/dir" and "/dir/" share a lock
+  uint32_t hash = 2166136261UL;
+  for (const char *c = path; *c != '\0'; c++) {
+    if (*c == '/' && c[1] == '\0')
+      break;
+    hash ^= static_cast<uint8_t>(*c);
+    hash *= 16777619UL;
+  }
+  return hash % STRIPES;
+}
+
+void LockTable::acquire(std::shared_mutex &lock, bool exclusive) {
+  // the uncontended case stays free of timing calls
+  if (exclusive ? lock.try_lock() : lock.try_lock_shared())
+    return;
+  const uint32_t start = micros();
+  if (exclusive) {
+    lock.lock();
+  } else {
+    lock.lock_shared();
+  }
+  this->wait_time_us_ += micros() - start;
+  this->contentions_++;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
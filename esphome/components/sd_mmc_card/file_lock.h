@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Hold on a path of the card, released when destroyed. A shared hold lets other readers of the path in, an
+ * exclusive one keeps everybody else out. Either also keeps the card from being unmounted. */
+class FileLock {
+ public:
+  FileLock() = default;
+  FileLock(FileLock &&other);
+  FileLock &operator=(FileLock &&other);
+  FileLock(const FileLock &) = delete;
+  FileLock &operator=(const FileLock &) = delete;
+  ~FileLock() { this->release(); }
+
+  void release();
+  bool is_exclusive() const { return this->exclusive_; }
+
+ protected:
+  friend class LockTable;
+  FileLock(std::shared_mutex *mount, std::shared_mutex *path, std::shared_mutex *second, bool exclusive)
+      : mount_(mount), path_(path), second_(second), exclusive_(exclusive) {}
+
+  std::shared_mutex *mount_{nullptr};
+  std::shared_mutex *path_{nullptr};
+  // the other stripe of a two paths hold, nullptr when both paths share one
+  std::shared_mutex *second_{nullptr};
+  bool exclusive_{false};
+};
+
+/* Reader/writer locks shared by the tasks using the card (main loop, web server, mount task...).
+ * Paths are hashed over a fixed set of stripes, two paths may share a stripe, which only costs some
+ * concurrency. Every path lock also holds the mount lock shared, so the card is only unmounted once all
+ * accesses are done. Time spent waiting on a held lock is accumulated. */
+class LockTable {
+ public:
+  static constexpr size_t STRIPES = 16;
+
+  FileLock lock_path(const char *path, bool exclusive);
+  /* Both paths at once, for a move. Stripes are always taken in the same order. */
+  FileLock lock_paths(const char *first, const char *second, bool exclusive);
+  /* Shared hold on the mount lock alone, for accesses to the card outside the filesystem */
+  FileLock lock_card();
+  /* Exclusive hold on the mount lock, for unmounting */
+  std::unique_lock<std::shared_mutex> lock_mount();
+
+  uint64_t get_wait_time_us() const { return this->wait_time_us_; }
+  uint32_t get_contentions() const { return this->contentions_; }
+
+ protected:
+  static size_t stripe_of(const char *path);
+  void acquire(std::shared_mutex &lock, bool exclusive);
+
+  std::shared_mutex mount_;
+  std::shared_mutex stripes_[STRIPES];
+  std::atomic<uint64_t> wait_time_us_{0};
+  std::atomic<uint32_t> contentions_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
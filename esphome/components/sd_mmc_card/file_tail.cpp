@@ -0,0 +1,104 @@
+#include "file_tail.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+struct TailHub::Subscriber {
+  std::string path;
+  std::vector<uint8_t> ring;
+  size_t head;
+  size_t size;
+  uint32_t dropped;
+};
+
+TailHub::Subscriber *TailHub::subscribe(const std::string &path, size_t backlog) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (this->subscribers_.size() >= MAX_SUBSCRIBERS || backlog == 0)
+    return nullptr;
+  Subscriber *subscriber = new Subscriber{path, std::vector<uint8_t>(backlog), 0, 0, 0};
+  this->subscribers_.push_back(subscriber);
+  this->count_ = this->subscribers_.size();
+  return subscriber;
+}
+
+void TailHub::unsubscribe(Subscriber *subscriber) {
+  if (subscriber == nullptr)
+    return;
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->subscribers_.erase(std::remove(this->subscribers_.begin(), this->subscribers_.end(), subscriber),
+                           this->subscribers_.end());
+  this->count_ = this->subscribers_.size();
+  delete subscriber;
+}
+
+void TailHub::publish(const char *path, const uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  for (Subscriber *subscriber : this->subscribers_) {
+    if (subscriber->path == path)
+      this->push(subscriber, data, len);
+  }
+}
+
+void TailHub::feed(Subscriber *subscriber, const uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->push(subscriber, data, len);
+}
+
+size_t TailHub::read(Subscriber *subscriber, uint8_t *buffer, size_t max, bool lines) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  const size_t capacity = subscriber->ring.size();
+  size_t len = std::min(max, subscriber->size);
+  if (lines) {
+    // look back for the end of the last complete line within len
+    size_t end = len;
+    while (end > 0 && subscriber->ring[(subscriber->head + end - 1) % capacity] != '\n')
+      end--;
+    if (end != 0 || subscriber->size < capacity)
+      len = end;
+  }
+  for (size_t i = 0; i < len;) {
+    size_t span = std::min(len - i, capacity - subscriber->head);
+    memcpy(buffer + i, subscriber->ring.data() + subscriber->head, span);
+    subscriber->head = (subscriber->head + span) % capacity;
+    i += span;
+  }
+  subscriber->size -= len;
+  return len;
+}
+
+uint32_t TailHub::take_dropped(Subscriber *subscriber) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  uint32_t dropped = subscriber->dropped;
+  subscriber->dropped = 0;
+  return dropped;
+}
+
+void TailHub::push(Subscriber *subscriber, const uint8_t *data, size_t len) {
+  const size_t capacity = subscriber->ring.size();
+  if (len > capacity) {
+    // only the newest bytes fit
+    subscriber->dropped += len - capacity;
+    data += len - capacity;
+    len = capacity;
+  }
+  const size_t overflow = subscriber->size + len > capacity ? subscriber->size + len - capacity : 0;
+  if (overflow != 0) {
+    subscriber->head = (subscriber->head + overflow) % capacity;
+    subscriber->size -= overflow;
+    subscriber->dropped += overflow;
+  }
+  size_t tail = (subscriber->head + subscriber->size) % capacity;
+  for (size_t i = 0; i < len;) {
+    size_t span = std::min(len - i, capacity - tail);
+    memcpy(subscriber->ring.data() + tail, data + i, span);
+    tail = (tail + span) % capacity;
+    i += span;
+  }
+  subscriber->size += len;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
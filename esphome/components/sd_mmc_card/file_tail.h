@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Fans the bytes appended to a file out to its followers (live tail), as append_file() commits them.
+ * Every follower owns a bounded backlog: a follower too slow to drain it loses the oldest bytes, which are
+ * counted, and never slows the writer down. */
+class TailHub {
+ public:
+  struct Subscriber;
+
+  static constexpr size_t MAX_SUBSCRIBERS = 8;
+
+  /* nullptr once MAX_SUBSCRIBERS are following */
+  Subscriber *subscribe(const std::string &path, size_t backlog);
+  void unsubscribe(Subscriber *subscriber);
+  void publish(const char *path, const uint8_t *data, size_t len);
+  void feed(Subscriber *subscriber, const uint8_t *data, size_t len);
+  /* Move up to max pending bytes to buffer. With lines, stop after the last complete line, unless the
+   * backlog is full and no line fits. */
+  size_t read(Subscriber *subscriber, uint8_t *buffer, size_t max, bool lines = false);
+  /* Bytes lost since the previous call */
+  uint32_t take_dropped(Subscriber *subscriber);
+  bool has_subscribers() const { return this->count_ != 0; }
+
+ protected:
+  void push(Subscriber *subscriber, const uint8_t *data, size_t len);
+
+  std::mutex lock_;
+  std::vector<Subscriber *> subscribers_;
+  std::atomic<size_t> count_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,170 @@
+#include "io_scheduler.h"
+
+#include <algorithm>
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+// a transfer that asked nothing for that long (its client isn't reading) no longer holds up the round
+static const uint32_t IDLE_TIMEOUT_MS = 100;
+// burst a capped client may take after a pause, in milliseconds of its rate
+static const uint32_t RATE_BURST_MS = 250;
+
+struct IoScheduler::Transfer {
+  IoClass io_class;
+  uint8_t weight;
+  int32_t credit;
+  uint32_t last_ms;
+  std::map<std::string, Client>::iterator client;
+};
+
+IoScheduler::Transfer *IoScheduler::begin(const std::string &client, IoClass io_class, IoRequest request) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  auto it = this->clients_.find(client);
+  if (it == this->clients_.end()) {
+    // a new client starts with a full burst
+    uint32_t rate = this->rate_limit_of(client);
+    int64_t burst = static_cast<int64_t>(rate) * RATE_BURST_MS / 1000;
+    it = this->clients_.emplace(client, Client{rate, burst, millis(), 0}).first;
+  }
+  it->second.transfers++;
+
+  Transfer *transfer = new Transfer{io_class, this->weights_[request], 0, millis(), it};
+  transfer->credit = static_cast<int32_t>(this->quantum_ * transfer->weight);
+  this->transfers_.push_back(transfer);
+  return transfer;
+}
+
+void IoScheduler::end(Transfer *transfer) {
+  if (transfer == nullptr)
+    return;
+  std::lock_guard<std::mutex> lock(this->lock_);
+  // the client entry keeps its debt while another transfer of it is running
+  if (--transfer->client->second.transfers == 0)
+    this->clients_.erase(transfer->client);
+  this->transfers_.erase(std::remove(this->transfers_.begin(), this->transfers_.end(), transfer),
+                         this->transfers_.end());
+  delete transfer;
+}
+
+size_t IoScheduler::acquire(Transfer *transfer, size_t wanted) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  const uint32_t now = millis();
+  transfer->last_ms = now;
+  if (transfer->io_class == IO_REALTIME) {
+    this->realtime_in_flight_++;
+    return wanted;
+  }
+  if (this->realtime_in_flight_ != 0) {
+    this->deferred_++;
+    return 0;
+  }
+
+  if (transfer->credit <= 0) {
+    if (this->round_busy(transfer, now)) {
+      this->deferred_++;
+      return 0;
+    }
+    this->start_round();
+    if (transfer->credit <= 0) {
+      // still paying back a charged upload
+      this->deferred_++;
+      return 0;
+    }
+  }
+  size_t granted = std::min<size_t>(wanted, transfer->credit);
+
+  Client &client = transfer->client->second;
+  if (client.rate != 0) {
+    this->refill(client, now);
+    if (client.tokens <= 0) {
+      this->deferred_++;
+      return 0;
+    }
+    granted = std::min<size_t>(granted, client.tokens);
+    client.tokens -= granted;
+  }
+  transfer->credit -= granted;
+  return granted;
+}
+
+void IoScheduler::release(Transfer *transfer, size_t granted, size_t used) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (transfer->io_class == IO_REALTIME) {
+    if (this->realtime_in_flight_ != 0)
+      this->realtime_in_flight_--;
+    return;
+  }
+  if (used >= granted)
+    return;
+  transfer->credit += granted - used;
+  if (transfer->client->second.rate != 0)
+    transfer->client->second.tokens += granted - used;
+}
+
+void IoScheduler::charge(Transfer *transfer, size_t used) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  transfer->last_ms = millis();
+  if (transfer->io_class == IO_REALTIME)
+    return;
+  transfer->credit -= used;
+  Client &client = transfer->client->second;
+  if (client.rate != 0) {
+    this->refill(client, transfer->last_ms);
+    client.tokens -= used;
+  }
+}
+
+void IoScheduler::add_client_rate_limit(const std::string &client, uint32_t rate) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->rate_limits_[client] = rate;
+}
+
+size_t IoScheduler::get_active_transfers() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  return this->transfers_.size();
+}
+
+uint32_t IoScheduler::rate_limit_of(const std::string &client) const {
+  auto it = this->rate_limits_.find(client);
+  return it != this->rate_limits_.end() ? it->second : this->default_rate_limit_;
+}
+
+void IoScheduler::refill(Client &client, uint32_t now) {
+  const int64_t burst = static_cast<int64_t>(client.rate) * RATE_BURST_MS / 1000;
+  const int64_t added = static_cast<int64_t>(client.rate) * (now - client.refill_ms) / 1000;
+  // a slow rate would otherwise lose every millisecond to the rounding
+  if (added == 0)
+    return;
+  client.tokens = std::min(client.tokens + added, burst);
+  client.refill_ms = now;
+}
+
+bool IoScheduler::round_busy(const Transfer *transfer, uint32_t now) const {
+  for (const Transfer *other : this->transfers_) {
+    if (other == transfer || other->io_class != IO_BULK || other->credit <= 0 ||
+        now - other->last_ms >= IDLE_TIMEOUT_MS)
+      continue;
+    // a client held back by its rate cap doesn't hold up the others either
+    const Client &client = other->client->second;
+    if (client.rate != 0 && client.tokens <= 0)
+      continue;
+    return true;
+  }
+  return false;
+}
+
+void IoScheduler::start_round() {
+  // a debt is carried over, unused credit isn't, so an idle transfer can't hoard rounds
+  for (Transfer *transfer : this->transfers_) {
+    if (transfer->io_class != IO_BULK)
+      continue;
+    const int32_t quantum = static_cast<int32_t>(this->quantum_ * transfer->weight);
+    transfer->credit = std::min(transfer->credit + quantum, quantum);
+  }
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+enum IoClass : uint8_t {
+  IO_BULK,
+  IO_REALTIME,
+};
+
+/* What a bulk transfer serves, each kind has its own weight in the rounds */
+enum IoRequest : uint8_t {
+  IO_REQUEST_GET,
+  IO_REQUEST_PUT,
+  IO_REQUEST_INTERNAL,
+};
+
+/* Shares the card bandwidth between the transfers running at the same time.
+ * Bulk transfers (HTTP downloads and uploads, OTA) are served in weighted round robin: each round every busy
+ * transfer may move quantum * weight bytes, the weight being the one of its request kind, and a new round only
+ * starts once they all used theirs. A transfer idle for a
+ * while (client not reading) no longer holds up the round. Every client may also be capped to a byte rate.
+ * Real-time transfers (audio) bypass both, and no bulk transfer is granted while one of their reads is running.
+ * Grants are cooperative: a bulk transfer given 0 bytes retries later (RESPONSE_TRY_AGAIN for a web response). */
+class IoScheduler {
+ public:
+  struct Transfer;
+
+  Transfer *begin(const std::string &client, IoClass io_class, IoRequest request = IO_REQUEST_INTERNAL);
+  /* Forget the transfer, must be called once whether it completed or was dropped */
+  void end(Transfer *transfer);
+  /* Bytes the transfer may move now, at most wanted, 0 meaning try again later */
+  size_t acquire(Transfer *transfer, size_t wanted);
+  /* Report the bytes actually moved out of a grant, the rest goes back to the transfer */
+  void release(Transfer *transfer, size_t granted, size_t used);
+  /* Account bytes moved without a grant (an upload body has to be written when it arrives), the debt is paid
+   * back by the transfer and its client on their next grants */
+  void charge(Transfer *transfer, size_t used);
+
+  void set_quantum(size_t quantum) { this->quantum_ = quantum; }
+  /* Quanta a transfer of that kind gets per round, 1 by default */
+  void set_weight(IoRequest request, uint8_t weight) { this->weights_[request] = std::max<uint8_t>(weight, 1); }
+  /* Rate cap in bytes per second applied to each client without its own, 0 for none */
+  void set_default_rate_limit(uint32_t rate) { this->default_rate_limit_ = rate; }
+  void add_client_rate_limit(const std::string &client, uint32_t rate);
+
+  size_t get_quantum() const { return this->quantum_; }
+  uint8_t get_weight(IoRequest request) const { return this->weights_[request]; }
+  uint32_t get_default_rate_limit() const { return this->default_rate_limit_; }
+  size_t get_client_rate_limit_count() const { return this->rate_limits_.size(); }
+  size_t get_active_transfers();
+  uint32_t get_deferred_count() const { return this->deferred_; }
+
+ protected:
+  struct Client {
+    uint32_t rate;
+    int64_t tokens;
+    uint32_t refill_ms;
+    uint16_t transfers;
+  };
+
+  uint32_t rate_limit_of(const std::string &client) const;
+  void refill(Client &client, uint32_t now);
+  bool round_busy(const Transfer *transfer, uint32_t now) const;
+  void start_round();
+
+  std::mutex lock_;
+  size_t quantum_{16 * 1024};
+  uint8_t weights_[IO_REQUEST_INTERNAL + 1]{1, 1, 1};
+  uint32_t default_rate_limit_{0};
+  std::map<std::string, uint32_t> rate_limits_;
+  std::map<std::string, Client> clients_;
+  std::vector<Transfer *> transfers_;
+  uint16_t realtime_in_flight_{0};
+  uint32_t deferred_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,332 @@
+#include "raw_log.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+#ifdef USE_ESP_IDF
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.raw_log";
+
+static const uint32_t SUPERBLOCK_MAGIC = 0x42534C52;  // "RLSB"
+static const uint32_t BATCH_MAGIC = 0x474F4C52;       // "RLOG"
+static const uint16_t RECORD_MAGIC = 0x4352;          // "RC"
+static const uint32_t FORMAT_VERSION = 1;
+
+struct Superblock {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t generation;
+  uint32_t batch_sectors;
+  uint32_t batch_count;
+  uint32_t crc;
+};
+
+struct BatchHeader {
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t sequence;
+  uint32_t crc;
+};
+
+// the record crc covers the length and the payload, seeded with the batch sequence so that records left over
+// from an earlier pass over the ring are never taken for new ones
+struct RecordHeader {
+  uint16_t magic;
+  uint16_t length;
+  uint32_t crc;
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+#ifdef USE_ESP_IDF
+  return esp_rom_crc32_le(crc, data, len);
+#else
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+#endif
+}
+
+static uint32_t record_crc(uint32_t sequence, uint16_t length, const uint8_t *payload) {
+  uint32_t crc = crc32(sequence, reinterpret_cast<const uint8_t *>(&length), sizeof(length));
+  return crc32(crc, payload, length);
+}
+
+static uint8_t *allocate_buffer(size_t size, bool dma) {
+#ifdef USE_ESP_IDF
+  if (dma)
+    return static_cast<uint8_t *>(heap_caps_malloc(size, MALLOC_CAP_DMA));
+#endif
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  return allocator.allocate(size);
+}
+
+static void free_buffer(uint8_t *buffer, size_t size, bool dma) {
+  if (buffer == nullptr)
+    return;
+#ifdef USE_ESP_IDF
+  if (dma) {
+    heap_caps_free(buffer);
+    return;
+  }
+#endif
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  allocator.deallocate(buffer, size);
+}
+
+RawLog::~RawLog() {
+  free_buffer(this->buffer_, this->batch_bytes(), true);
+  free_buffer(this->read_buffer_, this->batch_bytes(), false);
+}
+
+bool RawLog::allocate(uint32_t batch_sectors) {
+  this->batch_sectors_ = batch_sectors;
+  // the batch being written goes to the card straight from this buffer, reads can stay in PSRAM
+  this->buffer_ = allocate_buffer(this->batch_bytes(), true);
+  this->read_buffer_ = allocate_buffer(this->batch_bytes(), false);
+  return this->buffer_ != nullptr && this->read_buffer_ != nullptr;
+}
+
+bool RawLog::open(SectorDevice *device, uint32_t first_sector, uint32_t sector_count) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->device_ = device;
+  this->superblock_sector_ = first_sector;
+  // batches are aligned on their own size on the device
+  uint32_t end = first_sector + sector_count;
+  this->first_batch_sector_ = (first_sector + this->batch_sectors_) / this->batch_sectors_ * this->batch_sectors_;
+  this->batch_count_ = end > this->first_batch_sector_ ? (end - this->first_batch_sector_) / this->batch_sectors_ : 0;
+  this->read_valid_ = false;
+  if (this->batch_count_ < 2) {
+    ESP_LOGE(TAG, "Region of %u sectors is too small for %u sectors batches", sector_count, this->batch_sectors_);
+    this->device_ = nullptr;
+    return false;
+  }
+
+  Superblock superblock;
+  bool ok = device->read(this->superblock_sector_, this->buffer_, 1);
+  memcpy(&superblock, this->buffer_, sizeof(superblock));
+  if (ok && superblock.magic == SUPERBLOCK_MAGIC && superblock.version == FORMAT_VERSION &&
+      superblock.crc == crc32(0, this->buffer_, offsetof(Superblock, crc)) &&
+      superblock.batch_sectors == this->batch_sectors_ && superblock.batch_count == this->batch_count_) {
+    this->generation_ = superblock.generation;
+    ok = this->recover();
+  } else {
+    ESP_LOGI(TAG, "No log found, formatting %u batches of %u sectors", this->batch_count_, this->batch_sectors_);
+    ok = this->format();
+  }
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to open the log");
+    this->device_ = nullptr;
+  }
+  return ok;
+}
+
+void RawLog::close() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  this->device_ = nullptr;
+  this->dirty_ = false;
+  this->read_valid_ = false;
+}
+
+bool RawLog::format() {
+  // a new generation invalidates every batch header left on the device
+  this->generation_ = random_uint32();
+  Superblock superblock = {SUPERBLOCK_MAGIC, FORMAT_VERSION, this->generation_, this->batch_sectors_,
+                           this->batch_count_, 0};
+  memset(this->buffer_, 0, SECTOR_SIZE);
+  memcpy(this->buffer_, &superblock, sizeof(superblock));
+  superblock.crc = crc32(0, this->buffer_, offsetof(Superblock, crc));
+  memcpy(this->buffer_, &superblock, sizeof(superblock));
+  if (!this->device_->write(this->superblock_sector_, this->buffer_, 1))
+    return false;
+  this->start_batch(0);
+  return true;
+}
+
+bool RawLog::recover() {
+  // every slot is looked at: a single torn header must not hide the batches written after it
+  bool found = false;
+  for (uint32_t slot = 0; slot < this->batch_count_; slot++) {
+    uint32_t sequence;
+    if (this->read_batch_header(slot, &sequence) && (!found || sequence > this->head_sequence_)) {
+      this->head_sequence_ = sequence;
+      found = true;
+    }
+  }
+  if (!found) {
+    this->start_batch(0);
+    return true;
+  }
+  if (!this->device_->read(this->batch_sector(this->head_sequence_), this->buffer_, this->batch_sectors_))
+    return false;
+
+  // continue after the last complete record, a torn one is overwritten
+  uint32_t offset = sizeof(BatchHeader);
+  const uint8_t *payload;
+  uint16_t length;
+  while (this->parse_record(this->buffer_, this->head_sequence_, offset, &payload, &length))
+    offset += sizeof(RecordHeader) + length;
+  memset(this->buffer_ + offset, 0, this->batch_bytes() - offset);
+  this->offset_ = offset;
+  this->flushed_offset_ = offset / SECTOR_SIZE * SECTOR_SIZE;
+  this->dirty_ = false;
+  ESP_LOGI(TAG, "Recovered log, newest batch %u (%u bytes used)", this->head_sequence_, offset);
+  return true;
+}
+
+bool RawLog::read_batch_header(uint32_t slot, uint32_t *sequence) {
+  uint8_t *sector = this->read_buffer_;
+  this->read_valid_ = false;
+  if (!this->device_->read(this->first_batch_sector_ + slot * this->batch_sectors_, sector, 1))
+    return false;
+  BatchHeader header;
+  memcpy(&header, sector, sizeof(header));
+  if (header.magic != BATCH_MAGIC || header.generation != this->generation_ ||
+      header.crc != crc32(0, sector, offsetof(BatchHeader, crc)) ||
+      header.sequence % this->batch_count_ != slot)
+    return false;
+  *sequence = header.sequence;
+  return true;
+}
+
+void RawLog::start_batch(uint32_t sequence) {
+  BatchHeader header = {BATCH_MAGIC, this->generation_, sequence, 0};
+  memset(this->buffer_, 0, this->batch_bytes());
+  memcpy(this->buffer_, &header, sizeof(header));
+  header.crc = crc32(0, this->buffer_, offsetof(BatchHeader, crc));
+  memcpy(this->buffer_, &header, sizeof(header));
+  this->head_sequence_ = sequence;
+  this->offset_ = sizeof(BatchHeader);
+  this->flushed_offset_ = 0;
+  if (this->read_valid_ && this->read_sequence_ % this->batch_count_ == sequence % this->batch_count_)
+    this->read_valid_ = false;
+}
+
+bool RawLog::append(const uint8_t *data, size_t len) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (this->device_ == nullptr || len == 0 || len > this->get_max_record_size())
+    return false;
+  if (this->offset_ + sizeof(RecordHeader) + len > this->batch_bytes()) {
+    if (!this->write_pending())
+      return false;
+    this->start_batch(this->head_sequence_ + 1);
+  }
+  RecordHeader header = {RECORD_MAGIC, static_cast<uint16_t>(len),
+                         record_crc(this->head_sequence_, static_cast<uint16_t>(len), data)};
+  memcpy(this->buffer_ + this->offset_, &header, sizeof(header));
+  memcpy(this->buffer_ + this->offset_ + sizeof(header), data, len);
+  this->offset_ += sizeof(header) + len;
+  this->dirty_ = true;
+  this->bytes_written_ += len;
+  return true;
+}
+
+bool RawLog::flush() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (this->device_ == nullptr)
+    return false;
+  return this->write_pending();
+}
+
+bool RawLog::write_pending() {
+  if (!this->dirty_)
+    return true;
+  // only the sectors touched since the last write go to the device, a full batch is one aligned transfer
+  uint32_t first = this->flushed_offset_ / SECTOR_SIZE;
+  uint32_t last = (this->offset_ + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  if (!this->device_->write(this->batch_sector(this->head_sequence_) + first, this->buffer_ + first * SECTOR_SIZE,
+                            last - first)) {
+    ESP_LOGW(TAG, "Failed to write batch %u", this->head_sequence_);
+    return false;
+  }
+  this->flushed_offset_ = this->offset_ / SECTOR_SIZE * SECTOR_SIZE;
+  this->dirty_ = false;
+  return true;
+}
+
+RawLog::Cursor RawLog::begin() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  uint32_t oldest = this->head_sequence_ + 1 >= this->batch_count_ ? this->head_sequence_ + 1 - this->batch_count_ : 0;
+  return Cursor{oldest, sizeof(BatchHeader)};
+}
+
+bool RawLog::read(Cursor &cursor, std::vector<uint8_t> &record) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (this->device_ == nullptr)
+    return false;
+  uint32_t oldest = this->head_sequence_ + 1 >= this->batch_count_ ? this->head_sequence_ + 1 - this->batch_count_ : 0;
+  while (cursor.sequence <= this->head_sequence_) {
+    if (cursor.sequence < oldest) {
+      // overwritten while reading, skip ahead to what is left
+      cursor = Cursor{oldest, sizeof(BatchHeader)};
+    }
+    const uint8_t *batch = this->buffer_;
+    if (cursor.sequence != this->head_sequence_) {
+      if (!this->read_valid_ || this->read_sequence_ != cursor.sequence) {
+        uint32_t sequence;
+        if (!this->read_batch_header(cursor.sequence % this->batch_count_, &sequence) ||
+            sequence != cursor.sequence ||
+            !this->device_->read(this->batch_sector(cursor.sequence), this->read_buffer_, this->batch_sectors_)) {
+          cursor = Cursor{cursor.sequence + 1, sizeof(BatchHeader)};
+          continue;
+        }
+        this->read_sequence_ = cursor.sequence;
+        this->read_valid_ = true;
+      }
+      batch = this->read_buffer_;
+    }
+
+    const uint8_t *payload;
+    uint16_t length;
+    if (this->parse_record(batch, cursor.sequence, cursor.offset, &payload, &length)) {
+      record.assign(payload, payload + length);
+      cursor.offset += sizeof(RecordHeader) + length;
+      return true;
+    }
+    if (cursor.sequence == this->head_sequence_)
+      return false;
+    cursor = Cursor{cursor.sequence + 1, sizeof(BatchHeader)};
+  }
+  return false;
+}
+
+bool RawLog::parse_record(const uint8_t *batch, uint32_t sequence, uint32_t offset, const uint8_t **payload,
+                          uint16_t *length) const {
+  if (offset + sizeof(RecordHeader) > this->batch_bytes())
+    return false;
+  RecordHeader header;
+  memcpy(&header, batch + offset, sizeof(header));
+  if (header.magic != RECORD_MAGIC || header.length == 0 ||
+      offset + sizeof(RecordHeader) + header.length > this->batch_bytes())
+    return false;
+  const uint8_t *data = batch + offset + sizeof(RecordHeader);
+  if (header.crc != record_crc(sequence, header.length, data))
+    return false;
+  *payload = data;
+  *length = header.length;
+  return true;
+}
+
+size_t RawLog::get_max_record_size() const {
+  return std::min<size_t>(this->batch_bytes() - sizeof(BatchHeader) - sizeof(RecordHeader), UINT16_MAX);
+}
+
+uint32_t RawLog::batch_sector(uint32_t sequence) const {
+  return this->first_batch_sector_ + (sequence % this->batch_count_) * this->batch_sectors_;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "sector_device.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+/* Append-only log of CRC framed records written straight to a reserved range of sectors, without the FAT.
+ * The range starts with a superblock sector, followed by fixed size batches used as a ring. Each batch
+ * carries a sequence number and lives in slot sequence % batch count, so the newest batch is the valid
+ * header with the highest sequence when the log is opened. */
+class RawLog {
+ public:
+  struct Cursor {
+    uint32_t sequence;
+    uint32_t offset;
+  };
+
+  ~RawLog();
+  /* Allocate the batch buffers, batch_sectors also sets the write alignment on the device. */
+  bool allocate(uint32_t batch_sectors);
+  /* Attach to sector_count sectors of device starting at first_sector, formatting them if needed. */
+  bool open(SectorDevice *device, uint32_t first_sector, uint32_t sector_count);
+  void close();
+  bool is_open() const { return this->device_ != nullptr; }
+
+  /* Queue a record, the batch is written once full or on flush(). */
+  bool append(const uint8_t *data, size_t len);
+  bool flush();
+  bool is_dirty() const { return this->dirty_; }
+
+  /* Cursor on the oldest record still stored. */
+  Cursor begin();
+  /* Copy the record under cursor and move it forward, false once past the newest record. */
+  bool read(Cursor &cursor, std::vector<uint8_t> &record);
+
+  size_t get_max_record_size() const;
+  uint32_t get_batch_count() const { return this->batch_count_; }
+  uint64_t get_bytes_written() const { return this->bytes_written_; }
+
+ protected:
+  bool format();
+  bool recover();
+  bool read_batch_header(uint32_t slot, uint32_t *sequence);
+  bool write_pending();
+  void start_batch(uint32_t sequence);
+  bool parse_record(const uint8_t *batch, uint32_t sequence, uint32_t offset, const uint8_t **payload,
+                    uint16_t *length) const;
+  uint32_t batch_sector(uint32_t sequence) const;
+  uint32_t batch_bytes() const { return this->batch_sectors_ * SECTOR_SIZE; }
+
+  std::mutex lock_;
+  SectorDevice *device_{nullptr};
+  uint32_t batch_sectors_{0};
+  uint32_t superblock_sector_;
+  uint32_t first_batch_sector_;
+  uint32_t batch_count_{0};
+  uint32_t generation_;
+  // batch being filled, always the newest one
+  uint8_t *buffer_{nullptr};
+  uint32_t head_sequence_;
+  uint32_t offset_;
+  uint32_t flushed_offset_;
+  std::atomic<bool> dirty_{false};
+  // last batch loaded by read()
+  uint8_t *read_buffer_{nullptr};
+  uint32_t read_sequence_;
+  bool read_valid_{false};
+  std::atomic<uint64_t> bytes_written_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,233 @@
+#include "rotating_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.rotating_log";
+
+RotatingLog::RotatingLog(SdMmc *parent) : parent_(parent) {}
+
+bool RotatingLog::append(const uint8_t *data, size_t len) {
+  if (this->state_ != STATE_READY)
+    return false;
+  if (this->current_ != nullptr) {
+    const Generation &current = this->generations_.back();
+    if ((this->max_size_ != 0 && current.size != 0 && current.size + len > this->max_size_) ||
+        (this->max_age_ != 0 && millis() - this->opened_ms_ >= this->max_age_))
+      this->rotate();
+  }
+  if (this->current_ == nullptr && !this->open_current())
+    return false;
+  bool written;
+  {
+    // readers of the generation (file server, follow) see whole appends, and the card stays mounted meanwhile
+    auto lock = this->parent_->lock_write(this->current_path_.c_str());
+    written = this->parent_->is_mounted() && fwrite(data, 1, len, this->current_) == len &&
+              fflush(this->current_) == 0;
+    // a handle kept by the pool for a reader still sees the old size
+    if (written)
+      this->parent_->close_handles(this->current_path_.c_str());
+  }
+  if (!written) {
+    ESP_LOGE(TAG, "Failed to append to %s", this->current_path_.c_str());
+    this->close_current();
+    return false;
+  }
+  this->generations_.back().size += len;
+  this->total_size_ += len;
+  this->parent_->notify_file_event(FILE_MODIFIED, this->current_path_);
+  return true;
+}
+
+bool RotatingLog::append(const std::string &data) {
+  return this->append(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+}
+
+void RotatingLog::rotate() {
+  if (this->state_ != STATE_READY)
+    return;
+  this->close_current();
+  this->rotate_pending_ = true;
+}
+
+bool RotatingLog::step(uint32_t start_ms, uint32_t slice_ms) {
+  if (!this->parent_->is_mounted()) {
+    if (this->state_ != STATE_UNLOADED)
+      this->unload();
+    return false;
+  }
+  switch (this->state_) {
+    case STATE_UNLOADED:
+      if (this->start_scan())
+        return true;
+      // retried once the card has been remounted
+      this->state_ = STATE_FAILED;
+      return false;
+    case STATE_FAILED:
+      return false;
+    case STATE_SCANNING:
+      while (millis() - start_ms < slice_ms) {
+        if (!this->scan_entry())
+          return false;
+      }
+      return true;
+    case STATE_READY:
+      // the current generation is never deleted
+      while (this->generations_.size() > 1 && this->over_retention()) {
+        if (millis() - start_ms >= slice_ms)
+          return true;
+        Generation oldest = this->generations_.front();
+        this->generations_.pop_front();
+        this->total_size_ -= oldest.size;
+        this->delete_generation(oldest.sequence);
+      }
+      return false;
+  }
+  return false;
+}
+
+bool RotatingLog::take_pruned() {
+  const bool pruned = this->pruned_;
+  this->pruned_ = false;
+  return pruned;
+}
+
+void RotatingLog::delete_generation(uint32_t sequence) {
+  // not through delete_file(), its directory check and sensor update per file don't fit in the slice
+  std::string path = this->generation_path(sequence);
+  auto lock = this->parent_->lock_write(path.c_str());
+  if (!this->parent_->is_mounted())
+    return;
+  this->parent_->close_handles(path.c_str());
+  if (::remove(build_path(path.c_str()).c_str()) != 0) {
+    ESP_LOGW(TAG, "Failed to delete generation %u of %s: %s", sequence, this->path_.c_str(), strerror(errno));
+    return;
+  }
+  this->pruned_ = true;
+  this->parent_->notify_file_event(FILE_DELETED, path);
+}
+
+bool RotatingLog::start_scan() {
+  if (!this->parent_->is_directory(this->path_) && !this->parent_->create_directory(this->path_.c_str())) {
+    ESP_LOGE(TAG, "Failed to create %s", this->path_.c_str());
+    return false;
+  }
+  {
+    auto lock = this->parent_->lock_read(this->path_.c_str());
+    this->scan_dir_ = opendir(build_path(this->path_.c_str()).c_str());
+  }
+  if (this->scan_dir_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s", this->path_.c_str());
+    return false;
+  }
+  this->generations_.clear();
+  this->total_size_ = 0;
+  this->state_ = STATE_SCANNING;
+  return true;
+}
+
+bool RotatingLog::scan_entry() {
+  // the directory is read an entry per call, the lock is only held for that entry
+  auto lock = this->parent_->lock_read(this->path_.c_str());
+  // removed since the last slice, the next step() unloads the log
+  if (!this->parent_->is_mounted())
+    return true;
+  struct dirent *entry = readdir(this->scan_dir_);
+  if (entry == nullptr) {
+    closedir(this->scan_dir_);
+    this->scan_dir_ = nullptr;
+    std::sort(this->generations_.begin(), this->generations_.end(),
+              [](const Generation &a, const Generation &b) { return a.sequence < b.sequence; });
+    this->state_ = STATE_READY;
+    ESP_LOGD(TAG, "%s: %u generations, %s", this->path_.c_str(), this->generations_.size(),
+             format_size(this->total_size_).c_str());
+    return false;
+  }
+  uint32_t sequence;
+  char suffix[8];
+  if (entry->d_type == DT_DIR || sscanf(entry->d_name, "%8u.%7s", &sequence, suffix) != 2 ||
+      strcmp(suffix, "log") != 0)
+    return true;
+  Generation generation{sequence, 0};
+  // sizes are only needed for the byte budget and the size limit of the generation continued
+  struct stat info;
+  if ((this->max_total_size_ != 0 || this->max_size_ != 0) &&
+      stat(build_path(this->generation_path(sequence).c_str()).c_str(), &info) == 0)
+    generation.size = info.st_size;
+  this->generations_.push_back(generation);
+  this->total_size_ += generation.size;
+  return true;
+}
+
+bool RotatingLog::over_retention() const {
+  return (this->keep_ != 0 && this->generations_.size() > this->keep_) ||
+         (this->max_total_size_ != 0 && this->total_size_ > this->max_total_size_);
+}
+
+bool RotatingLog::open_current() {
+  // after a reboot the newest generation is continued
+  const bool created = this->generations_.empty() || this->rotate_pending_;
+  if (created) {
+    uint32_t sequence = this->generations_.empty() ? 1 : this->generations_.back().sequence + 1;
+    this->generations_.push_back(Generation{sequence, 0});
+    this->rotate_pending_ = false;
+  }
+  this->current_path_ = this->generation_path(this->generations_.back().sequence);
+  {
+    auto lock = this->parent_->lock_write(this->current_path_.c_str());
+    this->current_ = this->parent_->open_file(this->current_path_.c_str(), "ab");
+  }
+  if (this->current_ == nullptr)
+    return false;
+  if (created)
+    this->parent_->notify_file_event(FILE_CREATED, this->current_path_);
+  this->opened_ms_ = millis();
+  ESP_LOGV(TAG, "Writing to %s", this->current_path_.c_str());
+  return true;
+}
+
+void RotatingLog::close_current() {
+  if (this->current_ != nullptr) {
+    auto lock = this->parent_->lock_write(this->current_path_.c_str());
+    fclose(this->current_);
+  }
+  this->current_ = nullptr;
+}
+
+void RotatingLog::unload() {
+  this->close_current();
+  if (this->scan_dir_ != nullptr)
+    closedir(this->scan_dir_);
+  this->scan_dir_ = nullptr;
+  this->generations_.clear();
+  this->total_size_ = 0;
+  this->rotate_pending_ = false;
+  this->state_ = STATE_UNLOADED;
+}
+
+std::string RotatingLog::generation_path(uint32_t sequence) const {
+  return this->path_ + str_sprintf("/%08u.log", sequence);
+}
+
+void RotatingLog::set_path(std::string const &path) { this->path_ = path; }
+
+void RotatingLog::set_max_size(uint32_t size) { this->max_size_ = size; }
+
+void RotatingLog::set_max_age(uint32_t age) { this->max_age_ = age; }
+
+void RotatingLog::set_keep(uint32_t keep) { this->keep_ = keep; }
+
+void RotatingLog::set_max_total_size(uint64_t size) { this->max_total_size_ = size; }
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
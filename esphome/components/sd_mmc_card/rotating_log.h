@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+
+#include <dirent.h>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+/* Log written to numbered files (generations) in a directory, a new one being started once the current one is
+ * too big or too old. Old generations are deleted past a count or a byte budget. The directory is scanned and
+ * the retention applied by step(), called from the card loop with a time budget, so neither a large directory
+ * nor thousands of deletions hold the main loop. */
+class RotatingLog {
+ public:
+  RotatingLog(SdMmc *parent);
+
+  /* Append to the current generation, false until the directory has been scanned */
+  bool append(const uint8_t *data, size_t len);
+  bool append(const std::string &data);
+  /* Close the current generation, the next append starts a new one */
+  void rotate();
+  /* Do scanning or retention work until slice_ms have passed since start_ms, false when there is nothing to do */
+  bool step(uint32_t start_ms, uint32_t slice_ms);
+  /* True once after step() deleted generations, the space sensors are updated then rather than per file */
+  bool take_pruned();
+
+  bool is_ready() const { return this->state_ == STATE_READY; }
+  const std::string &get_path() const { return this->path_; }
+  size_t get_generation_count() const { return this->generations_.size(); }
+  uint64_t get_total_size() const { return this->total_size_; }
+
+  void set_path(std::string const &);
+  void set_max_size(uint32_t);
+  void set_max_age(uint32_t);
+  void set_keep(uint32_t);
+  void set_max_total_size(uint64_t);
+
+ protected:
+  enum State : uint8_t {
+    STATE_UNLOADED,
+    STATE_SCANNING,
+    STATE_READY,
+    STATE_FAILED,
+  };
+  struct Generation {
+    uint32_t sequence;
+    uint32_t size;
+  };
+
+  bool start_scan();
+  bool scan_entry();
+  bool over_retention() const;
+  void delete_generation(uint32_t sequence);
+  bool open_current();
+  void close_current();
+  void unload();
+  std::string generation_path(uint32_t sequence) const;
+
+  SdMmc *parent_;
+  std::string path_;
+  uint32_t max_size_{0};
+  uint32_t max_age_{0};
+  uint32_t keep_{0};
+  uint64_t max_total_size_{0};
+
+  State state_{STATE_UNLOADED};
+  DIR *scan_dir_{nullptr};
+  // oldest first, the last one is the current generation
+  std::deque<Generation> generations_;
+  uint64_t total_size_{0};
+  FILE *current_{nullptr};
+  std::string current_path_;
+  uint32_t opened_ms_{0};
+  bool rotate_pending_{false};
+  bool pruned_{false};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -1,61 +1,452 @@
 #include "sd_mmc_card.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <sys/stat.h>
 
 #include "math.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 namespace esphome {
 namespace sd_mmc_card {
 
 static const char *TAG = "sd_mmc_card";
 
+static const uint32_t MOUNT_TASK_STACK_SIZE = 4096;
+static const UBaseType_t MOUNT_TASK_PRIORITY = 1;
+static const uint32_t CARD_POLL_INTERVAL_MS = 500;
+// freed sectors are erased once the card has seen no filesystem I/O for that long, a slice at a time
+static const uint32_t TRIM_IDLE_DELAY_MS = 2000;
+static const uint32_t TRIM_SWEEP_SECTORS = 2048;
+// the self-test waits for that long without filesystem I/O, it measures the card and not the contention
+static const uint32_t SELF_TEST_IDLE_DELAY_MS = 2000;
+// time given to the rotating logs in each loop to scan their directory or delete old generations
+static const uint32_t ROTATION_SLICE_MS = 4;
+static const uint32_t BATCH_SLICE_MS = 8;
+// events waiting for the main loop, past that they are dropped
+static const size_t MAX_PENDING_FILE_EVENTS = 64;
+// the lock wait time moves with every contended access, it is published at most that often
+static const uint32_t LOCK_SENSOR_INTERVAL_MS = 1000;
+static const uint32_t CACHE_SENSOR_INTERVAL_MS = 5000;
+static const uint32_t CIPHER_SENSOR_INTERVAL_MS = 5000;
+// handles kept open longer than this without use are closed
+static const uint32_t HANDLE_IDLE_MS = 30000;
+
 bool SdMmc::exists(const std::string &path) {
-  FILE *file = fopen(path.c_str(), "rb");
-  if (file != nullptr) {
-    fclose(file);
+  auto lock = this->lock_read(path.c_str());
+  if (!this->check_mounted(path.c_str()))
+    return false;
+  size_t size;
+  if (this->atomic_writer_.pending_size(path, &size))
     return true;
-  }
-  return false;
+  std::string absolut_path = build_path(path.c_str());
+  if (this->handles_.pooled_size(absolut_path, &size))
+    return true;
+  struct stat info;
+  return stat(absolut_path.c_str(), &info) == 0;
 }
 
 size_t SdMmc::get_file_size(const std::string &path) {
-  FILE *file = fopen(path.c_str(), "rb");
-  if (file == nullptr) {
+  auto lock = this->lock_read(path.c_str());
+  if (!this->check_mounted(path.c_str()))
     return 0;
-  }
-  fseek(file, 0, SEEK_END);
-  size_t size = ftell(file);
-  fclose(file);
-  return size;
+  size_t size;
+  if (this->atomic_writer_.pending_size(path, &size))
+    return size;
+  std::string absolut_path = build_path(path.c_str());
+  if (this->handles_.pooled_size(absolut_path, &size))
+    return this->cipher_.plain_size(path.c_str(), size);
+  struct stat info;
+  if (stat(absolut_path.c_str(), &info) != 0 || S_ISDIR(info.st_mode))
+    return 0;
+  return this->cipher_.plain_size(path.c_str(), info.st_size);
 }
 
 #ifdef USE_SENSOR
 FileSizeSensor::FileSizeSensor(sensor::Sensor *sensor, std::string const &path) : sensor(sensor), path(path) {}
 #endif
 
-void SdMmc::loop() {}
+void SdMmc::setup() {
+  if (this->power_ctrl_pin_ != nullptr)
+    this->power_ctrl_pin_->setup();
+  if (this->card_detect_pin_ != nullptr)
+    this->card_detect_pin_->setup();
+#ifdef USE_ESP_IDF
+  if (this->raw_log_size_mb_ != 0 && !this->raw_log_.allocate(this->raw_log_batch_size_ / SECTOR_SIZE)) {
+    ESP_LOGE(TAG, "Failed to allocate the raw log buffers");
+    this->raw_log_size_mb_ = 0;
+  }
+#endif
+  if (this->auto_tune_) {
+    this->tuning_pref_ = global_preferences->make_preference<CardTuning>(fnv1_hash("sd_mmc_card_tuning"));
+    if (!this->tuning_pref_.load(&this->tuning_))
+      this->tuning_ = {};
+  }
+
+  // a missing or slow card must not hold up the boot, mounting happens in the background
+  if (xTaskCreate(SdMmc::mount_task, "sd_mmc_mount", MOUNT_TASK_STACK_SIZE, this, MOUNT_TASK_PRIORITY, nullptr) !=
+      pdPASS) {
+    ESP_LOGE(TAG, "Failed to start mount task");
+    this->mark_failed();
+  }
+}
+
+void SdMmc::loop() {
+#ifdef USE_ESP_IDF
+  this->update_trim_sensors();
+  this->update_health_sensors();
+#endif
+  this->update_lock_sensors();
+  this->update_cache_sensors();
+  this->update_cipher_sensors();
+  this->handles_.close_idle(millis(), HANDLE_IDLE_MS);
+  this->atomic_writer_.loop(millis());
+  this->dispatch_file_events();
+  if (this->tuning_pending_) {
+    this->tuning_pending_ = false;
+    this->tuning_pref_.save(&this->tuning_);
+    ESP_LOGI(TAG, "Stored tuning: %u kHz", this->tuning_.frequency_khz);
+  }
+  const uint32_t start = millis();
+  bool pruned = false;
+  for (auto *log : this->rotating_logs_) {
+    const bool busy = log->step(start, ROTATION_SLICE_MS);
+    // only reported once the retention is over, not after every slice of it
+    pruned |= !busy && log->take_pruned();
+    if (busy)
+      break;
+  }
+  if (pruned)
+    this->update_sensors();
+  // one sensor update per batch, not per entry
+  if (this->batch_queue_.step(millis(), BATCH_SLICE_MS))
+    this->update_sensors();
+  this->ota_.loop();
+
+  MountState state = this->mount_state_;
+  if (state == this->published_mount_state_)
+    return;
+  this->published_mount_state_ = state;
+  ESP_LOGD(TAG, "Card state: %s", SdMmc::mount_state_to_string(state).c_str());
+
+  if (state == STATE_READY) {
+    ESP_LOGI(TAG, "Card mounted");
+#ifdef USE_TEXT_SENSOR
+    {
+      // the state read above may be stale already: card_ and card_info_ are only safe under the mount lock, the
+      // unmount and the next mount wait for it
+      auto lock = this->lock_card();
+      if (this->is_mounted()) {
+        if (this->sd_card_type_text_sensor_ != nullptr)
+          this->sd_card_type_text_sensor_->publish_state(this->sd_card_type());
+#ifdef USE_ESP_IDF
+        if (this->card_identity_text_sensor_ != nullptr)
+          this->card_identity_text_sensor_->publish_state(this->card_info_.get_identity());
+        if (this->card_speed_class_text_sensor_ != nullptr)
+          this->card_speed_class_text_sensor_->publish_state(this->card_info_.get_speed_class());
+#endif
+      }
+    }
+#endif
+    this->update_sensors();
+  } else if (state == STATE_FAILED) {
+    ESP_LOGW(TAG, "Mount failed : %s", SdMmc::error_code_to_string(this->init_error_).c_str());
+  }
+}
+
+void SdMmc::mount_task(void *params) {
+  SdMmc *sd_mmc = static_cast<SdMmc *>(params);
+  uint32_t retry_delay = 0;
+  while (true) {
+    switch (sd_mmc->mount_state_.load()) {
+      case STATE_ABSENT:
+        if (sd_mmc->is_card_inserted())
+          sd_mmc->mount_state_ = STATE_MOUNTING;
+        break;
+      case STATE_MOUNTING:
+        if (sd_mmc->mount_card()) {
+          // before anyone reads a file a reset left between its two versions
+          sd_mmc->atomic_writer_.recover();
+          sd_mmc->mount_state_ = STATE_READY;
+        } else {
+          sd_mmc->mount_state_ = STATE_FAILED;
+        }
+        retry_delay = 0;
+        break;
+      case STATE_READY:
+        if (!sd_mmc->is_card_inserted() || !sd_mmc->is_card_responding()) {
+          ESP_LOGI(TAG, "Card removed");
+          sd_mmc->mount_state_ = STATE_ABSENT;
+          // new accesses now fail the mount check, the ones in flight are waited for
+          auto lock = sd_mmc->locks_.lock_mount();
+          sd_mmc->handles_.close_all();
+          sd_mmc->unmount_card();
+          // the next card may hold other files under the same names
+          sd_mmc->file_cache_.clear();
+          break;
+        }
+#ifdef USE_ESP_IDF
+        if (sd_mmc->raw_log_.is_dirty())
+          sd_mmc->raw_log_.flush();
+        if (sd_mmc->trim_mode_ == TRIM_IDLE && sd_mmc->disk_.is_idle(TRIM_IDLE_DELAY_MS))
+          sd_mmc->disk_.sweep(TRIM_SWEEP_SECTORS);
+        if (sd_mmc->self_test_interval_ != 0 && millis() - sd_mmc->self_test_ms_ >= sd_mmc->self_test_interval_ &&
+            sd_mmc->disk_.is_idle(SELF_TEST_IDLE_DELAY_MS))
+          sd_mmc->run_self_test();
+#endif
+        break;
+      case STATE_FAILED:
+        if (!sd_mmc->is_card_inserted()) {
+          sd_mmc->mount_state_ = STATE_ABSENT;
+        } else if (retry_delay >= sd_mmc->mount_retry_interval_) {
+          sd_mmc->mount_state_ = STATE_MOUNTING;
+        }
+        retry_delay += CARD_POLL_INTERVAL_MS;
+        break;
+    }
+    if (sd_mmc->mount_state_ != STATE_MOUNTING)
+      vTaskDelay(pdMS_TO_TICKS(CARD_POLL_INTERVAL_MS));
+  }
+}
+
+bool SdMmc::is_card_inserted() {
+  // without a card detect pin the card is assumed present, removal is then caught by is_card_responding()
+  if (this->card_detect_pin_ == nullptr)
+    return true;
+  return this->card_detect_pin_->digital_read();
+}
+
+void SdMmc::update_lock_sensors() {
+#ifdef USE_SENSOR
+  if (this->lock_wait_time_sensor_ == nullptr || millis() - this->lock_sensor_published_ms_ < LOCK_SENSOR_INTERVAL_MS)
+    return;
+  this->lock_sensor_published_ms_ = millis();
+  const float wait_ms = this->locks_.get_wait_time_us() / 1000.0f;
+  if (!this->lock_wait_time_sensor_->has_state() || this->lock_wait_time_sensor_->state != wait_ms)
+    this->lock_wait_time_sensor_->publish_state(wait_ms);
+#endif
+}
+
+void SdMmc::update_cache_sensors() {
+#ifdef USE_SENSOR
+  if (!this->file_cache_.is_enabled() || millis() - this->cache_sensor_published_ms_ < CACHE_SENSOR_INTERVAL_MS)
+    return;
+  this->cache_sensor_published_ms_ = millis();
+  const uint32_t hits = this->file_cache_.get_hits();
+  const uint32_t lookups = hits + this->file_cache_.get_misses();
+  if (this->cache_hit_ratio_sensor_ != nullptr && lookups != 0) {
+    const float ratio = hits * 100.0f / lookups;
+    if (!this->cache_hit_ratio_sensor_->has_state() || this->cache_hit_ratio_sensor_->state != ratio)
+      this->cache_hit_ratio_sensor_->publish_state(ratio);
+  }
+  if (this->cache_hit_bytes_sensor_ != nullptr) {
+    const float bytes = this->file_cache_.get_hit_bytes();
+    if (!this->cache_hit_bytes_sensor_->has_state() || this->cache_hit_bytes_sensor_->state != bytes)
+      this->cache_hit_bytes_sensor_->publish_state(bytes);
+  }
+#endif
+}
+
+void SdMmc::update_cipher_sensors() {
+#ifdef USE_SENSOR
+  if (this->encryption_throughput_sensor_ == nullptr ||
+      millis() - this->cipher_sensor_published_ms_ < CIPHER_SENSOR_INTERVAL_MS)
+    return;
+  this->cipher_sensor_published_ms_ = millis();
+  // bytes per second the peripheral sustains while busy, to compare with the bus throughput
+  const uint64_t bytes = this->cipher_.get_bytes();
+  const uint64_t busy_us = this->cipher_.get_busy_us();
+  if (busy_us == this->cipher_published_us_)
+    return;
+  const float throughput = (bytes - this->cipher_published_bytes_) * 1e6f / (busy_us - this->cipher_published_us_);
+  this->cipher_published_bytes_ = bytes;
+  this->cipher_published_us_ = busy_us;
+  this->encryption_throughput_sensor_->publish_state(throughput);
+#endif
+}
+
+std::shared_ptr<const FileCache::Block> SdMmc::read_cached(const char *path) {
+  if (!this->file_cache_.is_enabled())
+    return nullptr;
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return nullptr;
+  return this->read_cached_locked(path);
+}
+
+std::shared_ptr<const FileCache::Block> SdMmc::read_cached_locked(const char *path) {
+  // the cache holds what is on the card, clear text must not end up there
+  if (!this->file_cache_.is_enabled() || this->cipher_.is_encrypted(path))
+    return nullptr;
+  std::string absolut_path = build_path(path);
+  struct stat info;
+  if (stat(absolut_path.c_str(), &info) != 0 || !S_ISREG(info.st_mode) || !this->file_cache_.is_cacheable(info.st_size))
+    return nullptr;
+  auto cached = this->file_cache_.lookup(path, info.st_size, info.st_mtime);
+  if (cached)
+    return cached;
+
+  std::shared_ptr<FileCache::Block> block(new FileCache::Block(info.st_size));
+  if (!block->is_valid()) {
+    ESP_LOGW(TAG, "No PSRAM left to cache %s", path);
+    return nullptr;
+  }
+  FILE *file = fopen(absolut_path.c_str(), "rb");
+  if (file == nullptr)
+    return nullptr;
+  const size_t len = fread(block->data(), 1, block->size(), file);
+  fclose(file);
+  if (len != block->size())
+    return nullptr;
+  // the read lock held keeps writers, and so invalidations, out until the entry is in
+  this->file_cache_.insert(path, block, info.st_mtime);
+  return block;
+}
+
+void SdMmc::add_file_listener(std::function<void(FileEvent, const std::string &)> &&listener) {
+  this->file_listeners_.push_back(std::move(listener));
+}
+
+void SdMmc::notify_file_event(FileEvent event, const std::string &path) {
+  this->file_cache_.invalidate(path);
+  if (this->file_listeners_.empty())
+    return;
+  std::lock_guard<std::mutex> lock(this->file_events_lock_);
+  if (this->file_events_.size() >= MAX_PENDING_FILE_EVENTS) {
+    this->dropped_file_events_++;
+    return;
+  }
+  this->file_events_.emplace_back(event, path);
+}
+
+void SdMmc::dispatch_file_events() {
+  std::vector<std::pair<FileEvent, std::string>> events;
+  uint32_t dropped;
+  {
+    std::lock_guard<std::mutex> lock(this->file_events_lock_);
+    if (this->file_events_.empty())
+      return;
+    events.swap(this->file_events_);
+    dropped = this->dropped_file_events_;
+    this->dropped_file_events_ = 0;
+  }
+  if (dropped != 0)
+    ESP_LOGW(TAG, "%u file events dropped, the main loop didn't keep up", dropped);
+  for (auto &event : events) {
+    for (auto &listener : this->file_listeners_)
+      listener(event.first, event.second);
+  }
+}
+
+bool SdMmc::path_exists(const char *path) const {
+  struct stat info;
+  return stat(build_path(path).c_str(), &info) == 0;
+}
+
+bool SdMmc::check_mounted(const char *path) const {
+  if (this->is_mounted())
+    return true;
+  ESP_LOGW(TAG, "Card not ready (%s), ignoring access to %s",
+           SdMmc::mount_state_to_string(this->mount_state_).c_str(), path);
+  return false;
+}
+
+void SdMmc::on_shutdown() {
+  // the writes still waiting would be lost with the reboot
+  if (this->atomic_writer_.get_pending_bytes() != 0)
+    this->atomic_writer_.commit();
+}
 
 void SdMmc::dump_config() {
   ESP_LOGCONFIG(TAG, "SD MMC Component");
-  ESP_LOGCONFIG(TAG, "  Mode 1 bit: %s", TRUEFALSE(this->mode_1bit_));
-  ESP_LOGCONFIG(TAG, "  CLK Pin: %d", this->clk_pin_);
-  ESP_LOGCONFIG(TAG, "  CMD Pin: %d", this->cmd_pin_);
-  ESP_LOGCONFIG(TAG, "  DATA0 Pin: %d", this->data0_pin_);
-  if (!this->mode_1bit_) {
-    ESP_LOGCONFIG(TAG, "  DATA1 Pin: %d", this->data1_pin_);
-    ESP_LOGCONFIG(TAG, "  DATA2 Pin: %d", this->data2_pin_);
-    ESP_LOGCONFIG(TAG, "  DATA3 Pin: %d", this->data3_pin_);
+  if (this->spi_mode_) {
+    ESP_LOGCONFIG(TAG, "  Bus: SPI");
+    ESP_LOGCONFIG(TAG, "  CLK Pin: %d", this->clk_pin_);
+    ESP_LOGCONFIG(TAG, "  MOSI Pin: %d", this->mosi_pin_);
+    ESP_LOGCONFIG(TAG, "  MISO Pin: %d", this->miso_pin_);
+    ESP_LOGCONFIG(TAG, "  CS Pin: %d", this->cs_pin_);
+    ESP_LOGCONFIG(TAG, "  Max frequency: %u kHz", this->max_frequency_khz_);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Bus: SDMMC");
+    ESP_LOGCONFIG(TAG, "  Mode 1 bit: %s", TRUEFALSE(this->mode_1bit_));
+    ESP_LOGCONFIG(TAG, "  CLK Pin: %d", this->clk_pin_);
+    ESP_LOGCONFIG(TAG, "  CMD Pin: %d", this->cmd_pin_);
+    ESP_LOGCONFIG(TAG, "  DATA0 Pin: %d", this->data0_pin_);
+    if (!this->mode_1bit_) {
+      ESP_LOGCONFIG(TAG, "  DATA1 Pin: %d", this->data1_pin_);
+      ESP_LOGCONFIG(TAG, "  DATA2 Pin: %d", this->data2_pin_);
+      ESP_LOGCONFIG(TAG, "  DATA3 Pin: %d", this->data3_pin_);
+    }
+  }
+  ESP_LOGCONFIG(TAG, "  Auto tune: %s", YESNO(this->auto_tune_));
+  ESP_LOGCONFIG(TAG, "  Trim mode: %s",
+                this->trim_mode_ == TRIM_INLINE ? "inline" : (this->trim_mode_ == TRIM_IDLE ? "idle" : "none"));
+  if (this->bus_frequency_khz_ != 0)
+    ESP_LOGCONFIG(TAG, "  Bus frequency: %u kHz", this->bus_frequency_khz_);
+#ifdef USE_ESP_IDF
+  if (this->raw_log_size_mb_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Raw log: %u MB, batches of %s", this->raw_log_size_mb_,
+                  format_size(this->raw_log_batch_size_).c_str());
+  }
+  if (this->card_info_.valid) {
+    ESP_LOGCONFIG(TAG, "  Card: %s", this->card_info_.get_identity().c_str());
+    ESP_LOGCONFIG(TAG, "  Speed class: %s", this->card_info_.get_speed_class().c_str());
   }
+  if (this->self_test_interval_ != 0)
+    ESP_LOGCONFIG(TAG, "  Self-test every %u s", this->self_test_interval_ / 1000);
+#endif
+  for (auto *log : this->rotating_logs_)
+    ESP_LOGCONFIG(TAG, "  Rotating log: %s", log->get_path().c_str());
+  ESP_LOGCONFIG(TAG, "  I/O quantum: %s", format_size(this->io_scheduler_.get_quantum()).c_str());
+  ESP_LOGCONFIG(TAG, "  I/O weights: GET %u, PUT %u, internal %u", this->io_scheduler_.get_weight(IO_REQUEST_GET),
+                this->io_scheduler_.get_weight(IO_REQUEST_PUT), this->io_scheduler_.get_weight(IO_REQUEST_INTERNAL));
+  ESP_LOGCONFIG(TAG, "  Max open files: %u", this->max_open_files_);
+  if (this->handles_.is_enabled())
+    ESP_LOGCONFIG(TAG, "  Handle cache: %zu", this->handles_.get_capacity());
+  if (this->file_cache_.is_enabled()) {
+    ESP_LOGCONFIG(TAG, "  File cache: %s, files up to %s", format_size(this->file_cache_.get_capacity()).c_str(),
+                  format_size(this->file_cache_.get_max_file_size()).c_str());
+  }
+  if (this->cipher_.is_enabled())
+    ESP_LOGCONFIG(TAG, "  Encrypted paths: %zu patterns, AES-256-CTR", this->cipher_.get_pattern_count());
+  if (this->atomic_writer_.get_commit_interval() != 0)
+    ESP_LOGCONFIG(TAG, "  Atomic writes committed every %u ms", this->atomic_writer_.get_commit_interval());
+  if (this->atomic_writer_.get_commit_bytes() != 0)
+    ESP_LOGCONFIG(TAG, "  Atomic writes committed every %s",
+                  format_size(this->atomic_writer_.get_commit_bytes()).c_str());
+  if (this->io_scheduler_.get_default_rate_limit() != 0) {
+    ESP_LOGCONFIG(TAG, "  Client rate limit: %s/s",
+                  format_size(this->io_scheduler_.get_default_rate_limit()).c_str());
+  }
+  if (this->io_scheduler_.get_client_rate_limit_count() != 0)
+    ESP_LOGCONFIG(TAG, "  Per client rate limits: %zu", this->io_scheduler_.get_client_rate_limit_count());
 
   if (this->power_ctrl_pin_ != nullptr) {
     LOG_PIN("  Power Ctrl Pin: ", this->power_ctrl_pin_);
   }
+  if (this->card_detect_pin_ != nullptr) {
+    LOG_PIN("  Card Detect Pin: ", this->card_detect_pin_);
+  }
+  ESP_LOGCONFIG(TAG, "  Mount retry interval: %ums", this->mount_retry_interval_);
+  ESP_LOGCONFIG(TAG, "  State: %s", SdMmc::mount_state_to_string(this->mount_state_).c_str());
 
 #ifdef USE_SENSOR
   LOG_SENSOR("  ", "Used space", this->used_space_sensor_);
   LOG_SENSOR("  ", "Total space", this->total_space_sensor_);
   LOG_SENSOR("  ", "Free space", this->free_space_sensor_);
+  LOG_SENSOR("  ", "Trimmed space", this->trimmed_space_sensor_);
+  LOG_SENSOR("  ", "Pending trim space", this->pending_trim_space_sensor_);
+  LOG_SENSOR("  ", "Lock wait time", this->lock_wait_time_sensor_);
+  LOG_SENSOR("  ", "CRC errors", this->crc_errors_sensor_);
+  LOG_SENSOR("  ", "Timeout errors", this->timeout_errors_sensor_);
+  LOG_SENSOR("  ", "Transfer retries", this->transfer_retries_sensor_);
+  LOG_SENSOR("  ", "Self-test throughput", this->self_test_throughput_sensor_);
   for (auto &sensor : this->file_size_sensors_) {
     if (sensor.sensor != nullptr)
       LOG_SENSOR("  ", "File size", sensor.sensor);
@@ -63,10 +454,12 @@ void SdMmc::dump_config() {
 #endif
 #ifdef USE_TEXT_SENSOR
   LOG_TEXT_SENSOR("  ", "SD Card Type", this->sd_card_type_text_sensor_);
+  LOG_TEXT_SENSOR("  ", "Card identity", this->card_identity_text_sensor_);
+  LOG_TEXT_SENSOR("  ", "Card speed class", this->card_speed_class_text_sensor_);
 #endif
 
-  if (this->is_failed()) {
-    ESP_LOGE(TAG, "Setup failed : %s", SdMmc::error_code_to_string(this->init_error_).c_str());
+  if (this->mount_state_ == STATE_FAILED) {
+    ESP_LOGE(TAG, "Mount failed : %s", SdMmc::error_code_to_string(this->init_error_).c_str());
     return;
   }
 }
@@ -76,6 +469,13 @@ void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len) {
   this->write_file(path, buffer, len, "w");
 }
 
+bool SdMmc::write_file_atomic(const char *path, const uint8_t *buffer, size_t len) {
+  ESP_LOGV(TAG, "Writing atomically to file: %s", path);
+  if (!this->check_mounted(path))
+    return false;
+  return this->atomic_writer_.write(path, buffer, len);
+}
+
 void SdMmc::append_file(const char *path, const uint8_t *buffer, size_t len) {
   ESP_LOGV(TAG, "Appending to file: %s", path);
   this->write_file(path, buffer, len, "a");
@@ -94,6 +494,7 @@ std::vector<std::string> SdMmc::list_directory(std::string path, uint8_t depth)
 
 std::vector<FileInfo> SdMmc::list_directory_file_info(const char *path, uint8_t depth) {
   std::vector<FileInfo> list;
+  auto lock = this->lock_read(path);
   list_directory_file_info_rec(path, depth, list);
   return list;
 }
@@ -110,6 +511,47 @@ bool SdMmc::delete_file(std::string const &path) { return this->delete_file(path
 
 std::vector<uint8_t> SdMmc::read_file(std::string const &path) { return this->read_file(path.c_str()); }
 
+TailHub::Subscriber *SdMmc::follow_file(const char *path, size_t backlog, size_t initial) {
+  this->atomic_writer_.commit(path);
+  // appends hold the path exclusively, no byte is missed or sent twice between the snapshot and the stream
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return nullptr;
+  std::string absolut_path = build_path(path);
+  FILE *file = this->cipher_.open(path, absolut_path, "rb");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file to follow: %s", strerror(errno));
+    return nullptr;
+  }
+  TailHub::Subscriber *subscriber = this->tail_hub_.subscribe(path, backlog);
+  if (subscriber != nullptr && initial != 0) {
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    long start = std::max<long>(size - static_cast<long>(std::min(initial, backlog)), 0);
+    std::vector<uint8_t> buffer(size - start);
+    fseek(file, start, SEEK_SET);
+    size_t len = fread(buffer.data(), 1, buffer.size(), file);
+    this->tail_hub_.feed(subscriber, buffer.data(), len);
+  }
+  fclose(file);
+  return subscriber;
+}
+
+FILE *SdMmc::open_file(const char *path, const char *mode) {
+  ESP_LOGV(TAG, "Open File: %s", path);
+  if (!this->check_mounted(path))
+    return nullptr;
+  std::string absolut_path = build_path(path);
+  // kept handles would not see what the caller writes
+  if (mode[0] != 'r' || strchr(mode, '+') != nullptr)
+    this->handles_.close(absolut_path);
+  FILE *file = this->cipher_.open(path, absolut_path, mode);
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open file: %s", strerror(errno));
+  }
+  return file;
+}
+
 #ifdef USE_SENSOR
 void SdMmc::add_file_size_sensor(sensor::Sensor *sensor, std::string const &path) {
   this->file_size_sensors_.emplace_back(sensor, path);
@@ -132,6 +574,65 @@ void SdMmc::set_mode_1bit(bool b) { this->mode_1bit_ = b; }
 
 void SdMmc::set_power_ctrl_pin(GPIOPin *pin) { this->power_ctrl_pin_ = pin; }
 
+void SdMmc::set_mosi_pin(uint8_t pin) { this->mosi_pin_ = pin; }
+
+void SdMmc::set_miso_pin(uint8_t pin) { this->miso_pin_ = pin; }
+
+void SdMmc::set_cs_pin(uint8_t pin) {
+  this->cs_pin_ = pin;
+  this->spi_mode_ = true;
+}
+
+void SdMmc::set_max_frequency(uint32_t frequency) { this->max_frequency_khz_ = frequency; }
+
+void SdMmc::set_auto_tune(bool b) { this->auto_tune_ = b; }
+
+void SdMmc::set_trim_mode(TrimMode mode) { this->trim_mode_ = mode; }
+
+#ifdef USE_ESP_IDF
+void SdMmc::set_raw_log(uint32_t size_mb, uint32_t batch_size) {
+  this->raw_log_size_mb_ = size_mb;
+  this->raw_log_batch_size_ = batch_size;
+}
+
+void SdMmc::set_self_test_interval(uint32_t interval) { this->self_test_interval_ = interval; }
+#endif
+
+void SdMmc::add_rotating_log(RotatingLog *log) { this->rotating_logs_.push_back(log); }
+
+void SdMmc::set_io_quantum(size_t quantum) { this->io_scheduler_.set_quantum(quantum); }
+
+void SdMmc::set_io_weight(IoRequest request, uint8_t weight) { this->io_scheduler_.set_weight(request, weight); }
+
+void SdMmc::set_file_cache(size_t capacity, size_t max_file_size) {
+  this->file_cache_.set_capacity(capacity);
+  this->file_cache_.set_max_file_size(max_file_size);
+}
+
+void SdMmc::set_encryption_key(const std::array<uint8_t, FileCipher::KEY_SIZE> &key) { this->cipher_.set_key(key); }
+
+void SdMmc::add_encrypted_path(std::string const &pattern) { this->cipher_.add_pattern(pattern); }
+
+void SdMmc::set_atomic_commit_interval(uint32_t interval) { this->atomic_writer_.set_commit_interval(interval); }
+
+void SdMmc::set_atomic_commit_bytes(size_t bytes) { this->atomic_writer_.set_commit_bytes(bytes); }
+
+void SdMmc::set_max_open_files(uint8_t max_open_files) { this->max_open_files_ = max_open_files; }
+
+void SdMmc::set_handle_cache(size_t handles) { this->handles_.set_capacity(handles); }
+
+void SdMmc::close_handles(const char *path) { this->handles_.close(build_path(path)); }
+
+void SdMmc::set_client_rate_limit(uint32_t rate) { this->io_scheduler_.set_default_rate_limit(rate); }
+
+void SdMmc::add_client_rate_limit(std::string const &client, uint32_t rate) {
+  this->io_scheduler_.add_client_rate_limit(client, rate);
+}
+
+void SdMmc::set_card_detect_pin(GPIOPin *pin) { this->card_detect_pin_ = pin; }
+
+void SdMmc::set_mount_retry_interval(uint32_t interval) { this->mount_retry_interval_ = interval; }
+
 std::string SdMmc::error_code_to_string(SdMmc::ErrorCode code) {
   switch (code) {
     case ErrorCode::ERR_PIN_SETUP:
@@ -145,6 +646,77 @@ std::string SdMmc::error_code_to_string(SdMmc::ErrorCode code) {
   }
 }
 
+std::string SdMmc::mount_state_to_string(SdMmc::MountState state) {
+  switch (state) {
+    case MountState::STATE_ABSENT:
+      return "absent";
+    case MountState::STATE_MOUNTING:
+      return "mounting";
+    case MountState::STATE_READY:
+      return "ready";
+    case MountState::STATE_FAILED:
+      return "failed";
+    default:
+      return "unknown";
+  }
+}
+
+bool glob_match(const char *pattern, const char *path) {
+  for (; *pattern != '\0'; pattern++, path++) {
+    if (*pattern == '*') {
+      const bool spans = pattern[1] == '*';
+      pattern += spans ? 2 : 1;
+      // "**/" also stands for no directory at all
+      if (spans && *pattern == '/' && glob_match(pattern + 1, path))
+        return true;
+      for (;; path++) {
+        if (glob_match(pattern, path))
+          return true;
+        if (*path == '\0' || (!spans && *path == '/'))
+          return false;
+      }
+    }
+    if (*path == '\0' || (*pattern != *path && (*pattern != '?' || *path == '/')))
+      return false;
+  }
+  return *path == '\0';
+}
+
+FileEventTrigger::FileEventTrigger(SdMmc *parent, FileEvent event, std::string const &pattern) {
+  parent->add_file_listener([this, event, pattern](FileEvent happened, const std::string &path) {
+    if (happened == event && glob_match(pattern.c_str(), path.c_str()))
+      this->trigger(path);
+  });
+}
+
+BatchTrigger::BatchTrigger(SdMmc *parent, BatchEvent event) {
+  parent->get_batch_queue()->add_listener([this, event](BatchEvent happened, const BatchStatus &status) {
+    if (happened == event)
+      this->trigger(status.path, status.done, status.failed);
+  });
+}
+
+OtaProgressTrigger::OtaProgressTrigger(SdMmc *parent) {
+  parent->get_ota()->add_listener([this](OtaEvent event, float progress, const std::string &error) {
+    if (event == OTA_PROGRESS)
+      this->trigger(progress);
+  });
+}
+
+OtaFinishedTrigger::OtaFinishedTrigger(SdMmc *parent) {
+  parent->get_ota()->add_listener([this](OtaEvent event, float progress, const std::string &error) {
+    if (event == OTA_FINISHED)
+      this->trigger();
+  });
+}
+
+OtaFailedTrigger::OtaFailedTrigger(SdMmc *parent) {
+  parent->get_ota()->add_listener([this](OtaEvent event, float progress, const std::string &error) {
+    if (event == OTA_FAILED)
+      this->trigger(error);
+  });
+}
+
 long double convertBytes(uint64_t value, MemoryUnits unit) {
   return value * 1.0 / pow(1024, static_cast<uint64_t>(unit));
 }
@@ -1,8 +1,14 @@
 #pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+
 #include "esphome/core/gpio.h"
 #include "esphome/core/defines.h"
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
+#include "esphome/core/preferences.h"
 #ifdef USE_SENSOR
 #include "esphome/components/sensor/sensor.h"
 #endif
@@ -13,12 +19,32 @@
 #ifdef USE_ESP_IDF
 #include "sdmmc_cmd.h"
 #endif
+#include "atomic_writer.h"
+#include "batch_queue.h"
+#include "card_info.h"
+#include "file_cache.h"
+#include "file_cipher.h"
+#include "file_handles.h"
+#include "file_lock.h"
+#include "file_tail.h"
+#include "io_scheduler.h"
+#include "sd_ota.h"
+#include "card_disk.h"
+#include "raw_log.h"
+#include "rotating_log.h"
+#include "sharded_directory.h"
 
 namespace esphome {
 namespace sd_mmc_card {
 
 
 
+enum FileEvent : uint8_t {
+  FILE_CREATED,
+  FILE_MODIFIED,
+  FILE_DELETED,
+};
+
 enum MemoryUnits : short { Byte = 0, KiloByte = 1, MegaByte = 2, GigaByte = 3, TeraByte = 4, PetaByte = 5 };
 
 #ifdef USE_SENSOR
@@ -31,6 +57,12 @@ struct FileSizeSensor {
 };
 #endif
 
+/* Bus settings picked by the setup-time calibration, kept in NVS */
+struct CardTuning {
+  uint32_t card_serial;
+  uint32_t frequency_khz;
+} __attribute__((packed));
+
 struct FileInfo {
   std::string path;
   size_t size;
@@ -44,9 +76,21 @@ class SdMmc : public Component {
   SUB_SENSOR(used_space)
   SUB_SENSOR(total_space)
   SUB_SENSOR(free_space)
+  SUB_SENSOR(trimmed_space)
+  SUB_SENSOR(pending_trim_space)
+  SUB_SENSOR(lock_wait_time)
+  SUB_SENSOR(cache_hit_ratio)
+  SUB_SENSOR(cache_hit_bytes)
+  SUB_SENSOR(encryption_throughput)
+  SUB_SENSOR(crc_errors)
+  SUB_SENSOR(timeout_errors)
+  SUB_SENSOR(transfer_retries)
+  SUB_SENSOR(self_test_throughput)
 #endif
 #ifdef USE_TEXT_SENSOR
   SUB_TEXT_SENSOR(sd_card_type)
+  SUB_TEXT_SENSOR(card_identity)
+  SUB_TEXT_SENSOR(card_speed_class)
 #endif
  public:
   enum ErrorCode {
@@ -54,16 +98,49 @@ class SdMmc : public Component {
     ERR_MOUNT,
     ERR_NO_CARD,
   };
+  enum MountState : uint8_t {
+    STATE_ABSENT,
+    STATE_MOUNTING,
+    STATE_READY,
+    STATE_FAILED,
+  };
   void setup() override;
   void loop() override;
   void dump_config() override;
+  void on_shutdown() override;
   void write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode);
   void write_file(const char *path, const uint8_t *buffer, size_t len);
   void append_file(const char *path, const uint8_t *buffer, size_t len);
+  /* Replace the contents of path without a reset ever leaving it half written, see AtomicWriter. Committed
+   * according to the atomic_write policy, read_file() returns the new contents meanwhile. */
+  bool write_file_atomic(const char *path, const uint8_t *buffer, size_t len);
+  /* Commit the atomic writes still waiting */
+  bool commit_atomic_writes() { return this->atomic_writer_.commit(); }
+  /* Settle the atomic write waiting on path before accessing the file without the component's file
+   * operations: committed for a read or a partial write, dropped when the file is replaced or deleted. The
+   * file operations of the component do it themselves. Takes the path lock, not to be called with it held. */
+  bool commit_atomic_write(const char *path) { return this->atomic_writer_.commit(path); }
+  void discard_atomic_write(const char *path) { this->atomic_writer_.discard(path); }
   bool delete_file(const char *path);
   bool delete_file(std::string const &path);
   bool create_directory(const char *path);
   bool remove_directory(const char *path);
+  /* Batch operations run in the background by BatchQueue, false if the batch couldn't be queued. The space
+   * sensors are updated once the batch is done. */
+  bool delete_recursive(std::string const &path) { return this->batch_queue_.delete_paths({path}); }
+  bool delete_paths(std::vector<std::string> const &paths) { return this->batch_queue_.delete_paths(paths); }
+  bool create_directories(std::string const &path) { return this->batch_queue_.create_directories(path); }
+  bool move_paths(std::vector<std::string> const &paths, std::string const &destination) {
+    return this->batch_queue_.move_paths(paths, destination);
+  }
+  void cancel_batches() { this->batch_queue_.cancel(); }
+  BatchQueue *get_batch_queue() { return &this->batch_queue_; }
+  /* Flash the firmware image at path in the background, see SdOta. sha256 is the expected digest in hexadecimal,
+   * empty to look for a "<path>.sha256" file. False if an update is already running. */
+  bool start_ota(std::string const &path, std::string const &sha256, bool reboot) {
+    return this->ota_.start(path, sha256, reboot);
+  }
+  SdOta *get_ota() { return &this->ota_; }
   bool exists(const std::string &path);
   size_t get_file_size(const std::string &path);
   std::vector<uint8_t> read_file(char const *path);
@@ -76,9 +153,62 @@ class SdMmc : public Component {
   std::vector<FileInfo> list_directory_file_info(std::string path, uint8_t depth);
   size_t file_size(const char *path);
   size_t file_size(std::string const &path);
+  FILE *open_file(const char *path, const char *mode);
+  /* Contents of path through the file cache; nullptr when the cache is off, the file too large for it or
+   * unreadable, the caller then reads the file itself */
+  std::shared_ptr<const FileCache::Block> read_cached(const char *path);
+  FileCache *get_file_cache() { return &this->file_cache_; }
+  /* Encryption of the files matching the encrypted paths, see FileCipher. open_file(), read_file() and the
+   * write functions go through it already, code opening card files itself uses get_file_cipher()->open(). */
+  FileCipher *get_file_cipher() { return &this->cipher_; }
+  /* Close the handles kept open on path (and below it), for code about to rewrite, delete or move it without
+   * going through this component */
+  void close_handles(const char *path);
 #ifdef USE_SENSOR
   void add_file_size_sensor(sensor::Sensor *, std::string const &path);
 #endif
+  /* Called from the main loop for every file or directory created, modified or deleted through this component
+   * or the file server */
+  void add_file_listener(std::function<void(FileEvent, const std::string &)> &&listener);
+  /* Report a change made from any task, the listeners get it on the next loop */
+  void notify_file_event(FileEvent event, const std::string &path);
+  /* Hold path for reading or writing, for accesses spanning several calls such as streaming open_file().
+   * The file operations above take these themselves, so they must not be called on a path held exclusively. */
+  FileLock lock_read(const char *path) { return this->locks_.lock_path(path, false); }
+  FileLock lock_write(const char *path) { return this->locks_.lock_path(path, true); }
+  /* Both paths exclusively, for a move */
+  FileLock lock_write(const char *path, const char *other) { return this->locks_.lock_paths(path, other, true); }
+  /* Keep the card mounted without holding any path, for accesses outside the filesystem (raw log) */
+  FileLock lock_card() { return this->locks_.lock_card(); }
+  /* Time spent waiting on locks held by other accesses, since boot */
+  uint64_t get_lock_wait_time_us() const { return this->locks_.get_wait_time_us(); }
+  uint32_t get_lock_contentions() const { return this->locks_.get_contentions(); }
+  /* Follow the bytes later appended to path through append_file(), after its last initial bytes.
+   * nullptr if the file can't be opened or too many followers are attached. */
+  TailHub::Subscriber *follow_file(const char *path, size_t backlog, size_t initial = 0);
+  TailHub *get_tail_hub() { return &this->tail_hub_; }
+  /* Bandwidth shared between concurrent transfers, see IoScheduler */
+  IoScheduler *get_io_scheduler() { return &this->io_scheduler_; }
+  MountState get_mount_state() const { return this->mount_state_; }
+  bool is_mounted() const { return this->mount_state_ == STATE_READY; }
+#ifdef USE_ESP_IDF
+  /* Raw sector log reserved at the end of the card, open while the card is mounted */
+  RawLog *get_raw_log() { return &this->raw_log_; }
+  /* Queue a record in the raw log, the card can't be unmounted in the middle of a batch write */
+  bool append_raw_log(const uint8_t *data, size_t len);
+  uint32_t get_trimmed_sectors() const { return this->disk_.get_trim().get_trimmed_sectors(); }
+  uint32_t get_pending_trim_sectors() const { return this->disk_.get_trim().get_pending_sectors(); }
+  /* Registers of the mounted card, see CardInfo */
+  const CardInfo &get_card_info() const { return this->card_info_; }
+  /* path for the FatFs API ("0:/dir"), empty when the volume has no drive. Only while holding a lock on a
+   * mounted card */
+  std::string get_fatfs_path(const char *path) const;
+  uint32_t get_crc_errors() const { return this->disk_.get_crc_errors(); }
+  uint32_t get_timeout_errors() const { return this->disk_.get_timeouts(); }
+  uint32_t get_transfer_retries() const { return this->disk_.get_retries(); }
+  /* Sequential read throughput of the last self-test in bytes per second, 0 before the first one */
+  float get_self_test_throughput() const { return this->self_test_throughput_; }
+#endif
 
   void set_clk_pin(uint8_t);
   void set_cmd_pin(uint8_t);
@@ -88,6 +218,30 @@ class SdMmc : public Component {
   void set_data3_pin(uint8_t);
   void set_mode_1bit(bool);
   void set_power_ctrl_pin(GPIOPin *);
+  void set_mosi_pin(uint8_t);
+  void set_miso_pin(uint8_t);
+  void set_cs_pin(uint8_t);
+  void set_max_frequency(uint32_t);
+  void set_auto_tune(bool);
+  void set_trim_mode(TrimMode);
+#ifdef USE_ESP_IDF
+  void set_raw_log(uint32_t size_mb, uint32_t batch_size);
+  void set_self_test_interval(uint32_t);
+#endif
+  void add_rotating_log(RotatingLog *);
+  void set_io_quantum(size_t);
+  void set_io_weight(IoRequest, uint8_t);
+  void set_file_cache(size_t capacity, size_t max_file_size);
+  void set_encryption_key(const std::array<uint8_t, FileCipher::KEY_SIZE> &key);
+  void add_encrypted_path(std::string const &pattern);
+  void set_max_open_files(uint8_t);
+  void set_atomic_commit_interval(uint32_t);
+  void set_atomic_commit_bytes(size_t);
+  void set_handle_cache(size_t);
+  void set_client_rate_limit(uint32_t);
+  void add_client_rate_limit(std::string const &client, uint32_t rate);
+  void set_card_detect_pin(GPIOPin *);
+  void set_mount_retry_interval(uint32_t);
 
  protected:
   ErrorCode init_error_;
@@ -98,11 +252,82 @@ class SdMmc : public Component {
   uint8_t data2_pin_;
   uint8_t data3_pin_;
   bool mode_1bit_;
+  bool spi_mode_{false};
+  uint8_t mosi_pin_;
+  uint8_t miso_pin_;
+  uint8_t cs_pin_;
+  uint32_t max_frequency_khz_;
+  uint32_t bus_frequency_khz_{0};
+  bool auto_tune_{false};
+  CardTuning tuning_{};
+  std::atomic<bool> tuning_pending_{false};
+  ESPPreferenceObject tuning_pref_;
+  TrimMode trim_mode_{TRIM_NONE};
   GPIOPin *power_ctrl_pin_{nullptr};
+  GPIOPin *card_detect_pin_{nullptr};
+  uint32_t mount_retry_interval_;
+  uint8_t max_open_files_{5};
+  std::atomic<MountState> mount_state_{STATE_ABSENT};
+  MountState published_mount_state_{STATE_ABSENT};
 
 #ifdef USE_ESP_IDF
-  sdmmc_card_t *card_;
+  sdmmc_card_t *card_{nullptr};
+  bool spi_bus_initialized_{false};
+  esp_err_t mount_at(uint32_t frequency_khz);
+  bool verify_bus();
+  enum CalibrationResult : uint8_t {
+    CALIBRATION_OK,
+    // the scratch file couldn't be written (card full or write protected)
+    CALIBRATION_UNAVAILABLE,
+    // the scratch file was read back wrong or not at all
+    CALIBRATION_UNSTABLE,
+  };
+  CalibrationResult calibrate();
+  void store_tuning();
+  bool finish_mount(uint32_t frequency_khz);
+  CardDisk disk_;
+  void update_trim_sensors();
+  uint32_t raw_log_size_mb_{0};
+  uint32_t raw_log_batch_size_;
+  RawLog raw_log_;
+  std::unique_ptr<SdmmcSectorDevice> raw_log_device_;
+  void open_raw_log();
+  CardInfo card_info_;
+  uint32_t self_test_interval_{0};
+  uint32_t self_test_ms_{0};
+  uint32_t self_test_sector_{0};
+  std::atomic<float> self_test_throughput_{0};
+  std::atomic<uint32_t> self_test_count_{0};
+  uint32_t published_self_test_count_{0};
+  /* Time a short sequential read of the card, run from the mount task */
+  void run_self_test();
+  void update_health_sensors();
 #endif
+  std::vector<RotatingLog *> rotating_logs_{};
+  LockTable locks_;
+  IoScheduler io_scheduler_;
+  TailHub tail_hub_;
+  FileCache file_cache_;
+  FileCipher cipher_;
+  uint64_t cipher_published_bytes_{0};
+  uint64_t cipher_published_us_{0};
+  uint32_t cipher_sensor_published_ms_{0};
+  void update_cipher_sensors();
+  HandlePool handles_;
+  AtomicWriter atomic_writer_{this};
+  BatchQueue batch_queue_{this};
+  SdOta ota_{this};
+  std::shared_ptr<const FileCache::Block> read_cached_locked(const char *path);
+  uint32_t cache_sensor_published_ms_{0};
+  void update_cache_sensors();
+  std::vector<std::function<void(FileEvent, const std::string &)>> file_listeners_;
+  std::mutex file_events_lock_;
+  std::vector<std::pair<FileEvent, std::string>> file_events_;
+  uint32_t dropped_file_events_{0};
+  void dispatch_file_events();
+  bool path_exists(const char *path) const;
+  uint32_t lock_sensor_published_ms_{0};
+  void update_lock_sensors();
 #ifdef USE_SENSOR
   std::vector<FileSizeSensor> file_size_sensors_{};
 #endif
@@ -110,11 +335,17 @@ class SdMmc : public Component {
 #ifdef USE_ESP32_FRAMEWORK_ARDUINO
   std::string sd_card_type_to_string(int) const;
 #endif
-#ifdef USE_ESP_IDF
   std::string sd_card_type() const;
-#endif
+  /* Mount handling, run from the mount task */
+  static void mount_task(void *params);
+  bool mount_card();
+  void unmount_card();
+  bool is_card_inserted();
+  bool is_card_responding();
+  bool check_mounted(const char *path) const;
   std::vector<FileInfo> &list_directory_file_info_rec(const char *path, uint8_t depth, std::vector<FileInfo> &list);
   static std::string error_code_to_string(ErrorCode);
+  static std::string mount_state_to_string(MountState);
 };
 
 template<typename... Ts> class SdMmcWriteFileAction : public Action<Ts...> {
@@ -149,6 +380,22 @@ template<typename... Ts> class SdMmcAppendFileAction : public Action<Ts...> {
   SdMmc *parent_;
 };
 
+template<typename... Ts> class SdMmcWriteFileAtomicAction : public Action<Ts...> {
+ public:
+  SdMmcWriteFileAtomicAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+  TEMPLATABLE_VALUE(std::vector<uint8_t>, data)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    auto buffer = this->data_.value(x...);
+    this->parent_->write_file_atomic(path.c_str(), buffer.data(), buffer.size());
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
 template<typename... Ts> class SdMmcCreateDirectoryAction : public Action<Ts...> {
  public:
   SdMmcCreateDirectoryAction(SdMmc *parent) : parent_(parent) {}
@@ -191,6 +438,192 @@ template<typename... Ts> class SdMmcDeleteFileAction : public Action<Ts...> {
   SdMmc *parent_;
 };
 
+template<typename... Ts> class SdMmcDeleteRecursiveAction : public Action<Ts...> {
+ public:
+  SdMmcDeleteRecursiveAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    this->parent_->delete_recursive(path);
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcCreateDirectoriesAction : public Action<Ts...> {
+ public:
+  SdMmcCreateDirectoriesAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    this->parent_->create_directories(path);
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcDeletePathsAction : public Action<Ts...> {
+ public:
+  SdMmcDeletePathsAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::vector<std::string>, paths)
+
+  void play(Ts... x) {
+    auto paths = this->paths_.value(x...);
+    this->parent_->delete_paths(paths);
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcMovePathsAction : public Action<Ts...> {
+ public:
+  SdMmcMovePathsAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::vector<std::string>, paths)
+  TEMPLATABLE_VALUE(std::string, destination)
+
+  void play(Ts... x) {
+    auto paths = this->paths_.value(x...);
+    auto destination = this->destination_.value(x...);
+    this->parent_->move_paths(paths, destination);
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcCancelBatchAction : public Action<Ts...> {
+ public:
+  SdMmcCancelBatchAction(SdMmc *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->cancel_batches(); }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcOtaUpdateAction : public Action<Ts...> {
+ public:
+  SdMmcOtaUpdateAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::string, path)
+  TEMPLATABLE_VALUE(std::string, sha256)
+  TEMPLATABLE_VALUE(bool, reboot)
+
+  void play(Ts... x) {
+    auto path = this->path_.value(x...);
+    auto sha256 = this->sha256_.value(x...);
+    auto reboot = this->reboot_.value(x...);
+    this->parent_->start_ota(path, sha256, reboot);
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+
+template<typename... Ts> class SdMmcAppendRotatingLogAction : public Action<Ts...> {
+ public:
+  SdMmcAppendRotatingLogAction(RotatingLog *log) : log_(log) {}
+  TEMPLATABLE_VALUE(std::vector<uint8_t>, data)
+
+  void play(Ts... x) {
+    auto buffer = this->data_.value(x...);
+    this->log_->append(buffer.data(), buffer.size());
+  }
+
+ protected:
+  RotatingLog *log_;
+};
+
+template<typename... Ts> class SdMmcRotateLogAction : public Action<Ts...> {
+ public:
+  SdMmcRotateLogAction(RotatingLog *log) : log_(log) {}
+
+  void play(Ts... x) { this->log_->rotate(); }
+
+ protected:
+  RotatingLog *log_;
+};
+
+template<typename... Ts> class SdMmcWriteShardedFileAction : public Action<Ts...> {
+ public:
+  SdMmcWriteShardedFileAction(ShardedDirectory *directory) : directory_(directory) {}
+  TEMPLATABLE_VALUE(std::string, name)
+  TEMPLATABLE_VALUE(std::vector<uint8_t>, data)
+  TEMPLATABLE_VALUE(uint32_t, timestamp)
+
+  void play(Ts... x) {
+    auto name = this->name_.value(x...);
+    auto buffer = this->data_.value(x...);
+    this->directory_->write(name, buffer.data(), buffer.size(), this->timestamp_.value_or(x..., 0));
+  }
+
+ protected:
+  ShardedDirectory *directory_;
+};
+
+template<typename... Ts> class SdMmcDeleteShardedFileAction : public Action<Ts...> {
+ public:
+  SdMmcDeleteShardedFileAction(ShardedDirectory *directory) : directory_(directory) {}
+  TEMPLATABLE_VALUE(std::string, name)
+  TEMPLATABLE_VALUE(uint32_t, timestamp)
+
+  void play(Ts... x) {
+    auto name = this->name_.value(x...);
+    this->directory_->remove(name, this->timestamp_.value_or(x..., 0));
+  }
+
+ protected:
+  ShardedDirectory *directory_;
+};
+
+class FileEventTrigger : public Trigger<std::string> {
+ public:
+  FileEventTrigger(SdMmc *parent, FileEvent event, std::string const &pattern);
+};
+
+class BatchTrigger : public Trigger<std::string, uint32_t, uint32_t> {
+ public:
+  BatchTrigger(SdMmc *parent, BatchEvent event);
+};
+
+class OtaProgressTrigger : public Trigger<float> {
+ public:
+  OtaProgressTrigger(SdMmc *parent);
+};
+
+class OtaFinishedTrigger : public Trigger<> {
+ public:
+  OtaFinishedTrigger(SdMmc *parent);
+};
+
+class OtaFailedTrigger : public Trigger<std::string> {
+ public:
+  OtaFailedTrigger(SdMmc *parent);
+};
+
+#ifdef USE_ESP_IDF
+template<typename... Ts> class SdMmcAppendRawLogAction : public Action<Ts...> {
+ public:
+  SdMmcAppendRawLogAction(SdMmc *parent) : parent_(parent) {}
+  TEMPLATABLE_VALUE(std::vector<uint8_t>, data)
+
+  void play(Ts... x) {
+    auto buffer = this->data_.value(x...);
+    this->parent_->append_raw_log(buffer.data(), buffer.size());
+  }
+
+ protected:
+  SdMmc *parent_;
+};
+#endif
+
+std::string build_path(const char *path);
+/* Shell-like match of a card path: * and ? stop at '/', ** spans directories */
+bool glob_match(const char *pattern, const char *path);
 long double convertBytes(uint64_t, MemoryUnits);
 std::string memory_unit_to_string(MemoryUnits);
 MemoryUnits memory_unit_from_size(size_t);
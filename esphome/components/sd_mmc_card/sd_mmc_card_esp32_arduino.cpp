@@ -12,61 +12,78 @@ namespace esphome {
 namespace sd_mmc_card {
 
 static const char *TAG = "sd_mmc_card_esp32_arduino";
+static const std::string MOUNT_POINT("/sdcard");
 
-void SdMmc::setup() {
-  if (this->power_ctrl_pin_ != nullptr)
-    this->power_ctrl_pin_->setup();
+std::string build_path(const char *path) { return MOUNT_POINT + path; }
 
+bool SdMmc::mount_card() {
   bool setPinResult = this->mode_1bit_ ? SD_MMC.setPins(this->clk_pin_, this->cmd_pin_, this->data0_pin_)
                                        : SD_MMC.setPins(this->clk_pin_, this->cmd_pin_, this->data0_pin_,
                                                         this->data1_pin_, this->data2_pin_, this->data3_pin_);
 
   if (!setPinResult) {
     this->init_error_ = ErrorCode::ERR_PIN_SETUP;
-    this->mark_failed();
-    return;
+    return false;
   }
 
-  bool beginResult = this->mode_1bit_ ? SD_MMC.begin("/sdcard", this->mode_1bit_) : SD_MMC.begin();
+  bool beginResult = this->mode_1bit_ ? SD_MMC.begin(MOUNT_POINT.c_str(), this->mode_1bit_) : SD_MMC.begin();
   if (!beginResult) {
     this->init_error_ = ErrorCode::ERR_MOUNT;
-    this->mark_failed();
-    return;
+    return false;
   }
 
-  uint8_t cardType = SD_MMC.cardType();
-
-#ifdef USE_TEXT_SENSOR
-  if (this->sd_card_type_text_sensor_ != nullptr)
-    this->sd_card_type_text_sensor_->publish_state(sd_card_type_to_string(cardType));
-#endif
-
-  if (cardType == CARD_NONE) {
+  if (SD_MMC.cardType() == CARD_NONE) {
     this->init_error_ = ErrorCode::ERR_NO_CARD;
-    this->mark_failed();
-    return;
+    SD_MMC.end();
+    return false;
   }
-
-  update_sensors();
+  return true;
 }
 
+void SdMmc::unmount_card() { SD_MMC.end(); }
+
+// SD_MMC keeps no live view of the card, removal can only be detected through the card detect pin
+bool SdMmc::is_card_responding() { return true; }
+
 void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
-  File file = SD_MMC.open(path, mode);
-  if (!file) {
-    ESP_LOGE(TAG, "Failed to open file for writing");
-    return;
+  // a waiting atomic write would land after this one
+  if (mode[0] == 'w') {
+    this->atomic_writer_.discard(path);
+  } else {
+    this->atomic_writer_.commit(path);
   }
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return;
+    const bool existed = !this->file_listeners_.empty() && this->path_exists(path);
+    File file = SD_MMC.open(path, mode);
+    if (!file) {
+      ESP_LOGE(TAG, "Failed to open file for writing");
+      return;
+    }
 
-  file.write(buffer, len);
-  file.close();
+    size_t written = file.write(buffer, len);
+    file.close();
+    if (written != 0 && mode[0] == 'a' && this->tail_hub_.has_subscribers())
+      this->tail_hub_.publish(path, buffer, written);
+    if (written != 0)
+      this->notify_file_event(existed ? FILE_MODIFIED : FILE_CREATED, path);
+  }
   this->update_sensors();
 }
 
 bool SdMmc::create_directory(const char *path) {
   ESP_LOGV(TAG, "Create directory: %s", path);
-  if (!SD_MMC.mkdir(path)) {
-    ESP_LOGE(TAG, "Failed to create directory");
-    return false;
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return false;
+    if (!SD_MMC.mkdir(path)) {
+      ESP_LOGE(TAG, "Failed to create directory");
+      return false;
+    }
+    this->notify_file_event(FILE_CREATED, path);
   }
   this->update_sensors();
   return true;
@@ -74,9 +91,15 @@ bool SdMmc::create_directory(const char *path) {
 
 bool SdMmc::remove_directory(const char *path) {
   ESP_LOGV(TAG, "Remove directory: %s", path);
-  if (!SD_MMC.rmdir(path)) {
-    ESP_LOGE(TAG, "Failed to remove directory");
-    return false;
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return false;
+    if (!SD_MMC.rmdir(path)) {
+      ESP_LOGE(TAG, "Failed to remove directory");
+      return false;
+    }
+    this->notify_file_event(FILE_DELETED, path);
   }
   this->update_sensors();
   return true;
@@ -84,9 +107,16 @@ bool SdMmc::remove_directory(const char *path) {
 
 bool SdMmc::delete_file(const char *path) {
   ESP_LOGV(TAG, "Delete File: %s", path);
-  if (!SD_MMC.remove(path)) {
-    ESP_LOGE(TAG, "failed to remove file");
-    return false;
+  this->atomic_writer_.discard(path);
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return false;
+    if (!SD_MMC.remove(path)) {
+      ESP_LOGE(TAG, "failed to remove file");
+      return false;
+    }
+    this->notify_file_event(FILE_DELETED, path);
   }
   this->update_sensors();
   return true;
@@ -94,6 +124,15 @@ bool SdMmc::delete_file(const char *path) {
 
 std::vector<uint8_t> SdMmc::read_file(char const *path) {
   ESP_LOGV(TAG, "Read File: %s", path);
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return std::vector<uint8_t>();
+  std::vector<uint8_t> pending;
+  if (this->atomic_writer_.read_pending(path, &pending))
+    return pending;
+  auto cached = this->read_cached_locked(path);
+  if (cached)
+    return std::vector<uint8_t>(cached->data(), cached->data() + cached->size());
   File file = SD_MMC.open(path);
   if (!file) {
     ESP_LOGE(TAG, "Failed to open file for reading");
@@ -111,6 +150,8 @@ std::vector<uint8_t> SdMmc::read_file(char const *path) {
 std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uint8_t depth,
                                                            std::vector<FileInfo> &list) {
   ESP_LOGV(TAG, "Listing directory file info: %s\n", path);
+  if (!this->check_mounted(path))
+    return list;
 
   File root = SD_MMC.open(path);
   if (!root) {
@@ -136,6 +177,9 @@ std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uin
 }
 
 bool SdMmc::is_directory(const char *path) {
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return false;
   File root = SD_MMC.open(path);
   if (!root) {
     ESP_LOGE(TAG, "Failed to open directory");
@@ -145,10 +189,18 @@ bool SdMmc::is_directory(const char *path) {
 }
 
 size_t SdMmc::file_size(const char *path) {
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return -1;
+  size_t pending;
+  if (this->atomic_writer_.pending_size(path, &pending))
+    return pending;
   File file = SD_MMC.open(path);
   return file.size();
 }
 
+std::string SdMmc::sd_card_type() const { return this->sd_card_type_to_string(SD_MMC.cardType()); }
+
 std::string SdMmc::sd_card_type_to_string(int type) const {
   switch (type) {
     case CARD_NONE:
@@ -167,6 +219,8 @@ std::string SdMmc::sd_card_type_to_string(int type) const {
 
 void SdMmc::update_sensors() {
 #ifdef USE_SENSOR
+  if (!this->is_mounted())
+    return;
   uint64_t used_bytes = SD_MMC.usedBytes();
   uint64_t total_bytes = SD_MMC.totalBytes();
   if (this->used_space_sensor_ != nullptr)
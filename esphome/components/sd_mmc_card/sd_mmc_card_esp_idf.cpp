@@ -1,13 +1,21 @@
 #include "sd_mmc_card.h"
 
 #ifdef USE_ESP_IDF
+#include <algorithm>
+
 #include "math.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
+#include "diskio_sdmmc.h"
 #include "driver/sdmmc_host.h"
 #include "driver/sdmmc_types.h"
+#include "driver/sdspi_host.h"
+#include "driver/spi_common.h"
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
 
 int constexpr SD_OCR_SDHC_CAP = (1 << 30);  // value defined in esp-idf/components/sdmmc/include/sd_protocol_defs.h
 
@@ -18,16 +26,177 @@ static constexpr size_t FILE_PATH_MAX = ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAM
 static const char *TAG = "sd_mmc_card";
 static const std::string MOUNT_POINT("/sdcard");
 
+// Bus clocks tried from the fastest down, the first one passing verify_bus() (and calibrate() when tuning) is kept
+static const uint32_t SPI_FREQUENCIES_KHZ[] = {SDMMC_FREQ_HIGHSPEED, SDMMC_FREQ_26M, SDMMC_FREQ_DEFAULT, 10000, 4000};
+static const uint32_t SDMMC_TUNING_FREQUENCIES_KHZ[] = {SDMMC_FREQ_HIGHSPEED, SDMMC_FREQ_26M, SDMMC_FREQ_DEFAULT};
+static const uint32_t SDMMC_FREQUENCIES_KHZ[] = {SDMMC_FREQ_DEFAULT};
+static const spi_host_device_t SPI_HOST_ID = SPI2_HOST;
+static const int SPI_MAX_TRANSFER_SIZE = 4000;
+static const size_t VERIFY_SECTORS = 8;
+static const char *const CALIBRATION_FILE = "/.sd_mmc_tune";
+static const size_t CALIBRATION_CHUNK_SIZE = 32 * 1024;
+static const size_t CALIBRATION_CHUNKS = 8;
+// each self-test reads that much in sequence, from one of SELF_TEST_AREAS spread over the card in turn so the
+// card cache doesn't flatter the result
+static const size_t SELF_TEST_SIZE = 1024 * 1024;
+static const size_t SELF_TEST_CHUNK_SIZE = 32 * 1024;
+static const uint32_t SELF_TEST_AREAS = 16;
+
 std::string build_path(const char *path) { return MOUNT_POINT + path; }
 
-void SdMmc::setup() {
-  if (this->power_ctrl_pin_ != nullptr)
-    this->power_ctrl_pin_->setup();
+// used under a path lock already held, where is_directory() would lock again
+static bool directory_exists(const std::string &absolut_path) {
+  DIR *dir = opendir(absolut_path.c_str());
+  if (dir)
+    closedir(dir);
+  return dir != nullptr;
+}
+
+bool SdMmc::mount_card() {
+  if (this->spi_mode_ && !this->spi_bus_initialized_) {
+    spi_bus_config_t bus_config = {};
+    bus_config.mosi_io_num = this->mosi_pin_;
+    bus_config.miso_io_num = this->miso_pin_;
+    bus_config.sclk_io_num = this->clk_pin_;
+    bus_config.quadwp_io_num = -1;
+    bus_config.quadhd_io_num = -1;
+    bus_config.max_transfer_sz = SPI_MAX_TRANSFER_SIZE;
+    auto ret = spi_bus_initialize(SPI_HOST_ID, &bus_config, SPI_DMA_CH_AUTO);
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to initialize SPI bus: %s", esp_err_to_name(ret));
+      this->init_error_ = ErrorCode::ERR_PIN_SETUP;
+      return false;
+    }
+    this->spi_bus_initialized_ = true;
+  }
+
+  // a previous calibration for this very card lets us skip the probing
+  if (this->auto_tune_ && this->tuning_.frequency_khz != 0) {
+    if (this->mount_at(this->tuning_.frequency_khz) == ESP_OK) {
+      if (this->card_->cid.serial == this->tuning_.card_serial && this->verify_bus())
+        return this->finish_mount(this->tuning_.frequency_khz);
+      esp_vfs_fat_sdcard_unmount(MOUNT_POINT.c_str(), this->card_);
+    }
+    ESP_LOGD(TAG, "Stored tuning doesn't match the card, calibrating");
+  }
+
+  const uint32_t *frequencies = SDMMC_FREQUENCIES_KHZ;
+  size_t count = sizeof(SDMMC_FREQUENCIES_KHZ) / sizeof(uint32_t);
+  if (this->spi_mode_) {
+    frequencies = SPI_FREQUENCIES_KHZ;
+    count = sizeof(SPI_FREQUENCIES_KHZ) / sizeof(uint32_t);
+  } else if (this->auto_tune_) {
+    frequencies = SDMMC_TUNING_FREQUENCIES_KHZ;
+    count = sizeof(SDMMC_TUNING_FREQUENCIES_KHZ) / sizeof(uint32_t);
+  }
 
+  esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+  // first clock the bus verified at, kept when the calibration fails at every clock
+  uint32_t verified_khz = 0;
+  uint32_t previous_khz = 0;
+  for (size_t i = 0; i < count; i++) {
+    // candidates above max_frequency are tried at max_frequency, once, so a slow bus still gets a try
+    const uint32_t frequency = std::min(frequencies[i], this->max_frequency_khz_);
+    if (frequency == previous_khz)
+      continue;
+    previous_khz = frequency;
+    ret = this->mount_at(frequency);
+    if (ret == ESP_OK) {
+      if (this->verify_bus()) {
+        if (!this->auto_tune_)
+          return this->finish_mount(frequency);
+        const CalibrationResult result = this->calibrate();
+        if (result == CALIBRATION_OK) {
+          this->store_tuning();
+          return this->finish_mount(frequency);
+        }
+        if (result == CALIBRATION_UNAVAILABLE) {
+          // a full or write protected card can't be calibrated, it still mounts
+          ESP_LOGW(TAG, "Calibration file can't be written, mounting at %u kHz without tuning", frequency);
+          return this->finish_mount(frequency);
+        }
+        if (verified_khz == 0)
+          verified_khz = frequency;
+      }
+      esp_vfs_fat_sdcard_unmount(MOUNT_POINT.c_str(), this->card_);
+    } else if (ret == ESP_FAIL) {
+      // the card answered but holds no usable filesystem, a slower clock won't help
+      break;
+    }
+    ESP_LOGD(TAG, "Bus unstable at %u kHz, falling back", frequency);
+  }
+  if (verified_khz != 0 && (ret = this->mount_at(verified_khz)) == ESP_OK) {
+    ESP_LOGW(TAG, "Calibration failed at every clock, mounting at %u kHz without tuning", verified_khz);
+    return this->finish_mount(verified_khz);
+  }
+
+  this->init_error_ = ret == ESP_FAIL ? ErrorCode::ERR_MOUNT : ErrorCode::ERR_NO_CARD;
+  this->card_ = nullptr;
+  return false;
+}
+
+bool SdMmc::finish_mount(uint32_t frequency_khz) {
+  this->bus_frequency_khz_ = frequency_khz;
+  // the SD status command isn't sent on the SPI bus, its response format differs there
+  this->card_info_ = CardInfo::read(this->card_, !this->spi_mode_);
+  ESP_LOGI(TAG, "Card: %s, speed class %s", this->card_info_.get_identity().c_str(),
+           this->card_info_.get_speed_class().c_str());
+  if (this->card_info_.is_suspicious())
+    ESP_LOGW(TAG, "Card identification looks forged, the card may not hold its advertised capacity or speed");
+  // a self-test soon after the mount, once the card is idle
+  this->self_test_ms_ = millis() - this->self_test_interval_;
+  // the disk driver wrapper counts the transfer errors and serializes the raw log transfers with the
+  // filesystem ones
+  if (!this->disk_.attach(this->card_, this->trim_mode_)) {
+    ESP_LOGW(TAG, "Failed to install the disk driver, trim, raw log and error counts unavailable");
+    return true;
+  }
+  if (this->raw_log_size_mb_ != 0)
+    this->open_raw_log();
+  return true;
+}
+
+void SdMmc::open_raw_log() {
+  // the region is taken from the end of the card and must lie past the FAT volume
+  const uint32_t capacity = this->card_->csd.capacity;
+  const uint32_t sectors = this->raw_log_size_mb_ * (1024 * 1024 / SECTOR_SIZE);
+  if (sectors >= capacity || capacity - sectors < this->disk_.get_volume_end()) {
+    ESP_LOGE(TAG, "Raw log of %u MB overlaps the filesystem (volume ends at sector %u of %u)", this->raw_log_size_mb_,
+             this->disk_.get_volume_end(), capacity);
+    return;
+  }
+  this->raw_log_device_.reset(new SdmmcSectorDevice(this->card_, this->disk_.get_lock()));
+  this->raw_log_.open(this->raw_log_device_.get(), capacity - sectors, sectors);
+}
+
+bool SdMmc::append_raw_log(const uint8_t *data, size_t len) {
+  // a full batch is written right away, the unmount waits for it
+  auto lock = this->lock_card();
+  if (!this->check_mounted("raw log"))
+    return false;
+  return this->raw_log_.append(data, len);
+}
+
+esp_err_t SdMmc::mount_at(uint32_t frequency_khz) {
   esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-      .format_if_mount_failed = false, .max_files = 5, .allocation_unit_size = 16 * 1024};
+      .format_if_mount_failed = false,
+      .max_files = this->max_open_files_,
+      .allocation_unit_size = 16 * 1024};
+
+  if (this->spi_mode_) {
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    host.slot = SPI_HOST_ID;
+    host.max_freq_khz = frequency_khz;
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = static_cast<gpio_num_t>(this->cs_pin_);
+    slot_config.host_id = SPI_HOST_ID;
+    return esp_vfs_fat_sdspi_mount(MOUNT_POINT.c_str(), &host, &slot_config, &mount_config, &this->card_);
+  }
 
+  // above 25 MHz the driver switches the card to high speed mode, if the card doesn't support it
+  // the clock stays at the default speed
   sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+  host.max_freq_khz = frequency_khz;
   sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
 
   if (this->mode_1bit_) {
@@ -53,48 +222,187 @@ void SdMmc::setup() {
   // connected on the bus. This is for debug / example purpose only.
   slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
 
-  auto ret = esp_vfs_fat_sdmmc_mount(MOUNT_POINT.c_str(), &host, &slot_config, &mount_config, &this->card_);
+  return esp_vfs_fat_sdmmc_mount(MOUNT_POINT.c_str(), &host, &slot_config, &mount_config, &this->card_);
+}
 
-  if (ret != ESP_OK) {
-    if (ret == ESP_FAIL) {
-      this->init_error_ = ErrorCode::ERR_MOUNT;
-    } else {
-      this->init_error_ = ErrorCode::ERR_NO_CARD;
+bool SdMmc::verify_bus() {
+  // read the first sectors twice with a multi-block command, a marginal clock shows up as a CRC error,
+  // a timeout or mismatching data
+  size_t len = VERIFY_SECTORS * this->card_->csd.sector_size;
+  uint8_t *first = static_cast<uint8_t *>(heap_caps_malloc(len, MALLOC_CAP_DMA));
+  uint8_t *second = static_cast<uint8_t *>(heap_caps_malloc(len, MALLOC_CAP_DMA));
+  bool ok = first != nullptr && second != nullptr &&
+            sdmmc_read_sectors(this->card_, first, 0, VERIFY_SECTORS) == ESP_OK &&
+            sdmmc_read_sectors(this->card_, second, 0, VERIFY_SECTORS) == ESP_OK && memcmp(first, second, len) == 0;
+  heap_caps_free(first);
+  heap_caps_free(second);
+  return ok;
+}
+
+SdMmc::CalibrationResult SdMmc::calibrate() {
+  // write a scratch file through the filesystem, read it back and compare, timing both ways
+  ESP_LOGD(TAG, "Calibrating at %u kHz (card max %u kHz, CSD speed %d kHz)", this->card_->host.max_freq_khz,
+           this->card_->max_freq_khz, this->card_->csd.tr_speed / 1000);
+  std::string absolut_path = build_path(CALIBRATION_FILE);
+  uint8_t *buffer = static_cast<uint8_t *>(heap_caps_malloc(CALIBRATION_CHUNK_SIZE, MALLOC_CAP_DMA));
+  uint8_t *check = static_cast<uint8_t *>(heap_caps_malloc(CALIBRATION_CHUNK_SIZE, MALLOC_CAP_DMA));
+  FILE *file = nullptr;
+  bool ok = buffer != nullptr && check != nullptr;
+  bool written = false;
+  uint32_t write_us = 0, read_us = 0;
+
+  if (ok) {
+    for (size_t i = 0; i < CALIBRATION_CHUNK_SIZE; i++)
+      buffer[i] = static_cast<uint8_t>(i * 31 + 7);
+    file = fopen(absolut_path.c_str(), "wb");
+    ok = file != nullptr;
+  }
+  if (ok) {
+    setvbuf(file, nullptr, _IONBF, 0);
+    uint32_t start = micros();
+    for (size_t i = 0; ok && i < CALIBRATION_CHUNKS; i++)
+      ok = fwrite(buffer, 1, CALIBRATION_CHUNK_SIZE, file) == CALIBRATION_CHUNK_SIZE;
+    ok = fclose(file) == 0 && ok;
+    write_us = micros() - start;
+    written = ok;
+    file = ok ? fopen(absolut_path.c_str(), "rb") : nullptr;
+    ok = file != nullptr;
+  }
+  if (ok) {
+    setvbuf(file, nullptr, _IONBF, 0);
+    uint32_t start = micros();
+    for (size_t i = 0; ok && i < CALIBRATION_CHUNKS; i++) {
+      ok = fread(check, 1, CALIBRATION_CHUNK_SIZE, file) == CALIBRATION_CHUNK_SIZE &&
+           memcmp(buffer, check, CALIBRATION_CHUNK_SIZE) == 0;
     }
-    mark_failed();
-    return;
+    read_us = micros() - start;
+    fclose(file);
+  }
+  remove(absolut_path.c_str());
+  heap_caps_free(buffer);
+  heap_caps_free(check);
+
+  if (ok) {
+    const float total_kb = CALIBRATION_CHUNK_SIZE * CALIBRATION_CHUNKS / 1024.0f;
+    ESP_LOGI(TAG, "Calibration at %u kHz: write %.0f KB/s, read %.0f KB/s", this->card_->host.max_freq_khz,
+             total_kb * 1e6f / std::max<uint32_t>(write_us, 1), total_kb * 1e6f / std::max<uint32_t>(read_us, 1));
+    return CALIBRATION_OK;
   }
+  // only a file read back wrong tells about the bus, failing to write it is about the card
+  return written ? CALIBRATION_UNSTABLE : CALIBRATION_UNAVAILABLE;
+}
 
-#ifdef USE_TEXT_SENSOR
-  if (this->sd_card_type_text_sensor_ != nullptr)
-    this->sd_card_type_text_sensor_->publish_state(sd_card_type());
+void SdMmc::store_tuning() {
+  this->tuning_.card_serial = this->card_->cid.serial;
+  this->tuning_.frequency_khz = this->card_->host.max_freq_khz;
+  // the clock the host divided down to, the requested one is often not reachable exactly
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+  if (this->card_->real_freq_khz > 0)
+    this->tuning_.frequency_khz = this->card_->real_freq_khz;
 #endif
+  // NVS is written from the main loop
+  this->tuning_pending_ = true;
+}
 
-  update_sensors();
+void SdMmc::run_self_test() {
+  this->self_test_ms_ = millis();
+  uint8_t *buffer = static_cast<uint8_t *>(heap_caps_malloc(SELF_TEST_CHUNK_SIZE, MALLOC_CAP_DMA));
+  if (buffer == nullptr)
+    return;
+  const uint32_t sectors = SELF_TEST_SIZE / SECTOR_SIZE;
+  const uint32_t chunk_sectors = SELF_TEST_CHUNK_SIZE / SECTOR_SIZE;
+  const uint32_t capacity = this->card_->csd.capacity;
+  if (this->self_test_sector_ + sectors > capacity)
+    this->self_test_sector_ = 0;
+  // the lock is taken for each chunk, the filesystem is held up a few milliseconds at most
+  bool ok = true;
+  const uint32_t start = micros();
+  for (uint32_t done = 0; ok && done < sectors; done += chunk_sectors)
+    ok = this->disk_.read_sectors(buffer, this->self_test_sector_ + done, chunk_sectors);
+  const uint32_t elapsed_us = std::max<uint32_t>(micros() - start, 1);
+  heap_caps_free(buffer);
+  if (!ok) {
+    ESP_LOGW(TAG, "Self-test failed to read sector %u", this->self_test_sector_);
+    return;
+  }
+  const float throughput = SELF_TEST_SIZE * 1e6f / elapsed_us;
+  ESP_LOGD(TAG, "Self-test at sector %u: %.0f KB/s", this->self_test_sector_, throughput / 1024);
+  this->self_test_sector_ += capacity / SELF_TEST_AREAS;
+  this->self_test_throughput_ = throughput;
+  this->self_test_count_++;
 }
 
-void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
-  std::string absolut_path = build_path(path);
-  FILE *file = NULL;
-  file = fopen(absolut_path.c_str(), mode);
-  if (file == NULL) {
-    ESP_LOGE(TAG, "Failed to open file for writing");
+void SdMmc::unmount_card() {
+  if (this->card_ == nullptr)
     return;
+  this->raw_log_.close();
+  this->raw_log_device_.reset();
+  this->disk_.detach();
+  esp_vfs_fat_sdcard_unmount(MOUNT_POINT.c_str(), this->card_);
+  this->card_ = nullptr;
+}
+
+std::string SdMmc::get_fatfs_path(const char *path) const {
+  const BYTE pdrv = ff_diskio_get_pdrv_card(this->card_);
+  if (pdrv >= FF_VOLUMES)
+    return std::string();
+  return std::string(1, static_cast<char>('0' + pdrv)) + ":" + path;
+}
+
+bool SdMmc::is_card_responding() { return sdmmc_get_status(this->card_) == ESP_OK; }
+
+void SdMmc::write_file(const char *path, const uint8_t *buffer, size_t len, const char *mode) {
+  // a waiting atomic write would land after this one
+  if (mode[0] == 'w') {
+    this->atomic_writer_.discard(path);
+  } else {
+    this->atomic_writer_.commit(path);
   }
-  bool ok = fwrite(buffer, 1, len, file);
-  if (!ok) {
-    ESP_LOGE(TAG, "Failed to write to file");
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return;
+    std::string absolut_path = build_path(path);
+    const bool existed = !this->file_listeners_.empty() && this->path_exists(path);
+    // appends go through a kept handle, anything else must not leave a stale one behind
+    const bool append = mode[0] == 'a';
+    const bool pooled = append && !this->cipher_.is_encrypted(path);
+    this->handles_.close(absolut_path, pooled ? 'a' : '\0');
+    FILE *file = NULL;
+    file = pooled ? this->handles_.acquire(absolut_path, 'a') : this->cipher_.open(path, absolut_path, mode);
+    if (file == NULL) {
+      ESP_LOGE(TAG, "Failed to open file for writing");
+      return;
+    }
+    bool ok = fwrite(buffer, 1, len, file);
+    if (!ok) {
+      ESP_LOGE(TAG, "Failed to write to file");
+    }
+    if (pooled) {
+      this->handles_.release(absolut_path, 'a', file);
+    } else {
+      fclose(file);
+    }
+    if (ok && append && this->tail_hub_.has_subscribers())
+      this->tail_hub_.publish(path, buffer, len);
+    if (ok)
+      this->notify_file_event(existed ? FILE_MODIFIED : FILE_CREATED, path);
   }
-  fclose(file);
   this->update_sensors();
 }
 
 bool SdMmc::create_directory(const char *path) {
   ESP_LOGV(TAG, "Create directory: %s", path);
-  std::string absolut_path = build_path(path);
-  if (mkdir(absolut_path.c_str(), 0777) < 0) {
-    ESP_LOGE(TAG, "Failed to create a new directory: %s", strerror(errno));
-    return false;
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return false;
+    std::string absolut_path = build_path(path);
+    if (mkdir(absolut_path.c_str(), 0777) < 0) {
+      ESP_LOGE(TAG, "Failed to create a new directory: %s", strerror(errno));
+      return false;
+    }
+    this->notify_file_event(FILE_CREATED, path);
   }
   this->update_sensors();
   return true;
@@ -102,13 +410,21 @@ bool SdMmc::create_directory(const char *path) {
 
 bool SdMmc::remove_directory(const char *path) {
   ESP_LOGV(TAG, "Remove directory: %s", path);
-  if (!this->is_directory(path)) {
-    ESP_LOGE(TAG, "Not a directory");
-    return false;
-  }
-  std::string absolut_path = build_path(path);
-  if (remove(absolut_path.c_str()) != 0) {
-    ESP_LOGE(TAG, "Failed to remove directory: %s", strerror(errno));
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return false;
+    std::string absolut_path = build_path(path);
+    if (!directory_exists(absolut_path)) {
+      ESP_LOGE(TAG, "Not a directory");
+      return false;
+    }
+    this->handles_.close(absolut_path);
+    if (remove(absolut_path.c_str()) != 0) {
+      ESP_LOGE(TAG, "Failed to remove directory: %s", strerror(errno));
+    } else {
+      this->notify_file_event(FILE_DELETED, path);
+    }
   }
   this->update_sensors();
   return true;
@@ -116,13 +432,22 @@ bool SdMmc::remove_directory(const char *path) {
 
 bool SdMmc::delete_file(const char *path) {
   ESP_LOGV(TAG, "Delete File: %s", path);
-  if (this->is_directory(path)) {
-    ESP_LOGE(TAG, "Not a file");
-    return false;
-  }
-  std::string absolut_path = build_path(path);
-  if (remove(absolut_path.c_str()) != 0) {
-    ESP_LOGE(TAG, "Failed to remove file: %s", strerror(errno));
+  this->atomic_writer_.discard(path);
+  {
+    auto lock = this->lock_write(path);
+    if (!this->check_mounted(path))
+      return false;
+    std::string absolut_path = build_path(path);
+    if (directory_exists(absolut_path)) {
+      ESP_LOGE(TAG, "Not a file");
+      return false;
+    }
+    this->handles_.close(absolut_path);
+    if (remove(absolut_path.c_str()) != 0) {
+      ESP_LOGE(TAG, "Failed to remove file: %s", strerror(errno));
+    } else {
+      this->notify_file_event(FILE_DELETED, path);
+    }
   }
   this->update_sensors();
   return true;
@@ -130,20 +455,43 @@ bool SdMmc::delete_file(const char *path) {
 
 std::vector<uint8_t> SdMmc::read_file(char const *path) {
   ESP_LOGV(TAG, "Read File: %s", path);
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return std::vector<uint8_t>();
+  std::vector<uint8_t> pending;
+  if (this->atomic_writer_.read_pending(path, &pending))
+    return pending;
+  auto cached = this->read_cached_locked(path);
+  if (cached)
+    return std::vector<uint8_t>(cached->data(), cached->data() + cached->size());
 
   std::string absolut_path = build_path(path);
+  const bool encrypted = this->cipher_.is_encrypted(path);
   FILE *file = nullptr;
-  file = fopen(absolut_path.c_str(), "rb");
+  file = encrypted ? this->cipher_.open(path, absolut_path, "rb") : this->handles_.acquire(absolut_path, 'r');
   if (file == nullptr) {
     ESP_LOGE(TAG, "Failed to open file for reading");
     return std::vector<uint8_t>();
   }
 
   std::vector<uint8_t> res;
-  size_t fileSize = this->file_size(path);
+  struct stat info;
+  size_t fileSize = 0;
+  if (encrypted) {
+    // no descriptor behind the stream, the cipher knows the size of the contents
+    fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+  } else if (fstat(fileno(file), &info) == 0) {
+    fileSize = info.st_size;
+  }
   res.resize(fileSize);
   size_t len = fread(res.data(), 1, fileSize, file);
-  fclose(file);
+  if (encrypted) {
+    fclose(file);
+  } else {
+    this->handles_.release(absolut_path, 'r', file);
+  }
   if (len < 0) {
     ESP_LOGE(TAG, "Failed to read file: %s", strerror(errno));
     return std::vector<uint8_t>();
@@ -155,6 +503,8 @@ std::vector<uint8_t> SdMmc::read_file(char const *path) {
 std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uint8_t depth,
                                                            std::vector<FileInfo> &list) {
   ESP_LOGV(TAG, "Listing directory file info: %s\n", path);
+  if (!this->check_mounted(path))
+    return list;
   std::string absolut_path = build_path(path);
   DIR *dir = opendir(absolut_path.c_str());
   if (!dir) {
@@ -180,7 +530,7 @@ std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uin
       if (stat(entry_absolut_path, &info) < 0) {
         ESP_LOGE(TAG, "Failed to stat file: %s '%s' %s", strerror(errno), entry->d_name, entry_absolut_path);
       } else {
-        file_size = info.st_size;
+        file_size = this->cipher_.plain_size(entry_path, info.st_size);
       }
     }
     list.emplace_back(entry_path, file_size, entry->d_type == DT_DIR);
@@ -192,23 +542,29 @@ std::vector<FileInfo> &SdMmc::list_directory_file_info_rec(const char *path, uin
 }
 
 bool SdMmc::is_directory(const char *path) {
-  std::string absolut_path = build_path(path);
-  DIR *dir = opendir(absolut_path.c_str());
-  if (dir) {
-    closedir(dir);
-  }
-  return dir != nullptr;
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return false;
+  return directory_exists(build_path(path));
 }
 
 size_t SdMmc::file_size(const char *path) {
+  auto lock = this->lock_read(path);
+  if (!this->check_mounted(path))
+    return -1;
+  size_t pooled;
+  if (this->atomic_writer_.pending_size(path, &pooled))
+    return pooled;
   std::string absolut_path = build_path(path);
+  if (this->handles_.pooled_size(absolut_path, &pooled))
+    return this->cipher_.plain_size(path, pooled);
   struct stat info;
   size_t file_size = 0;
   if (stat(absolut_path.c_str(), &info) < 0) {
     ESP_LOGE(TAG, "Failed to stat file: %s", strerror(errno));
     return -1;
   }
-  return info.st_size;
+  return this->cipher_.plain_size(path, info.st_size);
 }
 
 std::string SdMmc::sd_card_type() const {
@@ -224,7 +580,7 @@ std::string SdMmc::sd_card_type() const {
 
 void SdMmc::update_sensors() {
 #ifdef USE_SENSOR
-  if (this->card_ == nullptr)
+  if (!this->is_mounted())
     return;
 
   FATFS *fs;
@@ -254,6 +610,42 @@ void SdMmc::update_sensors() {
 #endif
 }
 
+void SdMmc::update_health_sensors() {
+#ifdef USE_SENSOR
+  const float crc_errors = this->disk_.get_crc_errors();
+  const float timeouts = this->disk_.get_timeouts();
+  const float retries = this->disk_.get_retries();
+  if (this->crc_errors_sensor_ != nullptr &&
+      (!this->crc_errors_sensor_->has_state() || this->crc_errors_sensor_->state != crc_errors))
+    this->crc_errors_sensor_->publish_state(crc_errors);
+  if (this->timeout_errors_sensor_ != nullptr &&
+      (!this->timeout_errors_sensor_->has_state() || this->timeout_errors_sensor_->state != timeouts))
+    this->timeout_errors_sensor_->publish_state(timeouts);
+  if (this->transfer_retries_sensor_ != nullptr &&
+      (!this->transfer_retries_sensor_->has_state() || this->transfer_retries_sensor_->state != retries))
+    this->transfer_retries_sensor_->publish_state(retries);
+  const uint32_t self_tests = this->self_test_count_;
+  if (self_tests != this->published_self_test_count_) {
+    this->published_self_test_count_ = self_tests;
+    if (this->self_test_throughput_sensor_ != nullptr)
+      this->self_test_throughput_sensor_->publish_state(this->self_test_throughput_);
+  }
+#endif
+}
+
+void SdMmc::update_trim_sensors() {
+#ifdef USE_SENSOR
+  const float trimmed = static_cast<float>(this->disk_.get_trim().get_trimmed_sectors()) * FF_SS_SDCARD;
+  const float pending = static_cast<float>(this->disk_.get_trim().get_pending_sectors()) * FF_SS_SDCARD;
+  if (this->trimmed_space_sensor_ != nullptr &&
+      (!this->trimmed_space_sensor_->has_state() || this->trimmed_space_sensor_->state != trimmed))
+    this->trimmed_space_sensor_->publish_state(trimmed);
+  if (this->pending_trim_space_sensor_ != nullptr &&
+      (!this->pending_trim_space_sensor_->has_state() || this->pending_trim_space_sensor_->state != pending))
+    this->pending_trim_space_sensor_->publish_state(pending);
+#endif
+}
+
 }  // namespace sd_mmc_card
 }  // namespace esphome
 
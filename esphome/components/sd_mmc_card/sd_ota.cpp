@@ -0,0 +1,241 @@
+#include "sd_ota.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "esp_heap_caps.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "esphome/core/application.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.ota";
+
+static const uint32_t UPDATE_TASK_STACK_SIZE = 8192;
+static const UBaseType_t UPDATE_TASK_PRIORITY = 1;
+// bytes read and written at once, a multiple of the flash sector so every write but the last one is aligned
+static const size_t CHUNK_SIZE = 32 * 1024;
+static const size_t DIGEST_SIZE = 32;
+// waited between two tries when the other transfers hold the card bandwidth
+static const TickType_t RETRY_DELAY = pdMS_TO_TICKS(5);
+
+SdOta::SdOta(SdMmc *parent) : parent_(parent) {}
+
+bool SdOta::start(std::string const &path, std::string const &sha256, bool reboot) {
+  State idle = STATE_IDLE;
+  if (!this->state_.compare_exchange_strong(idle, STATE_RUNNING)) {
+    ESP_LOGW(TAG, "An update is already running, ignoring %s", path.c_str());
+    return false;
+  }
+  if (!this->parent_->is_mounted()) {
+    ESP_LOGW(TAG, "Card not ready, ignoring update from %s", path.c_str());
+    this->state_ = STATE_IDLE;
+    return false;
+  }
+  this->path_ = path;
+  this->sha256_ = sha256;
+  this->reboot_ = reboot;
+  this->error_.clear();
+  this->written_ = 0;
+  this->size_ = 0;
+  this->published_percent_ = -1;
+  if (xTaskCreate(SdOta::update_task, "sd_ota", UPDATE_TASK_STACK_SIZE, this, UPDATE_TASK_PRIORITY, nullptr) !=
+      pdPASS) {
+    ESP_LOGE(TAG, "Failed to start update task");
+    this->state_ = STATE_IDLE;
+    return false;
+  }
+  ESP_LOGI(TAG, "Updating from %s", path.c_str());
+  return true;
+}
+
+void SdOta::loop() {
+  const State state = this->state_;
+  if (state == STATE_IDLE)
+    return;
+  const uint32_t size = this->size_;
+  if (size != 0) {
+    const int percent = static_cast<int>(static_cast<uint64_t>(this->written_) * 100 / size);
+    if (percent != this->published_percent_) {
+      this->published_percent_ = percent;
+      this->publish(OTA_PROGRESS, percent);
+    }
+  }
+  if (state == STATE_RUNNING)
+    return;
+
+  this->state_ = STATE_IDLE;
+  if (state == STATE_FAILED) {
+    ESP_LOGE(TAG, "Update from %s failed: %s", this->path_.c_str(), this->error_.c_str());
+    this->publish(OTA_FAILED, std::max(this->published_percent_, 0));
+    return;
+  }
+  ESP_LOGI(TAG, "Update from %s done", this->path_.c_str());
+  this->publish(OTA_FINISHED, 100);
+  if (this->reboot_) {
+    ESP_LOGI(TAG, "Rebooting into the new firmware");
+    App.safe_reboot();
+  }
+}
+
+void SdOta::add_listener(std::function<void(OtaEvent, float, const std::string &)> &&listener) {
+  this->listeners_.push_back(std::move(listener));
+}
+
+void SdOta::update_task(void *params) {
+  SdOta *ota = static_cast<SdOta *>(params);
+  const bool done = ota->update();
+  ota->state_ = done ? STATE_FINISHED : STATE_FAILED;
+  vTaskDelete(nullptr);
+}
+
+bool SdOta::update() {
+  uint8_t expected[DIGEST_SIZE];
+  const bool verify = this->expected_digest(expected);
+  if (!this->error_.empty())
+    return false;
+  if (!verify)
+    ESP_LOGW(TAG, "No SHA-256 for %s, relying on the image checks only", this->path_.c_str());
+
+  const esp_partition_t *partition = esp_ota_get_next_update_partition(nullptr);
+  if (partition == nullptr) {
+    this->error_ = "no OTA partition";
+    return false;
+  }
+
+  FILE *file;
+  long size = -1;
+  {
+    // only held to open and size the image: flashing takes seconds and the main loop may wait on this stripe,
+    // the open handle keeps reading the same clusters afterwards
+    auto lock = this->parent_->lock_read(this->path_.c_str());
+    file = this->parent_->get_file_cipher()->open(this->path_, build_path(this->path_.c_str()), "rb");
+    if (file == nullptr) {
+      this->error_ = strerror(errno);
+      return false;
+    }
+    // reads land straight in the DMA capable chunk instead of going through the stdio buffer
+    setvbuf(file, nullptr, _IONBF, 0);
+    if (fseek(file, 0, SEEK_END) == 0) {
+      size = ftell(file);
+      fseek(file, 0, SEEK_SET);
+    }
+  }
+  if (size <= 0 || static_cast<uint32_t>(size) > partition->size) {
+    this->error_ = size <= 0 ? "empty or unreadable image" : "image larger than the OTA partition";
+    fclose(file);
+    return false;
+  }
+  uint8_t *chunk = static_cast<uint8_t *>(heap_caps_malloc(CHUNK_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT));
+  if (chunk == nullptr) {
+    this->error_ = "out of memory";
+    fclose(file);
+    return false;
+  }
+  esp_ota_handle_t handle;
+  esp_err_t err = esp_ota_begin(partition, size, &handle);
+  if (err != ESP_OK) {
+    this->error_ = std::string("begin failed: ") + esp_err_to_name(err);
+    heap_caps_free(chunk);
+    fclose(file);
+    return false;
+  }
+  this->size_ = size;
+  ESP_LOGD(TAG, "Writing %ld bytes to partition %s", size, partition->label);
+
+  mbedtls_sha256_context sha256;
+  mbedtls_sha256_init(&sha256);
+  mbedtls_sha256_starts(&sha256, 0);
+  IoScheduler *scheduler = this->parent_->get_io_scheduler();
+  IoScheduler::Transfer *transfer = scheduler->begin("ota", IO_BULK);
+  size_t remaining = size;
+  while (remaining > 0 && err == ESP_OK) {
+    // the chunk is filled over as many grants as it takes, the flash only sees large writes
+    const size_t wanted = std::min(remaining, CHUNK_SIZE);
+    size_t filled = 0;
+    while (filled < wanted) {
+      const size_t granted = scheduler->acquire(transfer, wanted - filled);
+      if (granted == 0) {
+        vTaskDelay(RETRY_DELAY);
+        continue;
+      }
+      const size_t read = fread(chunk + filled, 1, granted, file);
+      scheduler->release(transfer, granted, read);
+      if (read == 0)
+        break;
+      filled += read;
+    }
+    if (filled != wanted) {
+      this->error_ = ferror(file) ? strerror(errno) : "image shorter than expected";
+      err = ESP_FAIL;
+      break;
+    }
+    mbedtls_sha256_update(&sha256, chunk, filled);
+    err = esp_ota_write(handle, chunk, filled);
+    if (err != ESP_OK) {
+      this->error_ = std::string("write failed: ") + esp_err_to_name(err);
+      break;
+    }
+    remaining -= filled;
+    this->written_ += filled;
+  }
+  scheduler->end(transfer);
+  heap_caps_free(chunk);
+  fclose(file);
+  uint8_t digest[DIGEST_SIZE];
+  mbedtls_sha256_finish(&sha256, digest);
+  mbedtls_sha256_free(&sha256);
+
+  if (err == ESP_OK && verify && memcmp(digest, expected, DIGEST_SIZE) != 0) {
+    this->error_ = "SHA-256 mismatch, got " + format_hex(digest, DIGEST_SIZE);
+    err = ESP_FAIL;
+  }
+  if (err != ESP_OK) {
+    esp_ota_abort(handle);
+    return false;
+  }
+  // also checks the image header and its own checksum
+  err = esp_ota_end(handle);
+  if (err == ESP_OK)
+    err = esp_ota_set_boot_partition(partition);
+  if (err != ESP_OK) {
+    this->error_ = std::string("image rejected: ") + esp_err_to_name(err);
+    return false;
+  }
+  return true;
+}
+
+bool SdOta::expected_digest(uint8_t *digest) {
+  std::string hex = this->sha256_;
+  if (hex.empty()) {
+    const std::string sidecar = this->path_ + ".sha256";
+    if (!this->parent_->exists(sidecar))
+      return false;
+    // sha256sum output, the digest comes first
+    std::vector<uint8_t> contents = this->parent_->read_file(sidecar);
+    hex.assign(contents.begin(), contents.begin() + std::min<size_t>(contents.size(), DIGEST_SIZE * 2));
+  }
+  if (hex.size() != DIGEST_SIZE * 2 || !parse_hex(hex, digest, DIGEST_SIZE)) {
+    this->error_ = "invalid SHA-256 '" + hex + "'";
+    return false;
+  }
+  return true;
+}
+
+void SdOta::publish(OtaEvent event, float progress) {
+  for (auto &listener : this->listeners_)
+    listener(event, progress, this->error_);
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+enum OtaEvent : uint8_t {
+  OTA_PROGRESS,
+  OTA_FINISHED,
+  OTA_FAILED,
+};
+
+/* Firmware update from an image staged on the card. A background task streams the file into the next OTA
+ * partition in large reads straight into a DMA capable buffer, hashing each chunk with SHA-256 as it goes, so the
+ * image is never held in RAM. The digest is checked against the expected one (given, or read from a sha256sum
+ * style "<image>.sha256" file next to it) before the partition is made bootable; the image itself is also
+ * validated by the OTA driver. Progress and the outcome are reported from the main loop. */
+class SdOta {
+ public:
+  SdOta(SdMmc *parent);
+
+  /* Start flashing path, sha256 being the expected digest in hexadecimal or empty. False if an update is
+   * already running or the task can't be started. */
+  bool start(std::string const &path, std::string const &sha256, bool reboot);
+  bool is_running() const { return this->state_ == STATE_RUNNING; }
+  /* Publish progress at most once per percent, then the outcome, and reboot into the new image if asked */
+  void loop();
+
+  /* progress in percent, error only set for OTA_FAILED */
+  void add_listener(std::function<void(OtaEvent, float, const std::string &)> &&listener);
+
+ protected:
+  enum State : uint8_t {
+    STATE_IDLE,
+    STATE_RUNNING,
+    STATE_FINISHED,
+    STATE_FAILED,
+  };
+
+  static void update_task(void *params);
+  /* Flash the image, false with error_ set on failure */
+  bool update();
+  /* Expected digest from sha256_ or the .sha256 file, false if there is none */
+  bool expected_digest(uint8_t *digest);
+  void publish(OtaEvent event, float progress);
+
+  SdMmc *parent_;
+  std::atomic<State> state_{STATE_IDLE};
+  std::atomic<uint32_t> written_{0};
+  std::atomic<uint32_t> size_{0};
+  // set before the task starts or before state_ leaves STATE_RUNNING
+  std::string path_;
+  std::string sha256_;
+  std::string error_;
+  bool reboot_{false};
+  int published_percent_{-1};
+  std::vector<std::function<void(OtaEvent, float, const std::string &)>> listeners_;
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,225 @@
+#include "sd_trim.h"
+
+#ifdef USE_ESP_IDF
+#include <algorithm>
+#include <cstring>
+
+#include "esphome/core/log.h"
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.trim";
+
+// beyond that, newly freed ranges are dropped until the pending ones are erased
+static const size_t MAX_PENDING_RANGES = 128;
+bool SdTrim::attach(sdmmc_card_t *card, const FATFS *fs, TrimMode mode) {
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+  if (mode != TRIM_NONE) {
+    ESP_LOGW(TAG, "Erasing sectors requires ESP-IDF 5.0 or later");
+    mode = TRIM_NONE;
+  }
+#endif
+  if (this->scratch_ == nullptr)
+    this->scratch_ = static_cast<uint8_t *>(heap_caps_malloc(FF_SS_SDCARD, MALLOC_CAP_DMA));
+  if (this->scratch_ == nullptr)
+    return false;
+
+  this->card_ = card;
+  this->mode_ = mode;
+  this->discard_ = sdmmc_can_discard(card) == ESP_OK;
+  this->fs_type_ = fs->fs_type;
+  this->csize_ = fs->csize;
+  this->n_fatent_ = fs->n_fatent;
+  this->fatbase_ = fs->fatbase;
+  this->fsize_ = fs->fsize;
+  this->database_ = fs->database;
+  // FAT12 entries straddle sectors and exFAT keeps an allocation bitmap, only FAT16/32 tables are tracked
+  this->fat_tracking_ =
+      mode != TRIM_NONE && !FF_USE_TRIM && (fs->fs_type == FS_FAT16 || fs->fs_type == FS_FAT32);
+  if (mode != TRIM_NONE && !FF_USE_TRIM && !this->fat_tracking_) {
+    ESP_LOGW(TAG, "Freed clusters can't be tracked on this filesystem type (%u)", fs->fs_type);
+    this->mode_ = TRIM_NONE;
+  }
+  this->pending_.clear();
+  this->pending_sectors_ = 0;
+  if (this->mode_ != TRIM_NONE) {
+    ESP_LOGD(TAG, "Tracking freed clusters (%s, %s)", FF_USE_TRIM ? "FatFs trim" : "FAT scan",
+             this->discard_ ? "discard" : "erase");
+  }
+  return true;
+}
+
+void SdTrim::detach() {
+  this->card_ = nullptr;
+  this->pending_.clear();
+  this->pending_sectors_ = 0;
+}
+
+uint32_t SdTrim::sweep(uint32_t max_sectors) {
+  uint32_t erased = 0;
+  while (this->card_ != nullptr && !this->pending_.empty() && erased < max_sectors) {
+    SectorRange &range = this->pending_.back();
+    uint32_t count = std::min(range.count, max_sectors - erased);
+    // a range that fails to erase is dropped, the sectors only stay mapped in the card
+    this->erase(range.start, count);
+    this->pending_sectors_ -= count;
+    erased += count;
+    range.start += count;
+    range.count -= count;
+    if (range.count == 0)
+      this->pending_.pop_back();
+  }
+  return erased;
+}
+
+void SdTrim::before_write(const BYTE *buff, uint32_t sector, UINT count) {
+  if (this->fat_tracking_) {
+    for (UINT i = 0; i < count; i++) {
+      uint32_t current = sector + i;
+      if (current >= this->fatbase_ && current < this->fatbase_ + this->fsize_)
+        this->scan_fat_sector(current, buff + i * FF_SS_SDCARD);
+    }
+  }
+  // freed clusters may be reused before the FAT reaches the card, never erase a range written since
+  if (sector + count > this->database_)
+    this->forget(sector, count);
+}
+
+void SdTrim::after_write() {
+  if (this->mode_ == TRIM_INLINE)
+    this->flush();
+}
+
+void SdTrim::freed(uint32_t start, uint32_t count) {
+  if (this->mode_ == TRIM_NONE)
+    return;
+  this->queue(start, count);
+  if (this->mode_ == TRIM_INLINE)
+    this->flush();
+}
+
+void SdTrim::scan_fat_sector(uint32_t sector, const uint8_t *data) {
+  if (sdmmc_read_sectors(this->card_, this->scratch_, sector, 1) != ESP_OK)
+    return;
+  const bool fat16 = this->fs_type_ == FS_FAT16;
+  const uint32_t entries = fat16 ? FF_SS_SDCARD / 2 : FF_SS_SDCARD / 4;
+  const uint32_t first_cluster = (sector - this->fatbase_) * entries;
+  uint32_t run_start = 0, run_length = 0;
+
+  for (uint32_t i = 0; i < entries; i++) {
+    uint32_t cluster = first_cluster + i;
+    if (cluster < 2 || cluster >= this->n_fatent_)
+      continue;
+    uint32_t before, after;
+    if (fat16) {
+      uint16_t entry;
+      memcpy(&entry, this->scratch_ + i * 2, 2);
+      before = entry;
+      memcpy(&entry, data + i * 2, 2);
+      after = entry;
+    } else {
+      memcpy(&before, this->scratch_ + i * 4, 4);
+      memcpy(&after, data + i * 4, 4);
+      before &= 0x0FFFFFFF;
+      after &= 0x0FFFFFFF;
+    }
+
+    if (before != 0 && after == 0) {
+      if (run_length != 0 && run_start + run_length == cluster) {
+        run_length++;
+        continue;
+      }
+      if (run_length != 0)
+        this->queue(this->database_ + (run_start - 2) * this->csize_, run_length * this->csize_);
+      run_start = cluster;
+      run_length = 1;
+    } else if (before == 0 && after != 0) {
+      this->forget(this->database_ + (cluster - 2) * this->csize_, this->csize_);
+    }
+  }
+  if (run_length != 0)
+    this->queue(this->database_ + (run_start - 2) * this->csize_, run_length * this->csize_);
+}
+
+void SdTrim::queue(uint32_t start, uint32_t count) {
+  for (auto &range : this->pending_) {
+    if (range.start + range.count == start) {
+      range.count += count;
+      this->pending_sectors_ += count;
+      return;
+    }
+    if (start + count == range.start) {
+      range.start = start;
+      range.count += count;
+      this->pending_sectors_ += count;
+      return;
+    }
+  }
+  if (this->pending_.size() >= MAX_PENDING_RANGES) {
+    ESP_LOGV(TAG, "Trim queue full, dropping %u sectors at %u", count, start);
+    return;
+  }
+  this->pending_.push_back({start, count});
+  this->pending_sectors_ += count;
+}
+
+void SdTrim::forget(uint32_t start, uint32_t count) {
+  const uint32_t end = start + count;
+  for (size_t i = 0; i < this->pending_.size();) {
+    SectorRange &range = this->pending_[i];
+    const uint32_t range_end = range.start + range.count;
+    if (range_end <= start || range.start >= end) {
+      i++;
+      continue;
+    }
+    this->pending_sectors_ -= std::min(end, range_end) - std::max(start, range.start);
+    if (range.start < start && range_end > end) {
+      // the write lands inside the range, keep both sides, no other range can overlap
+      range.count = start - range.start;
+      this->pending_.push_back({end, range_end - end});
+      return;
+    }
+    if (range.start < start) {
+      range.count = start - range.start;
+      i++;
+    } else if (range_end > end) {
+      range.count = range_end - end;
+      range.start = end;
+      i++;
+    } else {
+      range = this->pending_.back();
+      this->pending_.pop_back();
+    }
+  }
+}
+
+void SdTrim::flush() {
+  for (auto &range : this->pending_)
+    this->erase(range.start, range.count);
+  this->pending_.clear();
+  this->pending_sectors_ = 0;
+}
+
+bool SdTrim::erase(uint32_t start, uint32_t count) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  esp_err_t err =
+      sdmmc_erase_sectors(this->card_, start, count, this->discard_ ? SDMMC_DISCARD_ARG : SDMMC_ERASE_ARG);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to erase %u sectors at %u: %s", count, start, esp_err_to_name(err));
+    return false;
+  }
+  this->trimmed_sectors_ += count;
+  ESP_LOGV(TAG, "Erased %u sectors at %u", count, start);
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
+
+#endif  // USE_ESP_IDF
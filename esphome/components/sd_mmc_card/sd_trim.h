@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_ESP_IDF
+#include "ff.h"
+#include "sdmmc_cmd.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+enum TrimMode : uint8_t {
+  TRIM_NONE,
+  TRIM_INLINE,
+  TRIM_IDLE,
+};
+
+#ifdef USE_ESP_IDF
+/* Erases the clusters the filesystem frees, so the card controller knows these flash blocks no longer hold data.
+ * A feature of the CardDisk driver, which calls it under its lock around the FatFs transfers.
+ * Freed clusters are reported by FatFs itself when it is built with FF_USE_TRIM, otherwise they are found by
+ * comparing each first FAT sector with its previous content before it is written. */
+class SdTrim {
+ public:
+  bool attach(sdmmc_card_t *card, const FATFS *fs, TrimMode mode);
+  void detach();
+  /* Before FatFs writes sectors: freed clusters found in the FAT, ranges written again dropped */
+  void before_write(const BYTE *buff, uint32_t sector, UINT count);
+  /* After a successful FatFs write, erases right away in TRIM_INLINE */
+  void after_write();
+  /* Range reported by FatFs (CTRL_TRIM) */
+  void freed(uint32_t start, uint32_t count);
+  /* Erase up to max_sectors of the pending ranges, returns the number of sectors erased. */
+  uint32_t sweep(uint32_t max_sectors);
+  uint32_t get_trimmed_sectors() const { return this->trimmed_sectors_; }
+  uint32_t get_pending_sectors() const { return this->pending_sectors_; }
+
+ protected:
+  struct SectorRange {
+    uint32_t start;
+    uint32_t count;
+  };
+
+  void scan_fat_sector(uint32_t sector, const uint8_t *data);
+  void queue(uint32_t start, uint32_t count);
+  void forget(uint32_t start, uint32_t count);
+  void flush();
+  bool erase(uint32_t start, uint32_t count);
+
+  sdmmc_card_t *card_{nullptr};
+  TrimMode mode_{TRIM_NONE};
+  bool discard_{false};
+  bool fat_tracking_{false};
+  BYTE fs_type_;
+  uint32_t csize_;
+  uint32_t n_fatent_;
+  uint32_t fatbase_;
+  uint32_t fsize_;
+  uint32_t database_;
+  uint8_t *scratch_{nullptr};
+  std::vector<SectorRange> pending_;
+  std::atomic<uint32_t> pending_sectors_{0};
+  std::atomic<uint32_t> trimmed_sectors_{0};
+};
+#endif
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
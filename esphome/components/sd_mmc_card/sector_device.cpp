@@ -0,0 +1,68 @@
+#include "sector_device.h"
+
+#include <cstring>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+#ifdef USE_ESP_IDF
+bool SdmmcSectorDevice::read(uint32_t sector, uint8_t *data, uint32_t count) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  return sdmmc_read_sectors(this->card_, data, sector, count) == ESP_OK;
+}
+
+bool SdmmcSectorDevice::write(uint32_t sector, const uint8_t *data, uint32_t count) {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  return sdmmc_write_sectors(this->card_, data, sector, count) == ESP_OK;
+}
+#endif
+
+FileSectorDevice::~FileSectorDevice() { this->close(); }
+
+bool FileSectorDevice::open(const char *path, uint32_t sector_count) {
+  this->close();
+  this->file_ = fopen(path, "r+b");
+  if (this->file_ == nullptr)
+    this->file_ = fopen(path, "w+b");
+  if (this->file_ == nullptr)
+    return false;
+  // reads past the end of the file return zeros, as on an erased card
+  uint8_t zero[SECTOR_SIZE] = {};
+  if (fseek(this->file_, static_cast<long>(sector_count - 1) * SECTOR_SIZE, SEEK_SET) != 0 ||
+      fread(zero, 1, SECTOR_SIZE, this->file_) != SECTOR_SIZE) {
+    memset(zero, 0, sizeof(zero));
+    if (fseek(this->file_, static_cast<long>(sector_count - 1) * SECTOR_SIZE, SEEK_SET) != 0 ||
+        fwrite(zero, 1, SECTOR_SIZE, this->file_) != SECTOR_SIZE) {
+      this->close();
+      return false;
+    }
+  }
+  this->sector_count_ = sector_count;
+  return true;
+}
+
+void FileSectorDevice::close() {
+  if (this->file_ != nullptr)
+    fclose(this->file_);
+  this->file_ = nullptr;
+  this->sector_count_ = 0;
+}
+
+bool FileSectorDevice::read(uint32_t sector, uint8_t *data, uint32_t count) {
+  if (this->file_ == nullptr || sector + count > this->sector_count_)
+    return false;
+  if (fseek(this->file_, static_cast<long>(sector) * SECTOR_SIZE, SEEK_SET) != 0)
+    return false;
+  return fread(data, SECTOR_SIZE, count, this->file_) == count;
+}
+
+bool FileSectorDevice::write(uint32_t sector, const uint8_t *data, uint32_t count) {
+  if (this->file_ == nullptr || sector + count > this->sector_count_)
+    return false;
+  if (fseek(this->file_, static_cast<long>(sector) * SECTOR_SIZE, SEEK_SET) != 0)
+    return false;
+  return fwrite(data, SECTOR_SIZE, count, this->file_) == count && fflush(this->file_) == 0;
+}
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
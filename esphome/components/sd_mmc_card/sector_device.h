@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_ESP_IDF
+#include "sdmmc_cmd.h"
+#endif
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static constexpr uint32_t SECTOR_SIZE = 512;
+
+/* Storage seen as an array of 512 bytes sectors */
+class SectorDevice {
+ public:
+  virtual ~SectorDevice() = default;
+  virtual bool read(uint32_t sector, uint8_t *data, uint32_t count) = 0;
+  virtual bool write(uint32_t sector, const uint8_t *data, uint32_t count) = 0;
+  virtual uint32_t get_sector_count() const = 0;
+};
+
+#ifdef USE_ESP_IDF
+/* Sectors of the mounted card, accesses are serialized with the filesystem ones through lock */
+class SdmmcSectorDevice : public SectorDevice {
+ public:
+  SdmmcSectorDevice(sdmmc_card_t *card, std::mutex &lock) : card_(card), lock_(lock) {}
+  bool read(uint32_t sector, uint8_t *data, uint32_t count) override;
+  bool write(uint32_t sector, const uint8_t *data, uint32_t count) override;
+  uint32_t get_sector_count() const override { return this->card_->csd.capacity; }
+
+ protected:
+  sdmmc_card_t *card_;
+  std::mutex &lock_;
+};
+#endif
+
+/* Sectors kept in a regular file, to run the raw storage on a host */
+class FileSectorDevice : public SectorDevice {
+ public:
+  ~FileSectorDevice() override;
+  /* Open or create the backing file and grow it to sector_count sectors. */
+  bool open(const char *path, uint32_t sector_count);
+  void close();
+  bool read(uint32_t sector, uint8_t *data, uint32_t count) override;
+  bool write(uint32_t sector, const uint8_t *data, uint32_t count) override;
+  uint32_t get_sector_count() const override { return this->sector_count_; }
+
+ protected:
+  FILE *file_{nullptr};
+  uint32_t sector_count_{0};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
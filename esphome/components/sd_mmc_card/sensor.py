@@ -3,9 +3,16 @@ import esphome.config_validation as cv
 from esphome.components import sensor
 from esphome.const import (
     CONF_TYPE,
+    ENTITY_CATEGORY_DIAGNOSTIC,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_BYTES,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
     ICON_MEMORY,
+    ICON_TIMER,
+    ICON_PERCENT,
+    ICON_SPEEDOMETER,
 )
 from . import (
     SdMmc,
@@ -19,9 +26,35 @@ CONF_USED_SPACE = "used_space"
 CONF_TOTAL_SPACE = "total_space"
 CONF_FREE_SPACE = "free_space"
 CONF_FILE_SIZE = "file_size"
+CONF_TRIMMED_SPACE = "trimmed_space"
+CONF_PENDING_TRIM_SPACE = "pending_trim_space"
+CONF_LOCK_WAIT_TIME = "lock_wait_time"
+CONF_CACHE_HIT_RATIO = "cache_hit_ratio"
+CONF_CACHE_HIT_BYTES = "cache_hit_bytes"
+CONF_ENCRYPTION_THROUGHPUT = "encryption_throughput"
+CONF_CRC_ERRORS = "crc_errors"
+CONF_TIMEOUT_ERRORS = "timeout_errors"
+CONF_TRANSFER_RETRIES = "transfer_retries"
+CONF_SELF_TEST_THROUGHPUT = "self_test_throughput"
+CONF_TEST_INTERVAL = "test_interval"
+UNIT_BYTES_PER_SECOND = "B/s"
 
 TYPES = [CONF_USED_SPACE, CONF_TOTAL_SPACE, CONF_USED_SPACE, CONF_FREE_SPACE]
-SIMPLE_TYPES = [CONF_USED_SPACE, CONF_TOTAL_SPACE, CONF_FREE_SPACE]
+SIMPLE_TYPES = [
+    CONF_USED_SPACE,
+    CONF_TOTAL_SPACE,
+    CONF_FREE_SPACE,
+    CONF_TRIMMED_SPACE,
+    CONF_PENDING_TRIM_SPACE,
+    CONF_LOCK_WAIT_TIME,
+    CONF_CACHE_HIT_RATIO,
+    CONF_CACHE_HIT_BYTES,
+    CONF_ENCRYPTION_THROUGHPUT,
+    CONF_CRC_ERRORS,
+    CONF_TIMEOUT_ERRORS,
+    CONF_TRANSFER_RETRIES,
+    CONF_SELF_TEST_THROUGHPUT,
+]
 
 BASE_CONFIG_SCHEMA = sensor.sensor_schema(
     unit_of_measurement=UNIT_BYTES,
@@ -34,11 +67,91 @@ BASE_CONFIG_SCHEMA = sensor.sensor_schema(
     }
 )
 
+LOCK_WAIT_TIME_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    icon=ICON_TIMER,
+    accuracy_decimals=1,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+CACHE_HIT_RATIO_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_PERCENT,
+    icon=ICON_PERCENT,
+    accuracy_decimals=1,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+CACHE_HIT_BYTES_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES,
+    icon=ICON_MEMORY,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+ENCRYPTION_THROUGHPUT_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES_PER_SECOND,
+    icon=ICON_MEMORY,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+ERROR_COUNT_SCHEMA = sensor.sensor_schema(
+    icon="mdi:alert-circle-outline",
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+    }
+)
+
+SELF_TEST_THROUGHPUT_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_BYTES_PER_SECOND,
+    icon=ICON_SPEEDOMETER,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+).extend(
+    {
+        cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
+        cv.Optional(CONF_TEST_INTERVAL, default="1h"): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(seconds=10))
+        ),
+    }
+)
+
 CONFIG_SCHEMA = cv.typed_schema(
     {
         CONF_TOTAL_SPACE : BASE_CONFIG_SCHEMA,
         CONF_USED_SPACE : BASE_CONFIG_SCHEMA,
         CONF_FREE_SPACE: BASE_CONFIG_SCHEMA,
+        CONF_TRIMMED_SPACE: cv.All(BASE_CONFIG_SCHEMA, cv.only_with_esp_idf),
+        CONF_PENDING_TRIM_SPACE: cv.All(BASE_CONFIG_SCHEMA, cv.only_with_esp_idf),
+        CONF_LOCK_WAIT_TIME: LOCK_WAIT_TIME_SCHEMA,
+        CONF_CACHE_HIT_RATIO: CACHE_HIT_RATIO_SCHEMA,
+        CONF_CACHE_HIT_BYTES: CACHE_HIT_BYTES_SCHEMA,
+        CONF_ENCRYPTION_THROUGHPUT: cv.All(ENCRYPTION_THROUGHPUT_SCHEMA, cv.only_with_esp_idf),
+        CONF_CRC_ERRORS: cv.All(ERROR_COUNT_SCHEMA, cv.only_with_esp_idf),
+        CONF_TIMEOUT_ERRORS: cv.All(ERROR_COUNT_SCHEMA, cv.only_with_esp_idf),
+        CONF_TRANSFER_RETRIES: cv.All(ERROR_COUNT_SCHEMA, cv.only_with_esp_idf),
+        CONF_SELF_TEST_THROUGHPUT: cv.All(SELF_TEST_THROUGHPUT_SCHEMA, cv.only_with_esp_idf),
         CONF_FILE_SIZE: BASE_CONFIG_SCHEMA.extend(
             {
                 cv.Required(CONF_PATH): cv.templatable(cv.string_strict),
@@ -55,5 +168,7 @@ async def to_code(config):
     if config[CONF_TYPE] in SIMPLE_TYPES:
         func = getattr(sd_mmc_component, f"set_{config[CONF_TYPE]}_sensor")
         cg.add(func(var))
+        if config[CONF_TYPE] == CONF_SELF_TEST_THROUGHPUT:
+            cg.add(sd_mmc_component.set_self_test_interval(config[CONF_TEST_INTERVAL]))
     elif config[CONF_TYPE] == CONF_FILE_SIZE:
         cg.add(sd_mmc_component.add_file_size_sensor(var, config[CONF_PATH]))
@@ -0,0 +1,177 @@
+#include "sharded_directory.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_mmc_card {
+
+static const char *TAG = "sd_mmc_card.sharded";
+
+ShardedDirectory::ShardedDirectory(SdMmc *parent) : parent_(parent) {}
+
+std::string ShardedDirectory::resolve(const std::string &name, time_t time) const {
+  return this->path_ + "/" + this->shard(name, time) + "/" + name;
+}
+
+FILE *ShardedDirectory::open(const std::string &name, const char *mode, time_t time) {
+  std::string shard = this->shard(name, time);
+  std::string path = this->path_ + "/" + shard + "/" + name;
+  const bool writing = mode[0] != 'r' || strchr(mode, '+') != nullptr;
+  // the caller uses the file directly, an atomic write waiting on it is settled first
+  if (mode[0] == 'w') {
+    this->parent_->discard_atomic_write(path.c_str());
+  } else {
+    this->parent_->commit_atomic_write(path.c_str());
+  }
+  // held for the open and the creation of the subdirectories, a caller writing afterwards takes it again
+  auto lock = writing ? this->parent_->lock_write(path.c_str()) : this->parent_->lock_read(path.c_str());
+  return this->open_locked(shard, path, mode);
+}
+
+void ShardedDirectory::write(const std::string &name, const uint8_t *data, size_t len, time_t time) {
+  std::string shard = this->shard(name, time);
+  {
+    auto lock = this->parent_->lock_write((this->path_ + "/" + shard).c_str());
+    if (!this->parent_->is_mounted() || !this->prepare_shard(shard))
+      return;
+  }
+  // through the card for the cipher, the file cache, the kept handles, the followers and the events
+  this->parent_->write_file((this->path_ + "/" + shard + "/" + name).c_str(), data, len);
+}
+
+FILE *ShardedDirectory::open_locked(const std::string &shard, const std::string &path, const char *mode) {
+  if (!this->parent_->is_mounted())
+    return nullptr;
+  const bool writing = mode[0] != 'r' || strchr(mode, '+') != nullptr;
+  struct stat info;
+  const bool existed = writing && stat(build_path(path.c_str()).c_str(), &info) == 0;
+  if (writing && !existed && !this->prepare_shard(shard))
+    return nullptr;
+  FILE *file = this->parent_->open_file(path.c_str(), mode);
+  if (file == nullptr)
+    return nullptr;
+  // reported when opened for writing, the caller's writes follow
+  if (writing)
+    this->parent_->notify_file_event(existed ? FILE_MODIFIED : FILE_CREATED, path);
+  return file;
+}
+
+bool ShardedDirectory::exists(const std::string &name, time_t time) const {
+  return this->parent_->exists(this->resolve(name, time));
+}
+
+size_t ShardedDirectory::file_size(const std::string &name, time_t time) const {
+  return this->parent_->get_file_size(this->resolve(name, time));
+}
+
+bool ShardedDirectory::remove(const std::string &name, time_t time) {
+  // the empty subdirectory is kept, it is bound to be reused in hash mode
+  return this->parent_->delete_file(this->resolve(name, time));
+}
+
+void ShardedDirectory::for_each(const std::function<bool(const std::string &, const std::string &)> &callback) const {
+  if (!this->parent_->is_mounted())
+    return;
+  this->walk(this->path_, this->depth(), callback);
+}
+
+std::string ShardedDirectory::shard(const std::string &name, time_t time) const {
+  if (this->mode_ != SHARD_HASH) {
+    if (time == 0)
+      time = ::time(nullptr);
+    struct tm local;
+    localtime_r(&time, &local);
+    char bucket[16];
+    strftime(bucket, sizeof(bucket), this->mode_ == SHARD_HOUR ? "%Y/%m/%d/%H" : "%Y/%m/%d", &local);
+    return bucket;
+  }
+  uint32_t hash = fnv1_hash(name);
+  std::string shard;
+  for (uint8_t level = 0; level < this->levels_; level++) {
+    if (level != 0)
+      shard += '/';
+    shard += str_sprintf("%02x", hash % this->fan_out_);
+    hash /= this->fan_out_;
+  }
+  return shard;
+}
+
+bool ShardedDirectory::prepare_shard(const std::string &shard) {
+  // subdirectories are only created on the first write landing in them, the bounded shards keep the check cheap
+  struct stat info;
+  if (stat(build_path((this->path_ + "/" + shard).c_str()).c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+    return true;
+  return this->create_shard(shard);
+}
+
+bool ShardedDirectory::create_shard(const std::string &shard) {
+  if (mkdir(build_path(this->path_.c_str()).c_str(), 0777) == 0)
+    this->parent_->notify_file_event(FILE_CREATED, this->path_);
+  size_t start = 0;
+  while (start <= shard.size()) {
+    size_t end = shard.find('/', start);
+    if (end == std::string::npos)
+      end = shard.size();
+    std::string path = this->path_ + "/" + shard.substr(0, end);
+    if (mkdir(build_path(path.c_str()).c_str(), 0777) == 0) {
+      this->parent_->notify_file_event(FILE_CREATED, path);
+    } else if (errno != EEXIST) {
+      ESP_LOGE(TAG, "Failed to create %s: %s", path.c_str(), strerror(errno));
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+bool ShardedDirectory::walk(const std::string &directory, uint8_t depth,
+                            const std::function<bool(const std::string &, const std::string &)> &callback) const {
+  DIR *dir = opendir(build_path(directory.c_str()).c_str());
+  if (dir == nullptr)
+    return true;
+  bool keep_going = true;
+  struct dirent *entry;
+  while (keep_going && (entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.')
+      continue;
+    std::string path = directory + "/" + entry->d_name;
+    // only the subdirectories of the layout are walked, files are only expected in the leaves
+    if (depth != 0) {
+      if (entry->d_type == DT_DIR)
+        keep_going = this->walk(path, depth - 1, callback);
+    } else if (entry->d_type != DT_DIR) {
+      keep_going = callback(entry->d_name, path);
+    }
+  }
+  closedir(dir);
+  return keep_going;
+}
+
+uint8_t ShardedDirectory::depth() const {
+  switch (this->mode_) {
+    case SHARD_HOUR:
+      return 4;
+    case SHARD_DAY:
+      return 3;
+    default:
+      return this->levels_;
+  }
+}
+
+void ShardedDirectory::set_path(std::string const &path) { this->path_ = path; }
+
+void ShardedDirectory::set_mode(ShardMode mode) { this->mode_ = mode; }
+
+void ShardedDirectory::set_levels(uint8_t levels) { this->levels_ = levels; }
+
+void ShardedDirectory::set_fan_out(uint16_t fan_out) { this->fan_out_ = fan_out; }
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <string>
+
+namespace esphome {
+namespace sd_mmc_card {
+
+class SdMmc;
+
+enum ShardMode : uint8_t {
+  SHARD_HASH,
+  SHARD_HOUR,
+  SHARD_DAY,
+};
+
+/* Spreads the files of a logical directory over subdirectories so that no FAT directory, which is scanned
+ * linearly on every lookup, grows past a bounded number of entries.
+ * In hash mode the subdirectory is picked from a hash of the name (levels of fan_out directories each). In
+ * hour and day modes it is picked from the file time (YYYY/MM/DD[/HH]), the time must then be given again to
+ * find the file. */
+class ShardedDirectory {
+ public:
+  ShardedDirectory(SdMmc *parent);
+
+  /* Path of name on the card, time is only used by the time modes, 0 meaning now */
+  std::string resolve(const std::string &name, time_t time = 0) const;
+  /* Open name, creating its subdirectories when the file is opened for writing. Like SdMmc::open_file(), the
+   * caller holds the path lock itself for accesses spanning several calls. */
+  FILE *open(const std::string &name, const char *mode, time_t time = 0);
+  /* Replace the contents of name through SdMmc::write_file(), after creating its subdirectories */
+  void write(const std::string &name, const uint8_t *data, size_t len, time_t time = 0);
+  /* exists(), file_size() and remove() go through SdMmc::exists(), get_file_size() and delete_file() */
+  bool exists(const std::string &name, time_t time = 0) const;
+  size_t file_size(const std::string &name, time_t time = 0) const;
+  bool remove(const std::string &name, time_t time = 0);
+  /* Call back every file with its name and path on the card, until the callback returns false */
+  void for_each(const std::function<bool(const std::string &, const std::string &)> &callback) const;
+
+  void set_path(std::string const &);
+  void set_mode(ShardMode);
+  void set_levels(uint8_t);
+  void set_fan_out(uint16_t);
+
+ protected:
+  std::string shard(const std::string &name, time_t time) const;
+  /* open() with the lock on path already held */
+  FILE *open_locked(const std::string &shard, const std::string &path, const char *mode);
+  /* Create the subdirectories of shard when missing, with the lock on them held */
+  bool prepare_shard(const std::string &shard);
+  bool create_shard(const std::string &shard);
+  bool walk(const std::string &directory, uint8_t depth,
+            const std::function<bool(const std::string &, const std::string &)> &callback) const;
+  uint8_t depth() const;
+
+  SdMmc *parent_;
+  std::string path_;
+  ShardMode mode_{SHARD_HASH};
+  uint8_t levels_{2};
+  uint16_t fan_out_{64};
+};
+
+}  // namespace sd_mmc_card
+}  // namespace esphome
@@ -9,12 +9,20 @@ from . import SdMmc, CONF_SD_MMC_CARD_ID
 DEPENDENCIES = ["sd_mmc_card"]
 
 CONF_SD_CARD_TYPE = "sd_card_type"
+CONF_CARD_IDENTITY = "card_identity"
+CONF_CARD_SPEED_CLASS = "card_speed_class"
 
 CONFIG_SCHEMA = {
     cv.GenerateID(CONF_SD_MMC_CARD_ID): cv.use_id(SdMmc),
     cv.Optional(CONF_SD_CARD_TYPE): text_sensor.text_sensor_schema(
         entity_category=ENTITY_CATEGORY_DIAGNOSTIC
     ),
+    cv.Optional(CONF_CARD_IDENTITY): cv.All(
+        text_sensor.text_sensor_schema(entity_category=ENTITY_CATEGORY_DIAGNOSTIC), cv.only_with_esp_idf
+    ),
+    cv.Optional(CONF_CARD_SPEED_CLASS): cv.All(
+        text_sensor.text_sensor_schema(entity_category=ENTITY_CATEGORY_DIAGNOSTIC), cv.only_with_esp_idf
+    ),
 }
 
 async def to_code(config):
@@ -23,3 +31,11 @@ async def to_code(config):
     if CONF_SD_CARD_TYPE in config:
         sens = await text_sensor.new_text_sensor(config[CONF_SD_CARD_TYPE])
         cg.add(sd_mmc_component.set_sd_card_type_text_sensor(sens))
+
+    if CONF_CARD_IDENTITY in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_CARD_IDENTITY])
+        cg.add(sd_mmc_component.set_card_identity_text_sensor(sens))
+
+    if CONF_CARD_SPEED_CLASS in config:
+        sens = await text_sensor.new_text_sensor(config[CONF_CARD_SPEED_CLASS])
+        cg.add(sd_mmc_component.set_card_speed_class_text_sensor(sens))
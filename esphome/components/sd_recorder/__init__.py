@@ -0,0 +1,96 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.components import sensor
+from esphome.components import time as time_
+from esphome.const import (
+    CONF_ID,
+    CONF_NAME,
+    CONF_PATH,
+    CONF_BUFFER_SIZE,
+    CONF_SENSOR,
+    CONF_SENSORS,
+    CONF_TIME_ID,
+)
+from .. import sd_mmc_card
+
+DEPENDENCIES = ["sd_mmc_card", "time"]
+
+CONF_SD_RECORDER_ID = "sd_recorder_id"
+CONF_FLUSH_INTERVAL = "flush_interval"
+
+sd_recorder_ns = cg.esphome_ns.namespace("sd_recorder")
+SdRecorder = sd_recorder_ns.class_("SdRecorder", cg.PollingComponent)
+
+# Action
+SdRecorderFlushAction = sd_recorder_ns.class_("SdRecorderFlushAction", automation.Action)
+
+
+def validate_path(value):
+    value = cv.string_strict(value)
+    if not value.startswith("/") or value.endswith("/"):
+        raise cv.Invalid("path must be absolute, without trailing slash")
+    return value
+
+
+def default_sensor_names(config):
+    for entry in config[CONF_SENSORS]:
+        if CONF_NAME not in entry:
+            entry[CONF_NAME] = entry[CONF_SENSOR].id
+    return config
+
+
+SENSOR_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_SENSOR): cv.use_id(sensor.Sensor),
+        cv.Optional(CONF_NAME): cv.string_strict,
+    }
+)
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SdRecorder),
+            cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.GenerateID(CONF_TIME_ID): cv.use_id(time_.RealTimeClock),
+            cv.Optional(CONF_PATH, default="/recorder"): validate_path,
+            cv.Optional(CONF_BUFFER_SIZE, default=32 * 1024): cv.int_range(min=1024),
+            cv.Optional(
+                CONF_FLUSH_INTERVAL, default="60s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Required(CONF_SENSORS): cv.ensure_list(SENSOR_SCHEMA),
+        }
+    ).extend(cv.polling_component_schema("10s")),
+    default_sensor_names,
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    clock = await cg.get_variable(config[CONF_TIME_ID])
+    cg.add(var.set_time(clock))
+    cg.add(var.set_path(config[CONF_PATH]))
+    cg.add(var.set_buffer_size(config[CONF_BUFFER_SIZE]))
+    cg.add(var.set_flush_interval(config[CONF_FLUSH_INTERVAL]))
+    for entry in config[CONF_SENSORS]:
+        sens = await cg.get_variable(entry[CONF_SENSOR])
+        cg.add(var.add_sensor(sens, entry[CONF_NAME]))
+
+
+SD_RECORDER_FLUSH_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(SdRecorder),
+    }
+)
+
+
+@automation.register_action(
+    "sd_recorder.flush", SdRecorderFlushAction, SD_RECORDER_FLUSH_ACTION_SCHEMA
+)
+async def sd_recorder_flush_to_code(config, action_id, template_arg, args):
+    parent = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, parent)
+    return var
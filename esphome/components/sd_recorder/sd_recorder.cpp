@@ -0,0 +1,210 @@
+#include "sd_recorder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_recorder {
+
+static const char *TAG = "sd_recorder";
+
+static const uint32_t WRITER_TASK_STACK_SIZE = 4096;
+static const UBaseType_t WRITER_TASK_PRIORITY = 3;
+// how often the writer task retries a batch while the card is away
+static const uint32_t WRITER_RETRY_MS = 1000;
+static const size_t MAX_LINE_LENGTH = 96;
+
+void SdRecorder::setup() {
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  for (auto &batch : this->batches_) {
+    batch.data = allocator.allocate(this->buffer_size_ / 2);
+    if (batch.data == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate %u bytes of batches", this->buffer_size_);
+      this->mark_failed();
+      return;
+    }
+  }
+  if (xTaskCreate(SdRecorder::writer_task, "sd_recorder", WRITER_TASK_STACK_SIZE, this, WRITER_TASK_PRIORITY,
+                  &this->task_handle_) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start writer task");
+    this->mark_failed();
+    return;
+  }
+  for (auto &entry : this->sensors_) {
+    sensor::Sensor *sens = entry.first;
+    std::string name = entry.second;
+    sens->add_on_state_callback(
+        [this, sens, name](float state) { this->record(name, sens->get_accuracy_decimals(), state); });
+  }
+}
+
+void SdRecorder::loop() {
+  Batch &batch = this->batches_[this->active_];
+  if (batch.size != 0 && millis() - batch.started_ms >= this->flush_interval_)
+    this->hand_off();
+}
+
+void SdRecorder::update() {
+  if (this->buffer_fill_sensor_ != nullptr)
+    this->buffer_fill_sensor_->publish_state(this->get_buffer_fill());
+  if (this->dropped_samples_sensor_ != nullptr)
+    this->dropped_samples_sensor_->publish_state(this->dropped_samples_);
+}
+
+void SdRecorder::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Recorder");
+  ESP_LOGCONFIG(TAG, "  Path: %s", this->path_.c_str());
+  ESP_LOGCONFIG(TAG, "  Buffer size: %s", sd_mmc_card::format_size(this->buffer_size_).c_str());
+  ESP_LOGCONFIG(TAG, "  Flush interval: %ums", this->flush_interval_);
+  for (auto &entry : this->sensors_)
+    ESP_LOGCONFIG(TAG, "  Sensor: %s", entry.second.c_str());
+  LOG_SENSOR("  ", "Buffer fill", this->buffer_fill_sensor_);
+  LOG_SENSOR("  ", "Dropped samples", this->dropped_samples_sensor_);
+}
+
+bool SdRecorder::flush() {
+  if (this->is_failed() || this->batches_[this->active_].size == 0)
+    return true;
+  return this->hand_off();
+}
+
+float SdRecorder::get_buffer_fill() const {
+  size_t used = this->batches_[this->active_].size;
+  if (this->pending_)
+    used += this->batches_[this->active_ ^ 1].size;
+  return used * 100.0f / this->buffer_size_;
+}
+
+void SdRecorder::record(const std::string &name, int8_t accuracy_decimals, float value) {
+  if (std::isnan(value))
+    return;
+  ESPTime now = this->time_->now();
+  if (!now.is_valid()) {
+    ESP_LOGV(TAG, "Time not valid yet, ignoring %s", name.c_str());
+    return;
+  }
+  char day[sizeof(Batch::day)];
+  now.strftime(day, sizeof(day), "%Y-%m-%d");
+  char line[MAX_LINE_LENGTH];
+  int len = snprintf(line, sizeof(line), "%u,%s,%.*f\n", static_cast<uint32_t>(now.timestamp), name.c_str(),
+                     std::max<int8_t>(accuracy_decimals, 0), value);
+  if (len < 0 || len >= static_cast<int>(sizeof(line)))
+    return;
+
+  // a batch only holds a single day, the first sample after midnight rotates the file
+  Batch *batch = &this->batches_[this->active_];
+  if (batch->size != 0 && (strcmp(batch->day, day) != 0 || batch->size + len > this->buffer_size_ / 2)) {
+    this->hand_off();
+    batch = &this->batches_[this->active_];
+  }
+  if (batch->size != 0 && (strcmp(batch->day, day) != 0 || batch->size + len > this->buffer_size_ / 2)) {
+    // the writer still holds the other batch, the card isn't keeping up
+    this->dropped_samples_++;
+    return;
+  }
+  if (batch->size == 0) {
+    memcpy(batch->day, day, sizeof(day));
+    batch->started_ms = millis();
+    batch->samples = 0;
+  }
+  memcpy(batch->data + batch->size, line, len);
+  batch->size += len;
+  batch->samples++;
+}
+
+bool SdRecorder::hand_off() {
+  if (this->pending_)
+    return false;
+  this->active_ ^= 1;
+  this->batches_[this->active_].size = 0;
+  this->pending_ = true;
+  xTaskNotifyGive(this->task_handle_);
+  return true;
+}
+
+void SdRecorder::write_batch(Batch &batch) {
+  if (this->file_ != nullptr && strcmp(this->file_day_, batch.day) != 0) {
+    fclose(this->file_);
+    this->file_ = nullptr;
+  }
+  const std::string path = this->path_ + "/" + batch.day + ".csv";
+  if (this->file_ == nullptr) {
+    if (!this->sd_mmc_card_->is_directory(this->path_))
+      this->sd_mmc_card_->create_directory(this->path_.c_str());
+    {
+      auto lock = this->sd_mmc_card_->lock_write(path.c_str());
+      this->file_ = this->sd_mmc_card_->open_file(path.c_str(), "ab");
+    }
+    if (this->file_ == nullptr) {
+      ESP_LOGE(TAG, "Failed to open %s, %u samples dropped", path.c_str(), batch.samples);
+      this->dropped_samples_ += batch.samples;
+      return;
+    }
+    // batches are far bigger than the stdio buffer, let them go straight to FatFs as multi-sector writes
+    setvbuf(this->file_, nullptr, _IONBF, 0);
+    memcpy(this->file_day_, batch.day, sizeof(batch.day));
+  }
+  bool written;
+  {
+    // readers of the day (file server, read_file) see whole batches, and the card stays mounted meanwhile
+    auto lock = this->sd_mmc_card_->lock_write(path.c_str());
+    written = this->sd_mmc_card_->is_mounted() && fwrite(batch.data, 1, batch.size, this->file_) == batch.size;
+    if (written) {
+      // commit the new file size, the data is lost on power loss otherwise
+      fsync(fileno(this->file_));
+      // a handle the card keeps for a reader of the day would report the old size
+      this->sd_mmc_card_->close_handles(path.c_str());
+    }
+  }
+  if (!written) {
+    ESP_LOGE(TAG, "Failed to write to %s.csv, %u samples dropped", batch.day, batch.samples);
+    this->dropped_samples_ += batch.samples;
+    fclose(this->file_);
+    this->file_ = nullptr;
+    return;
+  }
+  ESP_LOGV(TAG, "Wrote %u samples (%u bytes) to %s.csv", batch.samples, batch.size, batch.day);
+}
+
+void SdRecorder::writer_task(void *params) {
+  SdRecorder *this_recorder = static_cast<SdRecorder *>(params);
+
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WRITER_RETRY_MS));
+    if (!this_recorder->sd_mmc_card_->is_mounted()) {
+      // the batch waits for the card, new samples are dropped once the other one is full too
+      if (this_recorder->file_ != nullptr) {
+        fclose(this_recorder->file_);
+        this_recorder->file_ = nullptr;
+      }
+      continue;
+    }
+    if (!this_recorder->pending_)
+      continue;
+    this_recorder->write_batch(this_recorder->batches_[this_recorder->active_ ^ 1]);
+    this_recorder->pending_ = false;
+  }
+}
+
+void SdRecorder::add_sensor(sensor::Sensor *sensor, std::string const &name) {
+  this->sensors_.push_back(std::make_pair(sensor, name));
+}
+
+void SdRecorder::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdRecorder::set_time(time::RealTimeClock *time) { this->time_ = time; }
+
+void SdRecorder::set_path(std::string const &path) { this->path_ = path; }
+
+void SdRecorder::set_buffer_size(size_t size) { this->buffer_size_ = size; }
+
+void SdRecorder::set_flush_interval(uint32_t interval) { this->flush_interval_ = interval; }
+
+}  // namespace sd_recorder
+}  // namespace esphome
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "esphome/core/automation.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/time/real_time_clock.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace esphome {
+namespace sd_recorder {
+
+/* Records sensor states as csv lines in one file per day.
+ * Lines are gathered in one of two fixed batches; a full or old enough batch is handed to a background task
+ * that appends it to the card in a single write while the other batch fills. When the card is too slow to
+ * free a batch in time, new samples are dropped instead of growing the memory used. */
+class SdRecorder : public PollingComponent {
+  SUB_SENSOR(buffer_fill)
+  SUB_SENSOR(dropped_samples)
+ public:
+  void setup() override;
+  void loop() override;
+  void update() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  /* Write the batch being filled without waiting for the thresholds */
+  bool flush();
+  float get_buffer_fill() const;
+  uint32_t get_dropped_samples() const { return this->dropped_samples_; }
+
+  void add_sensor(sensor::Sensor *sensor, std::string const &name);
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_time(time::RealTimeClock *);
+  void set_path(std::string const &);
+  void set_buffer_size(size_t);
+  void set_flush_interval(uint32_t);
+
+ protected:
+  struct Batch {
+    uint8_t *data;
+    size_t size;
+    uint32_t samples;
+    uint32_t started_ms;
+    // day of the samples, also the name of the file they go to
+    char day[11];
+  };
+
+  void record(const std::string &name, int8_t accuracy_decimals, float value);
+  bool hand_off();
+  void write_batch(Batch &batch);
+  static void writer_task(void *params);
+
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  time::RealTimeClock *time_;
+  std::string path_;
+  size_t buffer_size_;
+  uint32_t flush_interval_;
+  std::vector<std::pair<sensor::Sensor *, std::string>> sensors_;
+
+  Batch batches_[2]{};
+  // batch filled by the main loop, the other one belongs to the writer task while pending_ is set
+  uint8_t active_{0};
+  std::atomic<bool> pending_{false};
+  std::atomic<uint32_t> dropped_samples_{0};
+  TaskHandle_t task_handle_{nullptr};
+  // only used by the writer task
+  FILE *file_{nullptr};
+  char file_day_[11]{};
+};
+
+template<typename... Ts> class SdRecorderFlushAction : public Action<Ts...> {
+ public:
+  SdRecorderFlushAction(SdRecorder *parent) : parent_(parent) {}
+
+  void play(Ts... x) { this->parent_->flush(); }
+
+ protected:
+  SdRecorder *parent_;
+};
+
+}  // namespace sd_recorder
+}  // namespace esphome
@@ -0,0 +1,43 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_PERCENT,
+)
+from . import SdRecorder, CONF_SD_RECORDER_ID
+
+DEPENDENCIES = ["sd_recorder"]
+
+CONF_BUFFER_FILL = "buffer_fill"
+CONF_DROPPED_SAMPLES = "dropped_samples"
+
+CONFIG_SCHEMA = {
+    cv.GenerateID(CONF_SD_RECORDER_ID): cv.use_id(SdRecorder),
+    cv.Optional(CONF_BUFFER_FILL): sensor.sensor_schema(
+        unit_of_measurement=UNIT_PERCENT,
+        icon="mdi:buffer",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_MEASUREMENT,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ),
+    cv.Optional(CONF_DROPPED_SAMPLES): sensor.sensor_schema(
+        icon="mdi:alert-circle-outline",
+        accuracy_decimals=0,
+        state_class=STATE_CLASS_TOTAL_INCREASING,
+        entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+    ),
+}
+
+
+async def to_code(config):
+    sd_recorder = await cg.get_variable(config[CONF_SD_RECORDER_ID])
+
+    if CONF_BUFFER_FILL in config:
+        sens = await sensor.new_sensor(config[CONF_BUFFER_FILL])
+        cg.add(sd_recorder.set_buffer_fill_sensor(sens))
+    if CONF_DROPPED_SAMPLES in config:
+        sens = await sensor.new_sensor(config[CONF_DROPPED_SAMPLES])
+        cg.add(sd_recorder.set_dropped_samples_sensor(sens))
@@ -0,0 +1,94 @@
+import re
+
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor, web_server_base
+from esphome.components import time as time_
+from esphome.components.web_server_base import CONF_WEB_SERVER_BASE_ID
+from esphome.const import (
+    CONF_ID,
+    CONF_NAME,
+    CONF_PATH,
+    CONF_RESOLUTION,
+    CONF_SENSOR,
+    CONF_TIME_ID,
+)
+from esphome.core import coroutine_with_priority
+from .. import sd_mmc_card
+
+AUTO_LOAD = ["web_server_base"]
+DEPENDENCIES = ["sd_mmc_card", "time"]
+
+CONF_URL_PREFIX = "url_prefix"
+CONF_SERIES = "series"
+
+sd_timeseries_ns = cg.esphome_ns.namespace("sd_timeseries")
+SdTimeSeries = sd_timeseries_ns.class_("SdTimeSeries", cg.PollingComponent)
+
+
+def validate_series_name(value):
+    value = cv.string_strict(value)
+    if not re.match(r"^[a-zA-Z0-9_\-]{1,32}$", value):
+        raise cv.Invalid("series name must be 1 to 32 letters, digits, '_' or '-'")
+    return value
+
+
+def validate_path(value):
+    value = cv.string_strict(value)
+    if not value.startswith("/") or value.endswith("/"):
+        raise cv.Invalid("path must be absolute, without trailing slash")
+    return value
+
+
+def default_series_names(config):
+    names = set()
+    for series in config[CONF_SERIES]:
+        if CONF_NAME not in series:
+            series[CONF_NAME] = validate_series_name(series[CONF_SENSOR].id)
+        if series[CONF_NAME] in names:
+            raise cv.Invalid(f"series {series[CONF_NAME]} is defined twice")
+        names.add(series[CONF_NAME])
+    return config
+
+
+SERIES_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_SENSOR): cv.use_id(sensor.Sensor),
+        cv.Optional(CONF_NAME): validate_series_name,
+        cv.Optional(CONF_RESOLUTION, default=0.01): cv.positive_not_null_float,
+    }
+)
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(SdTimeSeries),
+            cv.GenerateID(CONF_WEB_SERVER_BASE_ID): cv.use_id(
+                web_server_base.WebServerBase
+            ),
+            cv.GenerateID(sd_mmc_card.CONF_SD_MMC_CARD_ID): cv.use_id(sd_mmc_card.SdMmc),
+            cv.GenerateID(CONF_TIME_ID): cv.use_id(time_.RealTimeClock),
+            cv.Optional(CONF_PATH, default="/timeseries"): validate_path,
+            cv.Optional(CONF_URL_PREFIX, default="timeseries"): cv.string_strict,
+            cv.Required(CONF_SERIES): cv.ensure_list(SERIES_SCHEMA),
+        }
+    ).extend(cv.polling_component_schema("60s")),
+    default_series_names,
+)
+
+
+@coroutine_with_priority(45.0)
+async def to_code(config):
+    paren = await cg.get_variable(config[CONF_WEB_SERVER_BASE_ID])
+
+    var = cg.new_Pvariable(config[CONF_ID], paren)
+    await cg.register_component(var, config)
+    sdmmc = await cg.get_variable(config[sd_mmc_card.CONF_SD_MMC_CARD_ID])
+    cg.add(var.set_sd_mmc_card(sdmmc))
+    clock = await cg.get_variable(config[CONF_TIME_ID])
+    cg.add(var.set_time(clock))
+    cg.add(var.set_path(config[CONF_PATH]))
+    cg.add(var.set_url_prefix(config[CONF_URL_PREFIX]))
+    for series in config[CONF_SERIES]:
+        sens = await cg.get_variable(series[CONF_SENSOR])
+        cg.add(var.add_series(sens, series[CONF_NAME], series[CONF_RESOLUTION]))
@@ -0,0 +1,521 @@
+#include "sd_timeseries.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sd_timeseries {
+
+static const char *TAG = "sd_timeseries";
+
+static const uint16_t BLOCK_MAGIC = 0x5354;
+static const uint8_t FLAG_SEALED = 0x01;
+// rows of a single response, the client asks for the next page from the X-Next-From header
+static const size_t MAX_ROWS = 1000;
+static const uint32_t DEFAULT_RANGE = 24 * 3600;
+
+static_assert(sizeof(Block) == BLOCK_SIZE, "a block must fill exactly one sector");
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static uint32_t block_crc(const Block &block) {
+  return crc32(0, reinterpret_cast<const uint8_t *>(&block) + sizeof(uint32_t), sizeof(Block) - sizeof(uint32_t));
+}
+
+static uint32_t get_param(AsyncWebServerRequest *request, const char *name, uint32_t fallback) {
+  if (!request->hasParam(name))
+    return fallback;
+  return strtoul(request->getParam(name)->value().c_str(), nullptr, 10);
+}
+
+SdTimeSeries::SdTimeSeries(web_server_base::WebServerBase *base) : base_(base) {}
+
+void SdTimeSeries::setup() {
+  for (auto &series : this->series_) {
+    Series *target = series.get();
+    this->reset_open_block(*target);
+    target->sensor->add_on_state_callback([this, target](float state) { this->record(*target, state); });
+  }
+  this->base_->init();
+  this->base_->add_handler(this);
+}
+
+void SdTimeSeries::loop() {
+  // the series follow the card, they are loaded once mounted and dropped when the card goes away
+  if (!this->sd_mmc_card_->is_mounted()) {
+    if (this->loaded_)
+      this->unload();
+    this->load_failed_ = false;
+    return;
+  }
+  if (!this->loaded_ && !this->load_failed_) {
+    if (!this->load()) {
+      ESP_LOGE(TAG, "Failed to load the series from %s", this->path_.c_str());
+      this->unload();
+      this->load_failed_ = true;
+    }
+  }
+}
+
+void SdTimeSeries::update() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (!this->loaded_)
+    return;
+  for (auto &series : this->series_) {
+    if (series->dirty)
+      this->write_open_block(*series);
+  }
+}
+
+void SdTimeSeries::dump_config() {
+  ESP_LOGCONFIG(TAG, "SD Time Series:");
+  ESP_LOGCONFIG(TAG, "  Path: %s", this->path_.c_str());
+  ESP_LOGCONFIG(TAG, "  Url Prefix: %s", this->url_prefix_.c_str());
+  for (auto &series : this->series_) {
+    ESP_LOGCONFIG(TAG, "  Series %s", series->name.c_str());
+    ESP_LOGCONFIG(TAG, "    Resolution: %g", series->resolution);
+    if (this->loaded_)
+      ESP_LOGCONFIG(TAG, "    Blocks: %u", series->index.size());
+  }
+}
+
+bool SdTimeSeries::canHandle(AsyncWebServerRequest *request) {
+  if (request->method() != HTTP_GET)
+    return false;
+  std::string url = request->url().c_str();
+  std::string prefix = "/" + this->url_prefix_;
+  return url.compare(0, prefix.size(), prefix) == 0 && (url.size() == prefix.size() || url[prefix.size()] == '/');
+}
+
+void SdTimeSeries::handleRequest(AsyncWebServerRequest *request) {
+  if (!this->loaded_) {
+    request->send(503, "text/plain", "SD card not mounted");
+    return;
+  }
+  std::string url = request->url().c_str();
+  size_t start = this->url_prefix_.size() + 2;
+  if (url.size() <= start) {
+    this->handle_list(request);
+    return;
+  }
+  this->handle_series(request, url.substr(start));
+}
+
+bool SdTimeSeries::query(const std::string &name, uint32_t from, uint32_t to,
+                         const std::function<bool(uint32_t, float)> &callback) {
+  return this->visit_blocks(name, from, to, [&](const Block &block, float resolution) {
+    uint32_t time = block.header.t_first;
+    int32_t value = block.header.v_first;
+    for (size_t i = 0; i < block.header.count; i++) {
+      time += block.time_deltas[i];
+      value += block.value_deltas[i];
+      if (time < from)
+        continue;
+      if (time > to || !callback(time, value * resolution))
+        return false;
+    }
+    return true;
+  });
+}
+
+bool SdTimeSeries::aggregate(const std::string &name, uint32_t from, uint32_t to, uint32_t step,
+                             const std::function<bool(const Aggregate &)> &callback) {
+  if (step == 0)
+    return false;
+  struct {
+    uint32_t start;
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t count{0};
+  } bucket;
+  float scale = 1.0f;
+  auto emit = [&]() {
+    if (bucket.count == 0)
+      return true;
+    Aggregate aggregate{bucket.start, bucket.min * scale, bucket.max * scale,
+                        static_cast<float>(bucket.sum) / bucket.count * scale, bucket.count};
+    bucket.count = 0;
+    return callback(aggregate);
+  };
+  auto add = [&](uint32_t time, int32_t min, int32_t max, int64_t sum, uint32_t count) {
+    uint32_t start = from + (time - from) / step * step;
+    if (bucket.count != 0 && bucket.start != start && !emit())
+      return false;
+    if (bucket.count == 0) {
+      bucket = {start, min, max, 0, 0};
+    } else {
+      bucket.min = std::min(bucket.min, min);
+      bucket.max = std::max(bucket.max, max);
+    }
+    bucket.sum += sum;
+    bucket.count += count;
+    return true;
+  };
+
+  bool stopped = false;
+  bool ok = this->visit_blocks(name, from, to, [&](const Block &block, float resolution) {
+    scale = resolution;
+    const BlockHeader &header = block.header;
+    // a block inside a single bucket is summed up from its header without decoding the samples
+    if (header.t_first >= from && header.t_last <= to &&
+        (header.t_first - from) / step == (header.t_last - from) / step) {
+      stopped = !add(header.t_first, header.v_min, header.v_max, header.v_sum, header.count);
+      return !stopped;
+    }
+    uint32_t time = header.t_first;
+    int32_t value = header.v_first;
+    for (size_t i = 0; i < header.count; i++) {
+      time += block.time_deltas[i];
+      value += block.value_deltas[i];
+      if (time < from)
+        continue;
+      if (time > to)
+        return false;
+      if (!add(time, value, value, value, 1)) {
+        stopped = true;
+        return false;
+      }
+    }
+    return true;
+  });
+  if (ok && !stopped)
+    emit();
+  return ok;
+}
+
+bool SdTimeSeries::load() {
+  if (!this->sd_mmc_card_->is_directory(this->path_) && !this->sd_mmc_card_->create_directory(this->path_.c_str()))
+    return false;
+  std::lock_guard<std::mutex> lock(this->lock_);
+  for (auto &series : this->series_) {
+    if (!this->load_series(*series))
+      return false;
+  }
+  this->loaded_ = true;
+  return true;
+}
+
+bool SdTimeSeries::load_series(Series &series) {
+  // "r+b" fails on a missing file, make sure both exist
+  for (auto &path : {this->data_path(series), this->index_path(series)}) {
+    FILE *file = this->sd_mmc_card_->open_file(path.c_str(), "ab");
+    if (file == nullptr)
+      return false;
+    fclose(file);
+  }
+
+  series.index.clear();
+  this->reset_open_block(series);
+  FILE *file = this->sd_mmc_card_->open_file(this->index_path(series).c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  IndexEntry entry;
+  while (fread(&entry, sizeof(entry), 1, file) == 1)
+    series.index.push_back(entry);
+  fclose(file);
+
+  file = this->sd_mmc_card_->open_file(this->data_path(series).c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  fseek(file, 0, SEEK_END);
+  uint32_t blocks = ftell(file) / BLOCK_SIZE;
+  // index entries are written after their block, a shorter data file means the index is damaged
+  bool rewrite_index = series.index.size() > blocks;
+  if (rewrite_index)
+    series.index.resize(blocks);
+
+  // blocks past the index are the open one, or sealed ones whose index entry never made it to the card
+  std::unique_ptr<Block> block(new Block);
+  for (uint32_t number = series.index.size(); number < blocks; number++) {
+    // a torn or stale block is overwritten by the next one written
+    if (!this->read_block(file, number, *block))
+      break;
+    if (!series.index.empty() && block->header.t_first < series.index.back().t_last)
+      break;
+    // blocks after the open one are stale, it gets written over them
+    if (!(block->header.flags & FLAG_SEALED)) {
+      series.open = *block;
+      break;
+    }
+    series.index.push_back(IndexEntry{block->header.t_first, block->header.t_last});
+    rewrite_index = true;
+  }
+  fclose(file);
+
+  if (rewrite_index) {
+    ESP_LOGW(TAG, "Rebuilding the index of %s", series.name.c_str());
+    file = this->sd_mmc_card_->open_file(this->index_path(series).c_str(), "wb");
+    if (file == nullptr)
+      return false;
+    bool ok = series.index.empty() || fwrite(series.index.data(), sizeof(IndexEntry), series.index.size(), file) ==
+                                          series.index.size();
+    fclose(file);
+    if (!ok)
+      return false;
+  }
+  ESP_LOGD(TAG, "Loaded %s: %u sealed blocks, %u samples in the open one", series.name.c_str(),
+           series.index.size(), series.open.header.count);
+  return true;
+}
+
+void SdTimeSeries::unload() {
+  std::lock_guard<std::mutex> lock(this->lock_);
+  for (auto &series : this->series_) {
+    series->index.clear();
+    this->reset_open_block(*series);
+  }
+  this->loaded_ = false;
+}
+
+void SdTimeSeries::record(Series &series, float value) {
+  if (std::isnan(value))
+    return;
+  ESPTime now = this->time_->now();
+  if (!now.is_valid())
+    return;
+  uint32_t time = now.timestamp;
+  int32_t quantized = std::max<double>(INT32_MIN, std::min<double>(INT32_MAX, std::round(value / series.resolution)));
+
+  std::lock_guard<std::mutex> lock(this->lock_);
+  if (!this->loaded_)
+    return;
+  BlockHeader &header = series.open.header;
+  uint32_t last = header.count != 0 ? header.t_last : (series.index.empty() ? 0 : series.index.back().t_last);
+  if (time < last) {
+    ESP_LOGV(TAG, "Dropping %s sample older than the last one", series.name.c_str());
+    return;
+  }
+  if (header.count != 0) {
+    int64_t delta = static_cast<int64_t>(quantized) - header.v_last;
+    if (header.count == BLOCK_CAPACITY || time - header.t_last > UINT16_MAX || delta < INT16_MIN ||
+        delta > INT16_MAX) {
+      if (!this->seal(series))
+        return;
+    }
+  }
+
+  size_t i = header.count;
+  if (i == 0) {
+    header.t_first = header.t_last = time;
+    header.v_first = header.v_last = header.v_min = header.v_max = quantized;
+    header.v_sum = 0;
+  }
+  series.open.time_deltas[i] = time - header.t_last;
+  series.open.value_deltas[i] = quantized - header.v_last;
+  header.t_last = time;
+  header.v_last = quantized;
+  header.v_min = std::min(header.v_min, quantized);
+  header.v_max = std::max(header.v_max, quantized);
+  header.v_sum += quantized;
+  header.count++;
+  series.dirty = true;
+}
+
+bool SdTimeSeries::write_open_block(Series &series) {
+  series.open.header.crc = block_crc(series.open);
+  FILE *file = this->sd_mmc_card_->open_file(this->data_path(series).c_str(), "r+b");
+  if (file == nullptr)
+    return false;
+  // blocks are sector aligned in the file, rewriting the open one only touches its own sector
+  bool ok = fseek(file, series.index.size() * BLOCK_SIZE, SEEK_SET) == 0 &&
+            fwrite(&series.open, sizeof(Block), 1, file) == 1;
+  fclose(file);
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to write block %u of %s", series.index.size(), series.name.c_str());
+    return false;
+  }
+  series.dirty = false;
+  return true;
+}
+
+bool SdTimeSeries::seal(Series &series) {
+  series.open.header.flags |= FLAG_SEALED;
+  if (!this->write_open_block(series)) {
+    series.open.header.flags &= ~FLAG_SEALED;
+    return false;
+  }
+  IndexEntry entry{series.open.header.t_first, series.open.header.t_last};
+  FILE *file = this->sd_mmc_card_->open_file(this->index_path(series).c_str(), "ab");
+  // the block is sealed on the card, a missing entry is rebuilt at the next load
+  if (file == nullptr || fwrite(&entry, sizeof(entry), 1, file) != 1)
+    ESP_LOGW(TAG, "Failed to append to the index of %s", series.name.c_str());
+  if (file != nullptr)
+    fclose(file);
+  series.index.push_back(entry);
+  this->reset_open_block(series);
+  return true;
+}
+
+void SdTimeSeries::reset_open_block(Series &series) const {
+  memset(&series.open, 0, sizeof(Block));
+  series.open.header.magic = BLOCK_MAGIC;
+  series.dirty = false;
+}
+
+bool SdTimeSeries::read_block(FILE *file, uint32_t number, Block &block) const {
+  if (fseek(file, number * BLOCK_SIZE, SEEK_SET) != 0 || fread(&block, sizeof(Block), 1, file) != 1)
+    return false;
+  return block.header.magic == BLOCK_MAGIC && block.header.count <= BLOCK_CAPACITY &&
+         block.header.crc == block_crc(block);
+}
+
+bool SdTimeSeries::visit_blocks(const std::string &name, uint32_t from, uint32_t to,
+                                const std::function<bool(const Block &, float)> &visitor) {
+  Series *series = this->find_series(name);
+  if (series == nullptr)
+    return false;
+  std::string path = this->data_path(*series);
+  uint32_t first, last;
+  std::unique_ptr<Block> block(new Block);
+  bool open = false;
+  {
+    std::lock_guard<std::mutex> lock(this->lock_);
+    if (!this->loaded_)
+      return false;
+    auto &index = series->index;
+    first = std::lower_bound(index.begin(), index.end(), from,
+                             [](const IndexEntry &entry, uint32_t time) { return entry.t_last < time; }) -
+            index.begin();
+    last = std::upper_bound(index.begin(), index.end(), to,
+                            [](uint32_t time, const IndexEntry &entry) { return time < entry.t_first; }) -
+           index.begin();
+    const BlockHeader &header = series->open.header;
+    open = header.count != 0 && header.t_last >= from && header.t_first <= to;
+    if (open)
+      *block = series->open;
+  }
+
+  if (first < last) {
+    std::unique_ptr<Block> sealed(new Block);
+    FILE *file = this->sd_mmc_card_->open_file(path.c_str(), "rb");
+    if (file == nullptr)
+      return false;
+    for (uint32_t number = first; number < last; number++) {
+      if (!this->read_block(file, number, *sealed)) {
+        ESP_LOGW(TAG, "Skipping unreadable block %u of %s", number, name.c_str());
+        continue;
+      }
+      if (!visitor(*sealed, series->resolution)) {
+        fclose(file);
+        return true;
+      }
+    }
+    fclose(file);
+  }
+  if (open)
+    visitor(*block, series->resolution);
+  return true;
+}
+
+Series *SdTimeSeries::find_series(const std::string &name) {
+  for (auto &series : this->series_) {
+    if (series->name == name)
+      return series.get();
+  }
+  return nullptr;
+}
+
+std::string SdTimeSeries::data_path(const Series &series) const { return this->path_ + "/" + series.name + ".tsd"; }
+
+std::string SdTimeSeries::index_path(const Series &series) const { return this->path_ + "/" + series.name + ".tsi"; }
+
+void SdTimeSeries::handle_list(AsyncWebServerRequest *request) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->print("[");
+  {
+    std::lock_guard<std::mutex> lock(this->lock_);
+    bool separator = false;
+    for (auto &series : this->series_) {
+      const BlockHeader &header = series->open.header;
+      uint32_t first = !series->index.empty() ? series->index.front().t_first : header.t_first;
+      uint32_t last = header.count != 0 ? header.t_last : (series->index.empty() ? 0 : series->index.back().t_last);
+      response->printf("%s{\"name\":\"%s\",\"first\":%u,\"last\":%u,\"blocks\":%u}", separator ? "," : "",
+                       series->name.c_str(), first, last, series->index.size() + (header.count != 0 ? 1 : 0));
+      separator = true;
+    }
+  }
+  response->print("]");
+  request->send(response);
+}
+
+void SdTimeSeries::handle_series(AsyncWebServerRequest *request, const std::string &name) {
+  Series *series = this->find_series(name);
+  if (series == nullptr) {
+    request->send(404, "text/plain", "Unknown series");
+    return;
+  }
+  ESPTime now = this->time_->now();
+  uint32_t to = get_param(request, "to", now.is_valid() ? now.timestamp : UINT32_MAX);
+  uint32_t from = get_param(request, "from", to > DEFAULT_RANGE ? to - DEFAULT_RANGE : 0);
+  uint32_t step = get_param(request, "step", 0);
+  uint32_t points = get_param(request, "points", 0);
+  if (from > to) {
+    request->send(400, "text/plain", "from is after to");
+    return;
+  }
+  if (step == 0 && points != 0)
+    step = std::max<uint32_t>(1, (static_cast<uint64_t>(to) - from + points) / points);
+  int decimals = std::max(0, static_cast<int>(std::ceil(-std::log10(series->resolution) - 1e-3)));
+
+  AsyncResponseStream *response = request->beginResponseStream("text/csv");
+  size_t rows = 0;
+  uint32_t next = 0;
+  if (step == 0) {
+    response->print("timestamp,value\n");
+    this->query(name, from, to, [&](uint32_t time, float value) {
+      if (rows == MAX_ROWS) {
+        next = time;
+        return false;
+      }
+      response->printf("%u,%.*f\n", time, decimals, value);
+      rows++;
+      return true;
+    });
+  } else {
+    response->print("timestamp,min,max,mean,count\n");
+    this->aggregate(name, from, to, step, [&](const Aggregate &bucket) {
+      if (rows == MAX_ROWS) {
+        next = bucket.start;
+        return false;
+      }
+      response->printf("%u,%.*f,%.*f,%.*f,%u\n", bucket.start, decimals, bucket.min, decimals, bucket.max,
+                       decimals + 1, bucket.mean, bucket.count);
+      rows++;
+      return true;
+    });
+  }
+  if (next != 0)
+    response->addHeader("X-Next-From", to_string(next).c_str());
+  request->send(response);
+}
+
+void SdTimeSeries::add_series(sensor::Sensor *sensor, std::string const &name, float resolution) {
+  std::unique_ptr<Series> series(new Series());
+  series->sensor = sensor;
+  series->name = name;
+  series->resolution = resolution;
+  this->series_.push_back(std::move(series));
+}
+
+void SdTimeSeries::set_sd_mmc_card(sd_mmc_card::SdMmc *card) { this->sd_mmc_card_ = card; }
+
+void SdTimeSeries::set_time(time::RealTimeClock *time) { this->time_ = time; }
+
+void SdTimeSeries::set_path(std::string const &path) { this->path_ = path; }
+
+void SdTimeSeries::set_url_prefix(std::string const &prefix) { this->url_prefix_ = prefix; }
+
+}  // namespace sd_timeseries
+}  // namespace esphome
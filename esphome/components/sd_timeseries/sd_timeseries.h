@@ -0,0 +1,129 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/components/time/real_time_clock.h"
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "../sd_mmc_card/sd_mmc_card.h"
+
+namespace esphome {
+namespace sd_timeseries {
+
+static const size_t BLOCK_SIZE = 512;
+
+/* Header of a block, followed by a column of timestamp deltas then a column of value deltas */
+struct BlockHeader {
+  uint32_t crc;
+  uint16_t magic;
+  uint8_t count;
+  uint8_t flags;
+  uint32_t t_first;
+  uint32_t t_last;
+  int32_t v_first;
+  int32_t v_last;
+  int32_t v_min;
+  int32_t v_max;
+  int64_t v_sum;
+};
+
+static const size_t BLOCK_CAPACITY = (BLOCK_SIZE - sizeof(BlockHeader)) / (sizeof(uint16_t) + sizeof(int16_t));
+
+struct Block {
+  BlockHeader header;
+  uint16_t time_deltas[BLOCK_CAPACITY];
+  int16_t value_deltas[BLOCK_CAPACITY];
+};
+
+/* Time range of a sealed block, the index file holds one per block of the data file */
+struct IndexEntry {
+  uint32_t t_first;
+  uint32_t t_last;
+};
+
+struct Aggregate {
+  uint32_t start;
+  float min;
+  float max;
+  float mean;
+  uint32_t count;
+};
+
+struct Series {
+  sensor::Sensor *sensor;
+  std::string name;
+  float resolution;
+  std::vector<IndexEntry, ExternalRAMAllocator<IndexEntry>> index;
+  // block being filled, rewritten in place after the sealed ones until full
+  Block open;
+  bool dirty{false};
+};
+
+/* Time series logger storing each series as fixed size blocks of delta encoded samples.
+ * Sealed blocks never change, their time range is kept in an index file loaded in memory so a range query
+ * only reads the blocks it covers. */
+class SdTimeSeries : public PollingComponent, public AsyncWebHandler {
+ public:
+  SdTimeSeries(web_server_base::WebServerBase *);
+  void setup() override;
+  void loop() override;
+  void update() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::DATA; }
+
+  bool canHandle(AsyncWebServerRequest *request) override;
+  void handleRequest(AsyncWebServerRequest *request) override;
+  bool isRequestHandlerTrivial() override { return false; }
+
+  /* Call back every sample of the series between from and to, until the callback returns false */
+  bool query(const std::string &name, uint32_t from, uint32_t to, const std::function<bool(uint32_t, float)> &callback);
+  /* Call back the min, max and mean of each step seconds bucket between from and to */
+  bool aggregate(const std::string &name, uint32_t from, uint32_t to, uint32_t step,
+                 const std::function<bool(const Aggregate &)> &callback);
+
+  void add_series(sensor::Sensor *sensor, std::string const &name, float resolution);
+  void set_sd_mmc_card(sd_mmc_card::SdMmc *);
+  void set_time(time::RealTimeClock *);
+  void set_path(std::string const &);
+  void set_url_prefix(std::string const &);
+
+ protected:
+  bool load();
+  bool load_series(Series &series);
+  void unload();
+  void record(Series &series, float value);
+  bool write_open_block(Series &series);
+  bool seal(Series &series);
+  void reset_open_block(Series &series) const;
+  bool read_block(FILE *file, uint32_t number, Block &block) const;
+  Series *find_series(const std::string &name);
+  /* Hand the blocks overlapping [from, to] to visitor in time order, the open one last. The card is read
+   * without holding the lock, sealed blocks don't change and the open one is copied. */
+  bool visit_blocks(const std::string &name, uint32_t from, uint32_t to,
+                    const std::function<bool(const Block &, float)> &visitor);
+  std::string data_path(const Series &series) const;
+  std::string index_path(const Series &series) const;
+  void handle_list(AsyncWebServerRequest *request);
+  void handle_series(AsyncWebServerRequest *request, const std::string &name);
+
+  web_server_base::WebServerBase *base_;
+  sd_mmc_card::SdMmc *sd_mmc_card_;
+  time::RealTimeClock *time_;
+  std::string path_;
+  std::string url_prefix_;
+  std::vector<std::unique_ptr<Series>> series_;
+  // guards the series between the main loop and the web server task
+  std::mutex lock_;
+  std::atomic<bool> loaded_{false};
+  bool load_failed_{false};
+};
+
+}  // namespace sd_timeseries
+}  // namespace esphome
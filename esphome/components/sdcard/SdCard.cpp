@@ -18,6 +18,50 @@ SPIClass spiSD(HSPI);
 fs::FS gFSystem = (fs::FS) SD;
 #endif
 
+static volatile bool sdCardReady = false;
+
+#if !defined(SD_MMC_1BIT_MODE) && !defined(SINGLE_SPI_ENABLE)
+// SPI clocks tried from the fastest down, the first one the card mounts with is kept
+static constexpr std::array<uint32_t, 4> spiSdFrequencies = {40000000, 20000000, 10000000, 4000000};
+#endif
+
+static bool SdCard_Mount(void) {
+#ifdef SD_MMC_1BIT_MODE
+	return SD_MMC.begin("/sdcard", true);
+#else
+	#ifndef SINGLE_SPI_ENABLE
+	for (const uint32_t frequency : spiSdFrequencies) {
+		if (SD.begin(SPISD_CS, spiSD, frequency)) {
+			if (SD.cardType() != CARD_NONE) {
+				Log_Printf(LOGLEVEL_DEBUG, "SD card SPI clock: %u Hz", frequency);
+				return true;
+			}
+			SD.end();
+		}
+	}
+	return false;
+	#else
+	return SD.begin(SPISD_CS);
+	#endif
+#endif
+}
+
+// Keeps retrying in the background, so a missing or slow card doesn't hold up the boot
+static void SdCard_MountTask(void *parameter) {
+	while (!SdCard_Mount()) {
+		Log_Println(unableToMountSd, LOGLEVEL_ERROR);
+#ifdef SHUTDOWN_IF_SD_BOOT_FAILS
+		if (millis() >= deepsleepTimeAfterBootFails * 1000) {
+			Log_Println(sdBootFailedDeepsleep, LOGLEVEL_ERROR);
+			esp_deep_sleep_start();
+		}
+#endif
+		vTaskDelay(pdMS_TO_TICKS(500));
+	}
+	sdCardReady = true;
+	vTaskDelete(NULL);
+}
+
 void SdCard_Init(void) {
 #ifdef NO_SDCARD
 	// Initialize without any SD card, e.g. for webplayer only
@@ -28,31 +72,34 @@ void SdCard_Init(void) {
 #ifndef SINGLE_SPI_ENABLE
 	#ifdef SD_MMC_1BIT_MODE
 		pinMode(2, INPUT_PULLUP);
-	while (!SD_MMC.begin("/sdcard", true)) {
 	#else
 		pinMode(SPISD_CS, OUTPUT);
 	digitalWrite(SPISD_CS, HIGH);
 	spiSD.begin(SPISD_SCK, SPISD_MISO, SPISD_MOSI, SPISD_CS);
-	spiSD.setFrequency(1000000);
-	while (!SD.begin(SPISD_CS, spiSD)) {
 	#endif
 #else
 	#ifdef SD_MMC_1BIT_MODE
 	pinMode(2, INPUT_PULLUP);
-	while (!SD_MMC.begin("/sdcard", true)) {
-	#else
-	while (!SD.begin(SPISD_CS)) {
 	#endif
 #endif
-		Log_Println(unableToMountSd, LOGLEVEL_ERROR);
-		delay(500);
-#ifdef SHUTDOWN_IF_SD_BOOT_FAILS
-		if (millis() >= deepsleepTimeAfterBootFails * 1000) {
-			Log_Println(sdBootFailedDeepsleep, LOGLEVEL_ERROR);
-			esp_deep_sleep_start();
-		}
-#endif
+	if (SdCard_Mount()) {
+		sdCardReady = true;
+		return;
 	}
+	Log_Println(unableToMountSd, LOGLEVEL_ERROR);
+	xTaskCreatePinnedToCore(
+		SdCard_MountTask, /* Function to implement the task */
+		"sdMount", /* Name of the task */
+		2048, /* Stack size in words */
+		NULL, /* Task input parameter */
+		1 | portPRIVILEGE_BIT, /* Priority of the task */
+		NULL, /* Task handle. */
+		1 /* Core where the task should run */
+	);
+}
+
+bool SdCard_IsReady(void) {
+	return sdCardReady;
 }
 
 void SdCard_Exit(void) {
@@ -310,6 +357,10 @@ static std::optional<Playlist *> SdCard_ParseM3UPlaylist(File f, bool forceExten
 /* Puts SD-file(s) or directory into a playlist
 	First element of array always contains the number of payload-items. */
 std::optional<Playlist *> SdCard_ReturnPlaylist(const char *fileName, const uint32_t _playMode) {
+	if (!sdCardReady) {
+		Log_Println(unableToMountSd, LOGLEVEL_ERROR);
+		return std::nullopt;
+	}
 	// Look if file/folder requested really exists. If not => break.
 	File fileOrDirectory = gFSystem.open(fileName);
 	if (!fileOrDirectory) {
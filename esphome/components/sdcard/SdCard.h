@@ -14,6 +14,7 @@ extern fs::FS gFSystem;
 
 void SdCard_Init(void);
 void SdCard_Exit(void);
+bool SdCard_IsReady(void);
 sdcard_type_t SdCard_GetType(void);
 uint64_t SdCard_GetSize();
 uint64_t SdCard_GetFreeSize();
@@ -0,0 +1,182 @@
+// Host test of RawLog on a FileSectorDevice: wrap over the ring, torn batch header, torn record.
+// Built against an ESPHome checkout, from the root of this repository:
+//   g++ -std=gnu++17 -DUSE_HOST -I<esphome> -I. tests/components/sd_mmc_card/raw_log_test.cpp
+//     esphome/components/sd_mmc_card/raw_log.cpp esphome/components/sd_mmc_card/sector_device.cpp
+//     <esphome>/esphome/core/helpers.cpp -o raw_log_test && ./raw_log_test
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "esphome/components/sd_mmc_card/raw_log.h"
+#include "esphome/components/sd_mmc_card/sector_device.h"
+
+using esphome::sd_mmc_card::FileSectorDevice;
+using esphome::sd_mmc_card::RawLog;
+using esphome::sd_mmc_card::SECTOR_SIZE;
+
+static const char *const DEVICE_PATH = "raw_log_test.img";
+// one superblock sector, then 8 batches of 2 sectors from sector 2
+static const uint32_t BATCH_SECTORS = 2;
+static const uint32_t BATCH_COUNT = 8;
+static const uint32_t SECTOR_COUNT = BATCH_SECTORS + BATCH_COUNT * BATCH_SECTORS;
+// 9 records of 100 bytes fill a batch of 1024 bytes
+static const size_t RECORD_SIZE = 100;
+static const uint32_t RECORDS_PER_BATCH = 9;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+static std::vector<uint8_t> make_record(uint32_t number) {
+  std::vector<uint8_t> record(RECORD_SIZE, static_cast<uint8_t>(number));
+  memcpy(record.data(), &number, sizeof(number));
+  return record;
+}
+
+static uint32_t record_number(const std::vector<uint8_t> &record) {
+  uint32_t number;
+  memcpy(&number, record.data(), sizeof(number));
+  return number;
+}
+
+static bool open_log(RawLog &log, FileSectorDevice &device) {
+  return device.open(DEVICE_PATH, SECTOR_COUNT) && log.allocate(BATCH_SECTORS) && log.open(&device, 0, SECTOR_COUNT);
+}
+
+static void append_range(RawLog &log, uint32_t first, uint32_t end) {
+  for (uint32_t number = first; number < end; number++) {
+    std::vector<uint8_t> record = make_record(number);
+    CHECK(log.append(record.data(), record.size()));
+  }
+  CHECK(log.flush());
+}
+
+// numbers of every record, from the oldest
+static std::vector<uint32_t> read_all(RawLog &log) {
+  RawLog::Cursor cursor = log.begin();
+  std::vector<uint8_t> record;
+  std::vector<uint32_t> numbers;
+  while (log.read(cursor, record)) {
+    CHECK(record.size() == RECORD_SIZE);
+    numbers.push_back(record_number(record));
+  }
+  return numbers;
+}
+
+// numbers holds exactly [first, end)
+static bool is_range(const std::vector<uint32_t> &numbers, uint32_t first, uint32_t end) {
+  if (numbers.size() != end - first)
+    return false;
+  for (size_t i = 0; i < numbers.size(); i++) {
+    if (numbers[i] != first + i)
+      return false;
+  }
+  return true;
+}
+
+static void corrupt(FileSectorDevice &device, uint32_t sector, uint32_t offset, size_t len) {
+  uint8_t data[SECTOR_SIZE];
+  CHECK(device.read(sector, data, 1));
+  for (size_t i = 0; i < len; i++)
+    data[offset + i] ^= 0xFF;
+  CHECK(device.write(sector, data, 1));
+}
+
+static void test_wrap() {
+  remove(DEVICE_PATH);
+  // two and a half passes over the ring, the last batch full
+  const uint32_t written = RECORDS_PER_BATCH * BATCH_COUNT * 5 / 2;
+  {
+    FileSectorDevice device;
+    RawLog log;
+    CHECK(open_log(log, device));
+    CHECK(log.get_batch_count() == BATCH_COUNT);
+    append_range(log, 0, written);
+  }
+  FileSectorDevice device;
+  RawLog log;
+  CHECK(open_log(log, device));
+  // the newest batch is the last full one, the ring holds the batch_count latest ones
+  const uint32_t head = (written - 1) / RECORDS_PER_BATCH;
+  CHECK(is_range(read_all(log), (head + 1 - BATCH_COUNT) * RECORDS_PER_BATCH, written));
+  // the next record starts a new batch over the oldest one
+  append_range(log, written, written + 1);
+  CHECK(is_range(read_all(log), (head + 2 - BATCH_COUNT) * RECORDS_PER_BATCH, written + 1));
+}
+
+static void test_torn_header() {
+  remove(DEVICE_PATH);
+  // head in slot 3 of the second pass, slot 0 holds sequence 8
+  const uint32_t written = RECORDS_PER_BATCH * (BATCH_COUNT + 3) + 2;
+  {
+    FileSectorDevice device;
+    RawLog log;
+    CHECK(open_log(log, device));
+    append_range(log, 0, written);
+  }
+  {
+    // a write of slot 0 cut short by a reset
+    FileSectorDevice device;
+    CHECK(device.open(DEVICE_PATH, SECTOR_COUNT));
+    corrupt(device, BATCH_SECTORS, 0, 8);
+  }
+  FileSectorDevice device;
+  RawLog log;
+  CHECK(open_log(log, device));
+  // batches after the torn one are still found, the log goes on from the newest record; the oldest batches
+  // of the first pass are kept, only the torn one is lost
+  std::vector<uint32_t> expected;
+  for (uint32_t number = RECORDS_PER_BATCH * 4; number < written; number++) {
+    if (number / RECORDS_PER_BATCH != BATCH_COUNT)
+      expected.push_back(number);
+  }
+  CHECK(read_all(log) == expected);
+  append_range(log, written, written + RECORDS_PER_BATCH);
+  std::vector<uint32_t> numbers = read_all(log);
+  CHECK(!numbers.empty() && numbers.back() == written + RECORDS_PER_BATCH - 1);
+}
+
+static void test_torn_record() {
+  remove(DEVICE_PATH);
+  // head in slot 2 with 4 records, the last one ends in the second sector of the batch
+  const uint32_t written = RECORDS_PER_BATCH * 2 + 5;
+  {
+    FileSectorDevice device;
+    RawLog log;
+    CHECK(open_log(log, device));
+    append_range(log, 0, written);
+  }
+  {
+    // payload of the last record only partly written
+    FileSectorDevice device;
+    CHECK(device.open(DEVICE_PATH, SECTOR_COUNT));
+    const uint32_t offset = 16 + 4 * (8 + RECORD_SIZE) + 8 + 60;
+    corrupt(device, BATCH_SECTORS + 2 * BATCH_SECTORS + offset / SECTOR_SIZE, offset % SECTOR_SIZE, 4);
+  }
+  FileSectorDevice device;
+  RawLog log;
+  CHECK(open_log(log, device));
+  CHECK(is_range(read_all(log), 0, written - 1));
+  // the torn record is overwritten by the next one
+  append_range(log, written - 1, written + 1);
+  CHECK(is_range(read_all(log), 0, written + 1));
+}
+
+int main() {
+  test_wrap();
+  test_torn_header();
+  test_torn_record();
+  remove(DEVICE_PATH);
+  if (failures != 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}